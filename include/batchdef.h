@@ -0,0 +1,51 @@
+#ifndef PKTMINERG_BATCHDEF_H
+#define PKTMINERG_BATCHDEF_H
+
+#include <stdint.h>
+
+// batch format shared by the zmq export and the UDP batch export, all fields in network byte order:
+// | batch_hdr | (pkt_data length  + pkt_hdr  + pkt_data) | (pkt_data_length  + pkt_hdr  + pkt_data) | ...
+// | 8 bytes   | (2 bytes          + 16 bytes + n bytes ) | (2 bytes          + 16 bytes + n bytes ) | ...
+#define PKTMINERG_BATCH_VERSION 1
+// version 2: the same records, compressed, behind a batch_pkts_hdr_v2_t
+#define PKTMINERG_BATCH_VERSION_COMPRESSED 2
+#define PKTMINERG_BATCH_CHUNK_MAGIC 0xc4c4
+#define PKTMINERG_BATCH_CODEC_NONE 0
+#define PKTMINERG_BATCH_CODEC_LZ4 1
+#define PKTMINERG_BATCH_CODEC_ZSTD 2
+
+typedef struct PmrPktHdr {
+	uint32_t tv_sec;   // epoc seconds.  caution: unix 2038 problem
+	uint32_t tv_usec;  // and microseconds
+	uint32_t caplen;   // actual capture length
+	uint32_t len;      // wire packet length
+} pmr_pkthdr_t, * pmr_pkthdr_ptr_t;
+
+typedef struct batch_pkts_header {
+	uint16_t version;
+	uint16_t pkts_num;
+	uint32_t keybit;
+} batch_pkts_hdr_t;
+
+// header of a version 2 batch: the records of a version 1 batch follow as one compressed block (LZ4 block format
+// or a Zstandard frame), raw_length is their length before compression
+typedef struct batch_pkts_header_v2 {
+	uint16_t version;
+	uint16_t pkts_num;
+	uint32_t keybit;
+	uint8_t codec;
+	uint8_t reserved[3];
+	uint32_t raw_length;
+} batch_pkts_hdr_v2_t;
+
+// optional first frame of a two-frame batch message, sent by chunked offline replay (--chunks):
+// seq counts the batch messages of one chunk from 0, so receivers can put each chunk back in order.
+typedef struct batch_chunk_header {
+	uint16_t magic;
+	uint16_t chunk_id;
+	uint16_t chunk_count;
+	uint16_t reserved;
+	uint64_t seq;
+} batch_chunk_hdr_t;
+
+#endif //PKTMINERG_BATCHDEF_H
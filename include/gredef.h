@@ -1,10 +1,54 @@
 #ifndef PKTMINERG_GREDEF_H
 #define PKTMINERG_GREDEF_H
 
+#define GRE_FLAG_KEY 0x2000
+#define GRE_FLAG_SEQ 0x1000
+#define GRE_PROTO_TEB 0x6558
+#define GRE_PROTO_ERSPAN2 0x88be
+#define GRE_PROTO_ERSPAN3 0x22eb
+#define GRE_PROTO_SEGMENT 0x88b5
+#define GRE_SEGMENT_MORE 0x0001
+#define GRE_SEGMENT_TRUNCATED 0x0002
+
 typedef struct grehdr {
     uint16_t flags;
     uint16_t protocol;
     uint32_t keybit;
 } grehdr_t;
 
+// ERSPAN follows a GRE header carrying a sequence number instead of a key
+typedef struct erspan2hdr {
+    // version 1, vlan, cos, encapsulation type, truncated, session id
+    uint32_t session;
+    // reserved, index
+    uint32_t index;
+} erspan2hdr_t;
+
+typedef struct erspan3hdr {
+    // version 2, vlan, cos, bso, truncated, session id
+    uint32_t session;
+    uint32_t timestamp;
+    // sgt, pdu frame, frame type, hardware id, direction, timestamp granularity, optional sub-header
+    uint32_t flags;
+} erspan3hdr_t;
+
+// optional ERSPAN III sub-header of platform id 5: switch id, port index, upper 32 bits of the timestamp
+typedef struct erspan3platform {
+    uint32_t platform;
+    uint32_t seconds;
+} erspan3platform_t;
+
+// a frame too big for the path MTU of a remote, sent truncated or split by pktminerg (protocol 0x88B5, local
+// experimental): the header goes in front of the frame, or of each piece of it
+typedef struct gresegmenthdr {
+    // the same for all pieces of one frame, counted by the agent process over all its remotes and threads
+    uint32_t id;
+    // of the piece in the frame
+    uint16_t offset;
+    // GRE_SEGMENT_MORE: more pieces follow, GRE_SEGMENT_TRUNCATED: the frame was cut at the end of this piece
+    uint16_t flags;
+    // of the frame on the wire
+    uint32_t length;
+} gresegmenthdr_t;
+
 #endif //PKTMINERG_GREDEF_H
@@ -0,0 +1,12 @@
+#ifndef PKTMINERG_VXLANDEF_H
+#define PKTMINERG_VXLANDEF_H
+
+#define VXLAN_PORT 4789
+#define VXLAN_FLAG_VNI 0x08000000
+
+typedef struct vxlanhdr {
+    uint32_t flags;
+    uint32_t vni;
+} vxlanhdr_t;
+
+#endif //PKTMINERG_VXLANDEF_H
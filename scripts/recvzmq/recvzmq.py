@@ -71,6 +71,18 @@ def create_pcap(config, ts_sec, suffix_id):
     return pcap_file
 
 
+def create_chunk_pcap(config, ts_sec, chunk_id, chunk_count):
+    cur_time = time.localtime(ts_sec)
+    file_path_str = time.strftime(config["file_template"], cur_time)
+    file_path = "%s_chunk%d_%d.pcap"%(file_path_str, chunk_count, chunk_id)
+    directory = os.path.dirname(file_path)
+    if directory and not os.path.exists(directory):
+        os.makedirs(directory)
+    pcap_file = open(file_path, 'wb')
+    pcap_file.write(pcap_global_header())
+    return pcap_file
+
+
 def get_base_ts(ts_sec, span_time):
     return (ts_sec // span_time) * span_time
 
@@ -95,6 +107,40 @@ def get_pcapfile(config, ts_sec):
         grekey_file_info = (suffix_id, get_base_ts(ts_sec, span_time), pcap_file)
     return pcap_file
 
+BATCH_CODEC_NONE = 0
+BATCH_CODEC_LZ4 = 1
+BATCH_CODEC_ZSTD = 2
+
+def decode_batch(message):
+    """Turns a compressed batch (version 2, pktminerg --zmq-compress) back into a version 1 batch.
+    lz4 needs the python lz4 package, zstd the zstandard package; None when the batch can't be decoded."""
+    if struct.unpack(">H", message[:2])[0] != 2:
+        return message
+    _version, pkt_num, keybit, codec, raw_length = struct.unpack(">HHIB3xI", message[:16])
+    payload = message[16:]
+    try:
+        if codec == BATCH_CODEC_LZ4:
+            import lz4.block
+            records = lz4.block.decompress(payload, uncompressed_size=raw_length)
+        elif codec == BATCH_CODEC_ZSTD:
+            import zstandard
+            records = zstandard.ZstdDecompressor().decompress(payload, max_output_size=raw_length)
+        elif codec == BATCH_CODEC_NONE:
+            records = payload
+        else:
+            eprint("Unknown batch codec: %d"%(codec))
+            return None
+    except ImportError as e:
+        eprint("Can't decode batch codec %d: %s"%(codec, e))
+        return None
+    except Exception as e:
+        eprint("Corrupt batch of codec %d: %s"%(codec, e))
+        return None
+    if len(records) != raw_length:
+        eprint("Batch of codec %d decoded to %d bytes, expected %d"%(codec, len(records), raw_length))
+        return None
+    return struct.pack(">HHI", 1, pkt_num, keybit) + records
+
 def takeFirst(elem):
     return elem[0]
 
@@ -367,6 +413,9 @@ class BatchPktsHandler():
         fqueue_full_drop = 0
         if messages:
             for message in messages:
+                message = decode_batch(message)
+                if message is None:
+                    continue
                 version, pkt_num, keybit = struct.unpack(">HHI", message[:header_size])
                 if version != 1:
                     return
@@ -391,12 +440,57 @@ class BatchPktsHandler():
             self.evict_pkts(realworld_time_sec_and_usec, fqueue_full_drop)
 
 
-def recv_msg_to_parse(batch_pkts_handler, socket):
+class ChunkPktsHandler(BatchPktsHandler):
+    """Batches of a chunked offline replay (pktminerg --chunks) come with a chunk header frame.
+    Every chunk is written to its own pcap file, in the order of its batch sequence numbers."""
+
+    CHUNK_HEADER_MAGIC = 0xc4c4
+
+    def __init__(self, config):
+        BatchPktsHandler.__init__(self, config)
+        self.chunks = {}  # chunk_id: [next_seq, {seq: message}, pcap_file]
+
+    def parse_chunk_message(self, chunk_header, message):
+        magic, chunk_id, chunk_count, _reserved, seq = struct.unpack(">HHHHQ", chunk_header[:16])
+        if magic != self.CHUNK_HEADER_MAGIC:
+            eprint("Unknown chunk header magic: 0x%x"%(magic))
+            return
+        chunk = self.chunks.setdefault(chunk_id, [0, {}, None])
+        # a batch which can't be decoded still takes its place in the sequence
+        chunk[1][seq] = decode_batch(message)
+        while chunk[0] in chunk[1]:
+            self.write_chunk_message(chunk_id, chunk_count, chunk, chunk[1].pop(chunk[0]))
+            chunk[0] += 1
+
+    def write_chunk_message(self, chunk_id, chunk_count, chunk, message):
+        if message is None:
+            return
+        header_size = 8
+        version, pkt_num, keybit = struct.unpack(">HHI", message[:header_size])
+        pkt_pos = header_size
+        for j in range(pkt_num):
+            pkt_data_len, ts_sec, ts_usec, caplen, length = struct.unpack(">HIIII", message[pkt_pos:pkt_pos+18])
+            pkt_pos += 18
+            if chunk[2] is None:
+                chunk[2] = create_chunk_pcap(self.config, ts_sec, chunk_id, chunk_count)
+            pkt_data = message[pkt_pos : pkt_pos + pkt_data_len]
+            if self.construct_pkt_bytes(ts_sec, ts_usec, caplen, length, keybit, pkt_data_len, pkt_data):
+                self.write_buf_to_pcap(chunk[2])
+            pkt_pos += pkt_data_len
+        if chunk[2] is not None:
+            self.write_buf_to_pcap(chunk[2])
+            chunk[2].flush()
+
+
+def recv_msg_to_parse(batch_pkts_handler, chunk_pkts_handler, socket):
     messages = []
     try:
         while True:
-            message = socket.recv(flags=zmq.NOBLOCK)
-            messages.append(message)
+            frames = socket.recv_multipart(flags=zmq.NOBLOCK)
+            if len(frames) == 2:
+                chunk_pkts_handler.parse_chunk_message(frames[0], frames[1])
+            else:
+                messages.append(frames[0])
     except zmq.error.Again as _e:
         if not messages and not batch_pkts_handler.is_working_busy():
             time.sleep(0.01)
@@ -413,9 +507,10 @@ def server_loop_imp(config):
     else:
         socket.connect("tcp://127.0.0.1:%d"%(config["zmq_port"]))
     batch_pkts_handler = BatchPktsHandler(config)
+    chunk_pkts_handler = ChunkPktsHandler(config)
     while True:
         try:
-            recv_msg_to_parse(batch_pkts_handler, socket)
+            recv_msg_to_parse(batch_pkts_handler, chunk_pkts_handler, socket)
         except KeyboardInterrupt:
             eprint("KeyboardInterrupt")
             raise
@@ -464,6 +559,8 @@ def dispatch_loop(config):
     backend_socket.setsockopt(zmq.RCVHWM, 2000 * 1000)
     backend_socket.setsockopt(zmq.SNDHWM, 2000 * 1000)
     backend_socket.bind("tcp://127.0.0.1:%d"%(backend_port))
+    # chunks are put back in order here, their batches must not be spread over the workers
+    chunk_pkts_handler = ChunkPktsHandler(config)
     workers = []
     for i in range(config["total_workers"]):
         w = Process(target=server_loop, args=(backend_port, config["file_template"], config["span_time"], config["total_workers"], config["frag_offset"], i))
@@ -474,7 +571,11 @@ def dispatch_loop(config):
         try:
             message = None
             try:
-                message = front_socket.recv()
+                frames = front_socket.recv_multipart()
+                if len(frames) == 2:
+                    chunk_pkts_handler.parse_chunk_message(frames[0], frames[1])
+                else:
+                    message = frames[0]
             except zmq.error.Again:
                 check_need_terminate(workers)
             if message is None:
@@ -0,0 +1,49 @@
+#!/bin/bash
+# Compare pktminerg capture backends (libpcap and TPACKET_V3) in pps and cycles per packet.
+# Both backends capture the same tcpreplay stream, pktminerg runs under "perf stat" to count its cycles.
+
+run_backend() {
+    BACKEND=$1
+    PCAP_FILE=$2
+    PPS=$3
+    DURATION=$4
+    REPLAY_NIC=$5
+    GRE_IP=$6
+    CPU_ID=$7
+
+    rm -f perf_$BACKEND.txt pktg_$BACKEND.txt
+    perf stat -x, -e cycles -o perf_$BACKEND.txt \
+        pktminerg -i $REPLAY_NIC -r $GRE_IP -k 1 --cpu $CPU_ID \
+        --capture-backend $BACKEND > pktg_$BACKEND.txt &
+    sleep 2
+    timeout $DURATION tcpreplay -i $REPLAY_NIC -p $PPS -l 0 $PCAP_FILE > /dev/null 2>&1
+    sleep 2
+    killall -INT pktminerg
+    wait
+
+    # last statis line: ...,,live_time,bps,pps,,send_num,total_send_drop:send_drop,
+    PACKETS=`grep -v '^#' pktg_$BACKEND.txt | grep ',,' | tail -n 1 | awk -F',,' '{print $3}' | awk -F',' '{print $1}'`
+    CYCLES=`grep cycles perf_$BACKEND.txt | awk -F',' '{print $1}'`
+    if [ -z "$PACKETS" ] || [ "$PACKETS" -eq 0 ]; then
+        echo "$BACKEND: no packets captured"
+        return
+    fi
+    echo "$BACKEND: packets $PACKETS, pps $((PACKETS / DURATION)), cycles/packet $((CYCLES / PACKETS))"
+}
+
+if [ "$#" -ne 6 ]; then
+    echo "Usage:"
+    echo "    bash test_capture_backend.sh pcap_file pps duration replay_nic gre_recv_ip pktg_cpu_id"
+    echo "        pcap_file: input pcap for tcpreplay to send packets to NIC."
+    echo "        pps: tcpreplay sending rate."
+    echo "        duration: seconds to replay for each backend."
+    echo "        replay_nic: tcpreplay target network interface(eth1, eth2...)."
+    echo "        gre_recv_ip: remote ip to receive gre packet."
+    echo "        pktg_cpu_id: limit pktminerg to run on this cpu processor id (suggest to NOT use core 0)."
+    echo "Example:"
+    echo "    bash test_capture_backend.sh input.pcap 1000000 30 eth2 192.168.0.1 1"
+else
+    for backend in pcap tpacket; do
+        run_backend $backend $1 $2 $3 $4 $5 $6
+    done
+fi
@@ -25,6 +25,8 @@ typedef struct msg {
 typedef enum msg_action_req_type {
     MSG_ACTION_REQ_INVALID = 0x0000,
     MSG_ACTION_REQ_QUERY_STATUS = 0x0001,
+    MSG_ACTION_REQ_QUERY_IFACE_STATUS = 0x0002,
+    MSG_ACTION_REQ_QUERY_EXPORT_STATUS = 0x0003,
     MSG_ACTION_REQ_MAX
 } msg_act_req_type_e;
 
@@ -40,6 +42,31 @@ typedef struct msg_status {
     uint32_t total_fwd_drop_count;
 }__attribute__((packed)) msg_status_t, * msg_status_ptr_t;
 
+#define MSG_IFACE_NAME_LENGTH  (16)
+
+// action MSG_ACTION_REQ_QUERY_IFACE_STATUS's request data body.
+typedef struct msg_iface_req {
+    uint32_t iface_index;  // position of the interface in -i list, from 0
+}__attribute__((packed)) msg_iface_req_t, * msg_iface_req_ptr_t;
+
+// action MSG_ACTION_REQ_QUERY_IFACE_STATUS's response data body.
+typedef struct msg_iface_status {
+    uint32_t iface_index;
+    uint32_t iface_count;  // number of capture interfaces, iface_name is empty if iface_index is out of range
+    char iface_name[MSG_IFACE_NAME_LENGTH];
+    msg_status_t status;
+}__attribute__((packed)) msg_iface_status_t, * msg_iface_status_ptr_t;
+
+// action MSG_ACTION_REQ_QUERY_EXPORT_STATUS's response data body.
+typedef struct msg_export_status {
+    uint32_t ver;
+    uint32_t zmq_queued_batches;   // zmq batches which failed to send and wait in a retry queue
+    uint32_t zmq_retried_batches;  // zmq batches sent from a retry queue
+    uint32_t zmq_dropped_batches;  // zmq batches given up on
+    uint32_t zmq_spooled_batches;  // zmq batches written to a disk spool (--zmq-spool)
+    uint32_t zmq_replayed_batches; // zmq batches sent from a disk spool
+}__attribute__((packed)) msg_export_status_t, * msg_export_status_ptr_t;
+
 
 
 
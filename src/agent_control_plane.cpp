@@ -160,6 +160,24 @@ int AgentControlPlane::msg_rsp_process(const msg_t* req_msg, msg_t* res_msg) {
         msg_status_t stat;
         msg_rsp_process_get_status(&stat);
         memcpy(res_msg->body, &stat, sizeof(msg_status_t));
+    } else if (req_msg->action == MSG_ACTION_REQ_QUERY_IFACE_STATUS) {
+        res_msg->magic = req_msg->magic;
+        res_msg->action = req_msg->action;
+        res_msg->query_id = req_msg->query_id;
+        res_msg->msglength = MSG_HEADER_LENGTH + sizeof(msg_iface_status_t);
+        msg_iface_req_t req;
+        memcpy(&req, req_msg->body, sizeof(msg_iface_req_t));
+        msg_iface_status_t stat;
+        msg_rsp_process_get_iface_status(&req, &stat);
+        memcpy(res_msg->body, &stat, sizeof(msg_iface_status_t));
+    } else if (req_msg->action == MSG_ACTION_REQ_QUERY_EXPORT_STATUS) {
+        res_msg->magic = req_msg->magic;
+        res_msg->action = req_msg->action;
+        res_msg->query_id = req_msg->query_id;
+        res_msg->msglength = MSG_HEADER_LENGTH + sizeof(msg_export_status_t);
+        msg_export_status_t stat;
+        msg_rsp_process_get_export_status(&stat);
+        memcpy(res_msg->body, &stat, sizeof(msg_export_status_t));
     }
     return 0;
 }
@@ -185,5 +203,46 @@ int AgentControlPlane::msg_rsp_process_get_status(msg_status_t* p_stat) {
 }
 
 
+int AgentControlPlane::msg_rsp_process_get_iface_status(const msg_iface_req_t* req, msg_iface_status_t* p_stat) {
 
+    memset(p_stat, 0, sizeof(msg_iface_status_t));
+    p_stat->status.ver = MSG_SERVER_VERSION;
+    AgentStatus* inst = AgentStatus::get_instance();
+    if (!inst) {
+        return -1;
+    }
 
+    const size_t slot = req->iface_index;
+    p_stat->iface_index = req->iface_index;
+    p_stat->iface_count = static_cast<uint32_t>(inst->named_slot_count());
+    if (slot >= p_stat->iface_count) {
+        return -1;
+    }
+    std::strncpy(p_stat->iface_name, inst->slot_name(slot).c_str(), MSG_IFACE_NAME_LENGTH - 1);
+    p_stat->status.start_time = static_cast<uint32_t>(inst->first_packet_time(slot));
+    p_stat->status.last_time = static_cast<uint32_t>(inst->last_packet_time(slot));
+    p_stat->status.total_cap_bytes = static_cast<uint32_t>(inst->total_cap_bytes(slot));
+    p_stat->status.total_cap_packets = static_cast<uint32_t>(inst->total_cap_packets(slot));
+    p_stat->status.total_cap_drop_count = static_cast<uint32_t>(inst->total_cap_drop_count(slot));
+    p_stat->status.total_filter_drop_count = static_cast<uint32_t>(inst->total_filter_drop_count(slot));
+    p_stat->status.total_fwd_drop_count = static_cast<uint32_t>(inst->total_fwd_drop_count(slot));
+    return 0;
+}
+
+
+int AgentControlPlane::msg_rsp_process_get_export_status(msg_export_status_t* p_stat) {
+
+    memset(p_stat, 0, sizeof(msg_export_status_t));
+    p_stat->ver = MSG_SERVER_VERSION;
+    AgentStatus* inst = AgentStatus::get_instance();
+    if (!inst) {
+        return -1;
+    }
+
+    p_stat->zmq_queued_batches = static_cast<uint32_t>(inst->zmq_queued_batches());
+    p_stat->zmq_retried_batches = static_cast<uint32_t>(inst->zmq_retried_batches());
+    p_stat->zmq_dropped_batches = static_cast<uint32_t>(inst->zmq_dropped_batches());
+    p_stat->zmq_spooled_batches = static_cast<uint32_t>(inst->zmq_spooled_batches());
+    p_stat->zmq_replayed_batches = static_cast<uint32_t>(inst->zmq_replayed_batches());
+    return 0;
+}
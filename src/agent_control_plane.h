@@ -30,6 +30,8 @@ private:
     int msg_req_process(const char* buf, size_t size, msg_t* req_msg);
     int msg_rsp_process(const msg_t* req_msg, msg_t* res_msg);
     int msg_rsp_process_get_status(msg_status_t* stat);
+    int msg_rsp_process_get_iface_status(const msg_iface_req_t* req, msg_iface_status_t* stat);
+    int msg_rsp_process_get_export_status(msg_export_status_t* stat);
 
 private:
     static void* run(void*);
@@ -1,65 +1,204 @@
 
+
 #include "agent_status.h"
 
 AgentStatus::AgentStatus() {
-    _drop_count_at_beginning = 0;
-
-    _first_packet_time = 0;
-    _last_packet_time = 0;
-
-    _total_cap_bytes = 0;
-    _total_cap_packets = 0;
-    _total_cap_drop_count = 0;
-
-    _total_filter_drop_count = 0;
-    _total_fwd_drop_count = 0;
+    reset_agent_status();
 }
 
 AgentStatus::~AgentStatus() {
 
 }
 
-int AgentStatus::reset_agent_status() {
-    _drop_count_at_beginning = 0;
+void AgentStatus::reset_slot(capture_slot_t& slot) {
+    slot.drop_count_at_beginning = 0;
+
+    slot.first_packet_time = 0;
+    slot.last_packet_time = 0;
 
-    _first_packet_time = 0;
-    _last_packet_time = 0;
+    slot.total_cap_bytes = 0;
+    slot.total_cap_packets = 0;
+    slot.total_cap_drop_count = 0;
 
-    _total_cap_bytes = 0;
-    _total_cap_packets = 0;
-    _total_cap_drop_count = 0;
+    slot.total_filter_drop_count = 0;
+    slot.total_fwd_drop_count = 0;
+}
 
-    _total_filter_drop_count = 0;
-    _total_fwd_drop_count = 0;
+int AgentStatus::reset_agent_status() {
+    for (size_t i = 0; i < MAX_CAPTURE_SLOTS; ++i) {
+        reset_slot(_slots[i]);
+    }
+    _zmq_queued_batches = 0;
+    _zmq_retried_batches = 0;
+    _zmq_dropped_batches = 0;
+    _zmq_spooled_batches = 0;
+    _zmq_replayed_batches = 0;
     return 0;
 }
 
 
-int AgentStatus::update_capture_status(uint64_t cur_pkt_time, uint32_t cur_pkt_caplen,
-            uint64_t total_fwd_count, uint64_t total_fwd_drop_count, pcap_t* handle){
-    if(_first_packet_time == 0) {        
-        _first_packet_time = cur_pkt_time;
+int AgentStatus::update_capture_status(uint64_t cur_pkt_time, uint64_t cur_pkt_caplen,
+            uint64_t total_fwd_count, uint64_t total_fwd_drop_count, CaptureStatsSource* stats, size_t slot){
+    if (slot >= MAX_CAPTURE_SLOTS) {
+        return -1;
+    }
+    capture_slot_t& s = _slots[slot];
+    if(s.first_packet_time == 0) {
+        s.first_packet_time = cur_pkt_time;
 
         struct pcap_stat stat;
-        if(handle != NULL && pcap_stats(handle, &stat) == 0) {
-            _drop_count_at_beginning = stat.ps_drop + stat.ps_ifdrop;
+        if(stats != NULL && stats->getCaptureStats(&stat) == 0) {
+            s.drop_count_at_beginning = stat.ps_drop + stat.ps_ifdrop;
         }
     }
-    _last_packet_time = cur_pkt_time;
+    s.last_packet_time = cur_pkt_time;
 
-    _total_cap_bytes += cur_pkt_caplen;
+    s.total_cap_bytes += cur_pkt_caplen;
 
     struct pcap_stat stat;
-    if (handle != NULL && pcap_stats(handle, &stat) == 0) {
-        _total_cap_packets = stat.ps_recv;
-        _total_cap_drop_count = stat.ps_drop + stat.ps_ifdrop;
-        _total_cap_drop_count -= _drop_count_at_beginning;
+    if (stats != NULL && stats->getCaptureStats(&stat) == 0) {
+        s.total_cap_packets = stat.ps_recv;
+        s.total_cap_drop_count = stat.ps_drop + stat.ps_ifdrop;
+        s.total_cap_drop_count -= s.drop_count_at_beginning;
+    }
+
+    s.total_fwd_drop_count = total_fwd_drop_count;
+    s.total_filter_drop_count = 0; //_total_cap_packets - total_fwd_count - _total_fwd_drop_count;
+
+    return 0;
+}
+
+uint64_t AgentStatus::first_packet_time() {
+    uint64_t first = 0;
+    for (size_t i = 0; i < MAX_CAPTURE_SLOTS; ++i) {
+        uint64_t t = _slots[i].first_packet_time;
+        if (t != 0 && (first == 0 || t < first)) {
+            first = t;
+        }
+    }
+    return first;
+}
+
+uint64_t AgentStatus::last_packet_time() {
+    uint64_t last = 0;
+    for (size_t i = 0; i < MAX_CAPTURE_SLOTS; ++i) {
+        uint64_t t = _slots[i].last_packet_time;
+        if (t > last) {
+            last = t;
+        }
     }
+    return last;
+}
+
+#define AGENT_STATUS_SUM_SLOTS(field)                   \
+    uint64_t sum = 0;                                   \
+    for (size_t i = 0; i < MAX_CAPTURE_SLOTS; ++i) {    \
+        sum += _slots[i].field;                         \
+    }                                                   \
+    return sum;
+
+uint64_t AgentStatus::total_cap_bytes() {
+    AGENT_STATUS_SUM_SLOTS(total_cap_bytes)
+}
+
+uint64_t AgentStatus::total_cap_packets() {
+    AGENT_STATUS_SUM_SLOTS(total_cap_packets)
+}
+
+uint64_t AgentStatus::total_cap_drop_count() {
+    AGENT_STATUS_SUM_SLOTS(total_cap_drop_count)
+}
+
+uint64_t AgentStatus::total_filter_drop_count() {
+    AGENT_STATUS_SUM_SLOTS(total_filter_drop_count)
+}
+
+uint64_t AgentStatus::total_fwd_drop_count() {
+    AGENT_STATUS_SUM_SLOTS(total_fwd_drop_count)
+}
+
+#define AGENT_STATUS_GET_SLOT(field)                    \
+    if (slot >= MAX_CAPTURE_SLOTS) {                    \
+        return 0;                                       \
+    }                                                   \
+    return _slots[slot].field;
+
+uint64_t AgentStatus::first_packet_time(size_t slot) {
+    AGENT_STATUS_GET_SLOT(first_packet_time)
+}
+
+uint64_t AgentStatus::last_packet_time(size_t slot) {
+    AGENT_STATUS_GET_SLOT(last_packet_time)
+}
+
+uint64_t AgentStatus::total_cap_bytes(size_t slot) {
+    AGENT_STATUS_GET_SLOT(total_cap_bytes)
+}
 
-    _total_fwd_drop_count = total_fwd_drop_count;
-    _total_filter_drop_count = 0; //_total_cap_packets - total_fwd_count - _total_fwd_drop_count;
+uint64_t AgentStatus::total_cap_packets(size_t slot) {
+    AGENT_STATUS_GET_SLOT(total_cap_packets)
+}
+
+uint64_t AgentStatus::total_cap_drop_count(size_t slot) {
+    AGENT_STATUS_GET_SLOT(total_cap_drop_count)
+}
+
+uint64_t AgentStatus::total_filter_drop_count(size_t slot) {
+    AGENT_STATUS_GET_SLOT(total_filter_drop_count)
+}
+
+uint64_t AgentStatus::total_fwd_drop_count(size_t slot) {
+    AGENT_STATUS_GET_SLOT(total_fwd_drop_count)
+}
 
+int AgentStatus::set_slot_name(size_t slot, const std::string& name) {
+    if (slot >= MAX_CAPTURE_SLOTS) {
+        return -1;
+    }
+    _slot_names[slot] = name;
     return 0;
 }
 
+std::string AgentStatus::slot_name(size_t slot) {
+    if (slot >= MAX_CAPTURE_SLOTS) {
+        return "";
+    }
+    return _slot_names[slot];
+}
+
+size_t AgentStatus::named_slot_count() {
+    size_t count = 0;
+    while (count < MAX_CAPTURE_SLOTS && !_slot_names[count].empty()) {
+        count++;
+    }
+    return count;
+}
+
+void AgentStatus::add_zmq_batch_stats(uint64_t queued, uint64_t retried, uint64_t dropped, uint64_t spooled,
+                                      uint64_t replayed) {
+    _zmq_queued_batches += queued;
+    _zmq_retried_batches += retried;
+    _zmq_dropped_batches += dropped;
+    _zmq_spooled_batches += spooled;
+    _zmq_replayed_batches += replayed;
+}
+
+uint64_t AgentStatus::zmq_queued_batches() {
+    return _zmq_queued_batches;
+}
+
+uint64_t AgentStatus::zmq_retried_batches() {
+    return _zmq_retried_batches;
+}
+
+uint64_t AgentStatus::zmq_dropped_batches() {
+    return _zmq_dropped_batches;
+}
+
+uint64_t AgentStatus::zmq_spooled_batches() {
+    return _zmq_spooled_batches;
+}
 
+uint64_t AgentStatus::zmq_replayed_batches() {
+    return _zmq_replayed_batches;
+}
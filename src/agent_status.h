@@ -3,10 +3,25 @@
 
 
 #include <atomic>
+#include <string>
 
 #include <pcap/pcap.h>
+#include "statislog.h"
 
 
+// counters of one capture handler, capture workers each update their own slot
+typedef struct CaptureSlot {
+    uint64_t drop_count_at_beginning;
+
+    std::atomic<uint64_t> first_packet_time;
+    std::atomic<uint64_t> last_packet_time;
+    std::atomic<uint64_t> total_cap_bytes;
+    std::atomic<uint64_t> total_cap_packets;
+    std::atomic<uint64_t> total_cap_drop_count;
+    std::atomic<uint64_t> total_filter_drop_count;
+    std::atomic<uint64_t> total_fwd_drop_count;
+} capture_slot_t;
+
 
 class AgentStatus {
 public:
@@ -20,33 +35,62 @@ public:
     }
 
 public:
-    int update_capture_status(uint64_t cur_pkt_time, uint32_t cur_pkt_caplen,
-            uint64_t total_fwd_count, uint64_t total_fwd_drop_count, pcap_t* handle = NULL);
+    int update_capture_status(uint64_t cur_pkt_time, uint64_t cur_pkt_caplen,
+            uint64_t total_fwd_count, uint64_t total_fwd_drop_count, CaptureStatsSource* stats = NULL,
+            size_t slot = 0);
     int reset_agent_status();
 
 
 public:
-    uint64_t first_packet_time() { return _first_packet_time; }
-    uint64_t last_packet_time() { return _last_packet_time; }
-    uint64_t total_cap_bytes() { return _total_cap_bytes; }
-    uint64_t total_cap_packets() { return _total_cap_packets; }
-    uint64_t total_cap_drop_count() { return _total_cap_drop_count; }
-    uint64_t total_filter_drop_count() { return _total_filter_drop_count; }
-    uint64_t total_fwd_drop_count() { return _total_fwd_drop_count; }
+    // merged over all capture slots
+    uint64_t first_packet_time();
+    uint64_t last_packet_time();
+    uint64_t total_cap_bytes();
+    uint64_t total_cap_packets();
+    uint64_t total_cap_drop_count();
+    uint64_t total_filter_drop_count();
+    uint64_t total_fwd_drop_count();
+
+    // counters of one capture slot
+    uint64_t first_packet_time(size_t slot);
+    uint64_t last_packet_time(size_t slot);
+    uint64_t total_cap_bytes(size_t slot);
+    uint64_t total_cap_packets(size_t slot);
+    uint64_t total_cap_drop_count(size_t slot);
+    uint64_t total_filter_drop_count(size_t slot);
+    uint64_t total_fwd_drop_count(size_t slot);
+
+    // capture interface names, set once before capture starts; slots 0 to N-1 are the N interfaces
+    int set_slot_name(size_t slot, const std::string& name);
+    std::string slot_name(size_t slot);
+    size_t named_slot_count();
+
+    // batches of the zmq exporters: put in a retry queue, sent again from it, given up on, written to a spool, and
+    // sent again from a spool
+    void add_zmq_batch_stats(uint64_t queued, uint64_t retried, uint64_t dropped, uint64_t spooled,
+                             uint64_t replayed);
+    uint64_t zmq_queued_batches();
+    uint64_t zmq_retried_batches();
+    uint64_t zmq_dropped_batches();
+    uint64_t zmq_spooled_batches();
+    uint64_t zmq_replayed_batches();
 
+public:
+    const static size_t MAX_CAPTURE_SLOTS = 64;
+
+private:
+    void reset_slot(capture_slot_t& slot);
 
 private:
 
     // packet agent metrics
-    uint64_t _drop_count_at_beginning;
-
-    std::atomic<uint64_t> _first_packet_time;
-    std::atomic<uint64_t> _last_packet_time;
-    std::atomic<uint64_t> _total_cap_bytes;
-    std::atomic<uint64_t> _total_cap_packets;
-    std::atomic<uint64_t> _total_cap_drop_count;
-    std::atomic<uint64_t> _total_filter_drop_count;
-    std::atomic<uint64_t> _total_fwd_drop_count;
+    capture_slot_t _slots[MAX_CAPTURE_SLOTS];
+    std::string _slot_names[MAX_CAPTURE_SLOTS];
+    std::atomic<uint64_t> _zmq_queued_batches;
+    std::atomic<uint64_t> _zmq_retried_batches;
+    std::atomic<uint64_t> _zmq_dropped_batches;
+    std::atomic<uint64_t> _zmq_spooled_batches;
+    std::atomic<uint64_t> _zmq_replayed_batches;
 };
 
 #endif
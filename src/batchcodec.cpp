@@ -0,0 +1,105 @@
+#include "batchcodec.h"
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#include <lz4hc.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+BatchCompressor::BatchCompressor(uint8_t codec, int level) :
+        _codec(codec),
+        _level(level),
+        _zstd_ctx(NULL) {
+#ifdef HAVE_ZSTD
+    if (codec == PKTMINERG_BATCH_CODEC_ZSTD) {
+        _zstd_ctx = ZSTD_createCCtx();
+    }
+#endif
+}
+
+BatchCompressor::~BatchCompressor() {
+#ifdef HAVE_ZSTD
+    if (_zstd_ctx != NULL) {
+        ZSTD_freeCCtx(static_cast<ZSTD_CCtx*>(_zstd_ctx));
+    }
+#endif
+}
+
+size_t BatchCompressor::compress(const char* src, size_t src_len, char* dst, size_t dst_capacity) {
+    switch (_codec) {
+#ifdef HAVE_LZ4
+        case PKTMINERG_BATCH_CODEC_LZ4: {
+            int length;
+            if (_level > 0) {
+                length = LZ4_compress_HC(src, dst, static_cast<int>(src_len), static_cast<int>(dst_capacity),
+                                         _level);
+            } else {
+                length = LZ4_compress_default(src, dst, static_cast<int>(src_len), static_cast<int>(dst_capacity));
+            }
+            return length > 0 ? static_cast<size_t>(length) : 0;
+        }
+#endif
+#ifdef HAVE_ZSTD
+        case PKTMINERG_BATCH_CODEC_ZSTD: {
+            if (_zstd_ctx == NULL) {
+                return 0;
+            }
+            size_t length = ZSTD_compressCCtx(static_cast<ZSTD_CCtx*>(_zstd_ctx), dst, dst_capacity, src, src_len,
+                                              _level);
+            return ZSTD_isError(length) ? 0 : length;
+        }
+#endif
+        default:
+            return 0;
+    }
+}
+
+bool BatchCompressor::decompress(uint8_t codec, const char* src, size_t src_len, char* dst, size_t raw_len) {
+    switch (codec) {
+        case PKTMINERG_BATCH_CODEC_NONE:
+            return false;
+#ifdef HAVE_LZ4
+        case PKTMINERG_BATCH_CODEC_LZ4:
+            return LZ4_decompress_safe(src, dst, static_cast<int>(src_len), static_cast<int>(raw_len)) ==
+                   static_cast<int>(raw_len);
+#endif
+#ifdef HAVE_ZSTD
+        case PKTMINERG_BATCH_CODEC_ZSTD: {
+            size_t length = ZSTD_decompress(dst, raw_len, src, src_len);
+            return !ZSTD_isError(length) && length == raw_len;
+        }
+#endif
+        default:
+            return false;
+    }
+}
+
+bool BatchCompressor::available(uint8_t codec) {
+    switch (codec) {
+        case PKTMINERG_BATCH_CODEC_NONE:
+            return true;
+#ifdef HAVE_LZ4
+        case PKTMINERG_BATCH_CODEC_LZ4:
+            return true;
+#endif
+#ifdef HAVE_ZSTD
+        case PKTMINERG_BATCH_CODEC_ZSTD:
+            return true;
+#endif
+        default:
+            return false;
+    }
+}
+
+int BatchCompressor::parseCodec(const std::string& name) {
+    if (name == "none") {
+        return PKTMINERG_BATCH_CODEC_NONE;
+    } else if (name == "lz4") {
+        return PKTMINERG_BATCH_CODEC_LZ4;
+    } else if (name == "zstd") {
+        return PKTMINERG_BATCH_CODEC_ZSTD;
+    }
+    return -1;
+}
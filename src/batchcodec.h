@@ -0,0 +1,32 @@
+#ifndef SRC_BATCHCODEC_H_
+#define SRC_BATCHCODEC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include "batchdef.h"
+
+// compresses the records of zmq batches for the version 2 format (batchdef.h). lz4 and zstd are only there when
+// the build found their libraries (HAVE_LZ4, HAVE_ZSTD). A compressor keeps codec state, one per thread.
+class BatchCompressor {
+protected:
+    uint8_t _codec;
+    int _level;
+    void* _zstd_ctx;
+
+public:
+    // level 0 is the default of the codec, above it lz4 switches to its high compression mode
+    BatchCompressor(uint8_t codec, int level);
+    ~BatchCompressor();
+    BatchCompressor(const BatchCompressor&) = delete;
+    BatchCompressor& operator=(const BatchCompressor&) = delete;
+    // returns the compressed length, 0 when it does not fit dst_capacity
+    size_t compress(const char* src, size_t src_len, char* dst, size_t dst_capacity);
+    // true when src decompressed to exactly raw_len bytes
+    static bool decompress(uint8_t codec, const char* src, size_t src_len, char* dst, size_t raw_len);
+    static bool available(uint8_t codec);
+    // none, lz4 or zstd, -1 for anything else
+    static int parseCodec(const std::string& name);
+};
+
+#endif // SRC_BATCHCODEC_H_
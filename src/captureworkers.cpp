@@ -0,0 +1,119 @@
+#include "captureworkers.h"
+#include <iostream>
+#include <cstring>
+#include <linux/if_packet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "syshelp.h"
+
+PcapWorkerGroup::PcapWorkerGroup(size_t worker_count, int fanout_mode, int first_cpu) :
+        _worker_count(worker_count),
+        _fanout_mode(fanout_mode),
+        _first_cpu(first_cpu) {
+}
+
+PcapWorkerGroup::~PcapWorkerGroup() {
+    stopWorkers();
+    for (size_t i = 0; i < _threads.size(); ++i) {
+        if (_threads[i].joinable()) {
+            _threads[i].join();
+        }
+    }
+}
+
+int PcapWorkerGroup::parseFanoutMode(const std::string& mode) {
+    if (mode == "hash") {
+        return PACKET_FANOUT_HASH;
+    } else if (mode == "cpu") {
+        return PACKET_FANOUT_CPU;
+    } else if (mode == "lb") {
+        return PACKET_FANOUT_LB;
+    }
+    return -1;
+}
+
+int PcapWorkerGroup::joinFanoutGroup(PcapHandler& handler, uint16_t group_id) {
+    int fd = handler.getCaptureFd();
+    if (fd < 0) {
+        std::cerr << StatisLogContext::getTimeString() << "Capture handler has no socket to join fanout group."
+                  << std::endl;
+        return -1;
+    }
+    int fanout_arg = group_id | (_fanout_mode << 16);
+    if (_fanout_mode == PACKET_FANOUT_HASH) {
+        // keep the fragments of one datagram on the same worker
+        fanout_arg |= PACKET_FANOUT_FLAG_DEFRAG << 16;
+    }
+    if (setsockopt(fd, SOL_PACKET, PACKET_FANOUT, &fanout_arg, sizeof(fanout_arg)) == -1) {
+        std::cerr << StatisLogContext::getTimeString() << "Set PACKET_FANOUT failed, error is "
+                  << strerror(errno) << "." << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+int PcapWorkerGroup::openWorkers(const HandlerFactory& handlerFactory, const ExportFactory& exportFactory,
+                                 const std::string& dev, const pcap_init_t& param, const std::string& expression) {
+    // fanout group ids are global to the network namespace, derive ours from the pid
+    const uint16_t group_id = static_cast<uint16_t>(getpid() & 0xffff);
+    for (size_t i = 0; i < _worker_count; ++i) {
+        std::shared_ptr<PcapHandler> handler = handlerFactory();
+        handler->setStatusSlot(i, "pktminerg-w" + std::to_string(i));
+        if (handler->openPcap(dev, param, expression, false) != 0) {
+            std::cerr << StatisLogContext::getTimeString() << "Open capture worker " << i << " failed." << std::endl;
+            return -1;
+        }
+        if (joinFanoutGroup(*handler, group_id) != 0) {
+            std::cerr << StatisLogContext::getTimeString() << "Capture worker " << i
+                      << " join fanout group failed." << std::endl;
+            return -1;
+        }
+        std::shared_ptr<PcapExportBase> exportPtr = exportFactory();
+        if (exportPtr == nullptr) {
+            std::cerr << StatisLogContext::getTimeString() << "Create exporter for capture worker " << i
+                      << " failed." << std::endl;
+            return -1;
+        }
+        handler->addExport(exportPtr);
+        _handlers.push_back(handler);
+        _exports.push_back(exportPtr);
+    }
+    return 0;
+}
+
+void PcapWorkerGroup::runWorker(size_t index, int count) {
+    if (_first_cpu >= 0) {
+        int cpuid = _first_cpu + static_cast<int>(index);
+        if (set_cpu_affinity(cpuid) == 0) {
+            std::cout << StatisLogContext::getTimeString() << "Capture worker " << index << " call set_cpu_affinity("
+                      << cpuid << ") success." << std::endl;
+        } else {
+            std::cerr << StatisLogContext::getTimeString() << "Capture worker " << index << " call set_cpu_affinity("
+                      << cpuid << ") failed." << std::endl;
+        }
+    }
+    _handlers[index]->startPcapLoop(count);
+}
+
+int PcapWorkerGroup::startWorkers(int count) {
+    for (size_t i = 0; i < _handlers.size(); ++i) {
+        _threads.emplace_back(&PcapWorkerGroup::runWorker, this, i, count);
+    }
+    for (size_t i = 0; i < _threads.size(); ++i) {
+        _threads[i].join();
+    }
+    _threads.clear();
+    return 0;
+}
+
+void PcapWorkerGroup::stopWorkers() {
+    for (size_t i = 0; i < _handlers.size(); ++i) {
+        _handlers[i]->stopPcapLoop();
+    }
+}
+
+void PcapWorkerGroup::closeWorkers() {
+    for (size_t i = 0; i < _exports.size(); ++i) {
+        _exports[i]->closeExport();
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef SRC_CAPTUREWORKERS_H_
+#define SRC_CAPTUREWORKERS_H_
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "pcaphandler.h"
+
+// N capture handlers on the same interface, joined to one PACKET_FANOUT group, each running
+// its capture loop on its own thread with its own exporters.
+class PcapWorkerGroup {
+public:
+    typedef std::function<std::shared_ptr<PcapHandler>()> HandlerFactory;
+    typedef std::function<std::shared_ptr<PcapExportBase>()> ExportFactory;
+
+protected:
+    size_t _worker_count;
+    int _fanout_mode;
+    int _first_cpu;
+    std::vector<std::shared_ptr<PcapHandler>> _handlers;
+    std::vector<std::shared_ptr<PcapExportBase>> _exports;
+    std::vector<std::thread> _threads;
+
+protected:
+    int joinFanoutGroup(PcapHandler& handler, uint16_t group_id);
+    void runWorker(size_t index, int count);
+
+public:
+    // fanout_mode is one of PACKET_FANOUT_HASH, PACKET_FANOUT_CPU, PACKET_FANOUT_LB.
+    // first_cpu < 0 leaves workers unpinned, else worker N is pinned to first_cpu + N.
+    PcapWorkerGroup(size_t worker_count, int fanout_mode, int first_cpu);
+    ~PcapWorkerGroup();
+    int openWorkers(const HandlerFactory& handlerFactory, const ExportFactory& exportFactory,
+                    const std::string& dev, const pcap_init_t& param, const std::string& expression);
+    int startWorkers(int count);
+    void stopWorkers();
+    void closeWorkers();
+
+    static int parseFanoutMode(const std::string& mode);
+};
+
+#endif // SRC_CAPTUREWORKERS_H_
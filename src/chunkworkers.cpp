@@ -0,0 +1,62 @@
+#include "chunkworkers.h"
+#include <iostream>
+
+PcapChunkGroup::PcapChunkGroup(size_t chunk_count) :
+        _chunk_count(chunk_count) {
+}
+
+PcapChunkGroup::~PcapChunkGroup() {
+    stopChunks();
+    for (size_t i = 0; i < _threads.size(); ++i) {
+        if (_threads[i].joinable()) {
+            _threads[i].join();
+        }
+    }
+}
+
+int PcapChunkGroup::openChunks(const ExportFactory& exportFactory, const std::string& path,
+                               const pcap_init_t& param) {
+    for (size_t i = 0; i < _chunk_count; ++i) {
+        std::shared_ptr<PcapMmapHandler> handler = std::make_shared<PcapMmapHandler>();
+        handler->setStatusSlot(i, "pktminerg-c" + std::to_string(i));
+        handler->setChunk(static_cast<uint32_t>(i), static_cast<uint32_t>(_chunk_count));
+        if (handler->openPcap(path, param, "", false) != 0) {
+            std::cerr << StatisLogContext::getTimeString() << "Open chunk " << i << " of " << path << " failed."
+                      << std::endl;
+            return -1;
+        }
+        std::shared_ptr<PcapExportBase> exportPtr = exportFactory(i);
+        if (exportPtr == nullptr) {
+            std::cerr << StatisLogContext::getTimeString() << "Create exporter for chunk " << i << " failed."
+                      << std::endl;
+            return -1;
+        }
+        handler->addExport(exportPtr);
+        _handlers.push_back(handler);
+        _exports.push_back(exportPtr);
+    }
+    return 0;
+}
+
+int PcapChunkGroup::startChunks(int count) {
+    for (size_t i = 0; i < _handlers.size(); ++i) {
+        _threads.emplace_back(&PcapMmapHandler::startPcapLoop, _handlers[i].get(), count);
+    }
+    for (size_t i = 0; i < _threads.size(); ++i) {
+        _threads[i].join();
+    }
+    _threads.clear();
+    return 0;
+}
+
+void PcapChunkGroup::stopChunks() {
+    for (size_t i = 0; i < _handlers.size(); ++i) {
+        _handlers[i]->stopPcapLoop();
+    }
+}
+
+void PcapChunkGroup::closeChunks() {
+    for (size_t i = 0; i < _exports.size(); ++i) {
+        _exports[i]->closeExport();
+    }
+}
@@ -0,0 +1,33 @@
+#ifndef SRC_CHUNKWORKERS_H_
+#define SRC_CHUNKWORKERS_H_
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "mmaphandler.h"
+
+// One offline pcap file split into N byte ranges, each replayed by its own PcapMmapHandler on its
+// own thread with its own exporters. Packets keep their order within a chunk only.
+class PcapChunkGroup {
+public:
+    // gets the chunk index, so the exporter can tell receivers which chunk a batch belongs to
+    typedef std::function<std::shared_ptr<PcapExportBase>(size_t)> ExportFactory;
+
+protected:
+    size_t _chunk_count;
+    std::vector<std::shared_ptr<PcapMmapHandler>> _handlers;
+    std::vector<std::shared_ptr<PcapExportBase>> _exports;
+    std::vector<std::thread> _threads;
+
+public:
+    explicit PcapChunkGroup(size_t chunk_count);
+    ~PcapChunkGroup();
+    int openChunks(const ExportFactory& exportFactory, const std::string& path, const pcap_init_t& param);
+    int startChunks(int count);
+    void stopChunks();
+    void closeChunks();
+};
+
+#endif // SRC_CHUNKWORKERS_H_
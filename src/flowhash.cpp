@@ -0,0 +1,134 @@
+#include "flowhash.h"
+#include <cstring>
+
+const uint16_t ETHERTYPE_IPV4 = 0x0800;
+const uint16_t ETHERTYPE_IPV6 = 0x86dd;
+const uint16_t ETHERTYPE_VLAN = 0x8100;
+const uint16_t ETHERTYPE_QINQ = 0x88a8;
+const uint8_t PROTO_TCP = 6;
+const uint8_t PROTO_UDP = 17;
+const uint8_t PROTO_SCTP = 132;
+
+static inline uint32_t mix(uint32_t hash, uint32_t value) {
+    // murmur3 body and finalizer
+    value *= 0xcc9e2d51;
+    value = (value << 15) | (value >> 17);
+    value *= 0x1b873593;
+    hash ^= value;
+    hash = (hash << 13) | (hash >> 19);
+    return hash * 5 + 0xe6546b64;
+}
+
+static inline uint32_t finish(uint32_t hash) {
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6b;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+static inline uint16_t read16(const uint8_t* p) {
+    return static_cast<uint16_t>(p[0] << 8 | p[1]);
+}
+
+static uint32_t hashEndpoints(const uint8_t* src, const uint8_t* dst, size_t addr_len, uint8_t proto,
+                              const uint8_t* ports) {
+    uint16_t sport = ports != NULL ? read16(ports) : 0;
+    uint16_t dport = ports != NULL ? read16(ports + 2) : 0;
+    // order the two endpoints, so the reply hashes like the request
+    int order = std::memcmp(src, dst, addr_len);
+    if (order > 0 || (order == 0 && sport > dport)) {
+        const uint8_t* addr = src;
+        src = dst;
+        dst = addr;
+        uint16_t port = sport;
+        sport = dport;
+        dport = port;
+    }
+    uint32_t hash = proto;
+    uint32_t word;
+    for (size_t i = 0; i < addr_len; i += 4) {
+        std::memcpy(&word, src + i, sizeof(word));
+        hash = mix(hash, word);
+        std::memcpy(&word, dst + i, sizeof(word));
+        hash = mix(hash, word);
+    }
+    hash = mix(hash, static_cast<uint32_t>(sport) << 16 | dport);
+    return finish(hash);
+}
+
+static bool hasPorts(uint8_t proto) {
+    return proto == PROTO_TCP || proto == PROTO_UDP || proto == PROTO_SCTP;
+}
+
+uint32_t flowHash(const uint8_t* frame, uint32_t caplen) {
+    if (caplen < 14) {
+        return 0;
+    }
+    uint32_t offset = 12;
+    uint16_t ethertype = read16(frame + offset);
+    for (int tags = 0; tags < 2 && (ethertype == ETHERTYPE_VLAN || ethertype == ETHERTYPE_QINQ); ++tags) {
+        offset += 4;
+        if (offset + 2 > caplen) {
+            return 0;
+        }
+        ethertype = read16(frame + offset);
+    }
+    offset += 2;
+    const uint8_t* ip = frame + offset;
+    const uint32_t ip_len = caplen - offset;
+
+    if (ethertype == ETHERTYPE_IPV4 && ip_len >= 20) {
+        const uint32_t ihl = (ip[0] & 0x0f) * 4u;
+        const uint8_t proto = ip[9];
+        const bool fragment = (read16(ip + 6) & 0x3fff) != 0;
+        const uint8_t* ports = NULL;
+        if (!fragment && hasPorts(proto) && ihl >= 20 && ip_len >= ihl + 4) {
+            ports = ip + ihl;
+        }
+        return hashEndpoints(ip + 12, ip + 16, 4, proto, ports);
+    }
+    if (ethertype == ETHERTYPE_IPV6 && ip_len >= 40) {
+        uint8_t proto = ip[6];
+        uint32_t next = 40;
+        bool fragment = false;
+        // hop-by-hop, routing, fragment and destination options headers come before the ports
+        while (proto == 0 || proto == 43 || proto == 44 || proto == 60) {
+            if (ip_len < next + 8) {
+                break;
+            }
+            if (proto == 44) {
+                fragment = true;
+                proto = ip[next];
+                next += 8;
+            } else {
+                proto = ip[next];
+                next += (ip[next + 1] + 1u) * 8u;
+            }
+        }
+        const uint8_t* ports = NULL;
+        if (!fragment && hasPorts(proto) && ip_len >= next + 4) {
+            ports = ip + next;
+        }
+        return hashEndpoints(ip + 8, ip + 24, 16, proto, ports);
+    }
+    return finish(mix(0, ethertype));
+}
+
+uint32_t hashBytes(const void* data, size_t length, uint32_t seed) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    uint32_t hash = seed;
+    uint32_t word;
+    size_t i = 0;
+    for (; i + 4 <= length; i += 4) {
+        std::memcpy(&word, bytes + i, sizeof(word));
+        hash = mix(hash, word);
+    }
+    word = 0;
+    for (size_t shift = 0; i < length; ++i, shift += 8) {
+        word |= static_cast<uint32_t>(bytes[i]) << shift;
+    }
+    hash = mix(hash, word);
+    return finish(hash ^ static_cast<uint32_t>(length));
+}
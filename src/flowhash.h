@@ -0,0 +1,15 @@
+#ifndef SRC_FLOWHASH_H_
+#define SRC_FLOWHASH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Hash of the flow of an Ethernet frame: IPv4/IPv6 addresses, protocol and TCP/UDP/SCTP ports, behind up to
+// two VLAN tags. Both directions of a flow hash the same, IP fragments hash without ports so they stay together.
+// Frames which are not IP hash their ether type only.
+uint32_t flowHash(const uint8_t* frame, uint32_t caplen);
+
+// murmur3 of length bytes
+uint32_t hashBytes(const void* data, size_t length, uint32_t seed);
+
+#endif // SRC_FLOWHASH_H_
@@ -0,0 +1,126 @@
+#include "interfacegroup.h"
+#include <iostream>
+#include <cstring>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include "agent_status.h"
+
+const int GROUP_POLL_TIMEOUT_MS = 1000;
+
+PcapInterfaceGroup::PcapInterfaceGroup() {
+    _epollfd = -1;
+    _stop = false;
+}
+
+PcapInterfaceGroup::~PcapInterfaceGroup() {
+    if (_epollfd != -1) {
+        close(_epollfd);
+        _epollfd = -1;
+    }
+}
+
+int PcapInterfaceGroup::openInterfaces(const HandlerFactory& handlerFactory, const std::vector<std::string>& devs,
+                                       const pcap_init_t& param, const std::string& expression, bool iface_tag) {
+    if (devs.size() > AgentStatus::MAX_CAPTURE_SLOTS) {
+        std::cerr << StatisLogContext::getTimeString() << "Can not capture from more than "
+                  << AgentStatus::MAX_CAPTURE_SLOTS << " interfaces." << std::endl;
+        return -1;
+    }
+    _epollfd = epoll_create1(EPOLL_CLOEXEC);
+    if (_epollfd == -1) {
+        std::cerr << StatisLogContext::getTimeString() << "Call epoll_create1 failed, error is "
+                  << strerror(errno) << "." << std::endl;
+        return -1;
+    }
+    for (size_t i = 0; i < devs.size(); ++i) {
+        std::shared_ptr<PcapHandler> handler = handlerFactory();
+        handler->setStatusSlot(i, "pktminerg-" + devs[i]);
+        if (iface_tag) {
+            handler->setBatchTag(static_cast<uint32_t>(i));
+        }
+        if (handler->openPcap(devs[i], param, expression, false) != 0) {
+            std::cerr << StatisLogContext::getTimeString() << "Open capture on " << devs[i] << " failed."
+                      << std::endl;
+            return -1;
+        }
+        int fd = handler->getSelectableFd();
+        if (fd < 0) {
+            std::cerr << StatisLogContext::getTimeString() << "Capture on " << devs[i]
+                      << " has no selectable fd, the capture backend can not capture multiple interfaces."
+                      << std::endl;
+            return -1;
+        }
+        if (handler->setNonblock() != 0) {
+            return -1;
+        }
+        struct epoll_event event;
+        std::memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.u32 = static_cast<uint32_t>(i);
+        if (epoll_ctl(_epollfd, EPOLL_CTL_ADD, fd, &event) == -1) {
+            std::cerr << StatisLogContext::getTimeString() << "Add capture of " << devs[i]
+                      << " to epoll failed, error is " << strerror(errno) << "." << std::endl;
+            return -1;
+        }
+        AgentStatus::get_instance()->set_slot_name(i, devs[i]);
+        _devs.push_back(devs[i]);
+        _handlers.push_back(handler);
+    }
+    return 0;
+}
+
+void PcapInterfaceGroup::addExport(std::shared_ptr<PcapExportBase> pcapExport) {
+    for (size_t i = 0; i < _handlers.size(); ++i) {
+        _handlers[i]->addExport(pcapExport);
+    }
+}
+
+int PcapInterfaceGroup::startLoop(int count) {
+    if (_handlers.empty()) {
+        std::cerr << StatisLogContext::getTimeString() << "The pcap has not created." << std::endl;
+        return -1;
+    }
+    _stop = false;
+    int handled = 0;
+    int ret = 0;
+    std::vector<struct epoll_event> events(_handlers.size());
+    while (!_stop && (count <= 0 || handled < count)) {
+        int n = epoll_wait(_epollfd, events.data(), static_cast<int>(events.size()), GROUP_POLL_TIMEOUT_MS);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << StatisLogContext::getTimeString() << "Call epoll_wait failed, error is "
+                      << strerror(errno) << "." << std::endl;
+            ret = -1;
+            break;
+        }
+        if (n == 0) {
+            // nothing became readable, still pick up what a handler may hold back in its own buffer
+            for (size_t i = 0; i < _handlers.size(); ++i) {
+                events[i].data.u32 = static_cast<uint32_t>(i);
+            }
+            n = static_cast<int>(_handlers.size());
+        }
+        for (int i = 0; i < n && (count <= 0 || handled < count); ++i) {
+            const uint32_t index = events[i].data.u32;
+            int dispatched = _handlers[index]->dispatchReady(count > 0 ? count - handled : 0);
+            if (dispatched < 0) {
+                std::cerr << StatisLogContext::getTimeString() << "Capture on " << _devs[index] << " failed."
+                          << std::endl;
+                _stop = true;
+                ret = -1;
+                break;
+            }
+            handled += dispatched;
+        }
+    }
+    for (size_t i = 0; i < _handlers.size(); ++i) {
+        _handlers[i]->logEndStatis();
+    }
+    return ret;
+}
+
+void PcapInterfaceGroup::stopLoop() {
+    _stop = true;
+}
@@ -0,0 +1,33 @@
+#ifndef SRC_INTERFACEGROUP_H_
+#define SRC_INTERFACEGROUP_H_
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "pcaphandler.h"
+
+// One capture handler per interface, all of them driven by a single epoll loop on the calling
+// thread and all of them feeding the same exporters.
+class PcapInterfaceGroup {
+public:
+    typedef std::function<std::shared_ptr<PcapHandler>()> HandlerFactory;
+
+protected:
+    std::vector<std::string> _devs;
+    std::vector<std::shared_ptr<PcapHandler>> _handlers;
+    int _epollfd;
+    volatile bool _stop;
+
+public:
+    PcapInterfaceGroup();
+    ~PcapInterfaceGroup();
+    // iface_tag=true adds the interface position in devs to the GRE key / zmq batch keybit
+    int openInterfaces(const HandlerFactory& handlerFactory, const std::vector<std::string>& devs,
+                       const pcap_init_t& param, const std::string& expression, bool iface_tag);
+    void addExport(std::shared_ptr<PcapExportBase> pcapExport);
+    int startLoop(int count);
+    void stopLoop();
+};
+
+#endif // SRC_INTERFACEGROUP_H_
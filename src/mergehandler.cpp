@@ -0,0 +1,343 @@
+#include "mergehandler.h"
+#include <iostream>
+#include <algorithm>
+#include <functional>
+#include <glob.h>
+#include <unistd.h>
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+
+// records per prefetched block and blocks queued per file
+const size_t MERGE_BLOCK_RECORDS = 256;
+const size_t MERGE_QUEUE_BLOCKS = 8;
+
+PcapMergeHandler::PcapMergeHandler() {
+    _dead_handle = NULL;
+    _stop = false;
+    _halt = false;
+    _prefetching = false;
+}
+
+PcapMergeHandler::~PcapMergeHandler() {
+    stopPrefetch();
+    closePcapDumper();
+    if (_dead_handle != NULL) {
+        pcap_close(_dead_handle);
+        _dead_handle = NULL;
+    }
+}
+
+int PcapMergeHandler::expandPcapFiles(const std::string& spec, std::vector<std::string>& files) {
+    std::vector<std::string> items;
+    boost::split(items, spec, boost::is_any_of(","));
+    for (size_t i = 0; i < items.size(); ++i) {
+        const std::string& item = items[i];
+        if (item.empty()) {
+            continue;
+        }
+        boost::system::error_code ec;
+        if (boost::filesystem::is_directory(item, ec)) {
+            std::vector<std::string> dir_files;
+            boost::filesystem::directory_iterator it(item, ec);
+            for (; !ec && it != boost::filesystem::directory_iterator(); it.increment(ec)) {
+                const std::string name = it->path().filename().string();
+                if (name.empty() || name[0] == '.' || !boost::filesystem::is_regular_file(it->path(), ec)) {
+                    continue;
+                }
+                dir_files.push_back(it->path().string());
+            }
+            if (ec) {
+                std::cerr << StatisLogContext::getTimeString() << "List directory " << item << " failed, error is "
+                          << ec.message() << "." << std::endl;
+                return -1;
+            }
+            std::sort(dir_files.begin(), dir_files.end());
+            files.insert(files.end(), dir_files.begin(), dir_files.end());
+        } else if (item.find_first_of("*?[") != std::string::npos) {
+            glob_t matches;
+            int ret = glob(item.c_str(), 0, NULL, &matches);
+            if (ret == 0) {
+                for (size_t j = 0; j < matches.gl_pathc; ++j) {
+                    files.push_back(matches.gl_pathv[j]);
+                }
+            }
+            globfree(&matches);
+            if (ret != 0 && ret != GLOB_NOMATCH) {
+                std::cerr << StatisLogContext::getTimeString() << "Expand pattern " << item << " failed." << std::endl;
+                return -1;
+            }
+        } else {
+            files.push_back(item);
+        }
+    }
+    if (files.empty()) {
+        std::cerr << StatisLogContext::getTimeString() << "No pcap file found in " << spec << "." << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+int PcapMergeHandler::openPcap(const std::string& dev, const pcap_init_t& param, const std::string& expression,
+                               bool dumpfile) {
+    std::vector<std::string> files;
+    if (expandPcapFiles(dev, files) != 0) {
+        return -1;
+    }
+    return openFiles(files, param, dumpfile);
+}
+
+int PcapMergeHandler::openFiles(const std::vector<std::string>& files, const pcap_init_t& param, bool dumpfile) {
+    for (size_t i = 0; i < files.size(); ++i) {
+        std::unique_ptr<merge_source_t> source(new merge_source_t());
+        source->path = files[i];
+        if (source->reader.open(files[i]) != 0) {
+            std::cerr << StatisLogContext::getTimeString() << "Open " << files[i] << " with the mmap reader failed."
+                      << std::endl;
+            _sources.clear();
+            return -1;
+        }
+        if (!_sources.empty() && source->reader.getLinkType() != _sources[0]->reader.getLinkType()) {
+            std::cerr << StatisLogContext::getTimeString() << files[i] << " has link type "
+                      << source->reader.getLinkType() << " but " << _sources[0]->path << " has "
+                      << _sources[0]->reader.getLinkType() << ", they can not be merged." << std::endl;
+            _sources.clear();
+            return -1;
+        }
+        _sources.push_back(std::move(source));
+    }
+    _need_update_status = param.need_update_status;
+    setBatchSize(param.batch_size);
+    setReplay(param);
+    _batch.headers.reserve(static_cast<size_t>(_batch_size));
+    _batch.data.reserve(static_cast<size_t>(_batch_size));
+
+    if (dumpfile) {
+        uint32_t snaplen = 0;
+        for (size_t i = 0; i < _sources.size(); ++i) {
+            snaplen = std::max(snaplen, _sources[i]->reader.getSnaplen());
+        }
+        _dead_handle = pcap_open_dead(_sources[0]->reader.getLinkType(),
+                                      snaplen > 0 ? static_cast<int>(snaplen) : 65535);
+        if (_dead_handle == NULL || openPcapDumper(_dead_handle) != 0) {
+            std::cerr << StatisLogContext::getTimeString() << "Call openPcapDumper failed." << std::endl;
+            _sources.clear();
+            return -1;
+        }
+    }
+    std::cout << StatisLogContext::getTimeString() << "Merge " << _sources.size() << " pcap files by timestamp."
+              << std::endl;
+    return 0;
+}
+
+void PcapMergeHandler::prefetchSource(merge_source_t* source) {
+    const size_t pagesize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    volatile uint8_t touched = 0;
+    bool done = false;
+    while (!done && !_halt) {
+        std::vector<merge_record_t> block;
+        block.reserve(MERGE_BLOCK_RECORDS);
+        int ret = 1;
+        while (block.size() < MERGE_BLOCK_RECORDS) {
+            merge_record_t record;
+            ret = source->reader.next(&record.header, &record.data);
+            if (ret != 1) {
+                break;
+            }
+            // fault the data in here, not on the merging thread
+            for (size_t off = 0; off < record.header.caplen; off += pagesize) {
+                touched ^= record.data[off];
+            }
+            block.push_back(record);
+        }
+        done = ret != 1;
+
+        std::unique_lock<std::mutex> lock(source->lock);
+        source->cond.wait(lock, [this, source]() {
+            return _halt || source->blocks.size() < MERGE_QUEUE_BLOCKS;
+        });
+        if (!block.empty()) {
+            source->blocks.push_back(std::move(block));
+        }
+        if (done) {
+            source->eof = true;
+            source->error = ret < 0 ? ret : 0;
+        }
+        source->cond.notify_all();
+    }
+}
+
+int PcapMergeHandler::startPrefetch() {
+    _halt = false;
+    _heap.clear();
+    for (size_t i = 0; i < _sources.size(); ++i) {
+        merge_source_t* source = _sources[i].get();
+        source->blocks.clear();
+        source->current.clear();
+        source->pos = 0;
+        source->eof = false;
+        source->error = 0;
+        source->thread = std::thread(&PcapMergeHandler::prefetchSource, this, source);
+    }
+    _prefetching = true;
+    for (size_t i = 0; i < _sources.size(); ++i) {
+        if (pushHead(i) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void PcapMergeHandler::stopPrefetch() {
+    if (!_prefetching) {
+        return;
+    }
+    _halt = true;
+    for (size_t i = 0; i < _sources.size(); ++i) {
+        {
+            std::lock_guard<std::mutex> lock(_sources[i]->lock);
+            _sources[i]->cond.notify_all();
+        }
+        if (_sources[i]->thread.joinable()) {
+            _sources[i]->thread.join();
+        }
+    }
+    _prefetching = false;
+}
+
+int PcapMergeHandler::nextRecord(size_t index, merge_record_t& record) {
+    merge_source_t* source = _sources[index].get();
+    if (source->pos >= source->current.size()) {
+        std::unique_lock<std::mutex> lock(source->lock);
+        // stopPcapLoop may run in a signal handler and can not notify, so wake up now and then
+        while (!_stop && !source->eof && source->blocks.empty()) {
+            source->cond.wait_for(lock, std::chrono::milliseconds(100));
+        }
+        if (source->blocks.empty()) {
+            if (_stop) {
+                return 0;
+            }
+            if (source->error < 0) {
+                std::cerr << StatisLogContext::getTimeString() << "Read " << source->path << " failed."
+                          << std::endl;
+            }
+            return source->error < 0 ? -1 : 0;
+        }
+        source->current = std::move(source->blocks.front());
+        source->blocks.pop_front();
+        source->pos = 0;
+        source->cond.notify_all();
+    }
+    record = source->current[source->pos];
+    return 1;
+}
+
+int PcapMergeHandler::pushHead(size_t index) {
+    merge_record_t record;
+    int ret = nextRecord(index, record);
+    if (ret == 1) {
+        merge_head_t head;
+        head.ts = static_cast<int64_t>(record.header.ts.tv_sec) * 1000000 + record.header.ts.tv_usec;
+        head.source = index;
+        _heap.push_back(head);
+        std::push_heap(_heap.begin(), _heap.end(), std::greater<merge_head_t>());
+    }
+    return ret;
+}
+
+int PcapMergeHandler::dispatchReady(int count) {
+    int read_count = _batch_size;
+    if (count > 0 && count < read_count) {
+        read_count = count;
+    }
+    int handled = 0;
+    int ret = 0;
+    while (handled < read_count && !_stop && !_heap.empty()) {
+        std::pop_heap(_heap.begin(), _heap.end(), std::greater<merge_head_t>());
+        const size_t index = _heap.back().source;
+        _heap.pop_back();
+        merge_source_t* source = _sources[index].get();
+        const merge_record_t& record = source->current[source->pos];
+        if (_pacer.enabled()) {
+            paceBatch(&record.header);
+        }
+        // the record data stays mapped until the handler is closed
+        _batch.push_back(record.header, record.data);
+        handled++;
+        source->pos++;
+        if (pushHead(index) < 0) {
+            ret = -1;
+            break;
+        }
+    }
+    flushBatch();
+    if (_heap.empty() || ret < 0) {
+        flushExports();
+    }
+    return ret < 0 ? -1 : handled;
+}
+
+int PcapMergeHandler::rewindPcap() {
+    stopPrefetch();
+    for (size_t i = 0; i < _sources.size(); ++i) {
+        if (_sources[i]->reader.rewind() != 0) {
+            return -1;
+        }
+    }
+    return startPrefetch();
+}
+
+int PcapMergeHandler::startPcapLoop(int count) {
+    if (_sources.empty()) {
+        std::cerr << StatisLogContext::getTimeString() << "The pcap has not created." << std::endl;
+        return -1;
+    }
+    int handled = 0;
+    int pass = 1;
+    int pass_handled = 0;
+    _stop = false;
+    int ret = startPrefetch();
+    while (ret == 0 && !_stop && (count <= 0 || handled < count)) {
+        ret = dispatchReady(count > 0 ? count - handled : 0);
+        if (ret == 0 && pass_handled > 0 && (_loop_count <= 0 || pass < _loop_count)) {
+            if (rewindPcap() != 0) {
+                ret = -1;
+                break;
+            }
+            _pacer.restart();
+            pass++;
+            pass_handled = 0;
+            continue;
+        }
+        if (ret <= 0) {
+            break;
+        }
+        handled += ret;
+        pass_handled += ret;
+        ret = 0;
+    }
+    stopPrefetch();
+    logEndStatis();
+    return ret < 0 ? ret : 0;
+}
+
+void PcapMergeHandler::stopPcapLoop() {
+    _stop = true;
+    _pacer.cancel();
+}
+
+int PcapMergeHandler::getCaptureStats(struct pcap_stat* stat) {
+    // like pcap_stats on a savefile, there are no kernel counters to report
+    return -1;
+}
+
+int PcapMergeHandler::getCaptureFd() {
+    return -1;
+}
+
+int PcapMergeHandler::getSelectableFd() {
+    return -1;
+}
+
+int PcapMergeHandler::setNonblock() {
+    return 0;
+}
@@ -0,0 +1,82 @@
+#ifndef SRC_MERGEHANDLER_H_
+#define SRC_MERGEHANDLER_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "pcaphandler.h"
+#include "pcapreader.h"
+
+// Offline capture from several pcap/pcapng files at once, exported as one stream in timestamp order.
+// Every file has a PcapFileReader and a thread which reads blocks of records ahead (paging their data
+// in) into a small queue; the handler merges the heads of the queues through a min-heap.
+class PcapMergeHandler : public PcapHandler {
+protected:
+    typedef struct MergeRecord {
+        struct pcap_pkthdr header;
+        const uint8_t* data;
+    } merge_record_t;
+
+    typedef struct MergeSource {
+        std::string path;
+        PcapFileReader reader;
+        std::thread thread;
+        std::mutex lock;
+        std::condition_variable cond;
+        std::deque<std::vector<merge_record_t>> blocks;
+        bool eof;
+        int error;
+        std::vector<merge_record_t> current;
+        size_t pos;
+    } merge_source_t;
+
+    typedef struct MergeHead {
+        int64_t ts;
+        size_t source;
+        bool operator>(const MergeHead& other) const {
+            return ts > other.ts || (ts == other.ts && source > other.source);
+        }
+    } merge_head_t;
+
+    std::vector<std::unique_ptr<merge_source_t>> _sources;
+    std::vector<merge_head_t> _heap;
+    pcap_t* _dead_handle;
+    volatile bool _stop;
+    // tells the prefetch threads to quit, on stop and before a rewind
+    volatile bool _halt;
+    bool _prefetching;
+
+protected:
+    void prefetchSource(merge_source_t* source);
+    int startPrefetch();
+    void stopPrefetch();
+    int nextRecord(size_t index, merge_record_t& record);
+    int pushHead(size_t index);
+    int rewindPcap();
+
+public:
+    PcapMergeHandler();
+    ~PcapMergeHandler();
+    // files are merged in timestamp order, all of them must have the same link type
+    int openFiles(const std::vector<std::string>& files, const pcap_init_t& param, bool dumpfile=false);
+    // dev is a comma separated list of files, directories and glob patterns, see expandPcapFiles
+    int openPcap(const std::string& dev, const pcap_init_t& param, const std::string& expression,
+                 bool dumpfile=false);
+    int startPcapLoop(int count);
+    void stopPcapLoop();
+    int getCaptureStats(struct pcap_stat* stat);
+    int getCaptureFd();
+    int getSelectableFd();
+    int setNonblock();
+    int dispatchReady(int count);
+
+    // every regular file of a directory (by name), every match of a glob pattern, or the path itself
+    static int expandPcapFiles(const std::string& spec, std::vector<std::string>& files);
+};
+
+#endif // SRC_MERGEHANDLER_H_
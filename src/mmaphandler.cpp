@@ -0,0 +1,144 @@
+#include "mmaphandler.h"
+#include <iostream>
+#include "scopeguard.h"
+
+PcapMmapHandler::PcapMmapHandler() {
+    _dead_handle = NULL;
+    _chunk_index = 0;
+    _chunk_count = 1;
+    _stop = false;
+}
+
+PcapMmapHandler::~PcapMmapHandler() {
+    closePcapDumper();
+    if (_dead_handle != NULL) {
+        pcap_close(_dead_handle);
+        _dead_handle = NULL;
+    }
+    _reader.close();
+}
+
+void PcapMmapHandler::setChunk(uint32_t index, uint32_t count) {
+    _chunk_index = index;
+    _chunk_count = count;
+}
+
+int PcapMmapHandler::openPcap(const std::string& dev, const pcap_init_t& param, const std::string& expression,
+                              bool dumpfile) {
+    if (_reader.open(dev) != 0) {
+        std::cerr << StatisLogContext::getTimeString() << "Open " << dev << " with the mmap reader failed."
+                  << std::endl;
+        return -1;
+    }
+    auto readerGuard = MakeGuard([this]() {
+        _reader.close();
+    });
+    if (_chunk_count > 1 && _reader.selectChunk(_chunk_index, _chunk_count) != 0) {
+        std::cerr << StatisLogContext::getTimeString() << "Select chunk " << _chunk_index << " of " << dev
+                  << " failed." << std::endl;
+        return -1;
+    }
+    _need_update_status = param.need_update_status;
+    setBatchSize(param.batch_size);
+    setReplay(param);
+    _batch.headers.reserve(static_cast<size_t>(_batch_size));
+    _batch.data.reserve(static_cast<size_t>(_batch_size));
+
+    if (dumpfile) {
+        // pcap_dump_open only needs the link type and snaplen of a handle
+        const int snaplen = _reader.getSnaplen() > 0 ? static_cast<int>(_reader.getSnaplen()) : 65535;
+        _dead_handle = pcap_open_dead(_reader.getLinkType(), snaplen);
+        if (_dead_handle == NULL || openPcapDumper(_dead_handle) != 0) {
+            std::cerr << StatisLogContext::getTimeString() << "Call openPcapDumper failed." << std::endl;
+            return -1;
+        }
+    }
+    readerGuard.Dismiss();
+    return 0;
+}
+
+int PcapMmapHandler::dispatchReady(int count) {
+    int read_count = _batch_size;
+    if (count > 0 && count < read_count) {
+        read_count = count;
+    }
+    // the records are handed over in place, the mapping outlives the batch
+    int ret = 0;
+    int handled = 0;
+    struct pcap_pkthdr header;
+    const uint8_t* data = NULL;
+    while (handled < read_count && !_stop) {
+        ret = _reader.next(&header, &data);
+        if (ret <= 0) {
+            break;
+        }
+        if (_pacer.enabled()) {
+            paceBatch(&header);
+        }
+        _batch.push_back(header, data);
+        handled++;
+    }
+    flushBatch();
+    if (ret <= 0) {
+        flushExports();
+    }
+    return ret < 0 ? -1 : handled;
+}
+
+int PcapMmapHandler::startPcapLoop(int count) {
+    if (_reader.getFileSize() == 0) {
+        std::cerr << StatisLogContext::getTimeString() << "The pcap has not created." << std::endl;
+        return -1;
+    }
+    _stop = false;
+    int handled = 0;
+    int pass = 1;
+    int pass_handled = 0;
+    int ret = 0;
+    while (!_stop && (count <= 0 || handled < count)) {
+        ret = dispatchReady(count > 0 ? count - handled : 0);
+        if (ret == 0 && pass_handled > 0 && (_loop_count <= 0 || pass < _loop_count)) {
+            if (rewindPcap() != 0) {
+                ret = -1;
+                break;
+            }
+            _pacer.restart();
+            pass++;
+            pass_handled = 0;
+            continue;
+        }
+        if (ret <= 0) {
+            break;
+        }
+        handled += ret;
+        pass_handled += ret;
+    }
+    logEndStatis();
+    return ret < 0 ? ret : 0;
+}
+
+void PcapMmapHandler::stopPcapLoop() {
+    _stop = true;
+    _pacer.cancel();
+}
+
+int PcapMmapHandler::rewindPcap() {
+    return _reader.rewind();
+}
+
+int PcapMmapHandler::getCaptureStats(struct pcap_stat* stat) {
+    // like pcap_stats on a savefile, there are no kernel counters to report
+    return -1;
+}
+
+int PcapMmapHandler::getCaptureFd() {
+    return -1;
+}
+
+int PcapMmapHandler::getSelectableFd() {
+    return -1;
+}
+
+int PcapMmapHandler::setNonblock() {
+    return 0;
+}
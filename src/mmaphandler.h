@@ -0,0 +1,37 @@
+#ifndef SRC_MMAPHANDLER_H_
+#define SRC_MMAPHANDLER_H_
+
+#include <string>
+#include "pcaphandler.h"
+#include "pcapreader.h"
+
+// Offline capture from a pcap or pcapng file read by PcapFileReader instead of libpcap.
+// Batches point straight into the file mapping, no record is copied on the way to the exporters.
+class PcapMmapHandler : public PcapHandler {
+protected:
+    PcapFileReader _reader;
+    pcap_t* _dead_handle;
+    uint32_t _chunk_index;
+    uint32_t _chunk_count;
+    volatile bool _stop;
+
+protected:
+    int rewindPcap();
+
+public:
+    PcapMmapHandler();
+    ~PcapMmapHandler();
+    // read only the index-th of count chunks of the file, see PcapFileReader::selectChunk
+    void setChunk(uint32_t index, uint32_t count);
+    int openPcap(const std::string& dev, const pcap_init_t& param, const std::string& expression,
+                 bool dumpfile=false);
+    int startPcapLoop(int count);
+    void stopPcapLoop();
+    int getCaptureStats(struct pcap_stat* stat);
+    int getCaptureFd();
+    int getSelectableFd();
+    int setNonblock();
+    int dispatchReady(int count);
+};
+
+#endif // SRC_MMAPHANDLER_H_
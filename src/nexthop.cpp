@@ -0,0 +1,259 @@
+#include "nexthop.h"
+#include <iostream>
+#include <cstring>
+#include <vector>
+#include <arpa/inet.h>
+#include <linux/neighbour.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "scopeguard.h"
+#include "statislog.h"
+
+const size_t NETLINK_BUFFER_SIZE = 32 * 1024;
+const int NEIGHBOR_RETRY_MS = 100;
+const uint16_t DISCARD_PORT = 9;
+
+static std::string ipString(in_addr_t addr) {
+    struct in_addr in;
+    in.s_addr = addr;
+    return inet_ntoa(in);
+}
+
+int lookupLink(const std::string& dev, linkinfo_t& link) {
+    std::memset(&link, 0, sizeof(link));
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd == -1) {
+        std::cerr << StatisLogContext::getTimeString() << "Create socket failed, error is " << strerror(errno)
+                  << "." << std::endl;
+        return -1;
+    }
+    auto fdGuard = MakeGuard([fd]() {
+        close(fd);
+    });
+    struct ifreq ifr;
+    std::memset(&ifr, 0, sizeof(ifr));
+    std::strncpy(ifr.ifr_name, dev.c_str(), IFNAMSIZ - 1);
+    if (ioctl(fd, SIOCGIFINDEX, &ifr) == -1) {
+        std::cerr << StatisLogContext::getTimeString() << "Get index of " << dev << " failed, error is "
+                  << strerror(errno) << "." << std::endl;
+        return -1;
+    }
+    link.ifindex = ifr.ifr_ifindex;
+    if (ioctl(fd, SIOCGIFMTU, &ifr) == -1) {
+        std::cerr << StatisLogContext::getTimeString() << "Get MTU of " << dev << " failed, error is "
+                  << strerror(errno) << "." << std::endl;
+        return -1;
+    }
+    link.mtu = ifr.ifr_mtu;
+    if (ioctl(fd, SIOCGIFFLAGS, &ifr) == -1) {
+        std::cerr << StatisLogContext::getTimeString() << "Get flags of " << dev << " failed, error is "
+                  << strerror(errno) << "." << std::endl;
+        return -1;
+    }
+    link.noarp = (ifr.ifr_flags & (IFF_NOARP | IFF_LOOPBACK)) != 0;
+    if (ioctl(fd, SIOCGIFHWADDR, &ifr) == -1) {
+        std::cerr << StatisLogContext::getTimeString() << "Get MAC of " << dev << " failed, error is "
+                  << strerror(errno) << "." << std::endl;
+        return -1;
+    }
+    std::memcpy(link.mac, ifr.ifr_hwaddr.sa_data, sizeof(link.mac));
+    // no address is fine as long as the route has a preferred source
+    if (ioctl(fd, SIOCGIFADDR, &ifr) == 0) {
+        link.address = reinterpret_cast<struct sockaddr_in*>(&ifr.ifr_addr)->sin_addr.s_addr;
+    }
+    return 0;
+}
+
+static int netlinkRequest(struct nlmsghdr* request, std::vector<char>& response) {
+    int fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+    if (fd == -1) {
+        std::cerr << StatisLogContext::getTimeString() << "Create netlink socket failed, error is "
+                  << strerror(errno) << "." << std::endl;
+        return -1;
+    }
+    auto fdGuard = MakeGuard([fd]() {
+        close(fd);
+    });
+    if (send(fd, request, request->nlmsg_len, 0) == -1) {
+        std::cerr << StatisLogContext::getTimeString() << "Send netlink request failed, error is "
+                  << strerror(errno) << "." << std::endl;
+        return -1;
+    }
+    // collect the replies up to NLMSG_DONE, or the single reply of a request without NLM_F_DUMP
+    const bool dump = (request->nlmsg_flags & NLM_F_DUMP) != 0;
+    std::vector<char> buffer(NETLINK_BUFFER_SIZE);
+    response.clear();
+    for (;;) {
+        ssize_t len = recv(fd, buffer.data(), buffer.size(), 0);
+        if (len <= 0) {
+            std::cerr << StatisLogContext::getTimeString() << "Receive netlink reply failed, error is "
+                      << strerror(errno) << "." << std::endl;
+            return -1;
+        }
+        bool done = !dump;
+        for (struct nlmsghdr* nh = reinterpret_cast<struct nlmsghdr*>(buffer.data());
+             NLMSG_OK(nh, static_cast<size_t>(len)); nh = NLMSG_NEXT(nh, len)) {
+            if (nh->nlmsg_type == NLMSG_DONE) {
+                done = true;
+                break;
+            }
+            if (nh->nlmsg_type == NLMSG_ERROR) {
+                const struct nlmsgerr* err = static_cast<const struct nlmsgerr*>(NLMSG_DATA(nh));
+                errno = -err->error;
+                return -1;
+            }
+            response.insert(response.end(), reinterpret_cast<char*>(nh),
+                            reinterpret_cast<char*>(nh) + NLMSG_ALIGN(nh->nlmsg_len));
+        }
+        if (done) {
+            return 0;
+        }
+    }
+}
+
+int lookupRoute(in_addr_t remote, nexthop_t& hop) {
+    struct {
+        struct nlmsghdr nh;
+        struct rtmsg rt;
+        char attrs[64];
+    } request;
+    std::memset(&request, 0, sizeof(request));
+    request.nh.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+    request.nh.nlmsg_type = RTM_GETROUTE;
+    request.nh.nlmsg_flags = NLM_F_REQUEST;
+    request.rt.rtm_family = AF_INET;
+    request.rt.rtm_dst_len = 32;
+    struct rtattr* rta = reinterpret_cast<struct rtattr*>(reinterpret_cast<char*>(&request) +
+                                                           NLMSG_ALIGN(request.nh.nlmsg_len));
+    rta->rta_type = RTA_DST;
+    rta->rta_len = RTA_LENGTH(sizeof(remote));
+    std::memcpy(RTA_DATA(rta), &remote, sizeof(remote));
+    request.nh.nlmsg_len = NLMSG_ALIGN(request.nh.nlmsg_len) + RTA_ALIGN(rta->rta_len);
+
+    std::vector<char> response;
+    if (netlinkRequest(&request.nh, response) != 0 || response.empty()) {
+        std::cerr << StatisLogContext::getTimeString() << "Look up route to " << ipString(remote)
+                  << " failed, error is " << strerror(errno) << "." << std::endl;
+        return -1;
+    }
+    std::memset(&hop, 0, sizeof(hop));
+    struct nlmsghdr* nh = reinterpret_cast<struct nlmsghdr*>(response.data());
+    struct rtmsg* rt = static_cast<struct rtmsg*>(NLMSG_DATA(nh));
+    int len = static_cast<int>(RTM_PAYLOAD(nh));
+    for (rta = RTM_RTA(rt); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        if (rta->rta_type == RTA_OIF) {
+            std::memcpy(&hop.ifindex, RTA_DATA(rta), sizeof(hop.ifindex));
+        } else if (rta->rta_type == RTA_GATEWAY) {
+            std::memcpy(&hop.gateway, RTA_DATA(rta), sizeof(hop.gateway));
+        } else if (rta->rta_type == RTA_PREFSRC) {
+            std::memcpy(&hop.source, RTA_DATA(rta), sizeof(hop.source));
+        }
+    }
+    return 0;
+}
+
+int lookupNeighbor(in_addr_t addr, int ifindex, uint8_t mac[6]) {
+    struct {
+        struct nlmsghdr nh;
+        struct ndmsg nd;
+    } request;
+    std::memset(&request, 0, sizeof(request));
+    request.nh.nlmsg_len = NLMSG_LENGTH(sizeof(struct ndmsg));
+    request.nh.nlmsg_type = RTM_GETNEIGH;
+    request.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    request.nd.ndm_family = AF_INET;
+
+    std::vector<char> response;
+    if (netlinkRequest(&request.nh, response) != 0) {
+        std::cerr << StatisLogContext::getTimeString() << "Dump neighbour table failed, error is "
+                  << strerror(errno) << "." << std::endl;
+        return -1;
+    }
+    const uint16_t usable = NUD_REACHABLE | NUD_STALE | NUD_DELAY | NUD_PROBE | NUD_PERMANENT;
+    size_t offset = 0;
+    while (offset + sizeof(struct nlmsghdr) <= response.size()) {
+        struct nlmsghdr* nh = reinterpret_cast<struct nlmsghdr*>(&response[offset]);
+        offset += NLMSG_ALIGN(nh->nlmsg_len);
+        if (nh->nlmsg_type != RTM_NEWNEIGH) {
+            continue;
+        }
+        struct ndmsg* nd = static_cast<struct ndmsg*>(NLMSG_DATA(nh));
+        if (nd->ndm_ifindex != ifindex || (nd->ndm_state & usable) == 0) {
+            continue;
+        }
+        in_addr_t dst = 0;
+        const uint8_t* lladdr = NULL;
+        int len = static_cast<int>(nh->nlmsg_len - NLMSG_LENGTH(sizeof(struct ndmsg)));
+        for (struct rtattr* rta = reinterpret_cast<struct rtattr*>(reinterpret_cast<char*>(nd) +
+                                                                    NLMSG_ALIGN(sizeof(struct ndmsg)));
+             RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+            if (rta->rta_type == NDA_DST && RTA_PAYLOAD(rta) == sizeof(dst)) {
+                std::memcpy(&dst, RTA_DATA(rta), sizeof(dst));
+            } else if (rta->rta_type == NDA_LLADDR && RTA_PAYLOAD(rta) == 6) {
+                lladdr = static_cast<const uint8_t*>(RTA_DATA(rta));
+            }
+        }
+        if (dst == addr && lladdr != NULL) {
+            std::memcpy(mac, lladdr, 6);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void triggerNeighbor(in_addr_t remote) {
+    // any datagram routed to the remote makes the kernel resolve the next hop
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd == -1) {
+        return;
+    }
+    struct sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(DISCARD_PORT);
+    addr.sin_addr.s_addr = remote;
+    char byte = 0;
+    sendto(fd, &byte, sizeof(byte), MSG_DONTWAIT, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+    close(fd);
+}
+
+int resolveNextHop(in_addr_t remote, const linkinfo_t& link, nexthop_t& hop, int timeout_ms) {
+    if (lookupRoute(remote, hop) != 0) {
+        return -1;
+    }
+    if (hop.ifindex != link.ifindex) {
+        char name[IF_NAMESIZE] = {0};
+        if_indextoname(static_cast<unsigned int>(hop.ifindex), name);
+        std::cerr << StatisLogContext::getTimeString() << "The route to " << ipString(remote) << " goes out of "
+                  << name << ", not the bind device." << std::endl;
+        return -1;
+    }
+    if (hop.source == 0) {
+        hop.source = link.address;
+    }
+    if (link.noarp) {
+        std::memset(hop.mac, 0, sizeof(hop.mac));
+        return 0;
+    }
+    const in_addr_t neighbor = hop.gateway != 0 ? hop.gateway : remote;
+    for (int waited = 0; ; waited += NEIGHBOR_RETRY_MS) {
+        int ret = lookupNeighbor(neighbor, link.ifindex, hop.mac);
+        if (ret != 0) {
+            return ret > 0 ? 0 : -1;
+        }
+        if (waited >= timeout_ms) {
+            break;
+        }
+        if (waited == 0) {
+            triggerNeighbor(remote);
+        }
+        usleep(NEIGHBOR_RETRY_MS * 1000);
+    }
+    std::cerr << StatisLogContext::getTimeString() << "No MAC address of next hop " << ipString(neighbor)
+              << " to " << ipString(remote) << " in the neighbour table." << std::endl;
+    return -1;
+}
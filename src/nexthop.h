@@ -0,0 +1,36 @@
+#ifndef SRC_NEXTHOP_H_
+#define SRC_NEXTHOP_H_
+
+#include <string>
+#include <netinet/in.h>
+
+// where to put an IPv4 packet on the wire, found with rtnetlink the way the kernel routes it
+typedef struct NextHop {
+    int ifindex;
+    in_addr_t gateway;   // 0 when the remote is on link
+    in_addr_t source;    // preferred source address of the route
+    uint8_t mac[6];      // destination MAC of the frame, zero on a device without ARP
+} nexthop_t;
+
+// interface properties needed to build Ethernet frames on it
+typedef struct LinkInfo {
+    int ifindex;
+    int mtu;
+    bool noarp;
+    uint8_t mac[6];
+    in_addr_t address;
+} linkinfo_t;
+
+int lookupLink(const std::string& dev, linkinfo_t& link);
+
+// RTM_GETROUTE for remote
+int lookupRoute(in_addr_t remote, nexthop_t& hop);
+
+// the MAC of addr in the neighbour table of ifindex, returns 1 if found, 0 if not, -1 on error
+int lookupNeighbor(in_addr_t addr, int ifindex, uint8_t mac[6]);
+
+// route and neighbour lookup for remote through link; an unresolved neighbour is triggered with a UDP datagram
+// to the remote and looked up again for up to timeout_ms milliseconds
+int resolveNextHop(in_addr_t remote, const linkinfo_t& link, nexthop_t& hop, int timeout_ms);
+
+#endif // SRC_NEXTHOP_H_
@@ -1,23 +1,76 @@
 #ifndef SRC_PCAPEXPORT_H_
 #define SRC_PCAPEXPORT_H_
 
+#include <memory>
+#include <vector>
 #include <pcap/pcap.h>
+#include "remotebalance.h"
 
 enum class exporttype : uint8_t {
     gre = 0,
     file = 1,
     zmq = 2,
+    vxlan = 3,
+    batchudp = 4,
+};
+
+// packets handed to the exporters in one call, packet i is headers[i] and data[i].
+// data only has to stay valid until exportBatch returns.
+// tag is added to the GRE key / VXLAN VNI / zmq batch keybit by the exporters, it tells apart batches
+// of different capture interfaces sharing one exporter.
+struct PacketBatch {
+    std::vector<struct pcap_pkthdr> headers;
+    std::vector<const uint8_t*> data;
+    uint32_t tag;
+
+    PacketBatch() : tag(0) {
+    }
+
+    size_t size() const {
+        return headers.size();
+    }
+    bool empty() const {
+        return headers.empty();
+    }
+    void push_back(const struct pcap_pkthdr& header, const uint8_t* pkt_data) {
+        headers.push_back(header);
+        data.push_back(pkt_data);
+    }
+    void clear() {
+        headers.clear();
+        data.clear();
+    }
 };
 
 class PcapExportBase {
 protected:
     exporttype _type;
+    // set: every packet goes to the one remote picked for its flow, not to all of them
+    std::shared_ptr<RemoteBalancer> _balancer;
 public:
     exporttype getExportType() const {
         return _type;
     }
+    void setBalancer(const std::shared_ptr<RemoteBalancer>& balancer) {
+        _balancer = balancer;
+    }
     virtual int initExport() = 0;
     virtual int exportPacket(const struct pcap_pkthdr *header, const uint8_t *pkt_data) = 0;
+    // returns the number of packets of the batch which failed to export
+    virtual int exportBatch(const PacketBatch& batch) {
+        int failed = 0;
+        for (size_t i = 0; i < batch.size(); ++i) {
+            if (exportPacket(&batch.headers[i], batch.data[i]) != 0) {
+                failed++;
+            }
+        }
+        return failed;
+    }
+    // exporters may stage packets past exportBatch, the capture loop calls this when it goes idle to push
+    // them out; returns the number of staged packets which failed. Staged packets count as exported until then.
+    virtual int flushExport() {
+        return 0;
+    }
     virtual int closeExport() = 0;
 };
 
@@ -1,9 +1,27 @@
 #include "pcaphandler.h"
 #include <iostream>
 #include <algorithm>
+#include <cstring>
 #include <boost/filesystem.hpp>
 #include "scopeguard.h"
 #include "agent_status.h"
+#ifndef WIN32
+    #include <poll.h>
+    #include <sys/socket.h>
+#endif
+
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+
+const int DEFAULT_BATCH_SIZE = 64;
+const size_t MAX_BATCH_ARENA_SIZE = 4 * 1024 * 1024;
+const int LATENCY_POLL_TIMEOUT_MS = 1000;
+
+// the GRE counters count the packets mirrored to the remotes, GRE, VXLAN or UDP batches
+static bool countsForwarded(exporttype type) {
+    return type == exporttype::gre || type == exporttype::vxlan || type == exporttype::batchudp;
+}
 
 PcapHandler::PcapHandler() {
     _gre_count = 0;
@@ -11,6 +29,11 @@ PcapHandler::PcapHandler() {
     _pcap_handle = NULL;
     _pcap_dumpter = NULL;
     _need_update_status = 0;
+    _status_slot = 0;
+    _log_name = "pktminerg";
+    _batch_size = DEFAULT_BATCH_SIZE;
+    _batch_arena_used = 0;
+    _loop_count = 1;
     std::memset(_errbuf, 0, sizeof(_errbuf));
 }
 
@@ -55,7 +78,7 @@ void PcapHandler::packetHandler(const struct pcap_pkthdr* header, const uint8_t*
 //            std::cout << "pkt " << _gre_count << ", len: " << header->len << ", caplen: " << header->caplen << std::endl;
 //        }
                       int ret = pcapExport->exportPacket(header, pkt_data);
-                      if (pcapExport->getExportType() == exporttype::gre) {
+                      if (countsForwarded(pcapExport->getExportType())) {
                           if (ret == 0) {
                               this->_gre_count++;
                           } else {
@@ -68,46 +91,234 @@ void PcapHandler::packetHandler(const struct pcap_pkthdr* header, const uint8_t*
     }
     if (_statislog == nullptr) {
         _statislog = std::make_shared<GreSendStatisLog>(false);
-        _statislog->initSendLog("pktminerg");
+        _statislog->initSendLog(_log_name.c_str());
     }
     _statislog->logSendStatis((uint64_t) (header->ts.tv_sec), header->caplen, _gre_count, _gre_drop_count, 0,
-                              _pcap_handle);
+                              this);
     if (_need_update_status) {
         AgentStatus::get_instance()->update_capture_status((uint64_t) (header->ts.tv_sec), header->caplen, 
-                              _gre_count, _gre_drop_count, _pcap_handle);
+                              _gre_count, _gre_drop_count, this, _status_slot);
+    }
+}
+
+void PcapHandler::batchHandler(const PacketBatch& batch) {
+    if (batch.empty()) {
+        return;
+    }
+    std::for_each(_exports.begin(), _exports.end(), [&batch, this](std::shared_ptr<PcapExportBase> pcapExport) {
+        // failed may include packets staged by earlier batches, they were counted as sent then
+        int failed = pcapExport->exportBatch(batch);
+        if (countsForwarded(pcapExport->getExportType())) {
+            this->_gre_count += batch.size();
+            this->_gre_count -= failed;
+            this->_gre_drop_count += failed;
+        }
+    });
+    uint64_t caplen_bytes = 0;
+    for (size_t i = 0; i < batch.size(); ++i) {
+        caplen_bytes += batch.headers[i].caplen;
+        if (_pcap_dumpter) {
+            pcap_dump(reinterpret_cast<u_char*>(_pcap_dumpter), &batch.headers[i], batch.data[i]);
+        }
+    }
+    const uint64_t pkt_time = (uint64_t) (batch.headers.back().ts.tv_sec);
+    if (_statislog == nullptr) {
+        _statislog = std::make_shared<GreSendStatisLog>(false);
+        _statislog->initSendLog(_log_name.c_str());
+    }
+    _statislog->logSendStatisBatch(pkt_time, caplen_bytes, batch.size(), _gre_count, _gre_drop_count, 0, this);
+    if (_need_update_status) {
+        AgentStatus::get_instance()->update_capture_status(pkt_time, caplen_bytes, _gre_count, _gre_drop_count,
+                                                           this, _status_slot);
+    }
+}
+
+void PcapHandler::flushExports() {
+    for (size_t i = 0; i < _exports.size(); ++i) {
+        int failed = _exports[i]->flushExport();
+        if (failed > 0 && countsForwarded(_exports[i]->getExportType())) {
+            _gre_count -= failed;
+            _gre_drop_count += failed;
+        }
+    }
+}
+
+void PcapHandler::setBatchSize(int batch_size) {
+    _batch_size = batch_size > 0 ? batch_size : DEFAULT_BATCH_SIZE;
+}
+
+void PcapHandler::appendBatch(const struct pcap_pkthdr* header, const uint8_t* pkt_data) {
+    if (_pacer.enabled()) {
+        paceBatch(header);
+    }
+    // libpcap reuses its buffer once the callback returns, the batch keeps its own copy
+    if (_batch_arena_used + header->caplen > _batch_arena.size()) {
+        flushBatch();
+        if (header->caplen > _batch_arena.size()) {
+            _batch_arena.resize(header->caplen);
+        }
     }
+    uint8_t* data = _batch_arena.data() + _batch_arena_used;
+    std::memcpy(data, pkt_data, header->caplen);
+    _batch_arena_used += header->caplen;
+    _batch.push_back(*header, data);
+}
+
+void PcapHandler::flushBatch() {
+    batchHandler(_batch);
+    _batch.clear();
+    _batch_arena_used = 0;
+}
+
+void PcapHandler::setReplay(const pcap_init_t& param) {
+    _pacer.setMode(param.replay_mode, param.replay_rate);
+    _loop_count = param.replay_loop;
+}
+
+void PcapHandler::paceBatch(const struct pcap_pkthdr* header) {
+    // the packets already batched are due, they go out before waiting for this one
+    if (!_pacer.isDue(*header)) {
+        flushBatch();
+        flushExports();
+        _pacer.waitDue();
+    }
+}
+
+int PcapHandler::rewindPcap() {
+    return -1;
 }
 
 void PcapHandler::addExport(std::shared_ptr<PcapExportBase> pcapExport) {
     _exports.push_back(pcapExport);
 }
 
-int PcapHandler::startPcapLoop(int count) {
+void PcapHandler::setStatusSlot(size_t slot, const std::string& log_name) {
+    _status_slot = slot;
+    _log_name = log_name;
+}
+
+void PcapHandler::setBatchTag(uint32_t tag) {
+    _batch.tag = tag;
+}
+
+void PcapHandler::logEndStatis() {
+    flushExports();
+    if (_statislog == nullptr) {
+        _statislog = std::make_shared<GreSendStatisLog>(false);
+        _statislog->initSendLog(_log_name.c_str());
+    }
+    _statislog->logSendStatisGre(std::time(NULL), (uint64_t) std::time(NULL), _gre_count, _gre_drop_count, 0,
+                                 this);
+}
+
+int PcapHandler::dispatchReady(int count) {
     if (_pcap_handle == NULL) {
         std::cerr << StatisLogContext::getTimeString() << "The pcap has not created." << std::endl;
         return -1;
     }
-    int ret = pcap_loop(_pcap_handle, count, [](uint8_t* user, const struct pcap_pkthdr* h, const uint8_t* data) {
+    if (_batch_arena.empty()) {
+        size_t arena_size = static_cast<size_t>(_batch_size) * static_cast<size_t>(pcap_snapshot(_pcap_handle));
+        _batch_arena.resize(std::min(arena_size, MAX_BATCH_ARENA_SIZE));
+        _batch.headers.reserve(static_cast<size_t>(_batch_size));
+        _batch.data.reserve(static_cast<size_t>(_batch_size));
+    }
+
+    // pcap_dispatch hands over at most _batch_size packets, they go to the exporters as one batch
+    int dispatch_count = _batch_size;
+    if (count > 0 && count < dispatch_count) {
+        dispatch_count = count;
+    }
+    int ret = pcap_dispatch(_pcap_handle, dispatch_count,
+                            [](uint8_t* user, const struct pcap_pkthdr* h, const uint8_t* data) {
         PcapHandler* p = static_cast<PcapHandler*>(static_cast<void*>(user));
-        p->packetHandler(h, data);
+        p->appendBatch(h, data);
     }, reinterpret_cast<uint8_t*>(this));
-    if (_statislog == nullptr) {
-        _statislog = std::make_shared<GreSendStatisLog>(false);
-        _statislog->initSendLog("pktminerg");
+    flushBatch();
+    if (ret < dispatch_count) {
+        // the capture buffer is drained
+        flushExports();
+    }
+    if (ret == PCAP_ERROR) {
+        std::cerr << StatisLogContext::getTimeString() << "Call pcap_dispatch failed, error is "
+                  << pcap_geterr(_pcap_handle) << "." << std::endl;
     }
-    _statislog->logSendStatisGre(std::time(NULL), (uint64_t) std::time(NULL), _gre_count, _gre_drop_count, 0,
-                                 _pcap_handle);
     return ret;
 }
 
+int PcapHandler::startPcapLoop(int count) {
+    if (_pcap_handle == NULL) {
+        std::cerr << StatisLogContext::getTimeString() << "The pcap has not created." << std::endl;
+        return -1;
+    }
+    const bool offline = pcap_file(_pcap_handle) != NULL;
+    int handled = 0;
+    int pass = 1;
+    int pass_handled = 0;
+    int ret = 0;
+    while (count <= 0 || handled < count) {
+        ret = dispatchReady(count > 0 ? count - handled : 0);
+        if (ret == 0 && offline && pass_handled > 0 && (_loop_count <= 0 || pass < _loop_count)) {
+            if (rewindPcap() != 0) {
+                ret = -1;
+                break;
+            }
+            _pacer.restart();
+            pass++;
+            pass_handled = 0;
+            continue;
+        }
+        if (ret < 0 || (ret == 0 && offline)) {
+            break;
+        }
+        handled += ret;
+        pass_handled += ret;
+    }
+    logEndStatis();
+    return ret < 0 ? ret : 0;
+}
+
 void PcapHandler::stopPcapLoop() {
     if (_pcap_handle == NULL) {
         std::cerr << StatisLogContext::getTimeString() << "The pcap has not created." << std::endl;
         return;
     }
+    _pacer.cancel();
     pcap_breakloop(_pcap_handle);
 }
 
+int PcapHandler::getCaptureStats(struct pcap_stat* stat) {
+    if (_pcap_handle == NULL) {
+        return -1;
+    }
+    return pcap_stats(_pcap_handle, stat);
+}
+
+int PcapHandler::getCaptureFd() {
+    if (_pcap_handle == NULL) {
+        return -1;
+    }
+    return pcap_fileno(_pcap_handle);
+}
+
+int PcapHandler::getSelectableFd() {
+    if (_pcap_handle == NULL) {
+        return -1;
+    }
+    return pcap_get_selectable_fd(_pcap_handle);
+}
+
+int PcapHandler::setNonblock() {
+    if (_pcap_handle == NULL) {
+        return -1;
+    }
+    if (pcap_setnonblock(_pcap_handle, 1, _errbuf) != 0) {
+        std::cerr << StatisLogContext::getTimeString() << "Call pcap_setnonblock failed, error is " << _errbuf
+                  << "." << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
 int PcapOfflineHandler::openPcap(const std::string& dev, const pcap_init_t& param, const std::string& expression,
                                  bool dumpfile) {
     pcap_t* pcap_handle = pcap_open_offline(dev.c_str(), _errbuf);
@@ -120,6 +331,8 @@ int PcapOfflineHandler::openPcap(const std::string& dev, const pcap_init_t& para
         pcap_close(pcap_handle);
     });
     _need_update_status = param.need_update_status;
+    setBatchSize(param.batch_size);
+    setReplay(param);
 
     if (dumpfile) {
         if (openPcapDumper(pcap_handle) != 0) {
@@ -129,9 +342,82 @@ int PcapOfflineHandler::openPcap(const std::string& dev, const pcap_init_t& para
     }
     pcapGuard.Dismiss();
     _pcap_handle = pcap_handle;
+    _path = dev;
     return 0;
 }
 
+int PcapOfflineHandler::rewindPcap() {
+    // a savefile can not seek back, open it again; the dumper does not depend on the handle
+    pcap_t* pcap_handle = pcap_open_offline(_path.c_str(), _errbuf);
+    if (!pcap_handle) {
+        std::cerr << StatisLogContext::getTimeString() << "Call pcap_open_offline failed, error is " << _errbuf << "."
+                  << std::endl;
+        return -1;
+    }
+    closePcap();
+    _pcap_handle = pcap_handle;
+    return 0;
+}
+
+PcapLiveHandler::PcapLiveHandler() {
+    _latency_mode = 0;
+}
+
+int PcapLiveHandler::setBusyPoll(int busy_poll) {
+#ifdef WIN32
+    return -1;
+#else
+    int fd = pcap_get_selectable_fd(_pcap_handle);
+    if (fd < 0) {
+        return -1;
+    }
+    // both are hints, the capture still works without them
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &busy_poll, sizeof(busy_poll)) == -1) {
+        std::cerr << StatisLogContext::getTimeString() << "Set SO_BUSY_POLL to " << busy_poll
+                  << " failed, error is " << strerror(errno) << "." << std::endl;
+    }
+    int prefer = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &prefer, sizeof(prefer)) == -1) {
+        std::cerr << StatisLogContext::getTimeString() << "Set SO_PREFER_BUSY_POLL failed, error is "
+                  << strerror(errno) << "." << std::endl;
+    }
+    return 0;
+#endif // WIN32
+}
+
+int PcapLiveHandler::startPcapLoop(int count) {
+    if (!_latency_mode) {
+        return PcapHandler::startPcapLoop(count);
+    }
+#ifdef WIN32
+    return -1;
+#else
+    if (_pcap_handle == NULL) {
+        std::cerr << StatisLogContext::getTimeString() << "The pcap has not created." << std::endl;
+        return -1;
+    }
+    // non-blocking dispatch, poll() spins on the NIC queue when busy polling is on
+    struct pollfd pfd;
+    pfd.fd = pcap_get_selectable_fd(_pcap_handle);
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    int handled = 0;
+    int ret = 0;
+    while (count <= 0 || handled < count) {
+        ret = dispatchReady(count > 0 ? count - handled : 0);
+        if (ret < 0) {
+            break;
+        }
+        if (ret == 0) {
+            poll(&pfd, 1, LATENCY_POLL_TIMEOUT_MS);
+        }
+        handled += ret;
+    }
+    logEndStatis();
+    return ret < 0 ? ret : 0;
+#endif // WIN32
+}
+
 int PcapLiveHandler::openPcap(const std::string& dev, const pcap_init_t& param, const std::string& expression,
                               bool dumpfile) {
     int ret;
@@ -139,6 +425,7 @@ int PcapLiveHandler::openPcap(const std::string& dev, const pcap_init_t& param,
     bpf_u_int32 mask = 0;
     bpf_u_int32 net = 0;
     _need_update_status = param.need_update_status;
+    setBatchSize(param.batch_size);
 
     pcap_t* pcap_handle = pcap_create(dev.c_str(), _errbuf);
     if (!pcap_handle) {
@@ -153,6 +440,18 @@ int PcapLiveHandler::openPcap(const std::string& dev, const pcap_init_t& param,
     pcap_set_snaplen(pcap_handle, param.snaplen);
     pcap_set_timeout(pcap_handle, param.timeout);
     pcap_set_promisc(pcap_handle, param.promisc);
+#ifndef WIN32
+    _latency_mode = param.latency_mode;
+    if (_latency_mode) {
+        // packets go up as soon as they arrive instead of waiting for the buffer timeout
+        ret = pcap_set_immediate_mode(pcap_handle, 1);
+        if (ret != 0) {
+            std::cerr << StatisLogContext::getTimeString() << "Call pcap_set_immediate_mode failed, error is "
+                      << pcap_statustostr(ret) << "." << std::endl;
+            return -1;
+        }
+    }
+#endif // WIN32
     ret = pcap_set_buffer_size(pcap_handle, param.buffer_size);
     if (ret != 0) {
         std::cerr << StatisLogContext::getTimeString() << "Call pcap_set_buffer_size to " << param.buffer_size
@@ -197,5 +496,13 @@ int PcapLiveHandler::openPcap(const std::string& dev, const pcap_init_t& param,
     }
     pcapGuard.Dismiss();
     _pcap_handle = pcap_handle;
+    if (_latency_mode) {
+        if (setNonblock() != 0) {
+            return -1;
+        }
+        if (param.busy_poll > 0) {
+            setBusyPoll(param.busy_poll);
+        }
+    }
     return 0;
 }
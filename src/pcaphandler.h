@@ -6,6 +6,7 @@
 #include <memory>
 #include "pcapexport.h"
 #include "statislog.h"
+#include "replaypacer.h"
 
 typedef struct PcapInit {
     int snaplen;
@@ -13,9 +14,26 @@ typedef struct PcapInit {
     int promisc;
     int buffer_size;
     int need_update_status;
+    // max packets handed to the exporters in one exportBatch call
+    int batch_size;
+    // PcapLiveHandler only: deliver every packet at once and busy poll the NIC for busy_poll microseconds
+    int latency_mode;
+    int busy_poll;
+    // offline handlers only: pace the replay (replay_rate is the speed multiple, pps or mbps following
+    // replay_mode) and replay the file replay_loop times, 0 means endless
+    pacemode replay_mode;
+    double replay_rate;
+    int replay_loop;
+    // TPACKET_V3 ring geometry, only used by PcapTpacketHandler
+    int block_size;
+    int block_count;
+    int retire_timeout;
+    // AF_XDP sockets, only used by PcapXdpHandler; 0 means every rx queue / default frame count
+    int xdp_queue_count;
+    int xdp_frame_count;
 } pcap_init_t;
 
-class PcapHandler {
+class PcapHandler : public CaptureStatsSource {
 protected:
     pcap_t*_pcap_handle;
     pcap_dumper_t* _pcap_dumpter;
@@ -25,31 +43,70 @@ protected:
     uint64_t _gre_count;
     uint64_t _gre_drop_count;
     int _need_update_status;
+    size_t _status_slot;
+    std::string _log_name;
+    int _batch_size;
+    PacketBatch _batch;
+    std::vector<uint8_t> _batch_arena;
+    size_t _batch_arena_used;
+    ReplayPacer _pacer;
+    int _loop_count;
 protected:
     int openPcapDumper(pcap_t *pcap_handle);
     void closePcapDumper();
+    void setBatchSize(int batch_size);
+    void appendBatch(const struct pcap_pkthdr *header, const uint8_t *pkt_data);
+    void flushBatch();
+    void setReplay(const pcap_init_t& param);
+    void paceBatch(const struct pcap_pkthdr* header);
+    // nothing more to export for now, send out what the exporters staged
+    void flushExports();
+    // starts the offline file over for the next --loop pass
+    virtual int rewindPcap();
 public:
     PcapHandler();
     virtual ~PcapHandler();
     void packetHandler(const struct pcap_pkthdr *header, const uint8_t *pkt_data);
+    void batchHandler(const PacketBatch& batch);
     void addExport(std::shared_ptr<PcapExportBase> pcapExport);
-    int startPcapLoop(int count);
-    void stopPcapLoop();
+    void setStatusSlot(size_t slot, const std::string& log_name);
+    void setBatchTag(uint32_t tag);
+    void logEndStatis();
+    virtual int startPcapLoop(int count);
+    virtual void stopPcapLoop();
+    virtual int getCaptureStats(struct pcap_stat* stat);
+    virtual int getCaptureFd();
+    // used by PcapInterfaceGroup to drive several handlers from one poll loop:
+    // dispatchReady handles at most count (<=0 unlimited) packets already captured, without blocking,
+    // and returns the number of packets handled or a negative value on error.
+    virtual int getSelectableFd();
+    virtual int setNonblock();
+    virtual int dispatchReady(int count);
     virtual int openPcap(const std::string &dev, const pcap_init_t &param, const std::string &expression,
                          bool dumpfile=false) = 0;
     void closePcap();
 };
 
 class PcapOfflineHandler : public PcapHandler {
+protected:
+    std::string _path;
+protected:
+    int rewindPcap();
 public:
     int openPcap(const std::string &dev, const pcap_init_t &param, const std::string &expression,
                  bool dumpfile=false);
 };
 
 class PcapLiveHandler : public PcapHandler {
+protected:
+    int _latency_mode;
+protected:
+    int setBusyPoll(int busy_poll);
 public:
+    PcapLiveHandler();
     int openPcap(const std::string &dev, const pcap_init_t &param, const std::string &expression,
                  bool dumpfile=false);
+    int startPcapLoop(int count);
 };
 
 #endif // SRC_PCAPHANDLER_H_
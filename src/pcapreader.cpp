@@ -0,0 +1,464 @@
+#include "pcapreader.h"
+#include <iostream>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "statislog.h"
+
+const int INVALIDE_FILE_FD = -1;
+const size_t READ_AHEAD_SIZE = 64 * 1024 * 1024;
+const uint32_t MAX_RECORD_CAPLEN = 256 * 1024;
+// consecutive record headers which must look right before a chunk starts at an offset
+const int RESYNC_CHAIN_LENGTH = 8;
+
+const uint32_t PCAP_MAGIC_USEC = 0xa1b2c3d4;
+const uint32_t PCAP_MAGIC_NSEC = 0xa1b23c4d;
+const size_t PCAP_FILE_HEADER_LEN = 24;
+const size_t PCAP_RECORD_HEADER_LEN = 16;
+
+const uint32_t PCAPNG_SECTION_HEADER = 0x0a0d0d0a;
+const uint32_t PCAPNG_BYTE_ORDER_MAGIC = 0x1a2b3c4d;
+const uint32_t PCAPNG_INTERFACE_DESC = 0x00000001;
+const uint32_t PCAPNG_PACKET = 0x00000002;
+const uint32_t PCAPNG_SIMPLE_PACKET = 0x00000003;
+const uint32_t PCAPNG_ENHANCED_PACKET = 0x00000006;
+const uint16_t PCAPNG_OPT_ENDOFOPT = 0;
+const uint16_t PCAPNG_OPT_IF_TSRESOL = 9;
+const size_t PCAPNG_BLOCK_OVERHEAD = 12;
+
+static inline size_t align4(size_t len) {
+    return (len + 3) & ~static_cast<size_t>(3);
+}
+
+PcapFileReader::PcapFileReader() {
+    _fd = INVALIDE_FILE_FD;
+    _map = NULL;
+    _size = 0;
+    _offset = 0;
+    _first_record = 0;
+    _end = 0;
+    _advised = 0;
+    _released = 0;
+    _pcapng = false;
+    _swapped = false;
+    _nanosecond = false;
+    _has_interface = false;
+    _linktype = DLT_EN10MB;
+    _snaplen = 0;
+}
+
+PcapFileReader::~PcapFileReader() {
+    close();
+}
+
+uint16_t PcapFileReader::read16(const uint8_t* p) const {
+    uint16_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return _swapped ? __builtin_bswap16(value) : value;
+}
+
+uint32_t PcapFileReader::read32(const uint8_t* p) const {
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return _swapped ? __builtin_bswap32(value) : value;
+}
+
+int PcapFileReader::open(const std::string& path) {
+    close();
+    _path = path;
+    _fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (_fd == INVALIDE_FILE_FD) {
+        std::cerr << StatisLogContext::getTimeString() << "Open " << path << " failed, error is "
+                  << strerror(errno) << "." << std::endl;
+        return -1;
+    }
+    struct stat st;
+    if (fstat(_fd, &st) == -1) {
+        std::cerr << StatisLogContext::getTimeString() << "Stat " << path << " failed, error is "
+                  << strerror(errno) << "." << std::endl;
+        close();
+        return -1;
+    }
+    if (static_cast<size_t>(st.st_size) < sizeof(uint32_t)) {
+        std::cerr << StatisLogContext::getTimeString() << path << " is not a pcap or pcapng file." << std::endl;
+        close();
+        return -1;
+    }
+    _size = static_cast<size_t>(st.st_size);
+    void* map = mmap(NULL, _size, PROT_READ, MAP_PRIVATE, _fd, 0);
+    if (map == MAP_FAILED) {
+        std::cerr << StatisLogContext::getTimeString() << "Map " << path << " of " << _size
+                  << " bytes failed, error is " << strerror(errno) << "." << std::endl;
+        _size = 0;
+        close();
+        return -1;
+    }
+    _map = static_cast<const uint8_t*>(map);
+    // the file is read once from front to back: larger kernel read-ahead, no page reuse
+    madvise(map, _size, MADV_SEQUENTIAL);
+    posix_fadvise(_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    uint32_t magic;
+    std::memcpy(&magic, _map, sizeof(magic));
+    int ret;
+    if (magic == PCAPNG_SECTION_HEADER) {
+        _pcapng = true;
+        ret = parseSectionHeader();
+    } else {
+        ret = parsePcapHeader();
+    }
+    if (ret != 0) {
+        close();
+        return -1;
+    }
+    _first_record = _offset;
+    _end = _size;
+    readAhead();
+    return 0;
+}
+
+void PcapFileReader::close() {
+    if (_map != NULL) {
+        munmap(const_cast<uint8_t*>(_map), _size);
+        _map = NULL;
+    }
+    if (_fd != INVALIDE_FILE_FD) {
+        ::close(_fd);
+        _fd = INVALIDE_FILE_FD;
+    }
+    _size = 0;
+    _offset = 0;
+    _first_record = 0;
+    _end = 0;
+    _advised = 0;
+    _released = 0;
+    _pcapng = false;
+    _swapped = false;
+    _nanosecond = false;
+    _has_interface = false;
+    _interfaces.clear();
+}
+
+int PcapFileReader::rewind() {
+    if (_map == NULL) {
+        return -1;
+    }
+    int ret = 0;
+    if (_pcapng) {
+        _offset = 0;
+        ret = parseSectionHeader();
+    } else {
+        _offset = _first_record;
+    }
+    const size_t pagesize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    _advised = _offset / pagesize * pagesize;
+    _released = _advised;
+    readAhead();
+    return ret;
+}
+
+bool PcapFileReader::isRecordChain(size_t offset) const {
+    const uint32_t frac_limit = _nanosecond ? 1000000000 : 1000000;
+    for (int i = 0; i < RESYNC_CHAIN_LENGTH && offset != _size; ++i) {
+        if (_size - offset < PCAP_RECORD_HEADER_LEN) {
+            return false;
+        }
+        const uint8_t* record = _map + offset;
+        uint32_t ts_frac = read32(record + 4);
+        uint32_t caplen = read32(record + 8);
+        uint32_t len = read32(record + 12);
+        if (ts_frac >= frac_limit || caplen > len || len > MAX_RECORD_CAPLEN || (_snaplen > 0 && caplen > _snaplen)
+            || caplen > _size - offset - PCAP_RECORD_HEADER_LEN) {
+            return false;
+        }
+        offset += PCAP_RECORD_HEADER_LEN + caplen;
+    }
+    return true;
+}
+
+int PcapFileReader::selectChunk(uint32_t index, uint32_t count) {
+    if (_map == NULL || count == 0 || index >= count) {
+        return -1;
+    }
+    if (_pcapng) {
+        // pcapng blocks depend on the interface blocks before them, a chunk can not start anywhere
+        std::cerr << StatisLogContext::getTimeString() << _path << " is a pcapng file, only pcap files can be read "
+                  << "in chunks." << std::endl;
+        return -1;
+    }
+    // a record belongs to the chunk its header starts in
+    const size_t records = _size - _first_record;
+    size_t begin = _first_record + records / count * index;
+    _end = index + 1 == count ? _size : _first_record + records / count * (index + 1);
+    if (index > 0) {
+        while (begin < _end && !isRecordChain(begin)) {
+            begin++;
+        }
+    }
+    _first_record = begin;
+    return rewind();
+}
+
+int PcapFileReader::parsePcapHeader() {
+    if (_size < PCAP_FILE_HEADER_LEN) {
+        std::cerr << StatisLogContext::getTimeString() << _path << " is not a pcap or pcapng file." << std::endl;
+        return -1;
+    }
+    uint32_t magic;
+    std::memcpy(&magic, _map, sizeof(magic));
+    if (magic == PCAP_MAGIC_USEC || magic == PCAP_MAGIC_NSEC) {
+        _swapped = false;
+    } else if (magic == __builtin_bswap32(PCAP_MAGIC_USEC) || magic == __builtin_bswap32(PCAP_MAGIC_NSEC)) {
+        _swapped = true;
+    } else {
+        std::cerr << StatisLogContext::getTimeString() << _path << " is not a pcap or pcapng file." << std::endl;
+        return -1;
+    }
+    _nanosecond = read32(_map) == PCAP_MAGIC_NSEC;
+    _snaplen = read32(_map + 16);
+    _linktype = static_cast<int>(read32(_map + 20) & 0x03ffffff);
+    _offset = PCAP_FILE_HEADER_LEN;
+    return 0;
+}
+
+int PcapFileReader::parseSectionHeader() {
+    if (_size - _offset < 28) {
+        std::cerr << StatisLogContext::getTimeString() << _path << " has a truncated pcapng section header."
+                  << std::endl;
+        return -1;
+    }
+    const uint8_t* block = _map + _offset;
+    uint32_t byte_order;
+    std::memcpy(&byte_order, block + 8, sizeof(byte_order));
+    if (byte_order == PCAPNG_BYTE_ORDER_MAGIC) {
+        _swapped = false;
+    } else if (byte_order == __builtin_bswap32(PCAPNG_BYTE_ORDER_MAGIC)) {
+        _swapped = true;
+    } else {
+        std::cerr << StatisLogContext::getTimeString() << _path << " has a bad pcapng byte-order magic."
+                  << std::endl;
+        return -1;
+    }
+    uint32_t block_len = read32(block + 4);
+    if (block_len < 28 || block_len % 4 != 0 || block_len > _size - _offset) {
+        std::cerr << StatisLogContext::getTimeString() << _path << " has a bad pcapng section header at offset "
+                  << _offset << "." << std::endl;
+        return -1;
+    }
+    // interface ids are numbered per section
+    _interfaces.clear();
+    _offset += block_len;
+    return 0;
+}
+
+int PcapFileReader::parseInterface(const uint8_t* body, uint32_t body_len) {
+    if (body_len < 8) {
+        return -1;
+    }
+    pcapng_interface_t iface;
+    iface.linktype = read16(body);
+    iface.snaplen = read32(body + 4);
+    iface.ts_units = 1000000;
+    size_t pos = 8;
+    while (pos + 4 <= body_len) {
+        uint16_t code = read16(body + pos);
+        uint16_t len = read16(body + pos + 2);
+        pos += 4;
+        if (code == PCAPNG_OPT_ENDOFOPT || pos + len > body_len) {
+            break;
+        }
+        if (code == PCAPNG_OPT_IF_TSRESOL && len >= 1) {
+            // high bit set: negative power of 2, else negative power of 10
+            uint8_t resol = body[pos];
+            uint8_t exponent = resol & 0x7f;
+            uint64_t units = 1;
+            if (resol & 0x80) {
+                units = exponent < 64 ? (static_cast<uint64_t>(1) << exponent) : 0;
+            } else {
+                for (uint8_t i = 0; i < exponent && units != 0; ++i) {
+                    units = units <= UINT64_MAX / 10 ? units * 10 : 0;
+                }
+            }
+            if (units != 0) {
+                iface.ts_units = units;
+            }
+        }
+        pos += align4(len);
+    }
+    // the first interface of the file stands for the whole file, e.g. for the dump file
+    if (!_has_interface) {
+        _has_interface = true;
+        _linktype = iface.linktype;
+        _snaplen = iface.snaplen;
+    }
+    _interfaces.push_back(iface);
+    return 0;
+}
+
+void PcapFileReader::setTimestamp(struct pcap_pkthdr* header, uint32_t interface_id, uint32_t ts_high,
+                                  uint32_t ts_low) {
+    uint64_t ts = (static_cast<uint64_t>(ts_high) << 32) | ts_low;
+    uint64_t units = interface_id < _interfaces.size() ? _interfaces[interface_id].ts_units : 1000000;
+    uint64_t frac = ts % units;
+    header->ts.tv_sec = static_cast<time_t>(ts / units);
+    if (units == 1000000) {
+        header->ts.tv_usec = static_cast<suseconds_t>(frac);
+    } else {
+        header->ts.tv_usec = static_cast<suseconds_t>(static_cast<double>(frac) * 1000000.0 /
+                                                      static_cast<double>(units));
+    }
+}
+
+void PcapFileReader::readAhead() {
+    // keep READ_AHEAD_SIZE in flight in front of the reader, drop what lies a whole window behind;
+    // pages dropped here are only unmapped, they come back from the page cache if touched again
+    const size_t pagesize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    if (_advised < _size && _offset + READ_AHEAD_SIZE / 2 >= _advised) {
+        size_t start = _advised / pagesize * pagesize;
+        size_t end = std::min(_size, _offset + READ_AHEAD_SIZE);
+        madvise(const_cast<uint8_t*>(_map) + start, end - start, MADV_WILLNEED);
+        _advised = end;
+    }
+    if (_offset > _released + 2 * READ_AHEAD_SIZE) {
+        size_t end = (_offset - READ_AHEAD_SIZE) / pagesize * pagesize;
+        madvise(const_cast<uint8_t*>(_map) + _released, end - _released, MADV_DONTNEED);
+        _released = end;
+    }
+}
+
+int PcapFileReader::nextPcap(struct pcap_pkthdr* header, const uint8_t** data) {
+    if (_offset >= _end) {
+        return 0;
+    }
+    if (_size - _offset < PCAP_RECORD_HEADER_LEN) {
+        if (_size != _offset) {
+            std::cerr << StatisLogContext::getTimeString() << _path << " has a truncated record header at offset "
+                      << _offset << "." << std::endl;
+            return -1;
+        }
+        return 0;
+    }
+    const uint8_t* record = _map + _offset;
+    uint32_t ts_sec = read32(record);
+    uint32_t ts_frac = read32(record + 4);
+    uint32_t caplen = read32(record + 8);
+    uint32_t len = read32(record + 12);
+    if (caplen > MAX_RECORD_CAPLEN || caplen > _size - _offset - PCAP_RECORD_HEADER_LEN) {
+        std::cerr << StatisLogContext::getTimeString() << _path << " has a bad or truncated record of " << caplen
+                  << " bytes at offset " << _offset << "." << std::endl;
+        return -1;
+    }
+    header->ts.tv_sec = static_cast<time_t>(ts_sec);
+    header->ts.tv_usec = static_cast<suseconds_t>(_nanosecond ? ts_frac / 1000 : ts_frac);
+    header->caplen = caplen;
+    header->len = len;
+    *data = record + PCAP_RECORD_HEADER_LEN;
+    _offset += PCAP_RECORD_HEADER_LEN + caplen;
+    return 1;
+}
+
+int PcapFileReader::nextPcapng(struct pcap_pkthdr* header, const uint8_t** data) {
+    while (true) {
+        if (_size - _offset < PCAPNG_BLOCK_OVERHEAD) {
+            if (_size != _offset) {
+                std::cerr << StatisLogContext::getTimeString() << _path << " has a truncated block at offset "
+                          << _offset << "." << std::endl;
+                return -1;
+            }
+            return 0;
+        }
+        const uint8_t* block = _map + _offset;
+        uint32_t type;
+        std::memcpy(&type, block, sizeof(type));
+        if (type == PCAPNG_SECTION_HEADER) {
+            if (parseSectionHeader() != 0) {
+                return -1;
+            }
+            continue;
+        }
+        type = read32(block);
+        uint32_t block_len = read32(block + 4);
+        if (block_len < PCAPNG_BLOCK_OVERHEAD || block_len % 4 != 0 || block_len > _size - _offset) {
+            std::cerr << StatisLogContext::getTimeString() << _path << " has a bad block of " << block_len
+                      << " bytes at offset " << _offset << "." << std::endl;
+            return -1;
+        }
+        const uint8_t* body = block + 8;
+        const uint32_t body_len = block_len - PCAPNG_BLOCK_OVERHEAD;
+        _offset += block_len;
+
+        if (type == PCAPNG_INTERFACE_DESC) {
+            if (parseInterface(body, body_len) != 0) {
+                std::cerr << StatisLogContext::getTimeString() << _path << " has a bad interface description block."
+                          << std::endl;
+                return -1;
+            }
+        } else if (type == PCAPNG_ENHANCED_PACKET && body_len >= 20) {
+            uint32_t caplen = read32(body + 12);
+            if (caplen > body_len - 20) {
+                break;
+            }
+            setTimestamp(header, read32(body), read32(body + 4), read32(body + 8));
+            header->caplen = caplen;
+            header->len = read32(body + 16);
+            *data = body + 20;
+            return 1;
+        } else if (type == PCAPNG_PACKET && body_len >= 20) {
+            uint32_t caplen = read32(body + 12);
+            if (caplen > body_len - 20) {
+                break;
+            }
+            setTimestamp(header, read16(body), read32(body + 4), read32(body + 8));
+            header->caplen = caplen;
+            header->len = read32(body + 16);
+            *data = body + 20;
+            return 1;
+        } else if (type == PCAPNG_SIMPLE_PACKET && body_len >= 4) {
+            // no timestamp, caplen is bounded by the block and the snaplen of interface 0
+            uint32_t len = read32(body);
+            uint32_t caplen = std::min(len, body_len - 4);
+            if (!_interfaces.empty() && _interfaces[0].snaplen > 0) {
+                caplen = std::min(caplen, _interfaces[0].snaplen);
+            }
+            header->ts.tv_sec = 0;
+            header->ts.tv_usec = 0;
+            header->caplen = caplen;
+            header->len = len;
+            *data = body + 4;
+            return 1;
+        }
+        // name resolution, statistics and custom blocks are skipped
+    }
+    std::cerr << StatisLogContext::getTimeString() << _path << " has a packet block with a bad caplen before offset "
+              << _offset << "." << std::endl;
+    return -1;
+}
+
+int PcapFileReader::next(struct pcap_pkthdr* header, const uint8_t** data) {
+    if (_map == NULL) {
+        return -1;
+    }
+    int ret = _pcapng ? nextPcapng(header, data) : nextPcap(header, data);
+    readAhead();
+    return ret;
+}
+
+int PcapFileReader::getLinkType() const {
+    return _linktype;
+}
+
+uint32_t PcapFileReader::getSnaplen() const {
+    return _snaplen;
+}
+
+size_t PcapFileReader::getOffset() const {
+    return _offset;
+}
+
+size_t PcapFileReader::getFileSize() const {
+    return _size;
+}
@@ -0,0 +1,66 @@
+#ifndef SRC_PCAPREADER_H_
+#define SRC_PCAPREADER_H_
+
+#include <string>
+#include <vector>
+#include <pcap/pcap.h>
+
+// Reads pcap and pcapng files through one read-only memory mapping of the whole file, without libpcap.
+// Records are returned as pointers into the mapping, they stay valid until close().
+// The kernel is asked to read ahead far in front of the current record and to drop pages long behind it.
+class PcapFileReader {
+protected:
+    typedef struct PcapngInterface {
+        int linktype;
+        uint32_t snaplen;
+        uint64_t ts_units;
+    } pcapng_interface_t;
+
+    int _fd;
+    const uint8_t* _map;
+    size_t _size;
+    size_t _offset;
+    size_t _first_record;
+    size_t _end;
+    size_t _advised;
+    size_t _released;
+    bool _pcapng;
+    bool _swapped;
+    bool _nanosecond;
+    bool _has_interface;
+    int _linktype;
+    uint32_t _snaplen;
+    std::vector<pcapng_interface_t> _interfaces;
+    std::string _path;
+
+protected:
+    uint16_t read16(const uint8_t* p) const;
+    uint32_t read32(const uint8_t* p) const;
+    int parsePcapHeader();
+    int parseSectionHeader();
+    int parseInterface(const uint8_t* body, uint32_t body_len);
+    bool isRecordChain(size_t offset) const;
+    int nextPcap(struct pcap_pkthdr* header, const uint8_t** data);
+    int nextPcapng(struct pcap_pkthdr* header, const uint8_t** data);
+    void setTimestamp(struct pcap_pkthdr* header, uint32_t interface_id, uint32_t ts_high, uint32_t ts_low);
+    void readAhead();
+
+public:
+    PcapFileReader();
+    ~PcapFileReader();
+    int open(const std::string& path);
+    void close();
+    // goes back to the first record of the file, or of the chunk
+    int rewind();
+    // only reads the records starting in the index-th of count equal byte ranges of a pcap file;
+    // the first record of the range is found by checking a chain of record headers
+    int selectChunk(uint32_t index, uint32_t count);
+    // returns 1 with header and data filled in, 0 at the end of the file, -1 on a malformed record
+    int next(struct pcap_pkthdr* header, const uint8_t** data);
+    int getLinkType() const;
+    uint32_t getSnaplen() const;
+    size_t getOffset() const;
+    size_t getFileSize() const;
+};
+
+#endif // SRC_PCAPREADER_H_
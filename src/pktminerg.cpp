@@ -1,5 +1,6 @@
 #include <iostream>
 #include <csignal>
+#include <algorithm>
 #include <boost/program_options.hpp>
 #include <boost/algorithm/string.hpp>
 #include "pcaphandler.h"
@@ -9,9 +10,27 @@
 #include "syshelp.h"
 #ifndef WIN32
     #include "agent_control_plane.h"
+    #include "tpackethandler.h"
+    #include "captureworkers.h"
+    #include "interfacegroup.h"
+    #include "mmaphandler.h"
+    #include "mergehandler.h"
+    #include "chunkworkers.h"
+    #include "socketgrering.h"
+    #include "socketvxlan.h"
+    #include "socketbatch.h"
+    #include "agent_status.h"
+#endif
+#ifdef HAVE_AF_XDP
+    #include "xdphandler.h"
 #endif
 
 std::shared_ptr<PcapHandler> handler = nullptr;
+#ifndef WIN32
+std::shared_ptr<PcapWorkerGroup> workers = nullptr;
+std::shared_ptr<PcapInterfaceGroup> ifaces = nullptr;
+std::shared_ptr<PcapChunkGroup> chunks = nullptr;
+#endif
 
 int main(int argc, const char* argv[]) {
     boost::program_options::options_description generic("Generic options");
@@ -22,19 +41,93 @@ int main(int argc, const char* argv[]) {
     boost::program_options::options_description desc("Allowed options");
     desc.add_options()
             ("interface,i", boost::program_options::value<std::string>()->value_name("NIC"),
-             "interface to capture packets")
+             "interface to capture packets; NIC may be a comma separated list to capture several interfaces in "
+             "one process (Not available on Windows)")
             ("bind_device,B", boost::program_options::value<std::string>()->value_name("BIND"),
              "send GRE packets from this binded device.(Not available on Windows)")
             ("pmtudisc_option,M", boost::program_options::value<std::string>()->value_name("MTU"),
              " Select Path MTU Discovery strategy.  pmtudisc_option may be either do (prohibit fragmentation, even local one), want (do PMTU discovery, fragment locally when packet size is large), or dont (do not set DF flag)")
             ("pcapfile,f", boost::program_options::value<std::string>()->value_name("PATH"),
-             "specify pcap file for offline mode, mostly for test")
+             "specify pcap file for offline mode, mostly for test; a directory, a glob pattern or a ',' separated "
+             "list of files is replayed as one stream merged by timestamp (Not available on Windows)")
+            ("libpcap-reader",
+             "read the pcap file through libpcap instead of the memory mapped pcap/pcapng reader "
+             "(always on for Windows)")
+            ("replay-speed", boost::program_options::value<double>()->value_name("X"),
+             "offline mode: replay packets at X times their capture timing, e.g. 2 is twice as fast")
+            ("pps", boost::program_options::value<double>()->value_name("RATE"),
+             "offline mode: replay RATE packets per second")
+            ("mbps", boost::program_options::value<double>()->value_name("RATE"),
+             "offline mode: replay RATE megabits per second of captured bytes")
+            ("loop", boost::program_options::value<int>()->default_value(1)->value_name("N"),
+             "offline mode: replay the pcap file N times; N defaults 1, 0 means endless")
+            ("chunks", boost::program_options::value<int>()->default_value(1)->value_name("K"),
+             "offline mode: split the pcap file into K byte ranges replayed by K threads, each with its own "
+             "exporters; K defaults 1 (Not available on Windows)")
             ("remoteip,r", boost::program_options::value<std::string>()->value_name("IPs"),
              "set gre remote IPs, seperate by ',' Example: -r 8.8.4.4,8.8.8.8")
+            ("remote-mode", boost::program_options::value<std::string>()->default_value("replicate")
+                    ->value_name("MODE"),
+             "set how packets are spread over the remote IPs; MODE may be either replicate (every packet to every "
+             "remote) or balance (every flow to one remote, picked by consistent hashing of its 5-tuple)")
+            ("gre-batch", boost::program_options::value<int>()->default_value(32)->value_name("COUNT"),
+             "stage up to COUNT GRE packets and send them with one sendmmsg call per remote; COUNT defaults 32, "
+             "1 sends every packet at once")
+            ("gre-flush-us", boost::program_options::value<int>()->default_value(1000)->value_name("TIME"),
+             "send staged GRE packets at the latest TIME after the first of them was staged, as long as packets keep "
+             "coming; TIME defaults 1000 and units microsecond")
+            ("gre-queue", boost::program_options::value<int>()->default_value(0)->value_name("DEPTH"),
+             "send GRE packets from one thread per remote, each fed by a queue of DEPTH packets; DEPTH defaults 0 "
+             "means send from the capture thread (Not available on Windows)")
+            ("gre-queue-full", boost::program_options::value<std::string>()->default_value("drop-newest")
+                    ->value_name("POLICY"),
+             "set what happens to a packet when the GRE queue of a remote is full; POLICY may be either drop-newest, "
+             "drop-oldest or block (wait for the sender thread)")
+            ("gre-tx-ring",
+             "build the GRE frames in an AF_PACKET TX_RING on the bind device (-B), bypassing the IP stack and the "
+             "qdisc (Not available on Windows)")
+            ("gre-oversize", boost::program_options::value<std::string>()->default_value("fragment")
+                    ->value_name("POLICIES"),
+             "set what happens to a packet too big for the path MTU of a remote, one POLICY per --remoteip "
+             "seperated by ',', or one for all; POLICY may be either fragment (by the kernel), truncate or split "
+             "(into GRE packets gredump puts together again); truncate and split only work with --encap gre "
+             "(Not available on Windows)")
+            ("gre-seq",
+             "add a sequence number per remote and key to the GRE packets, so collectors can tell network loss from "
+             "packets the agent dropped; with --workers or --chunks, thread N sends with key BIT+N")
+            ("encap", boost::program_options::value<std::string>()->default_value("gre")->value_name("TYPE"),
+             "set how packets are encapsulated to the remotes; TYPE may be either gre, erspan2, erspan3 (session id "
+             "is the key bit, BIT+N for thread N of --workers or --chunks, type III adds the capture timestamps), "
+             "vxlan (UDP port 4789, VNI is the key bit, source port from the inner flow) or batch (many packets "
+             "per UDP datagram to --batch-port, in the zmq batch format); vxlan and batch are not available on "
+             "Windows")
+            ("batch-port", boost::program_options::value<int>()->default_value(0)->value_name("PORT"),
+             "set the UDP port of the remotes receiving --encap batch datagrams")
             ("zmq_port,z", boost::program_options::value<int>()->default_value(0)->value_name("ZMQ_PORT"),
              "set remote zeromq server port to receive packets reliably; ZMQ_PORT default value 0 means disable.")
             ("zmq_hwm,m", boost::program_options::value<int>()->default_value(100)->value_name("ZMQ_HWM"),
              "set zeromq queue high watermark; ZMQ_HWM default value 100.")
+            ("zmq-batch-ms", boost::program_options::value<int>()->default_value(1000)->value_name("TIME"),
+             "send a zeromq batch once it is TIME old, by capture time or by the wall clock when no packets come; "
+             "TIME defaults 1000 and units millisecond, a shorter snoop timeout is used when TIME is below it")
+            ("zmq-batch-bytes", boost::program_options::value<int>()->default_value(1048576)->value_name("SIZE"),
+             "send a zeromq batch before it grows over SIZE bytes; SIZE defaults 1048576, which is also the most")
+            ("zmq-compress", boost::program_options::value<std::string>()->default_value("none")->value_name("CODEC"),
+             "compress zeromq batches on a worker thread and send them in batch format version 2; CODEC is none, "
+             "lz4 or zstd, defaults none which keeps version 1")
+            ("zmq-compress-level", boost::program_options::value<int>()->default_value(0)->value_name("LEVEL"),
+             "compression level of --zmq-compress; LEVEL defaults 0 for the default of the codec, for lz4 1 to 12 "
+             "picks its high compression mode, for zstd 1 to 19")
+            ("zmq-retry-bytes", boost::program_options::value<int>()->default_value(16777216)->value_name("SIZE"),
+             "keep up to SIZE bytes of zeromq batches per remote which failed to send, and send them again once the "
+             "remote takes them, dropping the oldest when full; SIZE defaults 16777216, 0 drops them at once")
+            ("zmq-spool", boost::program_options::value<std::string>()->value_name("DIR"),
+             "write zeromq batches which do not fit --zmq-retry-bytes to memory mapped spool files in DIR, and "
+             "send them again once the remote takes batches; batches left from a previous run are sent first")
+            ("zmq-spool-mb", boost::program_options::value<int>()->default_value(1024)->value_name("SIZE"),
+             "most megabytes of spool files per remote, the oldest are dropped first; SIZE defaults 1024, at least 8")
+            ("zmq-spool-mbps", boost::program_options::value<double>()->default_value(100)->value_name("RATE"),
+             "send spooled batches at RATE megabits per second at most; RATE defaults 100, 0 means no limit")
             ("keybit,k", boost::program_options::value<int>()->default_value(1)->value_name("BIT"),
              "set gre key bit; BIT defaults 1")
             ("snaplen,s", boost::program_options::value<int>()->default_value(2048)->value_name("LENGTH"),
@@ -45,8 +138,38 @@ int main(int argc, const char* argv[]) {
              "set snoop buffer size; SIZE defaults 256 and units MB")
             ("count,c", boost::program_options::value<int>()->default_value(0)->value_name("COUNT"),
              "exit after receiving count packets; COUNT defaults; count<=0 means unlimited")
+            ("batch-size", boost::program_options::value<int>()->default_value(64)->value_name("COUNT"),
+             "hand at most COUNT packets to the exporters at once; COUNT defaults 64")
+            ("workers", boost::program_options::value<int>()->default_value(1)->value_name("N"),
+             "capture with N worker threads joined to one PACKET_FANOUT group, each with its own exporters; "
+             "N defaults 1 (Not available on Windows)")
+            ("fanout-mode", boost::program_options::value<std::string>()->default_value("hash")->value_name("MODE"),
+             "set how packets are spread over workers; MODE may be either hash (flow hash), cpu (receiving cpu) or "
+             "lb (round robin)")
+            ("latency-mode",
+             "deliver every packet to the exporters as soon as it is captured and busy poll the NIC, instead of "
+             "buffering up to the snoop timeout; pcap capture backend only (Not available on Windows)")
+            ("busy-poll", boost::program_options::value<int>()->default_value(50)->value_name("TIME"),
+             "set SO_BUSY_POLL of the capture socket in latency mode; TIME defaults 50 and units microsecond")
+            ("iface-tag",
+             "with several interfaces, add the position of the interface in the -i list to the GRE key / zmq batch "
+             "keybit, so interface N is sent with keybit BIT+N")
+            ("capture-backend", boost::program_options::value<std::string>()->default_value("pcap")->value_name("BACKEND"),
+             "set live capture backend; BACKEND may be either pcap (libpcap), tpacket (AF_PACKET TPACKET_V3 ring, "
+             "Not available on Windows) or xdp (AF_XDP sockets, Linux 5.4 or later)")
+            ("block-size", boost::program_options::value<int>()->default_value(1024)->value_name("SIZE"),
+             "set tpacket ring block size; SIZE defaults 1024 and units KB")
+            ("block-count", boost::program_options::value<int>()->default_value(0)->value_name("COUNT"),
+             "set tpacket ring block count; COUNT defaults 0 means buffsize divided by block size")
+            ("retire-timeout", boost::program_options::value<int>()->value_name("TIME"),
+             "set tpacket block retire timeout; TIME defaults to snoop timeout and units millisecond")
+            ("xdp-queues", boost::program_options::value<int>()->default_value(0)->value_name("COUNT"),
+             "capture rx queues 0 to COUNT-1 with the xdp backend; COUNT defaults 0 means every rx queue of the NIC")
+            ("xdp-frames", boost::program_options::value<int>()->default_value(4096)->value_name("COUNT"),
+             "set xdp UMEM frames per rx queue, rounded up to a power of 2; COUNT defaults 4096")
             ("priority,p", "set high priority mode")
-            ("cpu", boost::program_options::value<int>()->value_name("ID"), "set cpu affinity ID")
+            ("cpu", boost::program_options::value<int>()->value_name("ID"),
+             "set cpu affinity ID; with --workers, worker N is pinned to cpu ID+N")
             ("expression", boost::program_options::value<std::vector<std::string>>()->value_name("FILTER"),
              R"(filter packets with FILTER; FILTER as same as tcpdump BPF expression syntax)")
             ("dump", "specify dump file, mostly for integrated test")
@@ -140,6 +263,169 @@ int main(int argc, const char* argv[]) {
 
     int zmq_port = vm["zmq_port"].as<int>();
     int zmq_hwm = vm["zmq_hwm"].as<int>();
+    const int zmq_batch_ms = vm["zmq-batch-ms"].as<int>();
+    const int zmq_batch_bytes = vm["zmq-batch-bytes"].as<int>();
+    if (zmq_batch_ms < 1 || zmq_batch_bytes < 1024 || zmq_batch_bytes > 1048576) {
+        std::cerr << StatisLogContext::getTimeString()
+                  << "--zmq-batch-ms must be positive, --zmq-batch-bytes between 1024 and 1048576." << std::endl;
+        return 1;
+    }
+    const int zmq_retry_bytes = vm["zmq-retry-bytes"].as<int>();
+    if (zmq_retry_bytes < 0) {
+        std::cerr << StatisLogContext::getTimeString() << "--zmq-retry-bytes can not be negative." << std::endl;
+        return 1;
+    }
+    const std::string zmq_spool = vm.count("zmq-spool") ? vm["zmq-spool"].as<std::string>() : "";
+    const int zmq_spool_mb = vm["zmq-spool-mb"].as<int>();
+    const double zmq_spool_mbps = vm["zmq-spool-mbps"].as<double>();
+    if (!zmq_spool.empty()) {
+#ifdef WIN32
+        std::cerr << StatisLogContext::getTimeString() << "--zmq-spool is not supported on Windows." << std::endl;
+        return 1;
+#endif // WIN32
+        if (zmq_port == 0 || zmq_spool_mb < 8 || zmq_spool_mbps < 0) {
+            std::cerr << StatisLogContext::getTimeString()
+                      << "--zmq-spool needs --zmq_port, --zmq-spool-mb at least 8 and --zmq-spool-mbps not negative."
+                      << std::endl;
+            return 1;
+        }
+    }
+    const int zmq_codec = BatchCompressor::parseCodec(vm["zmq-compress"].as<std::string>());
+    const int zmq_codec_level = vm["zmq-compress-level"].as<int>();
+    if (zmq_codec < 0 || zmq_codec_level < 0 || zmq_codec_level > 19) {
+        std::cerr << StatisLogContext::getTimeString()
+                  << "--zmq-compress must be none, lz4 or zstd, --zmq-compress-level between 0 and 19." << std::endl;
+        return 1;
+    }
+    if (zmq_codec != PKTMINERG_BATCH_CODEC_NONE && (zmq_port == 0 || !BatchCompressor::available(zmq_codec))) {
+        std::cerr << StatisLogContext::getTimeString()
+                  << "--zmq-compress needs --zmq_port and a build with the library of the codec." << std::endl;
+        return 1;
+    }
+
+    int gre_batch = vm["gre-batch"].as<int>();
+    int gre_flush_us = vm["gre-flush-us"].as<int>();
+    if (gre_batch < 1 || gre_flush_us < 0) {
+        std::cerr << StatisLogContext::getTimeString()
+                  << "--gre-batch must be at least 1 and --gre-flush-us can not be negative." << std::endl;
+        return 1;
+    }
+    int gre_queue = vm["gre-queue"].as<int>();
+    queuefull gre_queue_full = queuefull::drop_newest;
+    const auto gre_queue_full_option = vm["gre-queue-full"].as<std::string>();
+    if (gre_queue_full_option == "drop-oldest") {
+        gre_queue_full = queuefull::drop_oldest;
+    } else if (gre_queue_full_option == "block") {
+        gre_queue_full = queuefull::block;
+    } else if (gre_queue_full_option != "drop-newest") {
+        std::cerr << StatisLogContext::getTimeString()
+                  << "Wrong value for --gre-queue-full: drop-newest, drop-oldest, block are valid ones." << std::endl;
+        return 1;
+    }
+    if (gre_queue < 0) {
+        std::cerr << StatisLogContext::getTimeString() << "--gre-queue can not be negative." << std::endl;
+        return 1;
+    }
+#ifdef WIN32
+    if (gre_queue > 0 || vm.count("gre-tx-ring")) {
+        std::cerr << StatisLogContext::getTimeString() << "--gre-queue and --gre-tx-ring are not supported on Windows."
+                  << std::endl;
+        return 1;
+    }
+#endif // WIN32
+    const bool gre_tx_ring = vm.count("gre-tx-ring") > 0;
+    if (gre_tx_ring && (!vm.count("bind_device") || gre_queue > 0)) {
+        std::cerr << StatisLogContext::getTimeString()
+                  << "--gre-tx-ring needs a bind device (-B) and can't be used with --gre-queue." << std::endl;
+        return 1;
+    }
+
+    const auto encap = vm["encap"].as<std::string>();
+    greencap gre_encap = greencap::gre;
+    if (encap == "erspan2") {
+        gre_encap = greencap::erspan2;
+    } else if (encap == "erspan3") {
+        gre_encap = greencap::erspan3;
+    } else if (encap != "gre" && encap != "vxlan" && encap != "batch") {
+        std::cerr << StatisLogContext::getTimeString()
+                  << "Wrong value for --encap: gre, erspan2, erspan3, vxlan, batch are valid ones." << std::endl;
+        return 1;
+    }
+    const bool vxlan = encap == "vxlan";
+    const bool batch_udp = encap == "batch";
+#ifdef WIN32
+    if (vxlan || batch_udp) {
+        std::cerr << StatisLogContext::getTimeString() << "--encap " << encap << " is not supported on Windows."
+                  << std::endl;
+        return 1;
+    }
+#endif // WIN32
+    if ((vxlan || batch_udp) && (gre_tx_ring || gre_queue > 0)) {
+        std::cerr << StatisLogContext::getTimeString()
+                  << "--gre-tx-ring and --gre-queue can't be used with --encap " << encap << "." << std::endl;
+        return 1;
+    }
+    const int batch_port = vm["batch-port"].as<int>();
+    if (batch_udp && (batch_port <= 0 || batch_port > 65535)) {
+        std::cerr << StatisLogContext::getTimeString() << "--encap batch needs a --batch-port." << std::endl;
+        return 1;
+    }
+    const bool gre_seq = vm.count("gre-seq") > 0;
+    std::vector<std::string> gre_oversize_options;
+    boost::algorithm::split(gre_oversize_options, vm["gre-oversize"].as<std::string>(),
+                            boost::algorithm::is_any_of(","));
+    std::vector<greoversize> gre_oversize;
+    bool gre_oversize_cut = false;
+    for (size_t i = 0; i < gre_oversize_options.size(); ++i) {
+        if (gre_oversize_options[i] == "fragment") {
+            gre_oversize.push_back(greoversize::fragment);
+        } else if (gre_oversize_options[i] == "truncate") {
+            gre_oversize.push_back(greoversize::truncate);
+            gre_oversize_cut = true;
+        } else if (gre_oversize_options[i] == "split") {
+            gre_oversize.push_back(greoversize::split);
+            gre_oversize_cut = true;
+        } else {
+            std::cerr << StatisLogContext::getTimeString()
+                      << "Wrong value for --gre-oversize: fragment, truncate, split are valid ones." << std::endl;
+            return 1;
+        }
+    }
+    if (gre_oversize.size() != 1 && gre_oversize.size() != remoteips.size()) {
+        std::cerr << StatisLogContext::getTimeString()
+                  << "--gre-oversize needs one policy, or one per --remoteip." << std::endl;
+        return 1;
+    }
+#ifdef WIN32
+    if (gre_oversize_cut) {
+        std::cerr << StatisLogContext::getTimeString() << "--gre-oversize truncate and split are not supported on "
+                  << "Windows." << std::endl;
+        return 1;
+    }
+#endif // WIN32
+    if (gre_oversize_cut && (encap != "gre" || gre_tx_ring || zmq_port != 0)) {
+        std::cerr << StatisLogContext::getTimeString()
+                  << "--gre-oversize truncate and split only work with --encap gre, without --gre-tx-ring and "
+                  << "--zmq_port." << std::endl;
+        return 1;
+    }
+    if (gre_tx_ring && (gre_encap != greencap::gre || gre_seq)) {
+        std::cerr << StatisLogContext::getTimeString()
+                  << "--gre-tx-ring only sends plain GRE without sequence numbers." << std::endl;
+        return 1;
+    }
+
+    const auto remote_mode = vm["remote-mode"].as<std::string>();
+    if (remote_mode != "replicate" && remote_mode != "balance") {
+        std::cerr << StatisLogContext::getTimeString()
+                  << "Wrong value for --remote-mode: replicate, balance are valid ones." << std::endl;
+        return 1;
+    }
+    // one ring shared by the exporters of all threads, so they agree on where a flow goes
+    std::shared_ptr<RemoteBalancer> balancer = nullptr;
+    if (remote_mode == "balance") {
+        balancer = std::make_shared<RemoteBalancer>(remoteips);
+    }
 
     int keybit = vm["keybit"].as<int>();
 
@@ -150,6 +436,28 @@ int main(int argc, const char* argv[]) {
                       [&filter](const std::string& express) { filter = filter + express + " "; });
     }
 
+    std::vector<std::string> devs;
+    if (vm.count("interface")) {
+        const auto devlist = vm["interface"].as<std::string>();
+        boost::algorithm::split(devs, devlist, boost::algorithm::is_any_of(","));
+    }
+
+    // with --iface-tag the last interface is sent with the largest key bit
+    const int max_keybit = keybit + (vm.count("iface-tag") && !devs.empty() ? static_cast<int>(devs.size()) - 1 : 0);
+    // with sequence numbers every worker or chunk sends its own session, the last one BIT+N-1
+    const int exporter_count = std::max(1, std::max(vm["workers"].as<int>(), vm["chunks"].as<int>()));
+    if (zmq_port == 0 && gre_encap != greencap::gre && (keybit < 0 || max_keybit + exporter_count - 1 > 1023)) {
+        std::cerr << StatisLogContext::getTimeString()
+                  << "The ERSPAN session id is 10 bits, the key bit plus the interfaces, workers or chunks must be "
+                  << "between 0 and 1023." << std::endl;
+        return 1;
+    }
+    if (zmq_port == 0 && vxlan && (keybit < 0 || max_keybit > 0xffffff)) {
+        std::cerr << StatisLogContext::getTimeString()
+                  << "The VXLAN VNI is 24 bits, the key bit must be between 0 and 16777215." << std::endl;
+        return 1;
+    }
+
     // no filter option
     bool nofilter = false;
     if (vm.count("nofilter")) {
@@ -160,7 +468,7 @@ int main(int argc, const char* argv[]) {
                 << "because GRE bind devices(-B) is not set, GRE packet might be sent via packet captured interface(-i)"
                 << std::endl;
                 return 1;
-            } else if (bind_device == vm["interface"].as<std::string>()) {
+            } else if (std::find(devs.begin(), devs.end(), bind_device) != devs.end()) {
                 std::cerr << StatisLogContext::getTimeString() << "Can't enable --nofilter option "
                 << "because packet captured interface(-i) is equal to GRE bind devices(-B)"
                 << std::endl;
@@ -195,7 +503,53 @@ int main(int argc, const char* argv[]) {
     param.snaplen = vm["snaplen"].as<int>();
     param.promisc = 0;
     param.timeout = vm["timeout"].as<int>() * 1000;
+    if (zmq_port != 0 && zmq_batch_ms < param.timeout) {
+        // the capture loop checks the age of the zmq batches when the snoop timeout expires
+        param.timeout = zmq_batch_ms;
+    }
     param.need_update_status = update_status;
+    param.batch_size = vm["batch-size"].as<int>();
+    param.latency_mode = vm.count("latency-mode") > 0 ? 1 : 0;
+    param.busy_poll = vm["busy-poll"].as<int>();
+    param.block_size = vm["block-size"].as<int>() * 1024;
+    param.block_count = vm["block-count"].as<int>();
+    param.retire_timeout = vm.count("retire-timeout") ? vm["retire-timeout"].as<int>() : param.timeout;
+    param.xdp_queue_count = vm["xdp-queues"].as<int>();
+    param.xdp_frame_count = vm["xdp-frames"].as<int>();
+    param.replay_mode = pacemode::none;
+    param.replay_rate = 0;
+    param.replay_loop = vm["loop"].as<int>();
+    const int pace_options = static_cast<int>(vm.count("replay-speed") + vm.count("pps") + vm.count("mbps"));
+    if (pace_options > 0 || param.replay_loop != 1) {
+        if (!vm.count("pcapfile")) {
+            std::cerr << StatisLogContext::getTimeString()
+                      << "--replay-speed, --pps, --mbps and --loop only work in offline mode (-f)." << std::endl;
+            return 1;
+        }
+        if (pace_options > 1) {
+            std::cerr << StatisLogContext::getTimeString()
+                      << "Only one of --replay-speed, --pps and --mbps can be set." << std::endl;
+            return 1;
+        }
+        if (vm.count("replay-speed")) {
+            param.replay_mode = pacemode::speed;
+            param.replay_rate = vm["replay-speed"].as<double>();
+        } else if (vm.count("pps")) {
+            param.replay_mode = pacemode::pps;
+            param.replay_rate = vm["pps"].as<double>();
+        } else if (vm.count("mbps")) {
+            param.replay_mode = pacemode::mbps;
+            param.replay_rate = vm["mbps"].as<double>();
+        }
+        if (pace_options > 0 && param.replay_rate <= 0) {
+            std::cerr << StatisLogContext::getTimeString() << "Replay rate must be greater than 0." << std::endl;
+            return 1;
+        }
+        if (param.replay_loop < 0) {
+            std::cerr << StatisLogContext::getTimeString() << "--loop must not be negative." << std::endl;
+            return 1;
+        }
+    }
     int nCount = vm["count"].as<int>();
     if (nCount < 0) {
         nCount = 0;
@@ -219,59 +573,351 @@ int main(int argc, const char* argv[]) {
         }
     }
 
-    if (vm.count("pcapfile")) {
-        // offline
-        std::string path = vm["pcapfile"].as<std::string>();
-        handler = std::make_shared<PcapOfflineHandler>();
-        if (handler->openPcap(path, param, "", dumpfile) != 0) {
-            std::cerr << StatisLogContext::getTimeString() << "Call PcapOfflineHandler openPcap failed." << std::endl;
-            return 1;
-        }
-    } else if (vm.count("interface")) {
-        // online
-        std::string dev = vm["interface"].as<std::string>();
-        handler = std::make_shared<PcapLiveHandler>();
-        if (handler->openPcap(dev, param, filter, dumpfile) != 0) {
-            std::cerr << StatisLogContext::getTimeString() << "Call PcapLiveHandler openPcap failed." << std::endl;
-            return 1;
+    const auto backend = vm["capture-backend"].as<std::string>();
+    auto createLiveHandler = [&backend]() -> std::shared_ptr<PcapHandler> {
+        if (backend == "pcap") {
+            return std::make_shared<PcapLiveHandler>();
+#ifndef WIN32
+        } else if (backend == "tpacket") {
+            return std::make_shared<PcapTpacketHandler>();
+#endif // WIN32
+#ifdef HAVE_AF_XDP
+        } else if (backend == "xdp") {
+            return std::make_shared<PcapXdpHandler>();
+#endif // HAVE_AF_XDP
         }
-
-    } else {
+        return nullptr;
+    };
+    if (createLiveHandler() == nullptr) {
         std::cerr << StatisLogContext::getTimeString()
-                  << "Please choice snoop mode: from interface use -i or from pcap file use -f." << std::endl;
+                  << "Wrong value for --capture-backend: " << backend << "." << std::endl;
+        return 1;
+    }
+    if (param.latency_mode) {
+#ifdef WIN32
+        std::cerr << StatisLogContext::getTimeString() << "--latency-mode is not supported on Windows." << std::endl;
         return 1;
+#else
+        if (backend != "pcap") {
+            std::cerr << StatisLogContext::getTimeString()
+                      << "--latency-mode only works with the pcap capture backend." << std::endl;
+            return 1;
+        }
+#endif // WIN32
     }
 
+    // capture workers and chunks each get an exporter N, counted from 0: its own spool DIR/N under --zmq-spool, and
+    // its own GRE key BIT+N with --gre-seq, as the sequence numbers of an exporter only count its own packets
+    size_t exports = 0;
+    auto createExport = [&]() -> std::shared_ptr<PcapExportBase> {
+        std::shared_ptr<PcapExportBase> exportPtr = nullptr;
+        const size_t export_index = exports++;
+        if (zmq_port != 0) {
+            auto zmqExport = std::make_shared<PcapExportZMQ>(remoteips, zmq_port, zmq_hwm, keybit, bind_device,
+                                                             param.buffer_size);
+            zmqExport->setBatchLimits(static_cast<uint32_t>(zmq_batch_ms), static_cast<uint32_t>(zmq_batch_bytes));
+            if (zmqExport->setCompression(static_cast<uint8_t>(zmq_codec), zmq_codec_level) != 0) {
+                return nullptr;
+            }
+            zmqExport->setRetryBudget(static_cast<size_t>(zmq_retry_bytes));
+            if (!zmq_spool.empty()) {
+                zmqExport->setSpool(zmq_spool + "/" + std::to_string(export_index),
+                                    static_cast<size_t>(zmq_spool_mb) * 1024 * 1024, zmq_spool_mbps);
+            }
+            exportPtr = zmqExport;
+            if (exportPtr->initExport() != 0) {
+                std::cerr << StatisLogContext::getTimeString()
+                          << "zmqExport initExport failed." << std::endl;
+                return nullptr;
+            }
+#ifndef WIN32
+        } else if (gre_tx_ring) {
+            exportPtr = std::make_shared<PcapExportGreRing>(remoteips, keybit, bind_device, pmtudisc);
+            if (exportPtr->initExport() != 0) {
+                std::cerr << StatisLogContext::getTimeString()
+                          << "greRingExport initExport failed." << std::endl;
+                return nullptr;
+            }
+        } else if (vxlan) {
+            exportPtr = std::make_shared<PcapExportVxlan>(remoteips, keybit, bind_device, pmtudisc);
+            if (exportPtr->initExport() != 0) {
+                std::cerr << StatisLogContext::getTimeString()
+                          << "vxlanExport initExport failed." << std::endl;
+                return nullptr;
+            }
+        } else if (batch_udp) {
+            auto batchExport = std::make_shared<PcapExportBatchUdp>(remoteips, static_cast<uint16_t>(batch_port),
+                                                                    keybit, bind_device, pmtudisc);
+            batchExport->setMaxDelay(static_cast<uint32_t>(gre_flush_us));
+            exportPtr = batchExport;
+            if (exportPtr->initExport() != 0) {
+                std::cerr << StatisLogContext::getTimeString()
+                          << "batchExport initExport failed." << std::endl;
+                return nullptr;
+            }
+#endif // WIN32
+        } else {
+            // export gre
+            // sequence numbers count per exporter, so every exporter numbers its own key (ERSPAN session)
+            const int gre_keybit = gre_seq || gre_encap != greencap::gre ? keybit + static_cast<int>(export_index)
+                                                                        : keybit;
+            auto greExport = std::make_shared<PcapExportGre>(remoteips, gre_keybit, bind_device, pmtudisc);
+            greExport->setSendBatch(static_cast<size_t>(gre_batch), static_cast<uint32_t>(gre_flush_us));
+            greExport->setSendQueue(static_cast<size_t>(gre_queue), gre_queue_full);
+            greExport->setEncap(gre_encap);
+            greExport->setSequence(gre_seq);
+            greExport->setOversize(gre_oversize);
+            exportPtr = greExport;
+            if (exportPtr->initExport() != 0) {
+                std::cerr << StatisLogContext::getTimeString()
+                          << "greExport initExport failed." << std::endl;
+                return nullptr;
+            }
+        }
+        if (balancer != nullptr) {
+            exportPtr->setBalancer(balancer);
+        }
+        return exportPtr;
+    };
+
     // signal
     std::signal(SIGINT, [](int) {
         if (handler != nullptr) {
             handler->stopPcapLoop();
         }
+#ifndef WIN32
+        if (workers != nullptr) {
+            workers->stopWorkers();
+        }
+        if (ifaces != nullptr) {
+            ifaces->stopLoop();
+        }
+        if (chunks != nullptr) {
+            chunks->stopChunks();
+        }
+#endif // WIN32
     });
     std::signal(SIGTERM, [](int) {
         if (handler != nullptr) {
             handler->stopPcapLoop();
         }
+#ifndef WIN32
+        if (workers != nullptr) {
+            workers->stopWorkers();
+        }
+        if (ifaces != nullptr) {
+            ifaces->stopLoop();
+        }
+        if (chunks != nullptr) {
+            chunks->stopChunks();
+        }
+#endif // WIN32
     });
 
-    std::shared_ptr<PcapExportBase> exportPtr = nullptr;
-    if (zmq_port != 0) {
-        exportPtr = std::make_shared<PcapExportZMQ>(remoteips, zmq_port, zmq_hwm, keybit, bind_device, param.buffer_size);
-        int err = exportPtr->initExport();
-        if (err != 0) {
+    int worker_count = vm["workers"].as<int>();
+    if (devs.size() > 1) {
+#ifdef WIN32
+        std::cerr << StatisLogContext::getTimeString() << "Multiple interfaces are not supported on Windows."
+                  << std::endl;
+        return 1;
+#else
+        if (worker_count > 1) {
+            std::cerr << StatisLogContext::getTimeString() << "Can't enable --workers with multiple interfaces."
+                      << std::endl;
+            return 1;
+        }
+        if (dumpfile) {
+            std::cerr << StatisLogContext::getTimeString() << "Can't enable --dump option with multiple interfaces."
+                      << std::endl;
+            return 1;
+        }
+        ifaces = std::make_shared<PcapInterfaceGroup>();
+        if (ifaces->openInterfaces(createLiveHandler, devs, param, filter, vm.count("iface-tag") > 0) != 0) {
+            std::cerr << StatisLogContext::getTimeString() << "Open " << devs.size() << " capture interfaces failed."
+                      << std::endl;
+            return 1;
+        }
+        std::shared_ptr<PcapExportBase> exportPtr = createExport();
+        if (exportPtr == nullptr) {
+            return 1;
+        }
+        ifaces->addExport(exportPtr);
+
+        std::cout << StatisLogContext::getTimeString() << "Start pcap snoop on " << devs.size() << " interfaces."
+                  << std::endl;
+        ifaces->startLoop(nCount);
+        std::cout << StatisLogContext::getTimeString() << "End pcap snoop." << std::endl;
+
+        exportPtr->closeExport();
+        return 0;
+#endif // WIN32
+    }
+
+    if (worker_count > 1) {
+#ifdef WIN32
+        std::cerr << StatisLogContext::getTimeString() << "--workers is not supported on Windows." << std::endl;
+        return 1;
+#else
+        if (!vm.count("interface")) {
+            std::cerr << StatisLogContext::getTimeString() << "--workers only works with interface (-i) mode."
+                      << std::endl;
+            return 1;
+        }
+        if (dumpfile) {
+            std::cerr << StatisLogContext::getTimeString() << "Can't enable --dump option with --workers."
+                      << std::endl;
+            return 1;
+        }
+        if (worker_count > static_cast<int>(AgentStatus::MAX_CAPTURE_SLOTS)) {
+            std::cerr << StatisLogContext::getTimeString() << "--workers can not be more than "
+                      << AgentStatus::MAX_CAPTURE_SLOTS << "." << std::endl;
+            return 1;
+        }
+        const auto fanout_option = vm["fanout-mode"].as<std::string>();
+        int fanout_mode = PcapWorkerGroup::parseFanoutMode(fanout_option);
+        if (fanout_mode < 0) {
             std::cerr << StatisLogContext::getTimeString()
-                      << "zmqExport initExport failed." << std::endl;
-            return err;
+                      << "Wrong value for --fanout-mode: hash, cpu, lb are valid ones." << std::endl;
+            return 1;
         }
-    } else {
-        // export gre
-        exportPtr = std::make_shared<PcapExportGre>(remoteips, keybit, bind_device, pmtudisc);
-        int err = exportPtr->initExport();
-        if (err != 0) {
+        int first_cpu = vm.count("cpu") ? vm["cpu"].as<int>() : -1;
+
+        std::string dev = vm["interface"].as<std::string>();
+        workers = std::make_shared<PcapWorkerGroup>(static_cast<size_t>(worker_count), fanout_mode, first_cpu);
+        if (workers->openWorkers(createLiveHandler, createExport, dev, param, filter) != 0) {
+            std::cerr << StatisLogContext::getTimeString() << "Open " << worker_count << " capture workers failed."
+                      << std::endl;
+            return 1;
+        }
+
+        std::cout << StatisLogContext::getTimeString() << "Start pcap snoop with " << worker_count << " workers."
+                  << std::endl;
+        workers->startWorkers(nCount);
+        std::cout << StatisLogContext::getTimeString() << "End pcap snoop." << std::endl;
+
+        workers->closeWorkers();
+        return 0;
+#endif // WIN32
+    }
+
+#ifndef WIN32
+    std::vector<std::string> pcap_files;
+    if (vm.count("pcapfile") &&
+        PcapMergeHandler::expandPcapFiles(vm["pcapfile"].as<std::string>(), pcap_files) != 0) {
+        return 1;
+    }
+#endif // WIN32
+
+    int chunk_count = vm["chunks"].as<int>();
+    if (chunk_count > 1) {
+#ifdef WIN32
+        std::cerr << StatisLogContext::getTimeString() << "--chunks is not supported on Windows." << std::endl;
+        return 1;
+#else
+        if (!vm.count("pcapfile") || vm.count("libpcap-reader")) {
+            std::cerr << StatisLogContext::getTimeString()
+                      << "--chunks only works in offline mode (-f) with the memory mapped reader." << std::endl;
+            return 1;
+        }
+        if (dumpfile || param.replay_mode != pacemode::none || param.replay_loop != 1) {
             std::cerr << StatisLogContext::getTimeString()
-                      << "greExport initExport failed." << std::endl;
-            return err;
+                      << "Can't enable --dump, --replay-speed, --pps, --mbps or --loop with --chunks." << std::endl;
+            return 1;
+        }
+        if (chunk_count > static_cast<int>(AgentStatus::MAX_CAPTURE_SLOTS)) {
+            std::cerr << StatisLogContext::getTimeString() << "--chunks can not be more than "
+                      << AgentStatus::MAX_CAPTURE_SLOTS << "." << std::endl;
+            return 1;
+        }
+        auto createChunkExport = [&](size_t chunk) -> std::shared_ptr<PcapExportBase> {
+            std::shared_ptr<PcapExportBase> exportPtr = createExport();
+            if (exportPtr != nullptr && exportPtr->getExportType() == exporttype::zmq) {
+                std::static_pointer_cast<PcapExportZMQ>(exportPtr)->setChunk(static_cast<uint16_t>(chunk),
+                                                                             static_cast<uint16_t>(chunk_count));
+            }
+            return exportPtr;
+        };
+
+        if (pcap_files.size() > 1) {
+            std::cerr << StatisLogContext::getTimeString() << "--chunks only works with a single pcap file."
+                      << std::endl;
+            return 1;
+        }
+        std::string path = pcap_files[0];
+        chunks = std::make_shared<PcapChunkGroup>(static_cast<size_t>(chunk_count));
+        if (chunks->openChunks(createChunkExport, path, param) != 0) {
+            std::cerr << StatisLogContext::getTimeString() << "Open " << chunk_count << " chunks of " << path
+                      << " failed." << std::endl;
+            return 1;
+        }
+
+        std::cout << StatisLogContext::getTimeString() << "Start pcap snoop with " << chunk_count << " chunks."
+                  << std::endl;
+        chunks->startChunks(nCount);
+        std::cout << StatisLogContext::getTimeString() << "End pcap snoop." << std::endl;
+
+        chunks->closeChunks();
+        return 0;
+#endif // WIN32
+    }
+
+    if (vm.count("pcapfile")) {
+        // offline
+#ifdef WIN32
+        std::string path = vm["pcapfile"].as<std::string>();
+        handler = std::make_shared<PcapOfflineHandler>();
+        if (handler->openPcap(path, param, "", dumpfile) != 0) {
+            std::cerr << StatisLogContext::getTimeString() << "Call offline handler openPcap failed." << std::endl;
+            return 1;
+        }
+#else
+        if (pcap_files.size() > 1) {
+            if (vm.count("libpcap-reader")) {
+                std::cerr << StatisLogContext::getTimeString()
+                          << "Can't enable --libpcap-reader with more than one pcap file." << std::endl;
+                return 1;
+            }
+            auto merge = std::make_shared<PcapMergeHandler>();
+            if (merge->openFiles(pcap_files, param, dumpfile) != 0) {
+                std::cerr << StatisLogContext::getTimeString() << "Call merge handler openFiles failed." << std::endl;
+                return 1;
+            }
+            handler = merge;
+        } else {
+            if (vm.count("libpcap-reader")) {
+                handler = std::make_shared<PcapOfflineHandler>();
+            } else {
+                handler = std::make_shared<PcapMmapHandler>();
+            }
+            if (handler->openPcap(pcap_files[0], param, "", dumpfile) != 0) {
+                std::cerr << StatisLogContext::getTimeString() << "Call offline handler openPcap failed."
+                          << std::endl;
+                return 1;
+            }
+        }
+#endif // WIN32
+    } else if (vm.count("interface")) {
+        // online
+        std::string dev = vm["interface"].as<std::string>();
+        handler = createLiveHandler();
+        if (handler->openPcap(dev, param, filter, dumpfile) != 0) {
+            std::cerr << StatisLogContext::getTimeString() << "Call " << backend << " handler openPcap failed."
+                      << std::endl;
+            return 1;
         }
+#ifndef WIN32
+        AgentStatus::get_instance()->set_slot_name(0, dev);
+#endif // WIN32
+
+    } else {
+        std::cerr << StatisLogContext::getTimeString()
+                  << "Please choice snoop mode: from interface use -i or from pcap file use -f." << std::endl;
+        return 1;
+    }
+
+    std::shared_ptr<PcapExportBase> exportPtr = createExport();
+    if (exportPtr == nullptr) {
+        return 1;
     }
     handler->addExport(exportPtr);
 
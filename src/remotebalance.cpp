@@ -0,0 +1,31 @@
+#include "remotebalance.h"
+#include <algorithm>
+#include "flowhash.h"
+
+// points per remote, enough to keep the shares within a few percent of each other
+const uint32_t RING_POINTS_PER_REMOTE = 160;
+
+RemoteBalancer::RemoteBalancer(const std::vector<std::string>& remoteips) {
+    _ring.reserve(remoteips.size() * RING_POINTS_PER_REMOTE);
+    for (size_t i = 0; i < remoteips.size(); ++i) {
+        for (uint32_t point = 0; point < RING_POINTS_PER_REMOTE; ++point) {
+            _ring.push_back(std::make_pair(hashBytes(remoteips[i].data(), remoteips[i].size(), point), i));
+        }
+    }
+    std::sort(_ring.begin(), _ring.end());
+}
+
+size_t RemoteBalancer::pickHash(uint32_t flow_hash) const {
+    if (_ring.empty()) {
+        return 0;
+    }
+    auto it = std::lower_bound(_ring.begin(), _ring.end(), std::make_pair(flow_hash, static_cast<size_t>(0)));
+    if (it == _ring.end()) {
+        it = _ring.begin();
+    }
+    return it->second;
+}
+
+size_t RemoteBalancer::pick(const uint8_t* frame, uint32_t caplen) const {
+    return pickHash(flowHash(frame, caplen));
+}
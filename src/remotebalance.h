@@ -0,0 +1,26 @@
+#ifndef SRC_REMOTEBALANCE_H_
+#define SRC_REMOTEBALANCE_H_
+
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+// --remote-mode balance: every flow goes to one remote instead of all of them.
+// Consistent hashing: each remote IP owns many points on a ring of 32 bit hashes, a flow belongs to the next
+// point after its flow hash. Adding or removing a collector only moves the flows of its own share, and the
+// order of the remotes does not matter. Immutable once built, exporters of several threads may share one.
+class RemoteBalancer {
+protected:
+    // ring point and remote index, sorted by point
+    std::vector<std::pair<uint32_t, size_t>> _ring;
+
+public:
+    explicit RemoteBalancer(const std::vector<std::string>& remoteips);
+    // index of the remote for a flow hash (flowHash)
+    size_t pickHash(uint32_t flow_hash) const;
+    // index of the remote for the flow of an Ethernet frame
+    size_t pick(const uint8_t* frame, uint32_t caplen) const;
+};
+
+#endif // SRC_REMOTEBALANCE_H_
@@ -0,0 +1,92 @@
+#include "replaypacer.h"
+#include <thread>
+
+// below this the pacer spins instead of sleeping, sleeps overshoot by tens of microseconds
+const int64_t PACE_SPIN_NS = 100 * 1000;
+// long sleeps are cut into slices so cancel() is noticed
+const int64_t PACE_SLEEP_SLICE_NS = 100 * 1000 * 1000;
+
+ReplayPacer::ReplayPacer() {
+    _mode = pacemode::none;
+    _rate = 0;
+    _started = false;
+    _rebase = false;
+    _first_ts = 0;
+    _packets = 0;
+    _bytes = 0;
+    _cancel = false;
+}
+
+void ReplayPacer::setMode(pacemode mode, double rate) {
+    _mode = rate > 0 ? mode : pacemode::none;
+    _rate = rate;
+    _started = false;
+    _rebase = false;
+    _packets = 0;
+    _bytes = 0;
+    _cancel = false;
+}
+
+bool ReplayPacer::enabled() const {
+    return _mode != pacemode::none;
+}
+
+bool ReplayPacer::isDue(const struct pcap_pkthdr& header) {
+    const clock::time_point now = clock::now();
+    const int64_t ts = static_cast<int64_t>(header.ts.tv_sec) * 1000000000 +
+                       static_cast<int64_t>(header.ts.tv_usec) * 1000;
+    if (!_started) {
+        _started = true;
+        _start = now;
+        _first_ts = ts;
+    } else if (_rebase) {
+        // timestamps start over with the new pass, its first packet follows the last one at once
+        _rebase = false;
+        _start = _deadline;
+        _first_ts = ts;
+    }
+    double offset_ns = 0;
+    switch (_mode) {
+        case pacemode::speed:
+            // packets out of timestamp order are sent at once
+            offset_ns = ts > _first_ts ? static_cast<double>(ts - _first_ts) / _rate : 0;
+            break;
+        case pacemode::pps:
+            offset_ns = static_cast<double>(_packets) * 1e9 / _rate;
+            break;
+        case pacemode::mbps:
+            offset_ns = static_cast<double>(_bytes) * 8 * 1e3 / _rate;
+            break;
+        default:
+            break;
+    }
+    _packets++;
+    _bytes += header.caplen;
+    _deadline = _start + std::chrono::duration_cast<clock::duration>(
+            std::chrono::duration<double, std::nano>(offset_ns));
+    return _deadline <= now;
+}
+
+void ReplayPacer::waitDue() {
+    while (!_cancel) {
+        const int64_t remain = std::chrono::duration_cast<std::chrono::nanoseconds>(_deadline - clock::now()).count();
+        if (remain <= 0) {
+            return;
+        }
+        if (remain > PACE_SPIN_NS) {
+            int64_t sleep_ns = remain - PACE_SPIN_NS;
+            if (sleep_ns > PACE_SLEEP_SLICE_NS) {
+                sleep_ns = PACE_SLEEP_SLICE_NS;
+            }
+            std::this_thread::sleep_for(std::chrono::nanoseconds(sleep_ns));
+        }
+    }
+}
+
+void ReplayPacer::restart() {
+    _rebase = _started && _mode == pacemode::speed;
+}
+
+void ReplayPacer::cancel() {
+    _cancel = true;
+}
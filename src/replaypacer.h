@@ -0,0 +1,48 @@
+#ifndef SRC_REPLAYPACER_H_
+#define SRC_REPLAYPACER_H_
+
+#include <chrono>
+#include <stdint.h>
+#include <pcap/pcap.h>
+
+enum class pacemode : uint8_t {
+    none = 0,
+    speed = 1,
+    pps = 2,
+    mbps = 3,
+};
+
+// Schedules offline packets at a fixed rate or at a multiple of their capture timing.
+// Deadlines are absolute, a pacer which fell behind catches up instead of drifting.
+// Waiting sleeps until shortly before the deadline and spins for the rest, which keeps
+// the jitter in the microseconds without burning a core at low rates.
+class ReplayPacer {
+protected:
+    typedef std::chrono::steady_clock clock;
+
+    pacemode _mode;
+    double _rate;
+    bool _started;
+    bool _rebase;
+    clock::time_point _start;
+    clock::time_point _deadline;
+    int64_t _first_ts;
+    uint64_t _packets;
+    uint64_t _bytes;
+    volatile bool _cancel;
+
+public:
+    ReplayPacer();
+    // rate is the speed multiple, packets per second or megabits per second, following mode
+    void setMode(pacemode mode, double rate);
+    bool enabled() const;
+    // schedules the packet, returns true when its deadline has already passed
+    bool isDue(const struct pcap_pkthdr& header);
+    // waits for the deadline of the last scheduled packet, returns early after cancel()
+    void waitDue();
+    // the next packet starts a new pass over the file, it is scheduled right after the last one
+    void restart();
+    void cancel();
+};
+
+#endif // SRC_REPLAYPACER_H_
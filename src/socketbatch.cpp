@@ -0,0 +1,363 @@
+#include "socketbatch.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include "statislog.h"
+
+const int INVALIDE_SOCKET_FD = -1;
+const size_t IPV4_UDP_HEADERS = 28;
+const size_t DEFAULT_PATH_MTU = 1500;
+// largest UDP payload of an IPv4 datagram
+const size_t MAX_UDP_PAYLOAD = 65507;
+const size_t BATCH_RECORD_HEADER = sizeof(uint16_t) + sizeof(pmr_pkthdr_t);
+
+PcapExportBatchUdp::PcapExportBatchUdp(const std::vector<std::string>& remoteips, uint16_t port, uint32_t keybit,
+                                       const std::string& bind_device, const int pmtudisc) :
+        _remoteips(remoteips),
+        _port(port),
+        _keybit(keybit),
+        _bind_device(bind_device),
+        _pmtudisc(pmtudisc),
+        _max_delay(1000),
+        _remotes(remoteips.size()) {
+    _type = exporttype::batchudp;
+    for (size_t i = 0; i < _remotes.size(); ++i) {
+        _remotes[i].socketfd = INVALIDE_SOCKET_FD;
+        _remotes[i].keybit = keybit;
+        _remotes[i].max_payload = DEFAULT_PATH_MTU - IPV4_UDP_HEADERS;
+        _remotes[i].open = false;
+    }
+}
+
+PcapExportBatchUdp::~PcapExportBatchUdp() {
+    closeExport();
+}
+
+int PcapExportBatchUdp::initSocket(batch_remote_t& remote, const std::string& remoteip) {
+    if ((remote.socketfd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == INVALIDE_SOCKET_FD) {
+        std::cerr << StatisLogContext::getTimeString() << "Create socket failed, error code is " << errno
+                  << ", error is " << strerror(errno) << "."
+                  << std::endl;
+        return -1;
+    }
+    if (_bind_device.length() > 0) {
+        if (setsockopt(remote.socketfd, SOL_SOCKET, SO_BINDTODEVICE, _bind_device.c_str(),
+                       _bind_device.length()) < 0) {
+            std::cerr << StatisLogContext::getTimeString() << "SO_BINDTODEVICE failed, error code is " << errno
+                      << ", error is " << strerror(errno) << "."
+                      << std::endl;
+            return -1;
+        }
+    }
+    // without -M the datagrams are sent with DF, the kernel then learns the path MTU for updateMtu
+    const int pmtudisc = _pmtudisc >= 0 ? _pmtudisc : IP_PMTUDISC_DO;
+    if (setsockopt(remote.socketfd, SOL_IP, IP_MTU_DISCOVER, &pmtudisc, sizeof(pmtudisc)) == -1) {
+        std::cerr << StatisLogContext::getTimeString() << "IP_MTU_DISCOVER failed, error code is " << errno
+                  << ", error is " << strerror(errno) << "."
+                  << std::endl;
+        return -1;
+    }
+    std::memset(&remote.addr, 0, sizeof(remote.addr));
+    remote.addr.sin_family = AF_INET;
+    remote.addr.sin_port = htons(_port);
+    remote.addr.sin_addr.s_addr = inet_addr(remoteip.c_str());
+    // connected, so IP_MTU tells the path MTU
+    if (connect(remote.socketfd, reinterpret_cast<struct sockaddr*>(&remote.addr), sizeof(remote.addr)) == -1) {
+        std::cerr << StatisLogContext::getTimeString() << "Connect socket failed, error code is " << errno
+                  << ", error is " << strerror(errno) << "."
+                  << std::endl;
+        return -1;
+    }
+    updateMtu(remote);
+    return 0;
+}
+
+int PcapExportBatchUdp::initExport() {
+    for (size_t i = 0; i < _remoteips.size(); ++i) {
+        if (_remotes[i].socketfd == INVALIDE_SOCKET_FD && initSocket(_remotes[i], _remoteips[i]) != 0) {
+            std::cerr << "Failed with index: " << i << std::endl;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int PcapExportBatchUdp::closeExport() {
+    // best effort, nobody counts the failures any more
+    flushRemotes(true);
+    for (size_t i = 0; i < _remotes.size(); ++i) {
+        if (i < _remoteips.size() && _remotes[i].socketfd != INVALIDE_SOCKET_FD) {
+            close(_remotes[i].socketfd);
+        }
+        _remotes[i].socketfd = INVALIDE_SOCKET_FD;
+    }
+    return 0;
+}
+
+void PcapExportBatchUdp::openTag(uint32_t tag) {
+    const size_t lanes = (static_cast<size_t>(tag) + 1) * _remoteips.size();
+    for (size_t i = _remotes.size(); i < lanes; ++i) {
+        // a copy of the lane of the first tag, sharing its socket
+        batch_remote_t remote;
+        const batch_remote_t& first = _remotes[i % _remoteips.size()];
+        remote.socketfd = first.socketfd;
+        remote.addr = first.addr;
+        remote.keybit = _keybit + static_cast<uint32_t>(i / _remoteips.size());
+        remote.max_payload = first.max_payload;
+        remote.open = false;
+        _remotes.push_back(remote);
+    }
+}
+
+void PcapExportBatchUdp::setMaxDelay(uint32_t max_delay_us) {
+    _max_delay = std::chrono::microseconds(max_delay_us);
+}
+
+size_t PcapExportBatchUdp::getMaxPayload(size_t index) const {
+    return index < _remotes.size() ? _remotes[index].max_payload : 0;
+}
+
+void PcapExportBatchUdp::updateMtu(batch_remote_t& remote) {
+    int mtu = 0;
+    socklen_t mtu_len = sizeof(mtu);
+    if (getsockopt(remote.socketfd, SOL_IP, IP_MTU, &mtu, &mtu_len) == -1 ||
+        mtu <= static_cast<int>(IPV4_UDP_HEADERS + sizeof(batch_pkts_hdr_t) + BATCH_RECORD_HEADER)) {
+        mtu = DEFAULT_PATH_MTU;
+    }
+    remote.max_payload = std::min(static_cast<size_t>(mtu) - IPV4_UDP_HEADERS, MAX_UDP_PAYLOAD);
+}
+
+int PcapExportBatchUdp::exportPacket(const struct pcap_pkthdr* header, const uint8_t* pkt_data) {
+    PacketBatch batch;
+    batch.push_back(*header, pkt_data);
+    return exportBatch(batch) > 0 ? -1 : 0;
+}
+
+int PcapExportBatchUdp::exportBatch(const PacketBatch& batch) {
+    // one datagram carries one keybit, the batch goes to the lanes of its tag
+    openTag(batch.tag);
+    const size_t first = static_cast<size_t>(batch.tag) * _remoteips.size();
+    if (_balancer != nullptr) {
+        for (size_t j = 0; j < batch.size(); ++j) {
+            appendPacket(_remotes[first + _balancer->pick(batch.data[j], batch.headers[j].caplen)],
+                         &batch.headers[j], batch.data[j]);
+        }
+        return flushRemotes(false);
+    }
+    for (size_t i = 0; i < _remoteips.size(); ++i) {
+        for (size_t j = 0; j < batch.size(); ++j) {
+            appendPacket(_remotes[first + i], &batch.headers[j], batch.data[j]);
+        }
+    }
+    return flushRemotes(false);
+}
+
+int PcapExportBatchUdp::flushExport() {
+    return flushRemotes(true);
+}
+
+int PcapExportBatchUdp::flushRemotes(bool all) {
+    int failed = 0;
+    int tag_failed = 0;
+    const auto now = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < _remotes.size(); ++i) {
+        batch_remote_t& remote = _remotes[i];
+        if (remote.open && (all || now - remote.open_start >= _max_delay)) {
+            closeDatagram(remote);
+        }
+        const int remote_failed = sendDatagrams(remote);
+        // balanced remotes carry different packets, replicated ones the same, other tags always different ones
+        tag_failed = _balancer != nullptr ? tag_failed + remote_failed : std::max(tag_failed, remote_failed);
+        if ((i + 1) % _remoteips.size() == 0) {
+            failed += tag_failed;
+            tag_failed = 0;
+        }
+    }
+    return failed;
+}
+
+void PcapExportBatchUdp::appendPacket(batch_remote_t& remote, const struct pcap_pkthdr* header,
+                                      const uint8_t* pkt_data) {
+    const uint16_t length = (uint16_t) (header->caplen <= 65535 ? header->caplen : 65535);
+    const size_t record = BATCH_RECORD_HEADER + length;
+    if (remote.open) {
+        const batch_datagram_t& datagram = remote.datagrams.back();
+        if (datagram.length + record > remote.max_payload || datagram.pkts_num == 65535) {
+            closeDatagram(remote);
+        }
+    }
+    if (!remote.open) {
+        batch_datagram_t datagram;
+        datagram.offset = remote.buf.size();
+        datagram.length = sizeof(batch_pkts_hdr_t);
+        datagram.pkts_num = 0;
+        datagram.oversize = false;
+        remote.datagrams.push_back(datagram);
+        remote.buf.resize(remote.buf.size() + sizeof(batch_pkts_hdr_t));
+        remote.open = true;
+        remote.open_start = std::chrono::steady_clock::now();
+    }
+    batch_datagram_t& datagram = remote.datagrams.back();
+    const size_t pos = remote.buf.size();
+    remote.buf.resize(pos + record);
+    const uint16_t hlen = htons(length);
+    pmr_pkthdr_t small_pkthdr = { htonl((uint32_t)header->ts.tv_sec),
+                                  htonl((uint32_t)header->ts.tv_usec),
+                                  htonl((uint32_t)header->caplen),
+                                  htonl((uint32_t)header->len) };
+    std::memcpy(&remote.buf[pos], &hlen, sizeof(hlen));
+    std::memcpy(&remote.buf[pos + sizeof(hlen)], &small_pkthdr, sizeof(small_pkthdr));
+    std::memcpy(&remote.buf[pos + BATCH_RECORD_HEADER], pkt_data, length);
+    datagram.length += record;
+    datagram.pkts_num++;
+    if (datagram.length > remote.max_payload) {
+        // alone and still too big
+        datagram.oversize = true;
+        closeDatagram(remote);
+    }
+}
+
+void PcapExportBatchUdp::closeDatagram(batch_remote_t& remote) {
+    if (!remote.open) {
+        return;
+    }
+    const batch_datagram_t& datagram = remote.datagrams.back();
+    batch_pkts_hdr_t batch_hdr = { htons(PKTMINERG_BATCH_VERSION), htons(datagram.pkts_num), htonl(remote.keybit) };
+    std::memcpy(&remote.buf[datagram.offset], &batch_hdr, sizeof(batch_hdr));
+    remote.open = false;
+}
+
+// sends the closed datagrams, returns the number of packets in the ones which failed
+int PcapExportBatchUdp::sendDatagrams(batch_remote_t& remote) {
+    const size_t count = remote.datagrams.size() - (remote.open ? 1 : 0);
+    if (count == 0) {
+        return 0;
+    }
+    int failed = 0;
+    if (remote.msgs.size() < count) {
+        remote.msgs.resize(count);
+        remote.iovecs.resize(count);
+    }
+    size_t first = 0;
+    while (first < count) {
+        if (remote.datagrams[first].oversize) {
+            failed += sendOversize(remote, remote.datagrams[first]);
+            first++;
+            continue;
+        }
+        size_t end = first;
+        while (end < count && !remote.datagrams[end].oversize) {
+            remote.iovecs[end].iov_base = &remote.buf[remote.datagrams[end].offset];
+            remote.iovecs[end].iov_len = remote.datagrams[end].length;
+            std::memset(&remote.msgs[end], 0, sizeof(struct mmsghdr));
+            remote.msgs[end].msg_hdr.msg_iov = &remote.iovecs[end];
+            remote.msgs[end].msg_hdr.msg_iovlen = 1;
+            end++;
+        }
+        // sendmmsg stops at the first datagram which fails, that one is dropped, or split when the path MTU shrank
+        size_t sent = first;
+        while (sent < end) {
+            int nSend = sendmmsg(remote.socketfd, &remote.msgs[sent], static_cast<unsigned int>(end - sent), 0);
+            if (nSend == -1 && errno == ENOBUFS) {
+                usleep(1000);
+                continue;
+            }
+            if (nSend == -1 && errno == EMSGSIZE) {
+                updateMtu(remote);
+                failed += resendSplit(remote, remote.datagrams[sent]);
+                sent++;
+                continue;
+            }
+            if (nSend == -1) {
+                std::cerr << StatisLogContext::getTimeString() << "Send to socket failed, error code is " << errno
+                          << ", error is " << strerror(errno) << "."
+                          << std::endl;
+                failed += remote.datagrams[sent].pkts_num;
+                sent++;
+                continue;
+            }
+            sent += nSend;
+        }
+        first = end;
+    }
+    if (remote.open) {
+        // the open datagram moves to the front
+        batch_datagram_t datagram = remote.datagrams.back();
+        std::memmove(&remote.buf[0], &remote.buf[datagram.offset], datagram.length);
+        remote.buf.resize(datagram.length);
+        datagram.offset = 0;
+        remote.datagrams.clear();
+        remote.datagrams.push_back(datagram);
+    } else {
+        remote.buf.clear();
+        remote.datagrams.clear();
+    }
+    return failed;
+}
+
+// a single packet larger than the path MTU, sent without DF for this once
+int PcapExportBatchUdp::sendOversize(batch_remote_t& remote, const batch_datagram_t& datagram) {
+    const int dont = IP_PMTUDISC_DONT;
+    const int pmtudisc = _pmtudisc >= 0 ? _pmtudisc : IP_PMTUDISC_DO;
+    const bool toggle = pmtudisc != IP_PMTUDISC_DONT && pmtudisc != IP_PMTUDISC_WANT;
+    if (toggle) {
+        setsockopt(remote.socketfd, SOL_IP, IP_MTU_DISCOVER, &dont, sizeof(dont));
+    }
+    ssize_t nSend;
+    while ((nSend = send(remote.socketfd, &remote.buf[datagram.offset], datagram.length, 0)) == -1 &&
+           errno == ENOBUFS) {
+        usleep(1000);
+    }
+    if (toggle) {
+        setsockopt(remote.socketfd, SOL_IP, IP_MTU_DISCOVER, &pmtudisc, sizeof(pmtudisc));
+    }
+    if (nSend == -1) {
+        std::cerr << StatisLogContext::getTimeString() << "Send to socket failed, error code is " << errno
+                  << ", error is " << strerror(errno) << "."
+                  << std::endl;
+        return datagram.pkts_num;
+    }
+    return 0;
+}
+
+// repacks a datagram which no longer fits the path MTU into smaller ones, sent one by one
+int PcapExportBatchUdp::resendSplit(batch_remote_t& remote, const batch_datagram_t& datagram) {
+    batch_remote_t piece;
+    piece.socketfd = remote.socketfd;
+    piece.keybit = remote.keybit;
+    piece.max_payload = remote.max_payload;
+    piece.open = false;
+    size_t pos = datagram.offset + sizeof(batch_pkts_hdr_t);
+    const size_t end = datagram.offset + datagram.length;
+    while (pos + BATCH_RECORD_HEADER <= end) {
+        uint16_t hlen;
+        pmr_pkthdr_t small_pkthdr;
+        std::memcpy(&hlen, &remote.buf[pos], sizeof(hlen));
+        std::memcpy(&small_pkthdr, &remote.buf[pos + sizeof(hlen)], sizeof(small_pkthdr));
+        struct pcap_pkthdr header;
+        header.ts.tv_sec = ntohl(small_pkthdr.tv_sec);
+        header.ts.tv_usec = ntohl(small_pkthdr.tv_usec);
+        header.caplen = ntohs(hlen);
+        header.len = ntohl(small_pkthdr.len);
+        appendPacket(piece, &header, &remote.buf[pos + BATCH_RECORD_HEADER]);
+        pos += BATCH_RECORD_HEADER + ntohs(hlen);
+    }
+    closeDatagram(piece);
+    int failed = 0;
+    for (size_t i = 0; i < piece.datagrams.size(); ++i) {
+        const batch_datagram_t& small = piece.datagrams[i];
+        if (small.oversize) {
+            failed += sendOversize(piece, small);
+        } else if (send(piece.socketfd, &piece.buf[small.offset], small.length, 0) == -1) {
+            std::cerr << StatisLogContext::getTimeString() << "Send to socket failed, error code is " << errno
+                      << ", error is " << strerror(errno) << "."
+                      << std::endl;
+            failed += small.pkts_num;
+        }
+    }
+    return failed;
+}
@@ -0,0 +1,79 @@
+#ifndef SRC_SOCKETBATCH_H_
+#define SRC_SOCKETBATCH_H_
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "pcapexport.h"
+#include "batchdef.h"
+
+// aggregated transport: packets are packed in the zmq batch format (batchdef.h) into UDP datagrams of up to the
+// path MTU of every remote, so many small packets cost the agent and the collector one datagram.
+// A datagram is sent once the next packet does not fit any more, or max_delay after its first packet, or when
+// the capture goes idle (flushExport); the full datagrams of a remote go out with one sendmmsg call.
+// A packet too big for a datagram of its own is sent alone and may be fragmented.
+class PcapExportBatchUdp : public PcapExportBase {
+protected:
+    typedef struct BatchDatagram {
+        size_t offset;
+        size_t length;
+        uint16_t pkts_num;
+        bool oversize;
+    } batch_datagram_t;
+
+    typedef struct BatchRemote {
+        int socketfd;
+        struct sockaddr_in addr;
+        // of the batch header, the key bit plus the key tag of the lane
+        uint32_t keybit;
+        // path MTU less IP and UDP headers
+        size_t max_payload;
+        // datagrams back to back, the last one is still filled while open is set
+        std::vector<uint8_t> buf;
+        std::vector<batch_datagram_t> datagrams;
+        bool open;
+        std::chrono::steady_clock::time_point open_start;
+        std::vector<struct mmsghdr> msgs;
+        std::vector<struct iovec> iovecs;
+    } batch_remote_t;
+
+protected:
+    std::vector<std::string> _remoteips;
+    uint16_t _port;
+    uint32_t _keybit;
+    std::string _bind_device;
+    int _pmtudisc;
+    std::chrono::microseconds _max_delay;
+    // one lane per remote and key tag, lane tag * remotes + remote, so packets of several interfaces fill their
+    // own datagrams; the lanes of a remote share its socket
+    std::vector<batch_remote_t> _remotes;
+
+private:
+    int initSocket(batch_remote_t& remote, const std::string& remoteip);
+    void openTag(uint32_t tag);
+    void updateMtu(batch_remote_t& remote);
+    void appendPacket(batch_remote_t& remote, const struct pcap_pkthdr* header, const uint8_t* pkt_data);
+    void closeDatagram(batch_remote_t& remote);
+    int sendDatagrams(batch_remote_t& remote);
+    int sendOversize(batch_remote_t& remote, const batch_datagram_t& datagram);
+    int resendSplit(batch_remote_t& remote, const batch_datagram_t& datagram);
+    int flushRemotes(bool all);
+
+public:
+    PcapExportBatchUdp(const std::vector<std::string>& remoteips, uint16_t port, uint32_t keybit,
+                       const std::string& bind_device, const int pmtudisc);
+    ~PcapExportBatchUdp();
+    int initExport();
+    int exportPacket(const struct pcap_pkthdr* header, const uint8_t* pkt_data);
+    // a packet failed on several remotes counts once for the remote with the most failures,
+    // balanced remotes add up
+    int exportBatch(const PacketBatch& batch);
+    int flushExport();
+    int closeExport();
+    void setMaxDelay(uint32_t max_delay_us);
+    size_t getMaxPayload(size_t index) const;
+};
+
+#endif // SRC_SOCKETBATCH_H_
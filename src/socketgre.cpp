@@ -1,6 +1,8 @@
 #include "socketgre.h"
 
 #include <iostream>
+#include <algorithm>
+#include <cstddef>
 #include <cstring>
 #ifdef WIN32
 	#include <WinSock2.h>
@@ -17,6 +19,73 @@
 #include "statislog.h"
 
 const int INVALIDE_SOCKET_FD = -1;
+const size_t MAX_POOLED_BLOCKS = 64;
+const int SENDER_IDLE_WAIT_MS = 1;
+// GRE with key and sequence number, or GRE with sequence number, ERSPAN III header and platform sub-header
+const size_t MAX_GRE_HEADER = 28;
+// IPv4 header without options in front of the GRE packets
+const size_t IPV4_HEADER = 20;
+// path MTU assumed when IP_MTU can't be read
+const size_t DEFAULT_PATH_MTU = 1500;
+// below this a frame is left to the kernel to fragment instead of being cut into tiny pieces
+const size_t MIN_SEGMENT_PAYLOAD = 64;
+const std::chrono::seconds MTU_CHECK_INTERVAL(1);
+
+#ifndef WIN32
+// the id of the next truncated or split frame, shared by every exporter (capture workers, chunks) of the process:
+// receivers put the pieces of a frame together by source, key and id
+static std::atomic<uint32_t> next_segment_id(0);
+
+// sends count messages, sendmmsg stops at the first message which fails, that one is dropped and the rest
+// sent again; failed[j] is set for every message which was not sent completely
+static void sendMessages(int socketfd, struct mmsghdr* msgs, size_t count, uint8_t* failed) {
+    size_t sent = 0;
+    while (sent < count) {
+        int nSend = sendmmsg(socketfd, &msgs[sent], static_cast<unsigned int>(count - sent), 0);
+        if (nSend == -1 && errno == ENOBUFS) {
+            usleep(1000);
+            continue;
+        }
+        if (nSend == -1) {
+            std::cerr << StatisLogContext::getTimeString() << "Send to socket failed, error code is " << errno
+                      << ", error is " << strerror(errno) << "."
+                      << std::endl;
+            failed[sent] = 1;
+            sent++;
+            continue;
+        }
+        for (int j = 0; j < nSend; ++j, ++sent) {
+            size_t length = 0;
+            for (size_t k = 0; k < msgs[sent].msg_hdr.msg_iovlen; ++k) {
+                length += msgs[sent].msg_hdr.msg_iov[k].iov_len;
+            }
+            if (msgs[sent].msg_len < length) {
+                std::cerr << StatisLogContext::getTimeString() << "Send socket " << length
+                          << " bytes, but only " << msgs[sent].msg_len <<
+                          " bytes are sent success." << std::endl;
+                failed[sent] = 1;
+            }
+        }
+    }
+}
+
+// points count messages of two iovecs, a header from headers and the payload, at addr; done once all of them
+// are built, the vectors may have grown meanwhile
+static void wireMessages(std::vector<struct mmsghdr>& msgs, std::vector<struct iovec>& iovecs,
+                         std::vector<uint8_t>& headers, size_t count, struct sockaddr_in* addr) {
+    if (msgs.size() < count) {
+        msgs.resize(count);
+    }
+    for (size_t k = 0; k < count; ++k) {
+        iovecs[2 * k].iov_base = &headers[MAX_GRE_HEADER * k];
+        std::memset(&msgs[k], 0, sizeof(struct mmsghdr));
+        msgs[k].msg_hdr.msg_name = addr;
+        msgs[k].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        msgs[k].msg_hdr.msg_iov = &iovecs[2 * k];
+        msgs[k].msg_hdr.msg_iovlen = 2;
+    }
+}
+#endif // WIN32
 
 PcapExportGre::PcapExportGre(const std::vector<std::string>& remoteips, uint32_t keybit, const std::string& bind_device,
                              const int pmtudisc) :
@@ -26,12 +95,25 @@ PcapExportGre::PcapExportGre(const std::vector<std::string>& remoteips, uint32_t
         _pmtudisc(pmtudisc),
         _socketfds(remoteips.size()),
         _remote_addrs(remoteips.size()),
-        _grebuffers(remoteips.size()) {
+        _encap(greencap::gre),
+        _sequences(remoteips.size()),
+        _oversize(remoteips.size(), greoversize::fragment),
+        _path_mtus(remoteips.size(), 0),
+        _mtu_checked(remoteips.size()),
+        _gre_sequence(false),
+        _send_batch(1),
+        _max_delay(0),
+        _stage_used(0),
+        _stage_copied(0),
+        _queue_depth(0),
+        _queue_full(queuefull::drop_newest),
+        _senders_stop(false),
+        _late_failed(0) {
     _type = exporttype::gre;
     for (size_t i = 0; i < remoteips.size(); ++i) {
         _socketfds[i] = INVALIDE_SOCKET_FD;
-        _grebuffers[i].resize(65535 + sizeof(grehdr_t), '\0');
     }
+    setSendBatch(1, 0);
 }
 
 PcapExportGre::~PcapExportGre() {
@@ -40,15 +122,8 @@ PcapExportGre::~PcapExportGre() {
 
 int PcapExportGre::initSockets(size_t index, uint32_t keybit) {
     auto& socketfd = _socketfds[index];
-    auto& grebuffer = _grebuffers[index];
 
-    grehdr_t grehdr;
     if (socketfd == INVALIDE_SOCKET_FD) {
-        grehdr.flags = htons(0x2000);
-        grehdr.protocol = htons(0x6558);
-        grehdr.keybit = htonl(keybit);
-        std::memcpy(reinterpret_cast<void*>(&(grebuffer[0])), &grehdr, sizeof(grehdr_t));
-
         _remote_addrs[index].sin_family = AF_INET;
         _remote_addrs[index].sin_addr.s_addr = inet_addr(_remoteips[index].c_str());
 
@@ -83,10 +158,18 @@ int PcapExportGre::initSockets(size_t index, uint32_t keybit) {
                 return -1;
             }
         }
+        if (_oversize[index] != greoversize::fragment) {
+            // IP_MTU needs a connected socket
+            if (connect(socketfd, reinterpret_cast<struct sockaddr*>(&_remote_addrs[index]),
+                        sizeof(_remote_addrs[index])) == -1) {
+                std::cerr << StatisLogContext::getTimeString() << "Connect socket failed, error code is " << errno
+                          << ", error is " << strerror(errno) << "."
+                          << std::endl;
+                return -1;
+            }
+            updateMtu(index);
+        }
 #endif // WIN32
-
-
-
     }
     return 0;
 }
@@ -99,10 +182,130 @@ int PcapExportGre::initExport() {
             return ret;
         }
     }
+    if (_queue_depth > 0 && _senders.empty()) {
+        return startSenders();
+    }
     return 0;
 }
 
+void PcapExportGre::setSendBatch(size_t send_batch, uint32_t max_delay_us) {
+    flushStaged();
+    _send_batch = send_batch > 0 ? send_batch : 1;
+    _max_delay = std::chrono::microseconds(max_delay_us);
+    _stage_data.reserve(_send_batch);
+    _stage_offsets.reserve(_send_batch);
+    _stage_lens.reserve(_send_batch);
+    _stage_wire_lens.reserve(_send_batch);
+    _stage_ts.reserve(_send_batch);
+    _stage_keybits.reserve(_send_batch);
+    _stage_remotes.reserve(_send_batch);
+    _stage_failed.reserve(_send_batch);
+#ifdef WIN32
+    _sendbuffer.resize(65535 + MAX_GRE_HEADER);
+#else
+    _msgs.resize(_send_batch);
+    _iovecs.resize(2 * _send_batch);
+    _headers.resize(MAX_GRE_HEADER * _send_batch);
+    _msg_packets.resize(_send_batch);
+    _msg_failed.resize(_send_batch);
+#endif // WIN32
+}
+
+void PcapExportGre::setSendQueue(size_t queue_depth, queuefull queue_full) {
+    _queue_depth = queue_depth;
+    _queue_full = queue_full;
+}
+
+void PcapExportGre::setEncap(greencap encap) {
+    _encap = encap;
+}
+
+void PcapExportGre::setSequence(bool gre_sequence) {
+    _gre_sequence = gre_sequence;
+}
+
+void PcapExportGre::setOversize(const std::vector<greoversize>& oversize) {
+    if (oversize.empty()) {
+        return;
+    }
+    for (size_t i = 0; i < _oversize.size(); ++i) {
+        _oversize[i] = oversize[std::min(i, oversize.size() - 1)];
+    }
+}
+
+size_t PcapExportGre::getPathMtu(size_t index) const {
+    return index < _path_mtus.size() ? _path_mtus[index] : 0;
+}
+
+#ifndef WIN32
+void PcapExportGre::updateMtu(size_t index) {
+    int mtu = 0;
+    socklen_t mtu_len = sizeof(mtu);
+    if (getsockopt(_socketfds[index], SOL_IP, IP_MTU, &mtu, &mtu_len) == -1 || mtu <= 0) {
+        mtu = DEFAULT_PATH_MTU;
+    }
+    _path_mtus[index] = static_cast<size_t>(mtu);
+    _mtu_checked[index] = std::chrono::steady_clock::now();
+}
+
+void PcapExportGre::checkMtu(size_t index) {
+    if (_oversize[index] != greoversize::fragment &&
+        std::chrono::steady_clock::now() - _mtu_checked[index] >= MTU_CHECK_INTERVAL) {
+        updateMtu(index);
+    }
+}
+
+// builds the messages of one frame from message first on and returns how many: one, unless the frame is too
+// big for the path MTU of a remote which truncates or splits it; wireMessages sets the bases of the headers
+size_t PcapExportGre::appendMessages(size_t index, size_t first, uint32_t keybit, uint32_t& sequence,
+                                     const struct timeval& ts, const uint8_t* data, uint32_t caplen, uint32_t len,
+                                     std::vector<uint8_t>& headers, std::vector<struct iovec>& iovecs) {
+    const size_t gre_length = sizeof(grehdr_t) + (_gre_sequence ? sizeof(uint32_t) : 0);
+    const size_t mtu = _path_mtus[index];
+    size_t max_payload = 0;
+    if (_oversize[index] != greoversize::fragment && _encap == greencap::gre &&
+        IPV4_HEADER + gre_length + caplen > mtu &&
+        mtu >= IPV4_HEADER + gre_length + sizeof(gresegmenthdr_t) + MIN_SEGMENT_PAYLOAD) {
+        max_payload = mtu - IPV4_HEADER - gre_length - sizeof(gresegmenthdr_t);
+    }
+    const bool truncate = _oversize[index] == greoversize::truncate;
+    const size_t count = max_payload == 0 || truncate ? 1 : (caplen + max_payload - 1) / max_payload;
+    if (iovecs.size() < 2 * (first + count)) {
+        iovecs.resize(2 * (first + count));
+    }
+    if (headers.size() < MAX_GRE_HEADER * (first + count)) {
+        headers.resize(MAX_GRE_HEADER * (first + count));
+    }
+    if (max_payload == 0) {
+        iovecs[2 * first].iov_len = buildHeader(&headers[MAX_GRE_HEADER * first], keybit, sequence, ts, caplen, len);
+        iovecs[2 * first + 1].iov_base = const_cast<uint8_t*>(data);
+        iovecs[2 * first + 1].iov_len = caplen;
+        return 1;
+    }
+    const uint32_t id = next_segment_id.fetch_add(1, std::memory_order_relaxed);
+    for (size_t k = 0; k < count; ++k) {
+        const size_t offset = k * max_payload;
+        uint8_t* header = &headers[MAX_GRE_HEADER * (first + k)];
+        const size_t header_length = buildHeader(header, keybit, sequence, ts, caplen, len);
+        reinterpret_cast<grehdr_t*>(header)->protocol = htons(GRE_PROTO_SEGMENT);
+        gresegmenthdr_t segment;
+        segment.id = htonl(id);
+        segment.offset = htons(static_cast<uint16_t>(offset));
+        segment.flags = htons(truncate ? GRE_SEGMENT_TRUNCATED : (k + 1 < count ? GRE_SEGMENT_MORE : 0));
+        segment.length = htonl(len);
+        std::memcpy(header + header_length, &segment, sizeof(segment));
+        iovecs[2 * (first + k)].iov_len = header_length + sizeof(segment);
+        iovecs[2 * (first + k) + 1].iov_base = const_cast<uint8_t*>(data + offset);
+        iovecs[2 * (first + k) + 1].iov_len = std::min(max_payload, caplen - offset);
+    }
+    return count;
+}
+#endif // WIN32
+
 int PcapExportGre::closeExport() {
+    // best effort, nobody counts the failures any more
+    flushStaged();
+    stopSenders();
     for (size_t i = 0; i < _remoteips.size(); ++i) {
         if (_socketfds[i] != INVALIDE_SOCKET_FD) {
 #ifdef WIN32
@@ -116,42 +319,430 @@ int PcapExportGre::closeExport() {
     return 0;
 }
 
+// writes the headers in front of one packet, returns their length; sequence is the counter of the remote and key
+size_t PcapExportGre::buildHeader(uint8_t* buffer, uint32_t keybit, uint32_t& sequence, const struct timeval& ts,
+                                  uint32_t caplen, uint32_t len) {
+    grehdr_t* grehdr = reinterpret_cast<grehdr_t*>(buffer);
+    if (_encap == greencap::gre) {
+        grehdr->protocol = htons(GRE_PROTO_TEB);
+        grehdr->keybit = htonl(keybit);
+        if (!_gre_sequence) {
+            grehdr->flags = htons(GRE_FLAG_KEY);
+            return sizeof(grehdr_t);
+        }
+        // the sequence number follows the key
+        grehdr->flags = htons(GRE_FLAG_KEY | GRE_FLAG_SEQ);
+        const uint32_t next = htonl(sequence++);
+        std::memcpy(buffer + sizeof(grehdr_t), &next, sizeof(next));
+        return sizeof(grehdr_t) + sizeof(next);
+    }
+    // the sequence number takes the place of the key
+    grehdr->flags = htons(GRE_FLAG_SEQ);
+    grehdr->keybit = htonl(sequence++);
+    const uint32_t truncated = caplen < len ? 1 : 0;
+    const uint32_t session = keybit & 0x3ff;
+    if (_encap == greencap::erspan2) {
+        grehdr->protocol = htons(GRE_PROTO_ERSPAN2);
+        erspan2hdr_t* erspan = reinterpret_cast<erspan2hdr_t*>(buffer + sizeof(grehdr_t));
+        // encapsulation type 3: the frames keep their VLAN tags
+        erspan->session = htonl(1u << 28 | 3u << 11 | truncated << 10 | session);
+        erspan->index = 0;
+        return sizeof(grehdr_t) + sizeof(erspan2hdr_t);
+    }
+    grehdr->protocol = htons(GRE_PROTO_ERSPAN3);
+    erspan3hdr_t* erspan = reinterpret_cast<erspan3hdr_t*>(buffer + sizeof(grehdr_t));
+    erspan->session = htonl(2u << 28 | truncated << 10 | session);
+    // IEEE 1588 granularity: nanoseconds here, seconds in the platform sub-header
+    erspan->timestamp = htonl(static_cast<uint32_t>(ts.tv_usec) * 1000u);
+    erspan->flags = htonl(1u << 15 | 2u << 1 | 1u);
+    erspan3platform_t* platform = reinterpret_cast<erspan3platform_t*>(buffer + sizeof(grehdr_t) +
+                                                                       sizeof(erspan3hdr_t));
+    platform->platform = htonl(5u << 26);
+    platform->seconds = htonl(static_cast<uint32_t>(ts.tv_sec));
+    return sizeof(grehdr_t) + sizeof(erspan3hdr_t) + sizeof(erspan3platform_t);
+}
+
 int PcapExportGre::exportPacket(const struct pcap_pkthdr* header, const uint8_t* pkt_data) {
-    int ret = 0;
+    if (!_senders.empty()) {
+        PacketBatch batch;
+        batch.push_back(*header, pkt_data);
+        return queueBatch(batch) == 0 ? 0 : -1;
+    }
+    stagePacket(header, pkt_data, _keybit);
+    return flushStaged() == 0 ? 0 : -1;
+}
+
+int PcapExportGre::exportBatch(const PacketBatch& batch) {
+    // returns the staged packets which failed in the flushes of this call, a packet counts as failed
+    // when any remote failed; packets still staged on return are flushed by a later call
+    if (!_senders.empty()) {
+        return queueBatch(batch);
+    }
+    int failed = 0;
+    for (size_t j = 0; j < batch.size(); ++j) {
+        stagePacket(&batch.headers[j], batch.data[j], _keybit + batch.tag);
+        if (_stage_lens.size() >= _send_batch) {
+            failed += flushStaged();
+        }
+    }
+    if (!_stage_lens.empty() && std::chrono::steady_clock::now() - _stage_start >= _max_delay) {
+        failed += flushStaged();
+    }
+    // the batch data is only valid until we return
+    copyStaged();
+    return failed;
+}
+
+int PcapExportGre::flushExport() {
+    if (!_senders.empty()) {
+        return static_cast<int>(_late_failed.exchange(0));
+    }
+    return flushStaged();
+}
+
+void PcapExportGre::stagePacket(const struct pcap_pkthdr* header, const uint8_t* pkt_data, uint32_t keybit) {
+    if (_stage_lens.empty()) {
+        _stage_start = std::chrono::steady_clock::now();
+    }
+    _stage_data.push_back(pkt_data);
+    _stage_offsets.push_back(0);
+    _stage_lens.push_back((size_t) (header->caplen <= 65535 ? header->caplen : 65535));
+    _stage_wire_lens.push_back(header->len);
+    _stage_ts.push_back(header->ts);
+    _stage_keybits.push_back(keybit);
+    _stage_remotes.push_back(_balancer != nullptr ? _balancer->pick(pkt_data, header->caplen) : 0);
+    _stage_failed.push_back(0);
+}
+
+void PcapExportGre::copyStaged() {
+    for (size_t j = _stage_copied; j < _stage_lens.size(); ++j) {
+        if (_stage_used + _stage_lens[j] > _stage_buf.size()) {
+            // offsets, not pointers, stay valid when the buffer grows
+            _stage_buf.resize(std::max(_stage_buf.size() * 2, _stage_used + _stage_lens[j]));
+        }
+        std::memcpy(&_stage_buf[_stage_used], _stage_data[j], _stage_lens[j]);
+        _stage_data[j] = NULL;
+        _stage_offsets[j] = _stage_used;
+        _stage_used += _stage_lens[j];
+    }
+    _stage_copied = _stage_lens.size();
+}
+
+int PcapExportGre::flushStaged() {
+    if (_stage_lens.empty()) {
+        return 0;
+    }
     for (size_t i = 0; i < _remoteips.size(); ++i) {
-        ret |= exportPacket(i, header, pkt_data);
+        sendStaged(i);
     }
-    return ret;
+    int failed = static_cast<int>(std::count(_stage_failed.begin(), _stage_failed.end(), 1));
+    _stage_data.clear();
+    _stage_offsets.clear();
+    _stage_lens.clear();
+    _stage_wire_lens.clear();
+    _stage_ts.clear();
+    _stage_keybits.clear();
+    _stage_remotes.clear();
+    _stage_failed.clear();
+    _stage_used = 0;
+    _stage_copied = 0;
+    return failed;
 }
 
-int PcapExportGre::exportPacket(size_t index, const struct pcap_pkthdr* header, const uint8_t* pkt_data) {
-    auto& grebuffer = _grebuffers[index];
+void PcapExportGre::sendStaged(size_t index) {
     int socketfd = _socketfds[index];
     auto& remote_addr = _remote_addrs[index];
-
-    size_t length = (size_t) (header->caplen <= 65535 ? header->caplen : 65535);
-    std::memcpy(reinterpret_cast<void*>(&(grebuffer[sizeof(grehdr_t)])),
-                reinterpret_cast<const void*>(pkt_data), length);
-    ssize_t nSend = sendto(socketfd, &(grebuffer[0]), length + sizeof(grehdr_t), 0, (struct sockaddr*) &remote_addr,
+    const size_t count = _stage_lens.size();
+#ifdef WIN32
+    for (size_t j = 0; j < count; ++j) {
+        if (_balancer != nullptr && _stage_remotes[j] != index) {
+            continue;
+        }
+        const uint32_t keybit = _stage_keybits[j];
+        uint32_t& sequence = _sequences[index][keybit];
+        const uint8_t* data = _stage_data[j] != NULL ? _stage_data[j] : &_stage_buf[_stage_offsets[j]];
+        const size_t header_length = buildHeader(reinterpret_cast<uint8_t*>(&_sendbuffer[0]), keybit, sequence,
+                                                 _stage_ts[j], static_cast<uint32_t>(_stage_lens[j]),
+                                                 _stage_wire_lens[j]);
+        const size_t length = _stage_lens[j] + header_length;
+        std::memcpy(&_sendbuffer[header_length], data, _stage_lens[j]);
+        ssize_t nSend = sendto(socketfd, &_sendbuffer[0], static_cast<int>(length), 0,
+                               (struct sockaddr*) &remote_addr, sizeof(struct sockaddr));
+        while (nSend == -1 && errno == ENOBUFS) {
+            usleep(1000);
+            nSend = sendto(socketfd, &_sendbuffer[0], static_cast<int>(length), 0, (struct sockaddr*) &remote_addr,
                            sizeof(struct sockaddr));
-    while (nSend == -1 && errno == ENOBUFS) {
-        usleep(1000);
-        nSend = static_cast<int>(sendto(socketfd, &(grebuffer[0]), length + sizeof(grehdr_t), 0,
-                                        (struct sockaddr*) &remote_addr,
-                                        sizeof(struct sockaddr)));
-    }
-    if (nSend == -1) {
-        std::cerr << StatisLogContext::getTimeString() << "Send to socket failed, error code is " << errno
-                  << ", error is " << strerror(errno) << "."
-                  << std::endl;
-        return -1;
+        }
+        if (nSend == -1) {
+            std::cerr << StatisLogContext::getTimeString() << "Send to socket failed, error code is " << errno
+                      << ", error is " << strerror(errno) << "."
+                      << std::endl;
+            _stage_failed[j] = 1;
+        } else if (nSend < (ssize_t) length) {
+            std::cerr << StatisLogContext::getTimeString() << "Send socket " << length
+                      << " bytes, but only " << nSend <<
+                      " bytes are sent success." << std::endl;
+            _stage_failed[j] = 1;
+        }
     }
-    if (nSend < (ssize_t) (length + sizeof(grehdr_t))) {
-        std::cerr << StatisLogContext::getTimeString() << "Send socket " << length + sizeof(grehdr_t)
-                  << " bytes, but only " << nSend <<
-                  " bytes are sent success." << std::endl;
-        return 1;
+#else
+    checkMtu(index);
+    // message k carries (a piece of) staged packet _msg_packets[k]
+    size_t messages = 0;
+    for (size_t j = 0; j < count; ++j) {
+        if (_balancer != nullptr && _stage_remotes[j] != index) {
+            continue;
+        }
+        const uint8_t* data = _stage_data[j] != NULL ? _stage_data[j] : &_stage_buf[_stage_offsets[j]];
+        const uint32_t keybit = _stage_keybits[j];
+        const size_t added = appendMessages(index, messages, keybit, _sequences[index][keybit], _stage_ts[j], data,
+                                            static_cast<uint32_t>(_stage_lens[j]), _stage_wire_lens[j], _headers,
+                                            _iovecs);
+        if (_msg_packets.size() < messages + added) {
+            _msg_packets.resize(messages + added);
+            _msg_failed.resize(messages + added);
+        }
+        for (size_t k = messages; k < messages + added; ++k) {
+            _msg_packets[k] = j;
+            _msg_failed[k] = 0;
+        }
+        messages += added;
+    }
+    wireMessages(_msgs, _iovecs, _headers, messages, &remote_addr);
+    sendMessages(socketfd, _msgs.data(), messages, _msg_failed.data());
+    bool failed = false;
+    for (size_t k = 0; k < messages; ++k) {
+        if (_msg_failed[k]) {
+            _stage_failed[_msg_packets[k]] = 1;
+            failed = true;
+        }
+    }
+    if (failed && _oversize[index] != greoversize::fragment) {
+        // the path MTU may have shrunk
+        updateMtu(index);
+    }
+#endif // WIN32
+}
+
+int PcapExportGre::startSenders() {
+#ifdef WIN32
+    std::cerr << StatisLogContext::getTimeString() << "GRE send queues are not supported on Windows." << std::endl;
+    return -1;
+#else
+    _senders_stop = false;
+    for (size_t i = 0; i < _remoteips.size(); ++i) {
+        std::unique_ptr<gre_sender_t> sender(new gre_sender_t());
+        sender->ring.reset(new BoundedRing<gre_send_item_t>(_queue_depth));
+        sender->sleeping = false;
+        sender->queued = 0;
+        sender->sent = 0;
+        sender->queue_drops = 0;
+        sender->send_failed = 0;
+        sender->max_queue_depth = 0;
+        _senders.push_back(std::move(sender));
+    }
+    for (size_t i = 0; i < _senders.size(); ++i) {
+        _senders[i]->thread = std::thread(&PcapExportGre::senderLoop, this, i);
+    }
+    return 0;
+#endif // WIN32
+}
+
+void PcapExportGre::stopSenders() {
+    if (_senders.empty()) {
+        return;
+    }
+    // the threads send what is queued before they quit
+    _senders_stop = true;
+    for (size_t i = 0; i < _senders.size(); ++i) {
+        {
+            std::lock_guard<std::mutex> lock(_senders[i]->lock);
+            _senders[i]->cond.notify_one();
+        }
+        if (_senders[i]->thread.joinable()) {
+            _senders[i]->thread.join();
+        }
+        gre_sender_stats_t stats;
+        getSenderStats(i, stats);
+        std::cout << StatisLogContext::getTimeString() << "GRE remote " << _remoteips[i] << " sent " << stats.sent
+                  << ", queue drops " << stats.queue_drops << ", send failed " << stats.send_failed
+                  << ", max queue depth " << stats.max_queue_depth << "." << std::endl;
+    }
+    _senders.clear();
+    _blocks.clear();
+}
+
+int PcapExportGre::getSenderStats(size_t index, gre_sender_stats_t& stats) const {
+    if (index >= _senders.size()) {
+        return -1;
     }
+    const gre_sender_t& sender = *_senders[index];
+    stats.queued = sender.queued;
+    stats.sent = sender.sent;
+    stats.queue_drops = sender.queue_drops;
+    stats.send_failed = sender.send_failed;
+    stats.queue_depth = sender.ring->size();
+    stats.max_queue_depth = sender.max_queue_depth;
     return 0;
 }
 
+std::shared_ptr<std::vector<uint8_t>> PcapExportGre::acquireBlock(size_t size) {
+    // only this thread hands out references, a block nobody else holds stays free
+    std::shared_ptr<std::vector<uint8_t>> block;
+    for (size_t i = 0; i < _blocks.size(); ++i) {
+        if (_blocks[i].use_count() == 1) {
+            // pairs with the sender threads dropping their references after the send
+            std::atomic_thread_fence(std::memory_order_acquire);
+            block = _blocks[i];
+            break;
+        }
+    }
+    if (block == nullptr) {
+        block = std::make_shared<std::vector<uint8_t>>();
+        if (_blocks.size() < MAX_POOLED_BLOCKS) {
+            _blocks.push_back(block);
+        }
+    }
+    if (block->size() < size) {
+        block->resize(size);
+    }
+    return block;
+}
+
+int PcapExportGre::queueBatch(const PacketBatch& batch) {
+    // one copy of the batch for all remotes, sent after exportBatch returned
+    size_t total = 0;
+    for (size_t j = 0; j < batch.size(); ++j) {
+        total += batch.headers[j].caplen <= 65535 ? batch.headers[j].caplen : 65535;
+    }
+    std::shared_ptr<std::vector<uint8_t>> block = acquireBlock(total);
+    std::vector<uint8_t>& buffer = *block;
+    const uint32_t keybit = _keybit + batch.tag;
+    int failed = static_cast<int>(_late_failed.exchange(0));
+    size_t offset = 0;
+    for (size_t j = 0; j < batch.size(); ++j) {
+        const uint32_t length = batch.headers[j].caplen <= 65535 ? batch.headers[j].caplen : 65535;
+        std::memcpy(&buffer[offset], batch.data[j], length);
+        const size_t picked = _balancer != nullptr ? _balancer->pick(batch.data[j], length) : 0;
+        bool dropped = false;
+        for (size_t i = 0; i < _senders.size(); ++i) {
+            if (_balancer != nullptr && i != picked) {
+                continue;
+            }
+            gre_sender_t& sender = *_senders[i];
+            gre_send_item_t item;
+            item.block = block;
+            item.data = &buffer[offset];
+            item.length = length;
+            item.keybit = keybit;
+            item.wire_length = batch.headers[j].len;
+            item.ts = batch.headers[j].ts;
+            bool queued = true;
+            while (!sender.ring->push(std::move(item))) {
+                if (_queue_full == queuefull::drop_newest) {
+                    sender.queue_drops++;
+                    queued = false;
+                    dropped = true;
+                    break;
+                } else if (_queue_full == queuefull::drop_oldest) {
+                    // the evicted packet was counted as exported by an earlier call
+                    gre_send_item_t oldest;
+                    if (sender.ring->pop(oldest)) {
+                        sender.queue_drops++;
+                        failed++;
+                    }
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+            if (queued) {
+                sender.queued++;
+            }
+            const size_t depth = sender.ring->size();
+            if (depth > sender.max_queue_depth) {
+                sender.max_queue_depth = depth;
+            }
+        }
+        if (dropped) {
+            failed++;
+        }
+        offset += length;
+    }
+    for (size_t i = 0; i < _senders.size(); ++i) {
+        gre_sender_t& sender = *_senders[i];
+        if (sender.sleeping) {
+            std::lock_guard<std::mutex> lock(sender.lock);
+            sender.cond.notify_one();
+        }
+    }
+    return failed;
+}
+
+void PcapExportGre::senderLoop(size_t index) {
+#ifndef WIN32
+    gre_sender_t& sender = *_senders[index];
+    const int socketfd = _socketfds[index];
+    std::vector<gre_send_item_t> items(_send_batch);
+    std::vector<uint8_t> headers(MAX_GRE_HEADER * _send_batch);
+    std::vector<struct mmsghdr> msgs(_send_batch);
+    std::vector<struct iovec> iovecs(2 * _send_batch);
+    // message k carries (a piece of) item msg_items[k]
+    std::vector<size_t> msg_items(_send_batch);
+    std::vector<uint8_t> msg_failed(_send_batch);
+    std::vector<uint8_t> failed(_send_batch);
+    auto& sequences = _sequences[index];
+    for (;;) {
+        size_t count = 0;
+        while (count < _send_batch && sender.ring->pop(items[count])) {
+            count++;
+        }
+        if (count == 0) {
+            if (_senders_stop) {
+                break;
+            }
+            // queueBatch only notifies a sleeping sender, the timeout covers a wake up lost in between
+            std::unique_lock<std::mutex> lock(sender.lock);
+            sender.sleeping = true;
+            if (sender.ring->size() == 0 && !_senders_stop) {
+                sender.cond.wait_for(lock, std::chrono::milliseconds(SENDER_IDLE_WAIT_MS));
+            }
+            sender.sleeping = false;
+            continue;
+        }
+        checkMtu(index);
+        size_t messages = 0;
+        for (size_t j = 0; j < count; ++j) {
+            const size_t added = appendMessages(index, messages, items[j].keybit, sequences[items[j].keybit],
+                                                items[j].ts, items[j].data, items[j].length, items[j].wire_length,
+                                                headers, iovecs);
+            if (msg_items.size() < messages + added) {
+                msg_items.resize(messages + added);
+                msg_failed.resize(messages + added);
+            }
+            for (size_t k = messages; k < messages + added; ++k) {
+                msg_items[k] = j;
+                msg_failed[k] = 0;
+            }
+            messages += added;
+            failed[j] = 0;
+        }
+        wireMessages(msgs, iovecs, headers, messages, &_remote_addrs[index]);
+        sendMessages(socketfd, msgs.data(), messages, msg_failed.data());
+        for (size_t k = 0; k < messages; ++k) {
+            if (msg_failed[k]) {
+                failed[msg_items[k]] = 1;
+            }
+        }
+        const uint64_t failed_count = static_cast<uint64_t>(std::count(failed.begin(), failed.begin() + count, 1));
+        sender.sent += count - failed_count;
+        sender.send_failed += failed_count;
+        _late_failed += failed_count;
+        if (failed_count > 0 && _oversize[index] != greoversize::fragment) {
+            updateMtu(index);
+        }
+        for (size_t j = 0; j < count; ++j) {
+            items[j].block.reset();
+        }
+    }
+#endif // WIN32
+}
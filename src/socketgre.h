@@ -3,14 +3,85 @@
 
 #ifndef WIN32
 	#include <netinet/in.h>
+	#include <sys/socket.h>
 #endif
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 #include "pcapexport.h"
 #include "gredef.h"
+#include "boundedring.h"
 
+// what exportBatch does with a packet when the send queue of a remote is full
+enum class queuefull : uint8_t {
+    drop_newest = 0,
+    drop_oldest = 1,
+    block = 2,
+};
+
+// what the GRE exporter puts in front of the packets: GRE with key (Transparent Ethernet Bridging),
+// or ERSPAN type II / III, which carry a per remote sequence number and the key bit as session id
+enum class greencap : uint8_t {
+    gre = 0,
+    erspan2 = 1,
+    erspan3 = 2,
+};
+
+// what the GRE exporter does with a frame too big for the path MTU of a remote: let the kernel fragment the
+// GRE packet, or send the frame truncated, or split into pieces (gredef.h gresegmenthdr_t); the path MTU is
+// read from the socket of the remote (IP_MTU) and read again every second, and after a failed send
+enum class greoversize : uint8_t {
+    fragment = 0,
+    truncate = 1,
+    split = 2,
+};
 
+typedef struct GreSenderStats {
+    uint64_t queued;
+    uint64_t sent;
+    uint64_t queue_drops;
+    uint64_t send_failed;
+    size_t queue_depth;
+    size_t max_queue_depth;
+} gre_sender_stats_t;
+
+// GRE packets are staged and sent to every remote together, with one sendmmsg call per remote,
+// once send_batch packets are staged or the oldest one waited max_delay microseconds.
+// Every message is two iovecs, the GRE (and ERSPAN) header built for the remote, and the payload where the
+// caller left it; only packets still staged when exportBatch returns are copied.
+// With a send queue (setSendQueue), every remote gets a sender thread instead: exportBatch copies the batch
+// once and queues a descriptor per packet and remote, a congested remote then only stalls its own thread.
 class PcapExportGre : public PcapExportBase {
+protected:
+    // a queued packet, block keeps the copy of its batch alive until every remote sent it
+    typedef struct GreSendItem {
+        std::shared_ptr<std::vector<uint8_t>> block;
+        const uint8_t* data;
+        uint32_t length;
+        uint32_t keybit;
+        uint32_t wire_length;
+        struct timeval ts;
+    } gre_send_item_t;
+
+    typedef struct GreSender {
+        std::unique_ptr<BoundedRing<gre_send_item_t>> ring;
+        std::thread thread;
+        std::mutex lock;
+        std::condition_variable cond;
+        std::atomic<bool> sleeping;
+        std::atomic<uint64_t> queued;
+        std::atomic<uint64_t> sent;
+        std::atomic<uint64_t> queue_drops;
+        std::atomic<uint64_t> send_failed;
+        std::atomic<size_t> max_queue_depth;
+    } gre_sender_t;
+
 protected:
     std::vector<std::string> _remoteips;
     uint32_t _keybit;
@@ -18,11 +89,68 @@ protected:
     int _pmtudisc;
     std::vector<int> _socketfds;
     std::vector<struct sockaddr_in> _remote_addrs;
-	std::vector<std::vector<char>> _grebuffers;
+    greencap _encap;
+    // next sequence number of every remote and key, only touched by the thread sending to the remote
+    std::vector<std::map<uint32_t, uint32_t>> _sequences;
+    // per remote, like the sequence numbers: the oversize policy, the path MTU and when it was read
+    std::vector<greoversize> _oversize;
+    std::vector<size_t> _path_mtus;
+    std::vector<std::chrono::steady_clock::time_point> _mtu_checked;
+    bool _gre_sequence;
+    size_t _send_batch;
+    std::chrono::microseconds _max_delay;
+    // payload of staged packet i: _stage_data[i], or _stage_buf from _stage_offsets[i] once it was copied;
+    // packets of several key tags (interfaces) are staged together, each with its own key
+    std::vector<const uint8_t*> _stage_data;
+    std::vector<size_t> _stage_offsets;
+    std::vector<size_t> _stage_lens;
+    std::vector<uint32_t> _stage_wire_lens;
+    std::vector<struct timeval> _stage_ts;
+    std::vector<uint32_t> _stage_keybits;
+    // the remote picked for every staged packet, when balancing
+    std::vector<size_t> _stage_remotes;
+    std::vector<uint8_t> _stage_failed;
+    std::vector<uint8_t> _stage_buf;
+    size_t _stage_used;
+    size_t _stage_copied;
+    std::chrono::steady_clock::time_point _stage_start;
+#ifdef WIN32
+    std::vector<char> _sendbuffer;
+#else
+    std::vector<struct mmsghdr> _msgs;
+    std::vector<struct iovec> _iovecs;
+    std::vector<uint8_t> _headers;
+    std::vector<size_t> _msg_packets;
+    std::vector<uint8_t> _msg_failed;
+#endif // WIN32
+    size_t _queue_depth;
+    queuefull _queue_full;
+    std::vector<std::unique_ptr<gre_sender_t>> _senders;
+    std::vector<std::shared_ptr<std::vector<uint8_t>>> _blocks;
+    std::atomic<bool> _senders_stop;
+    // packets the sender threads dropped or failed to send, not reported by exportBatch or flushExport yet
+    std::atomic<uint64_t> _late_failed;
 
 private:
 	int initSockets(size_t index, uint32_t keybit);
-    int exportPacket(size_t index, const struct pcap_pkthdr *header, const uint8_t *pkt_data);
+    size_t buildHeader(uint8_t* buffer, uint32_t keybit, uint32_t& sequence, const struct timeval& ts,
+                       uint32_t caplen, uint32_t len);
+#ifndef WIN32
+    void updateMtu(size_t index);
+    void checkMtu(size_t index);
+    size_t appendMessages(size_t index, size_t first, uint32_t keybit, uint32_t& sequence, const struct timeval& ts,
+                          const uint8_t* data, uint32_t caplen, uint32_t len, std::vector<uint8_t>& headers,
+                          std::vector<struct iovec>& iovecs);
+#endif // WIN32
+    void stagePacket(const struct pcap_pkthdr *header, const uint8_t *pkt_data, uint32_t keybit);
+    void copyStaged();
+    void sendStaged(size_t index);
+    int flushStaged();
+    int startSenders();
+    void stopSenders();
+    void senderLoop(size_t index);
+    std::shared_ptr<std::vector<uint8_t>> acquireBlock(size_t size);
+    int queueBatch(const PacketBatch& batch);
 
 public:
     PcapExportGre(const std::vector<std::string>& remoteips, uint32_t keybit, const std::string& bind_device,
@@ -30,7 +158,24 @@ public:
     ~PcapExportGre();
     int initExport();
     int exportPacket(const struct pcap_pkthdr *header, const uint8_t *pkt_data);
+    int exportBatch(const PacketBatch& batch);
+    int flushExport();
     int closeExport();
+    // send_batch 1 sends every packet at once
+    void setSendBatch(size_t send_batch, uint32_t max_delay_us);
+    // queue_depth packets per remote for the sender threads, 0 sends from the calling thread;
+    // call before initExport. Not available on Windows.
+    void setSendQueue(size_t queue_depth, queuefull queue_full);
+    int getSenderStats(size_t index, gre_sender_stats_t& stats) const;
+    // call before initExport
+    void setEncap(greencap encap);
+    // plain GRE packets carry a sequence number per remote and key (S bit), ERSPAN always does
+    void setSequence(bool gre_sequence);
+    // one policy per remote, or one for all of them; truncate and split only work with plain GRE.
+    // Call before initExport. Not available on Windows.
+    void setOversize(const std::vector<greoversize>& oversize);
+    // 0 unless the remote truncates or splits
+    size_t getPathMtu(size_t index) const;
 };
 
 #endif // SRC_SOCKETGRE_H_
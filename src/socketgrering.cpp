@@ -0,0 +1,308 @@
+#include "socketgrering.h"
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <netinet/ip.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "gredef.h"
+#include "scopeguard.h"
+#include "statislog.h"
+
+const int INVALIDE_SOCKET_FD = -1;
+const size_t TX_RING_SIZE = 16 * 1024 * 1024;
+const size_t MIN_TX_FRAMES = 64;
+const int NEIGHBOR_TIMEOUT_MS = 3000;
+const int TX_RING_WAIT_MS = 1000;
+const size_t FRAME_HEADER_LEN = sizeof(struct ethhdr) + sizeof(struct iphdr) + sizeof(grehdr_t);
+// frame data starts right behind the tpacket2_hdr, unless PACKET_TX_HAS_OFF is used
+const size_t TX_DATA_OFFSET = TPACKET2_HDRLEN - sizeof(struct sockaddr_ll);
+
+PcapExportGreRing::PcapExportGreRing(const std::vector<std::string>& remoteips, uint32_t keybit,
+                                     const std::string& bind_device, const int pmtudisc) :
+        _remoteips(remoteips),
+        _keybit(keybit),
+        _bind_device(bind_device),
+        _pmtudisc(pmtudisc),
+        _frame_headers(remoteips.size()),
+        _ip_ids(remoteips.size(), 0),
+        _socketfd(INVALIDE_SOCKET_FD),
+        _ring(NULL),
+        _ring_size(0),
+        _frame_size(0),
+        _frame_count(0),
+        _frame_index(0),
+        _late_failed(0),
+        _oversize_logged(false) {
+    _type = exporttype::gre;
+    std::memset(&_link, 0, sizeof(_link));
+}
+
+PcapExportGreRing::~PcapExportGreRing() {
+    closeExport();
+}
+
+static uint16_t ipChecksum(const uint8_t* data, size_t len) {
+    uint32_t sum = 0;
+    for (size_t i = 0; i + 1 < len; i += 2) {
+        sum += static_cast<uint32_t>(data[i] << 8 | data[i + 1]);
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return htons(static_cast<uint16_t>(~sum));
+}
+
+int PcapExportGreRing::buildFrameHeader(size_t index, const nexthop_t& hop) {
+    std::vector<uint8_t>& frame = _frame_headers[index];
+    frame.assign(FRAME_HEADER_LEN, 0);
+    struct ethhdr* eth = reinterpret_cast<struct ethhdr*>(&frame[0]);
+    std::memcpy(eth->h_dest, hop.mac, ETH_ALEN);
+    std::memcpy(eth->h_source, _link.mac, ETH_ALEN);
+    eth->h_proto = htons(ETH_P_IP);
+
+    struct iphdr* ip = reinterpret_cast<struct iphdr*>(&frame[sizeof(struct ethhdr)]);
+    ip->version = 4;
+    ip->ihl = sizeof(struct iphdr) / 4;
+    ip->ttl = 64;
+    ip->protocol = IPPROTO_GRE;
+    // like a raw socket: DF unless path MTU discovery is turned off
+    ip->frag_off = _pmtudisc == IP_PMTUDISC_DONT ? 0 : htons(IP_DF);
+    ip->saddr = hop.source;
+    ip->daddr = inet_addr(_remoteips[index].c_str());
+    if (ip->saddr == 0) {
+        std::cerr << StatisLogContext::getTimeString() << "No source address for " << _remoteips[index] << " on "
+                  << _bind_device << "." << std::endl;
+        return -1;
+    }
+
+    grehdr_t* gre = reinterpret_cast<grehdr_t*>(&frame[sizeof(struct ethhdr) + sizeof(struct iphdr)]);
+    gre->flags = htons(0x2000);
+    gre->protocol = htons(0x6558);
+    gre->keybit = htonl(_keybit);
+    return 0;
+}
+
+int PcapExportGreRing::setupRing() {
+    int version = TPACKET_V2;
+    if (setsockopt(_socketfd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1) {
+        std::cerr << StatisLogContext::getTimeString() << "Set PACKET_VERSION to TPACKET_V2 failed, error is "
+                  << strerror(errno) << "." << std::endl;
+        return -1;
+    }
+    int bypass = 1;
+    if (setsockopt(_socketfd, SOL_PACKET, PACKET_QDISC_BYPASS, &bypass, sizeof(bypass)) == -1) {
+        std::cerr << StatisLogContext::getTimeString() << "Set PACKET_QDISC_BYPASS failed, error is "
+                  << strerror(errno) << "." << std::endl;
+        return -1;
+    }
+
+    // a frame holds the largest IP packet the link takes; one frame per block keeps the geometry simple
+    const size_t pagesize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    const size_t frame_len = TX_DATA_OFFSET + sizeof(struct ethhdr) + static_cast<size_t>(_link.mtu);
+    _frame_size = pagesize;
+    while (_frame_size < frame_len) {
+        _frame_size <<= 1;
+    }
+    _frame_count = std::max(TX_RING_SIZE / _frame_size, MIN_TX_FRAMES);
+    struct tpacket_req req;
+    std::memset(&req, 0, sizeof(req));
+    req.tp_block_size = static_cast<unsigned int>(_frame_size);
+    req.tp_block_nr = static_cast<unsigned int>(_frame_count);
+    req.tp_frame_size = static_cast<unsigned int>(_frame_size);
+    req.tp_frame_nr = static_cast<unsigned int>(_frame_count);
+    if (setsockopt(_socketfd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) == -1) {
+        std::cerr << StatisLogContext::getTimeString() << "Set PACKET_TX_RING failed, error is "
+                  << strerror(errno) << "." << std::endl;
+        return -1;
+    }
+    _ring_size = _frame_size * _frame_count;
+    void* ring = mmap(NULL, _ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, _socketfd, 0);
+    if (ring == MAP_FAILED) {
+        std::cerr << StatisLogContext::getTimeString() << "Map the tx ring failed, error is "
+                  << strerror(errno) << "." << std::endl;
+        _ring_size = 0;
+        return -1;
+    }
+    _ring = static_cast<uint8_t*>(ring);
+    _frame_index = 0;
+
+    struct sockaddr_ll addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(ETH_P_IP);
+    addr.sll_ifindex = _link.ifindex;
+    if (bind(_socketfd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == -1) {
+        std::cerr << StatisLogContext::getTimeString() << "Bind the tx ring to " << _bind_device
+                  << " failed, error is " << strerror(errno) << "." << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+int PcapExportGreRing::initExport() {
+    if (_socketfd != INVALIDE_SOCKET_FD) {
+        return 0;
+    }
+    if (_bind_device.empty()) {
+        std::cerr << StatisLogContext::getTimeString() << "The GRE tx ring needs a bind device (-B)." << std::endl;
+        return -1;
+    }
+    if (lookupLink(_bind_device, _link) != 0) {
+        return -1;
+    }
+    for (size_t i = 0; i < _remoteips.size(); ++i) {
+        nexthop_t hop;
+        if (resolveNextHop(inet_addr(_remoteips[i].c_str()), _link, hop, NEIGHBOR_TIMEOUT_MS) != 0 ||
+            buildFrameHeader(i, hop) != 0) {
+            std::cerr << "Failed with index: " << i << std::endl;
+            return -1;
+        }
+    }
+    // protocol 0, the socket only sends
+    _socketfd = socket(AF_PACKET, SOCK_RAW, 0);
+    if (_socketfd == INVALIDE_SOCKET_FD) {
+        std::cerr << StatisLogContext::getTimeString() << "Create socket failed, error code is " << errno
+                  << ", error is " << strerror(errno) << "." << std::endl;
+        return -1;
+    }
+    if (setupRing() != 0) {
+        closeExport();
+        return -1;
+    }
+    return 0;
+}
+
+int PcapExportGreRing::closeExport() {
+    if (_socketfd != INVALIDE_SOCKET_FD && _ring != NULL) {
+        kick(true);
+    }
+    if (_ring != NULL) {
+        munmap(_ring, _ring_size);
+        _ring = NULL;
+        _ring_size = 0;
+    }
+    if (_socketfd != INVALIDE_SOCKET_FD) {
+        close(_socketfd);
+        _socketfd = INVALIDE_SOCKET_FD;
+    }
+    return 0;
+}
+
+void PcapExportGreRing::kick(bool wait) {
+    // one send for every frame marked TP_STATUS_SEND_REQUEST; wait returns once they all left the ring
+    if (send(_socketfd, NULL, 0, wait ? 0 : MSG_DONTWAIT) == -1 && errno != EAGAIN && errno != ENOBUFS) {
+        std::cerr << StatisLogContext::getTimeString() << "Send the tx ring failed, error code is " << errno
+                  << ", error is " << strerror(errno) << "." << std::endl;
+    }
+}
+
+uint8_t* PcapExportGreRing::nextFrame() {
+    uint8_t* frame = _ring + _frame_index * _frame_size;
+    struct tpacket2_hdr* hdr = reinterpret_cast<struct tpacket2_hdr*>(frame);
+    uint32_t status = __atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE);
+    if (status == TP_STATUS_SEND_REQUEST || status == TP_STATUS_SENDING) {
+        // the ring is full, let the driver catch up
+        kick(true);
+        struct pollfd pfd;
+        pfd.fd = _socketfd;
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+        status = __atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE);
+        if ((status == TP_STATUS_SEND_REQUEST || status == TP_STATUS_SENDING) && poll(&pfd, 1, TX_RING_WAIT_MS) <= 0) {
+            return NULL;
+        }
+        status = __atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE);
+        if (status == TP_STATUS_SEND_REQUEST || status == TP_STATUS_SENDING) {
+            return NULL;
+        }
+    }
+    if (status == TP_STATUS_WRONG_FORMAT) {
+        // the kernel refused the frame last time round
+        _late_failed++;
+    }
+    _frame_index = (_frame_index + 1) % _frame_count;
+    return frame;
+}
+
+int PcapExportGreRing::writeFrame(size_t index, uint32_t keybit, const struct pcap_pkthdr* header,
+                                  const uint8_t* pkt_data) {
+    const size_t length = header->caplen <= 65535 ? header->caplen : 65535;
+    const size_t ip_len = sizeof(struct iphdr) + sizeof(grehdr_t) + length;
+    if (ip_len > static_cast<size_t>(_link.mtu)) {
+        if (!_oversize_logged) {
+            std::cerr << StatisLogContext::getTimeString() << "GRE packet of " << ip_len << " bytes is larger than "
+                      << "the MTU " << _link.mtu << " of " << _bind_device << ", such packets are dropped."
+                      << std::endl;
+            _oversize_logged = true;
+        }
+        return -1;
+    }
+    uint8_t* frame = nextFrame();
+    if (frame == NULL) {
+        std::cerr << StatisLogContext::getTimeString() << "The tx ring of " << _bind_device << " is stuck."
+                  << std::endl;
+        return -1;
+    }
+    uint8_t* data = frame + TX_DATA_OFFSET;
+    std::memcpy(data, _frame_headers[index].data(), FRAME_HEADER_LEN);
+    struct iphdr* ip = reinterpret_cast<struct iphdr*>(data + sizeof(struct ethhdr));
+    ip->tot_len = htons(static_cast<uint16_t>(ip_len));
+    ip->id = htons(_ip_ids[index]++);
+    ip->check = 0;
+    ip->check = ipChecksum(reinterpret_cast<const uint8_t*>(ip), sizeof(struct iphdr));
+    grehdr_t* gre = reinterpret_cast<grehdr_t*>(data + sizeof(struct ethhdr) + sizeof(struct iphdr));
+    gre->keybit = keybit;
+    std::memcpy(data + FRAME_HEADER_LEN, pkt_data, length);
+
+    struct tpacket2_hdr* hdr = reinterpret_cast<struct tpacket2_hdr*>(frame);
+    hdr->tp_len = static_cast<uint32_t>(FRAME_HEADER_LEN + length);
+    __atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int PcapExportGreRing::exportPacket(const struct pcap_pkthdr* header, const uint8_t* pkt_data) {
+    PacketBatch batch;
+    batch.push_back(*header, pkt_data);
+    return exportBatch(batch) == 0 ? 0 : -1;
+}
+
+int PcapExportGreRing::exportBatch(const PacketBatch& batch) {
+    // a packet counts as failed when any remote failed, frames refused by the kernel are counted
+    // when their slot comes round again
+    if (_ring == NULL) {
+        return static_cast<int>(batch.size());
+    }
+    const uint32_t keybit = htonl(_keybit + batch.tag);
+    int failed = 0;
+    for (size_t j = 0; j < batch.size(); ++j) {
+        bool ok = true;
+        const size_t picked = _balancer != nullptr ? _balancer->pick(batch.data[j], batch.headers[j].caplen) : 0;
+        for (size_t i = 0; i < _remoteips.size(); ++i) {
+            if (_balancer != nullptr && i != picked) {
+                continue;
+            }
+            if (writeFrame(i, keybit, &batch.headers[j], batch.data[j]) != 0) {
+                ok = false;
+            }
+        }
+        if (!ok) {
+            failed++;
+        }
+    }
+    kick(false);
+    failed += static_cast<int>(_late_failed);
+    _late_failed = 0;
+    return failed;
+}
+
+int PcapExportGreRing::flushExport() {
+    int failed = static_cast<int>(_late_failed);
+    _late_failed = 0;
+    return failed;
+}
@@ -0,0 +1,49 @@
+#ifndef SRC_SOCKETGRERING_H_
+#define SRC_SOCKETGRERING_H_
+
+#include <string>
+#include <vector>
+#include "pcapexport.h"
+#include "nexthop.h"
+
+// GRE export which skips the IP stack: complete Ethernet/IPv4/GRE frames are written into an AF_PACKET
+// TPACKET_V2 TX_RING on the bind device, bypassing the qdisc, and every batch is handed to the driver with
+// one send() kick. The next hop MAC of every remote is resolved once in initExport.
+class PcapExportGreRing : public PcapExportBase {
+protected:
+    std::vector<std::string> _remoteips;
+    uint32_t _keybit;
+    std::string _bind_device;
+    int _pmtudisc;
+    linkinfo_t _link;
+    // Ethernet, IPv4 and GRE headers of every remote, only lengths, id, checksum and key change per packet
+    std::vector<std::vector<uint8_t>> _frame_headers;
+    std::vector<uint16_t> _ip_ids;
+    int _socketfd;
+    uint8_t* _ring;
+    size_t _ring_size;
+    size_t _frame_size;
+    size_t _frame_count;
+    size_t _frame_index;
+    uint64_t _late_failed;
+    bool _oversize_logged;
+
+private:
+    int buildFrameHeader(size_t index, const nexthop_t& hop);
+    int setupRing();
+    uint8_t* nextFrame();
+    int writeFrame(size_t index, uint32_t keybit, const struct pcap_pkthdr* header, const uint8_t* pkt_data);
+    void kick(bool wait);
+
+public:
+    PcapExportGreRing(const std::vector<std::string>& remoteips, uint32_t keybit, const std::string& bind_device,
+                      const int pmtudisc);
+    ~PcapExportGreRing();
+    int initExport();
+    int exportPacket(const struct pcap_pkthdr* header, const uint8_t* pkt_data);
+    int exportBatch(const PacketBatch& batch);
+    int flushExport();
+    int closeExport();
+};
+
+#endif // SRC_SOCKETGRERING_H_
@@ -0,0 +1,289 @@
+#include "socketvxlan.h"
+
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+#include <arpa/inet.h>
+#include <netinet/udp.h>
+#include <unistd.h>
+#include "flowhash.h"
+#include "statislog.h"
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+const int INVALIDE_SOCKET_FD = -1;
+// source ports, and sockets, the flows are spread over
+const size_t VXLAN_SOURCE_PORTS = 32;
+// UDP_MAX_SEGMENTS of older kernels
+const size_t MAX_GSO_SEGMENTS = 64;
+// largest UDP payload of an IPv4 datagram, also the limit for a whole GSO train
+const size_t MAX_UDP_PAYLOAD = 65507;
+
+PcapExportVxlan::PcapExportVxlan(const std::vector<std::string>& remoteips, uint32_t keybit,
+                                 const std::string& bind_device, const int pmtudisc) :
+        _remoteips(remoteips),
+        _keybit(keybit),
+        _bind_device(bind_device),
+        _pmtudisc(pmtudisc),
+        _remote_addrs(remoteips.size()),
+        _socketfds(VXLAN_SOURCE_PORTS, INVALIDE_SOCKET_FD),
+        _gso(false),
+        _vni_tag(0),
+        _runs(VXLAN_SOURCE_PORTS),
+        _msgs(MAX_GSO_SEGMENTS),
+        _gso_limit(MAX_UDP_PAYLOAD + 1) {
+    _type = exporttype::vxlan;
+    _vxlanhdr.flags = htonl(VXLAN_FLAG_VNI);
+    _vxlanhdr.vni = htonl((keybit & 0xffffff) << 8);
+    for (size_t i = 0; i < _runs.size(); ++i) {
+        _runs[i].iovecs.reserve(2 * MAX_GSO_SEGMENTS);
+        _runs[i].packets.reserve(MAX_GSO_SEGMENTS);
+    }
+    for (size_t i = 0; i < remoteips.size(); ++i) {
+        std::memset(&_remote_addrs[i], 0, sizeof(_remote_addrs[i]));
+        _remote_addrs[i].sin_family = AF_INET;
+        _remote_addrs[i].sin_port = htons(VXLAN_PORT);
+        _remote_addrs[i].sin_addr.s_addr = inet_addr(remoteips[i].c_str());
+    }
+}
+
+PcapExportVxlan::~PcapExportVxlan() {
+    closeExport();
+}
+
+int PcapExportVxlan::initSocket(int& socketfd) {
+    if ((socketfd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == INVALIDE_SOCKET_FD) {
+        std::cerr << StatisLogContext::getTimeString() << "Create socket failed, error code is " << errno
+                  << ", error is " << strerror(errno) << "."
+                  << std::endl;
+        return -1;
+    }
+    if (_bind_device.length() > 0) {
+        if (setsockopt(socketfd, SOL_SOCKET, SO_BINDTODEVICE, _bind_device.c_str(), _bind_device.length()) < 0) {
+            std::cerr << StatisLogContext::getTimeString() << "SO_BINDTODEVICE failed, error code is " << errno
+                      << ", error is " << strerror(errno) << "."
+                      << std::endl;
+            return -1;
+        }
+    }
+    if (_pmtudisc >= 0) {
+        if (setsockopt(socketfd, SOL_IP, IP_MTU_DISCOVER, &_pmtudisc, sizeof(_pmtudisc)) == -1) {
+            std::cerr << StatisLogContext::getTimeString() << "IP_MTU_DISCOVER failed, error code is " << errno
+                      << ", error is " << strerror(errno) << "."
+                      << std::endl;
+            return -1;
+        }
+    }
+    // the kernel picks a free source port
+    struct sockaddr_in local;
+    std::memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(socketfd, reinterpret_cast<struct sockaddr*>(&local), sizeof(local)) == -1) {
+        std::cerr << StatisLogContext::getTimeString() << "Bind socket failed, error code is " << errno
+                  << ", error is " << strerror(errno) << "."
+                  << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+int PcapExportVxlan::initExport() {
+    for (size_t i = 0; i < _socketfds.size(); ++i) {
+        if (_socketfds[i] == INVALIDE_SOCKET_FD && initSocket(_socketfds[i]) != 0) {
+            return -1;
+        }
+    }
+    // a gso size of 0 changes nothing, it only tells whether the kernel knows UDP_SEGMENT
+    int segment = 0;
+    _gso = setsockopt(_socketfds[0], SOL_UDP, UDP_SEGMENT, &segment, sizeof(segment)) == 0;
+    if (!_gso) {
+        std::cout << StatisLogContext::getTimeString() << "UDP_SEGMENT is not supported, VXLAN datagrams are "
+                  << "sent one by one." << std::endl;
+    }
+    return 0;
+}
+
+int PcapExportVxlan::closeExport() {
+    for (size_t i = 0; i < _socketfds.size(); ++i) {
+        if (_socketfds[i] != INVALIDE_SOCKET_FD) {
+            close(_socketfds[i]);
+            _socketfds[i] = INVALIDE_SOCKET_FD;
+        }
+    }
+    return 0;
+}
+
+bool PcapExportVxlan::hasGso() const {
+    return _gso;
+}
+
+void PcapExportVxlan::setVniTag(uint32_t tag) {
+    if (tag == _vni_tag) {
+        return;
+    }
+    _vxlanhdr.vni = htonl(((_keybit + tag) & 0xffffff) << 8);
+    _vni_tag = tag;
+}
+
+int PcapExportVxlan::exportPacket(const struct pcap_pkthdr* header, const uint8_t* pkt_data) {
+    PacketBatch batch;
+    batch.push_back(*header, pkt_data);
+    return exportBatch(batch) > 0 ? -1 : 0;
+}
+
+int PcapExportVxlan::exportBatch(const PacketBatch& batch) {
+    setVniTag(batch.tag);
+    _flow_sockets.resize(batch.size());
+    _flow_remotes.resize(batch.size());
+    _failed.assign(batch.size(), 0);
+    for (size_t i = 0; i < batch.size(); ++i) {
+        const uint32_t hash = flowHash(batch.data[i], batch.headers[i].caplen);
+        _flow_sockets[i] = hash % _socketfds.size();
+        _flow_remotes[i] = _balancer != nullptr ? _balancer->pickHash(hash) : 0;
+    }
+    for (size_t index = 0; index < _remoteips.size(); ++index) {
+        for (size_t i = 0; i < batch.size(); ++i) {
+            if (_balancer != nullptr && _flow_remotes[i] != index) {
+                continue;
+            }
+            appendRun(index, _flow_sockets[i], i, &batch.headers[i], batch.data[i]);
+        }
+        for (size_t socket = 0; socket < _runs.size(); ++socket) {
+            sendRun(index, socket);
+        }
+    }
+    int failed = 0;
+    for (size_t i = 0; i < _failed.size(); ++i) {
+        failed += _failed[i];
+    }
+    return failed;
+}
+
+void PcapExportVxlan::appendRun(size_t index, size_t socket, size_t packet, const struct pcap_pkthdr* header,
+                                const uint8_t* pkt_data) {
+    auto& run = _runs[socket];
+    const size_t length = sizeof(vxlanhdr_t) + header->caplen;
+    if (length > MAX_UDP_PAYLOAD) {
+        _failed[packet] = 1;
+        return;
+    }
+    // a GSO train is equal segments, only the last one may be shorter
+    if (!run.packets.empty() && (run.closed || length > run.segment || run.packets.size() >= MAX_GSO_SEGMENTS ||
+                                 run.bytes + length > MAX_UDP_PAYLOAD)) {
+        sendRun(index, socket);
+    }
+    if (run.packets.empty()) {
+        run.segment = length;
+        run.bytes = 0;
+        run.closed = false;
+    } else if (length < run.segment) {
+        run.closed = true;
+    }
+    struct iovec iov;
+    iov.iov_base = &_vxlanhdr;
+    iov.iov_len = sizeof(vxlanhdr_t);
+    run.iovecs.push_back(iov);
+    iov.iov_base = const_cast<uint8_t*>(pkt_data);
+    iov.iov_len = header->caplen;
+    run.iovecs.push_back(iov);
+    run.packets.push_back(packet);
+    run.bytes += length;
+}
+
+void PcapExportVxlan::sendRun(size_t index, size_t socket) {
+    auto& run = _runs[socket];
+    if (run.packets.empty()) {
+        return;
+    }
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &_remote_addrs[index];
+    msg.msg_namelen = sizeof(_remote_addrs[index]);
+    if (!_gso || run.packets.size() == 1 || run.segment >= _gso_limit ||
+        !sendTrain(_socketfds[socket], &msg, run)) {
+        sendDatagrams(_socketfds[socket], &msg, run);
+    }
+    run.iovecs.clear();
+    run.packets.clear();
+}
+
+// sends the whole run with one sendmsg; returns false when the kernel refused the train, the datagrams
+// then still have to be sent
+bool PcapExportVxlan::sendTrain(int socketfd, struct msghdr* msg, vxlan_run_t& run) {
+    char control[CMSG_SPACE(sizeof(uint16_t))];
+    std::memset(control, 0, sizeof(control));
+    msg->msg_iov = run.iovecs.data();
+    msg->msg_iovlen = run.iovecs.size();
+    msg->msg_control = control;
+    msg->msg_controllen = sizeof(control);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(msg);
+    cmsg->cmsg_level = SOL_UDP;
+    cmsg->cmsg_type = UDP_SEGMENT;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    const uint16_t segment = static_cast<uint16_t>(run.segment);
+    std::memcpy(CMSG_DATA(cmsg), &segment, sizeof(segment));
+
+    ssize_t nSend;
+    while ((nSend = sendmsg(socketfd, msg, 0)) == -1 && errno == ENOBUFS) {
+        usleep(1000);
+    }
+    msg->msg_control = NULL;
+    msg->msg_controllen = 0;
+    if (nSend == -1 && (errno == EINVAL || errno == EMSGSIZE)) {
+        // segments above the path MTU can't be trained
+        _gso_limit = run.segment;
+        return false;
+    }
+    if (nSend == -1) {
+        std::cerr << StatisLogContext::getTimeString() << "Send to socket failed, error code is " << errno
+                  << ", error is " << strerror(errno) << "."
+                  << std::endl;
+    } else if (static_cast<size_t>(nSend) < run.bytes) {
+        std::cerr << StatisLogContext::getTimeString() << "Send socket " << run.bytes
+                  << " bytes, but only " << nSend << " bytes are sent success." << std::endl;
+    }
+    if (nSend == -1 || static_cast<size_t>(nSend) < run.bytes) {
+        for (size_t i = 0; i < run.packets.size(); ++i) {
+            _failed[run.packets[i]] = 1;
+        }
+    }
+    return true;
+}
+
+// one message per datagram, sendmmsg stops at the first message which fails, that one is dropped
+void PcapExportVxlan::sendDatagrams(int socketfd, struct msghdr* msg, vxlan_run_t& run) {
+    const size_t count = run.packets.size();
+    for (size_t i = 0; i < count; ++i) {
+        _msgs[i].msg_hdr = *msg;
+        _msgs[i].msg_hdr.msg_iov = &run.iovecs[2 * i];
+        _msgs[i].msg_hdr.msg_iovlen = 2;
+        _msgs[i].msg_len = 0;
+    }
+    size_t sent = 0;
+    while (sent < count) {
+        int nSend = sendmmsg(socketfd, &_msgs[sent], static_cast<unsigned int>(count - sent), 0);
+        if (nSend == -1 && errno == ENOBUFS) {
+            usleep(1000);
+            continue;
+        }
+        if (nSend == -1) {
+            std::cerr << StatisLogContext::getTimeString() << "Send to socket failed, error code is " << errno
+                      << ", error is " << strerror(errno) << "."
+                      << std::endl;
+            _failed[run.packets[sent]] = 1;
+            sent++;
+            continue;
+        }
+        for (int j = 0; j < nSend; ++j, ++sent) {
+            const size_t length = sizeof(vxlanhdr_t) + run.iovecs[2 * sent + 1].iov_len;
+            if (_msgs[sent].msg_len < length) {
+                std::cerr << StatisLogContext::getTimeString() << "Send socket " << length
+                          << " bytes, but only " << _msgs[sent].msg_len << " bytes are sent success." << std::endl;
+                _failed[run.packets[sent]] = 1;
+            }
+        }
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef SRC_SOCKETVXLAN_H_
+#define SRC_SOCKETVXLAN_H_
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <string>
+#include <vector>
+#include "pcapexport.h"
+#include "vxlandef.h"
+
+// VXLAN export: every packet goes out as a UDP datagram to port 4789 of every remote, the VNI is the key bit.
+// The source port comes from a hash of the inner flow, so collectors spreading VXLAN by UDP ports over their
+// cores keep every flow on one core; each source port is a socket of its own.
+// Consecutive datagrams of one source port with the same length are sent with one sendmsg call as a UDP GSO
+// train (UDP_SEGMENT), the kernel or the NIC cuts it into datagrams.
+class PcapExportVxlan : public PcapExportBase {
+protected:
+    // datagrams waiting to be sent as one GSO train, all but the last one are segment bytes long
+    typedef struct VxlanRun {
+        std::vector<struct iovec> iovecs;
+        std::vector<size_t> packets;
+        size_t segment;
+        size_t bytes;
+        bool closed;
+    } vxlan_run_t;
+
+protected:
+    std::vector<std::string> _remoteips;
+    uint32_t _keybit;
+    std::string _bind_device;
+    int _pmtudisc;
+    std::vector<struct sockaddr_in> _remote_addrs;
+    std::vector<int> _socketfds;
+    bool _gso;
+    vxlanhdr_t _vxlanhdr;
+    uint32_t _vni_tag;
+    std::vector<size_t> _flow_sockets;
+    std::vector<size_t> _flow_remotes;
+    std::vector<uint8_t> _failed;
+    std::vector<vxlan_run_t> _runs;
+    std::vector<struct mmsghdr> _msgs;
+    // the smallest segment the kernel refused to send as a GSO train, larger ones go out one by one
+    size_t _gso_limit;
+
+private:
+    int initSocket(int& socketfd);
+    void setVniTag(uint32_t tag);
+    void appendRun(size_t index, size_t socket, size_t packet, const struct pcap_pkthdr* header,
+                   const uint8_t* pkt_data);
+    void sendRun(size_t index, size_t socket);
+    bool sendTrain(int socketfd, struct msghdr* msg, vxlan_run_t& run);
+    void sendDatagrams(int socketfd, struct msghdr* msg, vxlan_run_t& run);
+
+public:
+    PcapExportVxlan(const std::vector<std::string>& remoteips, uint32_t keybit, const std::string& bind_device,
+                    const int pmtudisc);
+    ~PcapExportVxlan();
+    int initExport();
+    int exportPacket(const struct pcap_pkthdr* header, const uint8_t* pkt_data);
+    int exportBatch(const PacketBatch& batch);
+    int closeExport();
+    // whether the kernel accepted UDP_SEGMENT, without it every datagram is sent on its own
+    bool hasGso() const;
+};
+
+#endif // SRC_SOCKETVXLAN_H_
@@ -1,6 +1,7 @@
 #include "socketzmq.h"
 
 #include <iostream>
+#include <algorithm>
 #include <cstring>
 #ifdef WIN32
 	#include <WinSock2.h>
@@ -11,11 +12,46 @@
 	#define IPPROTO_GRE 47
 #else
 #include <arpa/inet.h>
+#include <endian.h>
 #include <unistd.h>
 #endif
 #include <pcap/pcap.h>
 #include "statislog.h"
+#include "agent_status.h"
 
+const int SENDER_IDLE_WAIT_MS = 1;
+// full batches waiting for the sender thread, per remote
+const size_t SEND_QUEUE_DEPTH = 8;
+// a batch of one packet of the largest length, which may exceed the batch size limit
+const size_t MAX_SINGLE_PACKET_BATCH = sizeof(batch_pkts_hdr_t) + sizeof(uint16_t) + sizeof(pmr_pkthdr_t) + 65535;
+
+ZmqBufferPool::ZmqBufferPool(size_t buffer_size, size_t max_free) :
+        _buffer_size(buffer_size),
+        _free(max_free) {
+}
+
+ZmqBufferPool::~ZmqBufferPool() {
+    char* buffer;
+    while (_free.pop(buffer)) {
+        delete[] buffer;
+    }
+}
+
+char* ZmqBufferPool::acquire() {
+    char* buffer;
+    if (_free.pop(buffer)) {
+        return buffer;
+    }
+    return new char[_buffer_size];
+}
+
+void ZmqBufferPool::release(void* data, void* hint) {
+    ZmqBufferPool* pool = static_cast<ZmqBufferPool*>(hint);
+    char* buffer = static_cast<char*>(data);
+    if (!pool->_free.push(std::move(buffer))) {
+        delete[] buffer;
+    }
+}
 
 PcapExportZMQ::PcapExportZMQ(const std::vector<std::string>& remoteips, int zmq_port, int zmq_hwm, uint32_t keybit,
                              const std::string& bind_device, const int send_buf_size) :
@@ -25,18 +61,36 @@ PcapExportZMQ::PcapExportZMQ(const std::vector<std::string>& remoteips, int zmq_
         _keybit(keybit),
         _bind_device(bind_device),
         _send_buf_size(send_buf_size),
-        _pkts_bufs(remoteips.size()) {
+        _chunk_seqs(remoteips.size(), 0),
+        _chunk_id(0),
+        _chunk_count(0),
+        _max_batch_age(1000),
+        _max_batch_bytes(MAX_BATCH_BUF_LENGTH),
+        _codec(PKTMINERG_BATCH_CODEC_NONE),
+        _codec_level(0),
+        _retry_budget(0),
+        _sender_sleeping(false),
+        _sender_stop(false),
+        _retry_queues(remoteips.size()),
+        _retry_bytes(remoteips.size(), 0),
+        _retry_queued(0),
+        _retry_retried(0),
+        _retry_dropped(0),
+        _retry_queue_bytes(0),
+        _spool_max_bytes(0),
+        _spool_rate(0),
+        _spooled(0),
+        _spool_bytes(0),
+        _spool_replayed(0),
+        _late_dropped(0) {
     _type = exporttype::zmq;
-    for (size_t i = 0; i < remoteips.size(); ++i) {
-        _pkts_bufs[i].buf.resize(MAX_BATCH_BUF_LENGTH, '\0');
-        _pkts_bufs[i].batch_bufpos = sizeof(batch_pkts_hdr_t);
-        _pkts_bufs[i].batch_hdr = { htons(BatchPktsBuf::BATCH_PKTS_VERSION), 0, htonl(keybit) };
-        _pkts_bufs[i].first_pktsec = 0;
-   }
 }
 
 PcapExportZMQ::~PcapExportZMQ() {
     closeExport();
+    for (size_t i = 0; i < _pkts_bufs.size(); ++i) {
+        ZmqBufferPool::release(_pkts_bufs[i].buf, _pool.get());
+    }
 }
 
 int PcapExportZMQ::initSockets(size_t index, uint32_t keybit) {
@@ -56,6 +110,13 @@ int PcapExportZMQ::initSockets(size_t index, uint32_t keybit) {
 }
 
 int PcapExportZMQ::initExport() {
+    // zmq holds on to every buffer of a queued batch, so they are only as large as a batch can get; every remote
+    // queues up to zmq_hwm batches, and fills one more, with a sender thread more wait for it
+    _pool.reset(new ZmqBufferPool(std::max(static_cast<size_t>(_max_batch_bytes), MAX_SINGLE_PACKET_BATCH),
+                                  _remoteips.size() * (static_cast<size_t>(_zmq_hwm) + 2 + SEND_QUEUE_DEPTH)));
+    for (size_t i = 0; i < _remoteips.size(); ++i) {
+        batchSlot(i, 0);
+    }
     for (size_t i = 0; i < _remoteips.size(); ++i) {
         int ret = initSockets(i, _keybit);
         if (ret != 0) {
@@ -63,13 +124,37 @@ int PcapExportZMQ::initExport() {
             return ret;
         }
     }
+    if (!_spool_dir.empty()) {
+        for (size_t i = 0; i < _remoteips.size(); ++i) {
+            std::unique_ptr<ZmqSpool> spool(new ZmqSpool(_spool_dir, _remoteips[i] + "-" + std::to_string(_zmq_port),
+                                                         _spool_max_bytes));
+            if (spool->open() != 0) {
+                _spools.clear();
+                return -1;
+            }
+            _spool_bytes += spool->bytes();
+            _spools.push_back(std::move(spool));
+        }
+        _spool_tokens.assign(_remoteips.size(), 0);
+        _spool_refill.assign(_remoteips.size(), std::chrono::steady_clock::now());
+    }
+    if (_codec != PKTMINERG_BATCH_CODEC_NONE || _retry_budget > 0 || !_spools.empty()) {
+        _jobs.reset(new BoundedRing<zmq_send_job_t>(_remoteips.size() * SEND_QUEUE_DEPTH));
+        _sender_stop = false;
+        _sender = std::thread(&PcapExportZMQ::senderLoop, this);
+    }
     return 0;
 }
 
 int PcapExportZMQ::closeExport() {
-    for (size_t i = 0; i < _zmq_sockets.size(); ++i) {
-        flushBatchBuf(i);
+    for (size_t i = 0; i < _pkts_bufs.size() && !_zmq_sockets.empty(); ++i) {
+        // every remote gets a last batch of the first tag, also an empty one, as it always did
+        if (i < _remoteips.size() || _pkts_bufs[i].batch_hdr.pkts_num > 0) {
+            // the send queue holds a few batches per remote, with many interface tags there are more last batches
+            flushBatchBuf(i, true);
+        }
     }
+    stopSender();
     _zmq_sockets.clear();
     _zmq_contexts.clear();
     return 0;
@@ -77,6 +162,10 @@ int PcapExportZMQ::closeExport() {
 
 
 int PcapExportZMQ::exportPacket(const struct pcap_pkthdr* header, const uint8_t* pkt_data) {
+    // the slots of the first tag are slot 0 to remotes - 1
+    if (_balancer != nullptr) {
+        return exportPacket(_balancer->pick(pkt_data, header->caplen), header, pkt_data);
+    }
     int ret = 0;
     for (size_t i = 0; i < _remoteips.size(); ++i) {
         ret += exportPacket(i, header, pkt_data);
@@ -84,31 +173,372 @@ int PcapExportZMQ::exportPacket(const struct pcap_pkthdr* header, const uint8_t*
     return ret;
 }
 
+void PcapExportZMQ::setBatchLimits(uint32_t max_age_ms, uint32_t max_bytes) {
+    _max_batch_age = std::chrono::milliseconds(max_age_ms);
+    // std::min takes a reference, the copy keeps the class constant from needing a definition in c++11
+    const uint32_t max_length = MAX_BATCH_BUF_LENGTH;
+    _max_batch_bytes = std::min(std::max(max_bytes, static_cast<uint32_t>(sizeof(batch_pkts_hdr_t))), max_length);
+}
 
-int PcapExportZMQ::flushBatchBuf(size_t index) {
-    auto& pkts_buf = _pkts_bufs[index];
-    auto& socket = _zmq_sockets[index];
-    auto& buf = pkts_buf.buf;
+int PcapExportZMQ::setCompression(uint8_t codec, int level) {
+    if (!BatchCompressor::available(codec)) {
+        std::cerr << StatisLogContext::getTimeString() << "Batch codec " << static_cast<int>(codec)
+                  << " is not supported by this build." << std::endl;
+        return -1;
+    }
+    _codec = codec;
+    _codec_level = level;
+    return 0;
+}
 
-    int drop_pkts_num = pkts_buf.batch_hdr.pkts_num;
+void PcapExportZMQ::setRetryBudget(size_t budget) {
+    _retry_budget = budget;
+}
+
+void PcapExportZMQ::getRetryStats(zmq_retry_stats_t& stats) const {
+    stats.queued = _retry_queued;
+    stats.retried = _retry_retried;
+    stats.dropped = _retry_dropped;
+    stats.queue_bytes = _retry_queue_bytes;
+    stats.spooled = _spooled;
+    stats.spool_bytes = _spool_bytes;
+    stats.replayed = _spool_replayed;
+}
+
+void PcapExportZMQ::setSpool(const std::string& dir, size_t max_bytes, double mbps) {
+    _spool_dir = dir;
+    _spool_max_bytes = max_bytes;
+    _spool_rate = mbps * 1000000 / 8;
+}
+
+void PcapExportZMQ::setChunk(uint16_t chunk_id, uint16_t chunk_count) {
+    _chunk_id = chunk_id;
+    _chunk_count = chunk_count;
+}
+
+size_t PcapExportZMQ::batchSlot(size_t index, uint32_t tag) {
+    const size_t slot = static_cast<size_t>(tag) * _remoteips.size() + index;
+    while (_pkts_bufs.size() <= slot) {
+        // the first batch of a tag opens the slots of all remotes
+        BatchPktsBuf pkts_buf;
+        const uint32_t keybit = _keybit + static_cast<uint32_t>(_pkts_bufs.size() / _remoteips.size());
+        pkts_buf.buf = _pool->acquire();
+        pkts_buf.batch_bufpos = sizeof(batch_pkts_hdr_t);
+        pkts_buf.batch_hdr = { htons(BatchPktsBuf::BATCH_PKTS_VERSION), 0, htonl(keybit) };
+        pkts_buf.first_pkt_ts.tv_sec = 0;
+        pkts_buf.first_pkt_ts.tv_usec = 0;
+        _pkts_bufs.push_back(pkts_buf);
+    }
+    return slot;
+}
+
+int PcapExportZMQ::exportBatch(const PacketBatch& batch) {
+    int ret = 0;
+    if (_balancer != nullptr) {
+        for (size_t j = 0; j < batch.size(); ++j) {
+            ret += exportPacket(batchSlot(_balancer->pick(batch.data[j], batch.headers[j].caplen), batch.tag),
+                                &batch.headers[j], batch.data[j]);
+        }
+    } else {
+        for (size_t i = 0; i < _remoteips.size(); ++i) {
+            const size_t slot = batchSlot(i, batch.tag);
+            for (size_t j = 0; j < batch.size(); ++j) {
+                ret += exportPacket(slot, &batch.headers[j], batch.data[j]);
+            }
+        }
+    }
+    // a balanced remote which got none of these packets still sends its batch in time
+    return ret + flushAged();
+}
+
+
+int PcapExportZMQ::flushBatchBuf(size_t slot, bool wait) {
+    auto& pkts_buf = _pkts_bufs[slot];
+    const size_t index = slot % _remoteips.size();
+    char* buf = pkts_buf.buf;
+
+    const uint16_t pkts_num = pkts_buf.batch_hdr.pkts_num;
     pkts_buf.batch_hdr.pkts_num = htons(pkts_buf.batch_hdr.pkts_num);
     std::memcpy(reinterpret_cast<void*>(&(buf[0])), &pkts_buf.batch_hdr, sizeof(pkts_buf.batch_hdr));
+    // the batch leaves with its buffer, the next one goes to a fresh one
+    pkts_buf.buf = _pool->acquire();
 
-    auto ret = socket.send(zmq::buffer(&buf[0], pkts_buf.batch_bufpos), zmq::send_flags::dontwait);
-    if (ret.has_value()) {
-        drop_pkts_num = 0;
+    if (_jobs != nullptr) {
+        zmq_send_job_t job = { index, buf, pkts_buf.batch_bufpos, pkts_num, _chunk_seqs[index] };
+        bool queued = _jobs->push(std::move(job));
+        while (!queued && wait && _sender.joinable()) {
+            // a failed push leaves the job as it was, the sender thread makes room
+            usleep(1000);
+            queued = _jobs->push(std::move(job));
+        }
+        if (!queued) {
+            // the sender thread falls behind, drop like a full zmq queue does
+            ZmqBufferPool::release(buf, _pool.get());
+            dropBatches(1, 0);
+            return pkts_num;
+        }
+        _chunk_seqs[index]++;
+        if (_sender_sleeping) {
+            std::lock_guard<std::mutex> lock(_sender_lock);
+            _sender_cond.notify_one();
+        }
+        return 0;
+    }
+    // zmq takes the buffer without a copy and hands it back to the pool, also when the send fails
+    zmq::message_t msg(buf, pkts_buf.batch_bufpos, &ZmqBufferPool::release, _pool.get());
+    if (sendBatch(index, msg, _chunk_seqs[index])) {
+        _chunk_seqs[index]++;
+        return 0;
+    }
+    dropBatches(1, 0);
+    return pkts_num;
+}
+
+bool PcapExportZMQ::sendBatch(size_t index, zmq::message_t& msg, uint64_t chunk_seq) {
+    auto& socket = _zmq_sockets[index];
+    if (_chunk_count > 0) {
+        // both frames are queued or none: zmq only checks the high watermark on the first frame
+        batch_chunk_hdr_t chunk_hdr = { htons(BatchPktsBuf::BATCH_CHUNK_MAGIC), htons(_chunk_id),
+                                        htons(_chunk_count), 0, htobe64(chunk_seq) };
+        auto chunk_ret = socket.send(zmq::buffer(&chunk_hdr, sizeof(chunk_hdr)),
+                                     zmq::send_flags::sndmore | zmq::send_flags::dontwait);
+        if (!chunk_ret.has_value()) {
+            return false;
+        }
+    }
+    // a message zmq did not take stays with the caller
+    return socket.send(msg, zmq::send_flags::dontwait).has_value();
+}
+
+zmq::message_t PcapExportZMQ::packBatch(BatchCompressor& compressor, const zmq_send_job_t& job) {
+    if (_codec == PKTMINERG_BATCH_CODEC_NONE) {
+        return zmq::message_t(job.buf, job.length, &ZmqBufferPool::release, _pool.get());
+    }
+    const size_t header_length = sizeof(batch_pkts_hdr_v2_t);
+    const batch_pkts_hdr_t* raw_hdr = reinterpret_cast<const batch_pkts_hdr_t*>(job.buf);
+    const uint32_t raw_length = job.length - static_cast<uint32_t>(sizeof(batch_pkts_hdr_t));
+    char* out = _pool->acquire();
+    const size_t length = compressor.compress(job.buf + sizeof(batch_pkts_hdr_t), raw_length,
+                                              out + header_length, _pool->bufferSize() - header_length);
+    if (length == 0 || length >= raw_length) {
+        // a batch which does not shrink goes out as it is, in version 1
+        ZmqBufferPool::release(out, _pool.get());
+        return zmq::message_t(job.buf, job.length, &ZmqBufferPool::release, _pool.get());
+    }
+    batch_pkts_hdr_v2_t hdr = { htons(BatchPktsBuf::BATCH_PKTS_VERSION_COMPRESSED), raw_hdr->pkts_num,
+                                raw_hdr->keybit, _codec, { 0, 0, 0 }, htonl(raw_length) };
+    std::memcpy(out, &hdr, sizeof(hdr));
+    ZmqBufferPool::release(job.buf, _pool.get());
+    return zmq::message_t(out, header_length + length, &ZmqBufferPool::release, _pool.get());
+}
+
+void PcapExportZMQ::deliverBatch(size_t index, zmq::message_t& msg, uint16_t pkts_num, uint64_t chunk_seq) {
+    // a batch does not overtake the older ones waiting for a retry; the spooled ones only go out at the spool rate,
+    // next to the new ones, so catching up after an outage does not hold the capture back to that rate
+    replaySpool(index);
+    if (retryQueued(index) && sendBatch(index, msg, chunk_seq)) {
+        return;
+    }
+    if (_retry_budget == 0 || msg.size() > _retry_budget) {
+        spoolBatch(index, msg, pkts_num, chunk_seq);
+        return;
+    }
+    auto& queue = _retry_queues[index];
+    while (_retry_bytes[index] + msg.size() > _retry_budget) {
+        _retry_bytes[index] -= queue.front().msg.size();
+        _retry_queue_bytes -= queue.front().msg.size();
+        spoolBatch(index, queue.front().msg, queue.front().pkts_num, queue.front().chunk_seq);
+        queue.pop_front();
+    }
+    zmq_retry_batch_t batch;
+    if (msg.size() * 2 < _pool->bufferSize()) {
+        // a small batch is copied, it does not hold on to a whole pool buffer while it waits
+        batch.msg = zmq::message_t(msg.data(), msg.size());
     } else {
-        // std::cout<<"send failed."<<std::endl;  // send failed
+        batch.msg = std::move(msg);
+    }
+    batch.pkts_num = pkts_num;
+    batch.chunk_seq = chunk_seq;
+    _retry_bytes[index] += batch.msg.size();
+    _retry_queue_bytes += batch.msg.size();
+    queue.push_back(std::move(batch));
+    _retry_queued++;
+    AgentStatus::get_instance()->add_zmq_batch_stats(1, 0, 0, 0, 0);
+}
+
+bool PcapExportZMQ::retryQueued(size_t index) {
+    auto& queue = _retry_queues[index];
+    while (!queue.empty()) {
+        const size_t length = queue.front().msg.size();
+        if (!sendBatch(index, queue.front().msg, queue.front().chunk_seq)) {
+            return false;
+        }
+        _retry_bytes[index] -= length;
+        _retry_queue_bytes -= length;
+        queue.pop_front();
+        _retry_retried++;
+        AgentStatus::get_instance()->add_zmq_batch_stats(0, 1, 0, 0, 0);
+    }
+    return true;
+}
+
+bool PcapExportZMQ::replaySpool(size_t index) {
+    if (_spools.empty()) {
+        return true;
+    }
+    ZmqSpool& spool = *_spools[index];
+    const uint8_t* data;
+    uint32_t length;
+    uint16_t pkts_num;
+    uint64_t chunk_seq;
+    while (spool.front(data, length, pkts_num, chunk_seq)) {
+        if (_spool_rate > 0) {
+            // a token bucket of one second, which still lets a larger batch through
+            const auto now = std::chrono::steady_clock::now();
+            const double elapsed = std::chrono::duration<double>(now - _spool_refill[index]).count();
+            _spool_refill[index] = now;
+            _spool_tokens[index] = std::min(_spool_tokens[index] + elapsed * _spool_rate,
+                                            std::max(_spool_rate, static_cast<double>(length)));
+            if (_spool_tokens[index] < length) {
+                return false;
+            }
+        }
+        // the batch is only copied out of the spool when the remote has room for it
+        if ((_zmq_sockets[index].getsockopt<int>(ZMQ_EVENTS) & ZMQ_POLLOUT) == 0) {
+            return false;
+        }
+        zmq::message_t msg(data, length);
+        if (!sendBatch(index, msg, chunk_seq)) {
+            return false;
+        }
+        if (_spool_rate > 0) {
+            _spool_tokens[index] -= length;
+        }
+        spool.pop();
+        _spool_bytes -= length;
+        _spool_replayed++;
+        AgentStatus::get_instance()->add_zmq_batch_stats(0, 0, 0, 0, 1);
+    }
+    return true;
+}
+
+void PcapExportZMQ::spoolBatch(size_t index, zmq::message_t& msg, uint16_t pkts_num, uint64_t chunk_seq) {
+    if (_spools.empty()) {
+        dropBatches(1, pkts_num);
+        return;
+    }
+    ZmqSpool& spool = *_spools[index];
+    const size_t spool_bytes = spool.bytes();
+    uint64_t dropped_batches;
+    uint64_t dropped_pkts;
+    if (spool.push(msg.data(), static_cast<uint32_t>(msg.size()), pkts_num, chunk_seq, dropped_batches,
+                   dropped_pkts) != 0) {
+        dropBatches(1, pkts_num);
+        return;
+    }
+    if (dropped_batches > 0) {
+        dropBatches(dropped_batches, dropped_pkts);
+    }
+    _spool_bytes -= spool_bytes;
+    _spool_bytes += spool.bytes();
+    _spooled++;
+    AgentStatus::get_instance()->add_zmq_batch_stats(0, 0, 0, 1, 0);
+}
+
+void PcapExportZMQ::dropBatches(uint64_t batches, uint64_t pkts_num) {
+    _retry_dropped += batches;
+    _late_dropped += pkts_num;
+    AgentStatus::get_instance()->add_zmq_batch_stats(0, 0, batches, 0, 0);
+}
+
+void PcapExportZMQ::senderLoop() {
+    BatchCompressor compressor(_codec, _codec_level);
+    zmq_send_job_t job;
+    for (;;) {
+        if (!_jobs->pop(job)) {
+            // no new batch, the spools and retry queues get their turn
+            for (size_t i = 0; i < _retry_queues.size(); ++i) {
+                replaySpool(i);
+                retryQueued(i);
+            }
+            if (_sender_stop) {
+                break;
+            }
+            // flushBatchBuf only notifies a sleeping sender, the timeout covers a wake up lost in between
+            std::unique_lock<std::mutex> lock(_sender_lock);
+            _sender_sleeping = true;
+            if (_jobs->size() == 0 && !_sender_stop) {
+                _sender_cond.wait_for(lock, std::chrono::milliseconds(SENDER_IDLE_WAIT_MS));
+            }
+            _sender_sleeping = false;
+            continue;
+        }
+        zmq::message_t msg = packBatch(compressor, job);
+        deliverBatch(job.index, msg, job.pkts_num, job.chunk_seq);
+    }
+    // the remotes did not take these before the export closed, a spool keeps them for the next run
+    for (size_t i = 0; i < _retry_queues.size(); ++i) {
+        for (auto& batch : _retry_queues[i]) {
+            spoolBatch(i, batch.msg, batch.pkts_num, batch.chunk_seq);
+        }
+        _retry_queues[i].clear();
+        _retry_bytes[i] = 0;
+    }
+    _retry_queue_bytes = 0;
+}
+
+void PcapExportZMQ::stopSender() {
+    if (!_sender.joinable()) {
+        return;
+    }
+    // the thread sends what is queued before it quits
+    _sender_stop = true;
+    {
+        std::lock_guard<std::mutex> lock(_sender_lock);
+        _sender_cond.notify_one();
+    }
+    _sender.join();
+    zmq_retry_stats_t stats;
+    getRetryStats(stats);
+    std::cout << StatisLogContext::getTimeString() << "ZMQ batches queued for retry " << stats.queued
+              << ", spooled " << stats.spooled << ", retried " << stats.retried << ", replayed from spool "
+              << stats.replayed << ", dropped " << stats.dropped << "." << std::endl;
+    // unsent batches stay in the spool files
+    _spools.clear();
+}
+
+void PcapExportZMQ::resetBatchBuf(size_t slot, const struct timeval& ts) {
+    auto& pkts_buf = _pkts_bufs[slot];
+    pkts_buf.first_pkt_ts = ts;
+    pkts_buf.open_time = std::chrono::steady_clock::now();
+    pkts_buf.batch_bufpos = sizeof(pkts_buf.batch_hdr);
+    pkts_buf.batch_hdr.pkts_num = 0;
+}
+
+int PcapExportZMQ::flushAged() {
+    // batches the sender thread dropped since the last call are reported here
+    int drop_pkts_num = static_cast<int>(_late_dropped.exchange(0));
+    const auto now = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < _pkts_bufs.size() && !_zmq_sockets.empty(); ++i) {
+        auto& pkts_buf = _pkts_bufs[i];
+        if (pkts_buf.batch_hdr.pkts_num > 0 && now - pkts_buf.open_time >= _max_batch_age) {
+            drop_pkts_num += flushBatchBuf(i);
+            resetBatchBuf(i, pkts_buf.first_pkt_ts);
+        }
     }
     return drop_pkts_num;
 }
 
-int PcapExportZMQ::exportPacket(size_t index, const struct pcap_pkthdr* header, const uint8_t* pkt_data) {
-    auto& pkts_buf = _pkts_bufs[index];
+int PcapExportZMQ::flushExport() {
+    return flushAged();
+}
+
+int PcapExportZMQ::exportPacket(size_t slot, const struct pcap_pkthdr* header, const uint8_t* pkt_data) {
+    auto& pkts_buf = _pkts_bufs[slot];
     int drop_pkts_num = 0;
 
     if (pkts_buf.batch_hdr.pkts_num == 0) {
-        pkts_buf.first_pktsec = header->ts.tv_sec;
+        resetBatchBuf(slot, header->ts);
     }
 
     uint16_t length = (uint16_t) (header->caplen <= 65535 ? header->caplen : 65535);
@@ -118,15 +548,16 @@ int PcapExportZMQ::exportPacket(size_t index, const struct pcap_pkthdr* header,
                                   htonl((uint32_t)header->caplen),
                                   htonl((uint32_t)header->len) };
     auto& buf = pkts_buf.buf;
-    if (pkts_buf.batch_hdr.pkts_num >= 65535
-        || header->ts.tv_sec > pkts_buf.first_pktsec + MAX_PKTS_TIMEDIFF_S // 3 second timeout
-        || pkts_buf.batch_bufpos + sizeof(length) + sizeof(small_pkthdr) + length > MAX_BATCH_BUF_LENGTH) {
+    const int64_t age_ms = (static_cast<int64_t>(header->ts.tv_sec) - pkts_buf.first_pkt_ts.tv_sec) * 1000 +
+                           (static_cast<int64_t>(header->ts.tv_usec) - pkts_buf.first_pkt_ts.tv_usec) / 1000;
+    if (pkts_buf.batch_hdr.pkts_num > 0
+        && (pkts_buf.batch_hdr.pkts_num >= 65535
+            || age_ms >= _max_batch_age.count()
+            || pkts_buf.batch_bufpos + sizeof(length) + sizeof(small_pkthdr) + length > _max_batch_bytes)) {
 
-        drop_pkts_num = flushBatchBuf(index);
+        drop_pkts_num = flushBatchBuf(slot);
 
-        pkts_buf.first_pktsec = header->ts.tv_sec;
-        pkts_buf.batch_bufpos = sizeof(pkts_buf.batch_hdr);
-        pkts_buf.batch_hdr.pkts_num = 0;
+        resetBatchBuf(slot, header->ts);
     }
 
     uint16_t hlen = htons(length);
@@ -4,39 +4,89 @@
 #ifndef WIN32
 	#include <netinet/in.h>
 #endif
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 #include <zmq.hpp>
 #include "pcapexport.h"
+#include "batchdef.h"
+#include "batchcodec.h"
+#include "boundedring.h"
+#include "zmqspool.h"
 
+// batch buffers handed to zmq without a copy: zmq frees a message from its I/O thread once it was sent, or at once
+// when the send failed, and the buffer goes back on a lock-free list; the capture thread fills another one meanwhile
+class ZmqBufferPool {
+protected:
+    size_t _buffer_size;
+    BoundedRing<char*> _free;
 
-
-typedef struct PmrPktHdr {
-	uint32_t tv_sec;   // epoc seconds.  caution: unix 2038 problem
-	uint32_t tv_usec;  // and microseconds
-	uint32_t caplen;   // actual capture length
-	uint32_t len;      // wire packet length
-} pmr_pkthdr_t, * pmr_pkthdr_ptr_t;
-
-typedef struct batch_pkts_header {
-	uint16_t version;
-	uint16_t pkts_num;
-	uint32_t keybit;
-} batch_pkts_hdr_t;
+public:
+    // up to max_free buffers are kept for reuse, more are deleted when they come back
+    ZmqBufferPool(size_t buffer_size, size_t max_free);
+    ~ZmqBufferPool();
+    ZmqBufferPool(const ZmqBufferPool&) = delete;
+    ZmqBufferPool& operator=(const ZmqBufferPool&) = delete;
+    char* acquire();
+    size_t bufferSize() const { return _buffer_size; }
+    // zmq free function, hint is the pool
+    static void release(void* data, void* hint);
+};
 
 struct BatchPktsBuf {
     batch_pkts_hdr_t batch_hdr;
-    // buf format as below:
-	// | batch_hdr | (pkt_data length  + pkt_hdr  + pkt_data) | (pkt_data_length  + pkt_hdr  + pkt_data) | ...
-	// | 8 bytes   | (2 bytes          + 16 bytes + n bytes ) | (2 bytes          + 16 bytes + n bytes ) | ...
-    std::vector<char> buf;
+    // buf format: see batchdef.h; from the pool, zmq owns it once it was flushed
+    char* buf;
     uint32_t batch_bufpos;
-    __time_t first_pktsec;
+    // capture time of the first packet, and when it was batched
+    struct timeval first_pkt_ts;
+    std::chrono::steady_clock::time_point open_time;
 public:
-	static constexpr uint16_t BATCH_PKTS_VERSION = 1;
+	static constexpr uint16_t BATCH_PKTS_VERSION = PKTMINERG_BATCH_VERSION;
+	static constexpr uint16_t BATCH_PKTS_VERSION_COMPRESSED = PKTMINERG_BATCH_VERSION_COMPRESSED;
+	static constexpr uint16_t BATCH_CHUNK_MAGIC = PKTMINERG_BATCH_CHUNK_MAGIC;
 };
 
+typedef struct ZmqRetryStats {
+    uint64_t queued;
+    uint64_t retried;
+    uint64_t dropped;
+    size_t queue_bytes;
+    uint64_t spooled;
+    size_t spool_bytes;
+    // sent again from the spool
+    uint64_t replayed;
+} zmq_retry_stats_t;
+
+// With a codec or a retry queue, the batches go to a sender thread, which compresses them and owns the sockets.
+// A batch which does not go out waits in the retry queue of its remote, up to a byte budget with the oldest batch
+// dropped first; the queue goes out before newer batches once the socket takes them again.
+// With a spool the batches which do not fit the retry queue go to disk instead, and are sent again at the spool
+// rate once the socket is writable; the retry queue and new batches do not wait for them.
 class PcapExportZMQ : public PcapExportBase {
+protected:
+    // a full batch on its way to the sender thread, which owns buf from then on
+    typedef struct ZmqSendJob {
+        size_t index;
+        char* buf;
+        uint32_t length;
+        uint16_t pkts_num;
+        // of the chunk header, given when the batch is cut so a batch sent late keeps its place
+        uint64_t chunk_seq;
+    } zmq_send_job_t;
+
+    typedef struct ZmqRetryBatch {
+        zmq::message_t msg;
+        uint16_t pkts_num;
+        uint64_t chunk_seq;
+    } zmq_retry_batch_t;
+
 protected:
     std::vector<std::string> _remoteips;
 	int _zmq_port;
@@ -44,16 +94,68 @@ protected:
     uint32_t _keybit;
     std::string _bind_device;
     int _send_buf_size;
+    // outlives the contexts, which wait for the messages in flight when they are destroyed; created by initExport
+    // with buffers of the largest batch setBatchLimits allows
+    std::unique_ptr<ZmqBufferPool> _pool;
 	std::vector<zmq::context_t> _zmq_contexts;
     std::vector<zmq::socket_t> _zmq_sockets;
+    // the open batch of every remote and key tag, slot tag * remotes + remote: a batch carries one keybit, and
+    // packets of several interfaces fill their own batches
     std::vector<BatchPktsBuf> _pkts_bufs;
-    constexpr static uint32_t MAX_PKTS_TIMEDIFF_S = 1;
+    // the next seq of the chunk header, per remote; only the capture thread touches it
+    std::vector<uint64_t> _chunk_seqs;
+    uint16_t _chunk_id;
+    uint16_t _chunk_count;
+    std::chrono::milliseconds _max_batch_age;
+    uint32_t _max_batch_bytes;
+    uint8_t _codec;
+    int _codec_level;
+    size_t _retry_budget;
+    // with a sender thread the capture thread no longer touches the sockets
+    std::unique_ptr<BoundedRing<zmq_send_job_t>> _jobs;
+    std::thread _sender;
+    std::mutex _sender_lock;
+    std::condition_variable _sender_cond;
+    std::atomic<bool> _sender_sleeping;
+    std::atomic<bool> _sender_stop;
+    // only the sender thread touches the retry queues
+    std::vector<std::deque<zmq_retry_batch_t>> _retry_queues;
+    std::vector<size_t> _retry_bytes;
+    std::atomic<uint64_t> _retry_queued;
+    std::atomic<uint64_t> _retry_retried;
+    std::atomic<uint64_t> _retry_dropped;
+    std::atomic<size_t> _retry_queue_bytes;
+    std::string _spool_dir;
+    size_t _spool_max_bytes;
+    // bytes per second, 0 sends the spool as fast as the remote takes it
+    double _spool_rate;
+    std::vector<std::unique_ptr<ZmqSpool>> _spools;
+    std::vector<double> _spool_tokens;
+    std::vector<std::chrono::steady_clock::time_point> _spool_refill;
+    std::atomic<uint64_t> _spooled;
+    std::atomic<size_t> _spool_bytes;
+    std::atomic<uint64_t> _spool_replayed;
+    // packets of the batches the sender thread dropped, not reported yet
+    std::atomic<uint64_t> _late_dropped;
 	constexpr static uint32_t MAX_BATCH_BUF_LENGTH = 1 * 1024 * 1024;
 
 private:
     int initSockets(size_t index, uint32_t keybit);
-    int exportPacket(size_t index, const struct pcap_pkthdr *header, const uint8_t *pkt_data);
-    int flushBatchBuf(size_t index);
+    size_t batchSlot(size_t index, uint32_t tag);
+    int exportPacket(size_t slot, const struct pcap_pkthdr *header, const uint8_t *pkt_data);
+    // wait: for room in the send queue instead of dropping the batch when the sender thread falls behind
+    int flushBatchBuf(size_t slot, bool wait = false);
+    bool sendBatch(size_t index, zmq::message_t& msg, uint64_t chunk_seq);
+    zmq::message_t packBatch(BatchCompressor& compressor, const zmq_send_job_t& job);
+    void deliverBatch(size_t index, zmq::message_t& msg, uint16_t pkts_num, uint64_t chunk_seq);
+    bool retryQueued(size_t index);
+    bool replaySpool(size_t index);
+    void spoolBatch(size_t index, zmq::message_t& msg, uint16_t pkts_num, uint64_t chunk_seq);
+    void dropBatches(uint64_t batches, uint64_t pkts_num);
+    void senderLoop();
+    void stopSender();
+    void resetBatchBuf(size_t slot, const struct timeval& ts);
+    int flushAged();
 
 public:
     PcapExportZMQ(const std::vector<std::string>& remoteips, int zmq_port, int zmq_hwm, uint32_t keybit,
@@ -61,7 +163,28 @@ public:
     ~PcapExportZMQ();
     int initExport();
     int exportPacket(const struct pcap_pkthdr *header, const uint8_t *pkt_data);
+    int exportBatch(const PacketBatch& batch);
+    // sends the batches which are older than the batch age by the wall clock, on a quiet interface no packet
+    // comes to close them
+    int flushExport();
     int closeExport();
+    // a batch is sent once its packets span max_age_ms of capture time, or it waited that long, or the next
+    // packet would make it larger than max_bytes (at most 1 MB); a larger packet gets a batch of its own.
+    // Call before initExport
+    void setBatchLimits(uint32_t max_age_ms, uint32_t max_bytes);
+    // send version 2 batches compressed with a codec of batchdef.h, level 0 is the default of the codec; call it
+    // before initExport, fails for a codec this build has no library for
+    int setCompression(uint8_t codec, int level);
+    // keep up to budget bytes of batches per remote which failed to send, and send them again from the sender
+    // thread; 0 drops them at once. Call before initExport
+    void setRetryBudget(size_t budget);
+    void getRetryStats(zmq_retry_stats_t& stats) const;
+    // keep batches which do not fit the retry queue in a spool of max_bytes per remote under dir, and replay them
+    // at up to mbps megabits per second, 0 for no limit; batches a previous run left there are replayed first.
+    // Call before initExport. Not available on Windows
+    void setSpool(const std::string& dir, size_t max_bytes, double mbps);
+    // prefix every batch message with a batch_chunk_hdr_t frame; chunk_count 0 turns it off
+    void setChunk(uint16_t chunk_id, uint16_t chunk_count);
 };
 
 #endif // SRC_SOCKETZMQ_H_
\ No newline at end of file
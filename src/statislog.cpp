@@ -45,10 +45,10 @@ void StatisLogContext::initStatisLogFmt(const char* name, const char* title) {
     std::strncpy(title_buffer_, title, sizeof(title_buffer_)-1);
 }
 
-void StatisLogContext::__process_first_packet(uint64_t pkt_time, pcap_t *handle) {
+void StatisLogContext::__process_first_packet(uint64_t pkt_time, CaptureStatsSource* stats) {
     pcap_stat stat;
     first_pkt_time_ = pkt_time;
-    if(handle!=NULL && pcap_stats(handle, &stat) == 0) {
+    if(stats!=NULL && stats->getCaptureStats(&stat) == 0) {
         start_drop_ = stat.ps_drop;
     }
 }
@@ -77,11 +77,11 @@ void StatisLogContext::__process_bps_pps_buffer(std::time_t timep) {
     }
 }
 
-void StatisLogContext::__process_send_statis_buffer(uint64_t pkt_time, uint64_t filter_drop, pcap_t *handle) {
+void StatisLogContext::__process_send_statis_buffer(uint64_t pkt_time, uint64_t filter_drop, CaptureStatsSource* stats) {
     // first_packet_time, pkt_time,
     // ps_recv, ps_drop - start_drop, ps_ifdrop, filter_drop
     struct pcap_stat stat;
-    if (handle != NULL && pcap_stats(handle, &stat) == 0) {
+    if (stats != NULL && stats->getCaptureStats(&stat) == 0) {
         std::snprintf(statis_buffer_, sizeof(statis_buffer_), "%" PRIu64 ",%" PRIu64 ",%u,%u,%u,%" PRIu64, first_pkt_time_, pkt_time, stat.ps_recv,
                      stat.ps_drop - start_drop_, stat.ps_ifdrop, filter_drop);
     } else {
@@ -115,8 +115,8 @@ void GreSendStatisLog::initSendLog(const char* name) {
 }
 
 void GreSendStatisLog::logSendStatis(uint64_t pkt_time, uint32_t caplen, uint64_t count, uint64_t drop_count,
-                   uint64_t filter_drop, pcap_t *handle) {
-    logSendStatisGre(pkt_time, caplen, count, drop_count, filter_drop, handle);
+                   uint64_t filter_drop, CaptureStatsSource* stats) {
+    logSendStatisGre(pkt_time, caplen, count, drop_count, filter_drop, stats);
 }
 
 void GreSendStatisLog::init(const char* name) {
@@ -125,31 +125,36 @@ void GreSendStatisLog::init(const char* name) {
 }
 
 void GreSendStatisLog::logSendStatisGre(uint64_t pkt_time, uint32_t caplen, uint64_t count, uint64_t drop_count,
-                                        uint64_t filter_drop, pcap_t *handle) {
+                                        uint64_t filter_drop, CaptureStatsSource* stats) {
+    logSendStatisBatch(pkt_time, caplen, 1, count, drop_count, filter_drop, stats);
+}
+
+void GreSendStatisLog::logSendStatisBatch(uint64_t pkt_time, uint64_t caplen_bytes, uint64_t pkts, uint64_t count,
+                                          uint64_t drop_count, uint64_t filter_drop, CaptureStatsSource* stats) {
     if (bQuiet_) {
         return;
     }
 
     if(first_pkt_time_ == 0) {
-        __process_first_packet(pkt_time, handle);
+        __process_first_packet(pkt_time, stats);
     }
 
     // print statistical info
     std::time_t now = std::time(NULL);
     if (last_log_time_ != now) {
         __process_title();
-        logSendStatisGre(now, pkt_time, count, drop_count, filter_drop, handle);
+        logSendStatisGre(now, pkt_time, count, drop_count, filter_drop, stats);
         last_drop_count_ = drop_count;
     }
-    total_cap_bytes_ += caplen;
-    total_packets_++;
+    total_cap_bytes_ += caplen_bytes;
+    total_packets_ += pkts;
 }
 
 void GreSendStatisLog::logSendStatisGre(std::time_t current, uint64_t pkt_time, uint64_t count,
-                      uint64_t drop_count, uint64_t filter_drop, pcap_t *handle) {
+                      uint64_t drop_count, uint64_t filter_drop, CaptureStatsSource* stats) {
     // [now]: statis,bps_pps
     __process_time_buffer(current);
-    __process_send_statis_buffer(pkt_time, filter_drop, handle);
+    __process_send_statis_buffer(pkt_time, filter_drop, stats);
     __process_bps_pps_buffer(current);
     __process_send_gre_buffer(count, drop_count);
     __inline_update_statis(current);
@@ -12,6 +12,12 @@
 #define LOG_BUFFER_LEN 256
 #define LOG_TICK_COUNT 100
 
+// kernel capture counters (ps_recv, ps_drop, ps_ifdrop) provider, implemented by capture handlers
+class CaptureStatsSource {
+public:
+    virtual int getCaptureStats(struct pcap_stat* stat) = 0;
+};
+
 class StatisLogContext {
 protected:
     bool bQuiet_;
@@ -37,7 +43,7 @@ public:
 protected:
     void initStatisLogFmt(const char* name, const char* title);
 
-    void __process_first_packet(uint64_t pkt_time, pcap_t* handle = NULL);
+    void __process_first_packet(uint64_t pkt_time, CaptureStatsSource* stats = NULL);
 
     void __process_title();
 
@@ -45,7 +51,7 @@ protected:
 
     void __process_bps_pps_buffer(std::time_t timep);
 
-    void __process_send_statis_buffer(uint64_t pkt_time, uint64_t filter_drop = 0, pcap_t* handle = NULL);
+    void __process_send_statis_buffer(uint64_t pkt_time, uint64_t filter_drop = 0, CaptureStatsSource* stats = NULL);
 
 //    void __process_recv_statis_buffer(uint64_t pkt_time);
     void __inline_update_statis(std::time_t timep);
@@ -64,7 +70,7 @@ public:
     virtual void initSendLog(const char* name) = 0;
 
     virtual void logSendStatis(uint64_t pkt_time, uint32_t caplen, uint64_t count, uint64_t drop_count,
-                               uint64_t filter_drop, pcap_t* handle) = 0;
+                               uint64_t filter_drop, CaptureStatsSource* stats) = 0;
 };
 
 class GreSendStatisLog : public StatisSendLog, GreStatisLogContext {
@@ -74,15 +80,19 @@ public:
     void initSendLog(const char* name);
 
     void logSendStatis(uint64_t pkt_time, uint32_t caplen, uint64_t count = 0, uint64_t drop_count = 0,
-                       uint64_t filter_drop = 0, pcap_t* handle = NULL);
+                       uint64_t filter_drop = 0, CaptureStatsSource* stats = NULL);
 
     void init(const char* name);
 
     void logSendStatisGre(uint64_t pkt_time, uint32_t caplen, uint64_t count, uint64_t drop_count,
-                          uint64_t filter_drop = 0, pcap_t* handle = NULL);
+                          uint64_t filter_drop = 0, CaptureStatsSource* stats = NULL);
 
     void logSendStatisGre(std::time_t current, uint64_t pkt_time, uint64_t count,
-                          uint64_t drop_count, uint64_t filter_drop = 0, pcap_t* handle = NULL);
+                          uint64_t drop_count, uint64_t filter_drop = 0, CaptureStatsSource* stats = NULL);
+
+    // account pkts packets of caplen_bytes bytes in total at once, pkt_time is the time of the last one
+    void logSendStatisBatch(uint64_t pkt_time, uint64_t caplen_bytes, uint64_t pkts, uint64_t count,
+                            uint64_t drop_count, uint64_t filter_drop = 0, CaptureStatsSource* stats = NULL);
 
 protected:
     void __process_send_gre_buffer(uint64_t num, uint64_t drop_count);
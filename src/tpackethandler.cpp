@@ -0,0 +1,330 @@
+#include "tpackethandler.h"
+#include <iostream>
+#include <cstring>
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/filter.h>
+#include <net/if.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "scopeguard.h"
+
+const int INVALIDE_SOCKET_FD = -1;
+const int DEFAULT_BLOCK_SIZE = 1024 * 1024;
+const int DEFAULT_POLL_TIMEOUT_MS = 1000;
+const uint32_t VLAN_TAG_LEN = 4;
+
+PcapTpacketHandler::PcapTpacketHandler() {
+    _socketfd = INVALIDE_SOCKET_FD;
+    _ring = NULL;
+    _ring_size = 0;
+    _block_index = 0;
+    _snaplen = 0;
+    _poll_timeout = DEFAULT_POLL_TIMEOUT_MS;
+    _stop = false;
+    std::memset(&_stat, 0, sizeof(_stat));
+}
+
+PcapTpacketHandler::~PcapTpacketHandler() {
+    closeRing();
+}
+
+void PcapTpacketHandler::closeRing() {
+    if (_ring != NULL) {
+        munmap(_ring, _ring_size);
+        _ring = NULL;
+        _ring_size = 0;
+    }
+    _blocks.clear();
+    _block_index = 0;
+    if (_socketfd != INVALIDE_SOCKET_FD) {
+        close(_socketfd);
+        _socketfd = INVALIDE_SOCKET_FD;
+    }
+}
+
+int PcapTpacketHandler::setupRing(const pcap_init_t& param) {
+    int version = TPACKET_V3;
+    if (setsockopt(_socketfd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1) {
+        std::cerr << StatisLogContext::getTimeString() << "Set PACKET_VERSION to TPACKET_V3 failed, error is "
+                  << strerror(errno) << "." << std::endl;
+        return -1;
+    }
+
+    // leave room in front of each frame to put back a vlan tag stripped by the kernel
+    int reserve = VLAN_TAG_LEN;
+    if (setsockopt(_socketfd, SOL_PACKET, PACKET_RESERVE, &reserve, sizeof(reserve)) == -1) {
+        std::cerr << StatisLogContext::getTimeString() << "Set PACKET_RESERVE failed, error is "
+                  << strerror(errno) << "." << std::endl;
+        return -1;
+    }
+
+    const uint32_t pagesize = static_cast<uint32_t>(sysconf(_SC_PAGESIZE));
+    uint32_t block_size = static_cast<uint32_t>(param.block_size > 0 ? param.block_size : DEFAULT_BLOCK_SIZE);
+    block_size = (block_size + pagesize - 1) / pagesize * pagesize;
+    uint32_t frame_size = TPACKET_ALIGN(TPACKET3_HDRLEN + VLAN_TAG_LEN + _snaplen);
+    if (frame_size > block_size) {
+        std::cerr << StatisLogContext::getTimeString() << "TPACKET block size " << block_size
+                  << " can not hold a frame of snaplen " << _snaplen << "." << std::endl;
+        return -1;
+    }
+    uint32_t block_count = static_cast<uint32_t>(param.block_count);
+    if (param.block_count <= 0) {
+        block_count = static_cast<uint32_t>(param.buffer_size) / block_size;
+        if (block_count == 0) {
+            block_count = 1;
+        }
+    }
+
+    struct tpacket_req3 req;
+    std::memset(&req, 0, sizeof(req));
+    req.tp_block_size = block_size;
+    req.tp_block_nr = block_count;
+    req.tp_frame_size = frame_size;
+    req.tp_frame_nr = (block_size / frame_size) * block_count;
+    req.tp_retire_blk_tov = static_cast<unsigned int>(param.retire_timeout > 0 ? param.retire_timeout : 0);
+    if (setsockopt(_socketfd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) == -1) {
+        std::cerr << StatisLogContext::getTimeString() << "Set PACKET_RX_RING with " << block_count << " blocks of "
+                  << block_size << " bytes failed, error is " << strerror(errno) << "." << std::endl;
+        return -1;
+    }
+
+    _ring_size = static_cast<size_t>(block_size) * block_count;
+    void* ring = mmap(NULL, _ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, _socketfd, 0);
+    if (ring == MAP_FAILED) {
+        std::cerr << StatisLogContext::getTimeString() << "Map TPACKET_V3 ring of " << _ring_size
+                  << " bytes failed, error is " << strerror(errno) << "." << std::endl;
+        _ring_size = 0;
+        return -1;
+    }
+    _ring = static_cast<uint8_t*>(ring);
+    _blocks.resize(block_count);
+    for (uint32_t i = 0; i < block_count; ++i) {
+        _blocks[i] = reinterpret_cast<struct tpacket_block_desc*>(_ring + static_cast<size_t>(i) * block_size);
+    }
+    _block_index = 0;
+    if (param.retire_timeout > 0) {
+        _poll_timeout = param.retire_timeout;
+    }
+    return 0;
+}
+
+int PcapTpacketHandler::attachFilter(const std::string& expression) {
+    if (expression.length() == 0) {
+        return 0;
+    }
+    std::cout << StatisLogContext::getTimeString() << "Set pcap filter as \"" << expression << "\"." << std::endl;
+
+    // libpcap only compiles the expression, the program runs as a socket filter in the kernel
+    pcap_t* pcap_handle = pcap_open_dead(DLT_EN10MB, static_cast<int>(_snaplen));
+    if (!pcap_handle) {
+        std::cerr << StatisLogContext::getTimeString() << "Call pcap_open_dead failed." << std::endl;
+        return -1;
+    }
+    auto pcapGuard = MakeGuard([pcap_handle]() {
+        pcap_close(pcap_handle);
+    });
+
+    struct bpf_program filter;
+    if (pcap_compile(pcap_handle, &filter, expression.c_str(), 0, PCAP_NETMASK_UNKNOWN) != 0) {
+        std::cerr << StatisLogContext::getTimeString() << "Call pcap_compile failed, error is "
+                  << pcap_geterr(pcap_handle) << "." << std::endl;
+        return -1;
+    }
+    struct sock_fprog fprog;
+    fprog.len = static_cast<unsigned short>(filter.bf_len);
+    fprog.filter = reinterpret_cast<struct sock_filter*>(filter.bf_insns);
+    int ret = setsockopt(_socketfd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog));
+    pcap_freecode(&filter);
+    if (ret == -1) {
+        std::cerr << StatisLogContext::getTimeString() << "Set SO_ATTACH_FILTER failed, error is "
+                  << strerror(errno) << "." << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+int PcapTpacketHandler::openPcap(const std::string& dev, const pcap_init_t& param, const std::string& expression,
+                                 bool dumpfile) {
+    closeRing();
+    _need_update_status = param.need_update_status;
+    setBatchSize(param.batch_size);
+    _snaplen = static_cast<uint32_t>(param.snaplen > 0 ? param.snaplen : 65535);
+    std::memset(&_stat, 0, sizeof(_stat));
+
+    // protocol 0 receives nothing until the socket is bound to the interface
+    _socketfd = socket(AF_PACKET, SOCK_RAW, 0);
+    if (_socketfd == INVALIDE_SOCKET_FD) {
+        std::cerr << StatisLogContext::getTimeString() << "Create AF_PACKET socket failed, error is "
+                  << strerror(errno) << "." << std::endl;
+        return -1;
+    }
+    auto ringGuard = MakeGuard([this]() {
+        closeRing();
+    });
+
+    int ifindex = static_cast<int>(if_nametoindex(dev.c_str()));
+    if (ifindex == 0) {
+        std::cerr << StatisLogContext::getTimeString() << "Interface " << dev << " not found." << std::endl;
+        return -1;
+    }
+    if (setupRing(param) != 0) {
+        return -1;
+    }
+    if (attachFilter(expression) != 0) {
+        return -1;
+    }
+
+    struct sockaddr_ll addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(ETH_P_ALL);
+    addr.sll_ifindex = ifindex;
+    if (bind(_socketfd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == -1) {
+        std::cerr << StatisLogContext::getTimeString() << "Bind AF_PACKET socket to " << dev
+                  << " failed, error is " << strerror(errno) << "." << std::endl;
+        return -1;
+    }
+
+    if (param.promisc) {
+        struct packet_mreq mreq;
+        std::memset(&mreq, 0, sizeof(mreq));
+        mreq.mr_ifindex = ifindex;
+        mreq.mr_type = PACKET_MR_PROMISC;
+        if (setsockopt(_socketfd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == -1) {
+            std::cerr << StatisLogContext::getTimeString() << "Set promiscuous mode on " << dev
+                      << " failed, error is " << strerror(errno) << "." << std::endl;
+            return -1;
+        }
+    }
+
+    if (dumpfile) {
+        pcap_t* pcap_handle = pcap_open_dead(DLT_EN10MB, static_cast<int>(_snaplen));
+        if (!pcap_handle) {
+            std::cerr << StatisLogContext::getTimeString() << "Call pcap_open_dead failed." << std::endl;
+            return -1;
+        }
+        int ret = openPcapDumper(pcap_handle);
+        pcap_close(pcap_handle);
+        if (ret != 0) {
+            std::cerr << StatisLogContext::getTimeString() << "Call openPcapDumper failed." << std::endl;
+            return -1;
+        }
+    }
+    ringGuard.Dismiss();
+    return 0;
+}
+
+int PcapTpacketHandler::walkBlock(struct tpacket_block_desc* block, int count, int handled) {
+    const uint32_t num_pkts = block->hdr.bh1.num_pkts;
+    auto* tphdr = reinterpret_cast<struct tpacket3_hdr*>(reinterpret_cast<uint8_t*>(block) +
+                                                        block->hdr.bh1.offset_to_first_pkt);
+    struct pcap_pkthdr header;
+    for (uint32_t i = 0; i < num_pkts && (count <= 0 || handled < count); ++i) {
+        uint8_t* pkt_data = reinterpret_cast<uint8_t*>(tphdr) + tphdr->tp_mac;
+        header.ts.tv_sec = tphdr->tp_sec;
+        header.ts.tv_usec = tphdr->tp_nsec / 1000;
+        header.caplen = tphdr->tp_snaplen;
+        header.len = tphdr->tp_len;
+        if ((tphdr->tp_status & TP_STATUS_VLAN_VALID) && header.caplen >= 2 * ETH_ALEN) {
+            // the kernel stripped the 802.1Q tag, put it back in front of the ether type as libpcap does
+            uint16_t tpid = (tphdr->tp_status & TP_STATUS_VLAN_TPID_VALID) ? tphdr->hv1.tp_vlan_tpid
+                                                                           : static_cast<uint16_t>(ETH_P_8021Q);
+            uint16_t tag[2] = { htons(tpid), htons(static_cast<uint16_t>(tphdr->hv1.tp_vlan_tci)) };
+            pkt_data -= VLAN_TAG_LEN;
+            std::memmove(pkt_data, pkt_data + VLAN_TAG_LEN, 2 * ETH_ALEN);
+            std::memcpy(pkt_data + 2 * ETH_ALEN, tag, sizeof(tag));
+            header.caplen += VLAN_TAG_LEN;
+            header.len += VLAN_TAG_LEN;
+        }
+        if (header.caplen > _snaplen) {
+            header.caplen = _snaplen;
+        }
+        _batch.push_back(header, pkt_data);
+        handled++;
+        tphdr = reinterpret_cast<struct tpacket3_hdr*>(reinterpret_cast<uint8_t*>(tphdr) + tphdr->tp_next_offset);
+    }
+    // the block is one batch, its packets stay in the ring until the exporters are done with them
+    batchHandler(_batch);
+    _batch.clear();
+    return handled;
+}
+
+int PcapTpacketHandler::dispatchReady(int count) {
+    if (_socketfd == INVALIDE_SOCKET_FD) {
+        std::cerr << StatisLogContext::getTimeString() << "The pcap has not created." << std::endl;
+        return -1;
+    }
+    // at most one turn of the ring, the kernel may keep filling blocks behind us
+    int handled = 0;
+    for (size_t i = 0; i < _blocks.size() && (count <= 0 || handled < count); ++i) {
+        struct tpacket_block_desc* block = _blocks[_block_index];
+        if ((__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0) {
+            break;
+        }
+        handled = walkBlock(block, count, handled);
+        __atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        _block_index = (_block_index + 1) % _blocks.size();
+    }
+    if (handled == 0) {
+        flushExports();
+    }
+    return handled;
+}
+
+int PcapTpacketHandler::startPcapLoop(int count) {
+    if (_socketfd == INVALIDE_SOCKET_FD) {
+        std::cerr << StatisLogContext::getTimeString() << "The pcap has not created." << std::endl;
+        return -1;
+    }
+    _stop = false;
+    int handled = 0;
+    struct pollfd pfd;
+    pfd.fd = _socketfd;
+    pfd.events = POLLIN | POLLERR;
+    pfd.revents = 0;
+    while (!_stop && (count <= 0 || handled < count)) {
+        int ret = dispatchReady(count > 0 ? count - handled : 0);
+        if (ret == 0) {
+            poll(&pfd, 1, _poll_timeout);
+        }
+        handled += ret;
+    }
+    logEndStatis();
+    return 0;
+}
+
+void PcapTpacketHandler::stopPcapLoop() {
+    _stop = true;
+}
+
+int PcapTpacketHandler::getCaptureStats(struct pcap_stat* stat) {
+    if (_socketfd == INVALIDE_SOCKET_FD) {
+        return -1;
+    }
+    // the kernel resets its counters on every read, keep the running totals here
+    struct tpacket_stats_v3 kstats;
+    socklen_t len = sizeof(kstats);
+    if (getsockopt(_socketfd, SOL_PACKET, PACKET_STATISTICS, &kstats, &len) == -1) {
+        return -1;
+    }
+    _stat.ps_recv += kstats.tp_packets;
+    _stat.ps_drop += kstats.tp_drops;
+    *stat = _stat;
+    return 0;
+}
+
+int PcapTpacketHandler::getCaptureFd() {
+    return _socketfd;
+}
+
+int PcapTpacketHandler::getSelectableFd() {
+    return _socketfd;
+}
+
+int PcapTpacketHandler::setNonblock() {
+    // dispatchReady only looks at block status words, it never blocks
+    return 0;
+}
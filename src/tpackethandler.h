@@ -0,0 +1,44 @@
+#ifndef SRC_TPACKETHANDLER_H_
+#define SRC_TPACKETHANDLER_H_
+
+#include <linux/if_packet.h>
+#include <string>
+#include <vector>
+#include "pcaphandler.h"
+
+// Capture from an AF_PACKET TPACKET_V3 ring owned by the handler, without going through libpcap.
+// The ring is walked one retired block at a time, every packet of the block stays mapped
+// until the whole block has been handed to the exporters.
+class PcapTpacketHandler : public PcapHandler {
+protected:
+    int _socketfd;
+    uint8_t* _ring;
+    size_t _ring_size;
+    std::vector<struct tpacket_block_desc*> _blocks;
+    size_t _block_index;
+    uint32_t _snaplen;
+    int _poll_timeout;
+    volatile bool _stop;
+    struct pcap_stat _stat;
+
+protected:
+    int setupRing(const pcap_init_t& param);
+    int attachFilter(const std::string& expression);
+    int walkBlock(struct tpacket_block_desc* block, int count, int handled);
+    void closeRing();
+
+public:
+    PcapTpacketHandler();
+    ~PcapTpacketHandler();
+    int openPcap(const std::string& dev, const pcap_init_t& param, const std::string& expression,
+                 bool dumpfile=false);
+    int startPcapLoop(int count);
+    void stopPcapLoop();
+    int getCaptureStats(struct pcap_stat* stat);
+    int getCaptureFd();
+    int getSelectableFd();
+    int setNonblock();
+    int dispatchReady(int count);
+};
+
+#endif // SRC_TPACKETHANDLER_H_
@@ -0,0 +1,459 @@
+#include "xdphandler.h"
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+#include <linux/if_xdp.h>
+#include <net/if.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <boost/filesystem.hpp>
+#include "scopeguard.h"
+#include "xdpprog.h"
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+const int INVALIDE_XDP_FD = -1;
+const uint32_t XDP_FRAME_SIZE = 4096;
+const uint32_t DEFAULT_XDP_FRAME_COUNT = 4096;
+const int XDP_POLL_TIMEOUT_MS = 1000;
+
+PcapXdpHandler::PcapXdpHandler() {
+    _ifindex = 0;
+    _map_fd = INVALIDE_XDP_FD;
+    _prog_fd = INVALIDE_XDP_FD;
+    _generic = false;
+    _attached = false;
+    _snaplen = 0;
+    _frame_size = XDP_FRAME_SIZE;
+    _frame_count = DEFAULT_XDP_FRAME_COUNT;
+    std::memset(&_filter, 0, sizeof(_filter));
+    _has_filter = false;
+    _stop = false;
+    _received = 0;
+}
+
+PcapXdpHandler::~PcapXdpHandler() {
+    closeXdp();
+}
+
+int PcapXdpHandler::getRxQueueCount(const std::string& dev) {
+    boost::system::error_code ec;
+    boost::filesystem::directory_iterator it("/sys/class/net/" + dev + "/queues", ec);
+    if (ec) {
+        return -1;
+    }
+    int count = 0;
+    for (; it != boost::filesystem::directory_iterator(); it.increment(ec)) {
+        if (ec) {
+            return -1;
+        }
+        if (it->path().filename().string().compare(0, 3, "rx-") == 0) {
+            count++;
+        }
+    }
+    return count;
+}
+
+static int mapXdpRing(int fd, const struct xdp_ring_offset& off, uint32_t entries, size_t desc_size,
+                      off_t pgoff, void*& map, size_t& map_size, uint32_t*& producer, uint32_t*& consumer,
+                      uint32_t*& flags, void*& descs) {
+    map_size = off.desc + entries * desc_size;
+    map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, pgoff);
+    if (map == MAP_FAILED) {
+        map = NULL;
+        map_size = 0;
+        return -1;
+    }
+    uint8_t* base = static_cast<uint8_t*>(map);
+    producer = reinterpret_cast<uint32_t*>(base + off.producer);
+    consumer = reinterpret_cast<uint32_t*>(base + off.consumer);
+    flags = reinterpret_cast<uint32_t*>(base + off.flags);
+    descs = base + off.desc;
+    return 0;
+}
+
+int PcapXdpHandler::openQueue(xdp_queue_t& queue, uint32_t queue_id, bool zerocopy) {
+    std::memset(&queue, 0, sizeof(queue));
+    queue.queue_id = queue_id;
+    queue.zerocopy = zerocopy;
+    queue.fd = socket(AF_XDP, SOCK_RAW, 0);
+    if (queue.fd == INVALIDE_XDP_FD) {
+        std::cerr << StatisLogContext::getTimeString() << "Create AF_XDP socket failed, error is "
+                  << strerror(errno) << "." << std::endl;
+        return -1;
+    }
+
+    queue.umem_size = static_cast<size_t>(_frame_count) * _frame_size;
+    void* umem = mmap(NULL, queue.umem_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (umem == MAP_FAILED) {
+        std::cerr << StatisLogContext::getTimeString() << "Allocate UMEM of " << queue.umem_size
+                  << " bytes failed, error is " << strerror(errno) << "." << std::endl;
+        queue.umem_size = 0;
+        return -1;
+    }
+    queue.umem = static_cast<uint8_t*>(umem);
+
+    struct xdp_umem_reg reg;
+    std::memset(&reg, 0, sizeof(reg));
+    reg.addr = reinterpret_cast<uint64_t>(queue.umem);
+    reg.len = queue.umem_size;
+    reg.chunk_size = _frame_size;
+    reg.headroom = 0;
+    if (setsockopt(queue.fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) == -1) {
+        std::cerr << StatisLogContext::getTimeString() << "Set XDP_UMEM_REG failed, error is "
+                  << strerror(errno) << "." << std::endl;
+        return -1;
+    }
+    // the completion ring is never used for rx only, but the kernel refuses to bind without it
+    uint32_t entries = _frame_count;
+    if (setsockopt(queue.fd, SOL_XDP, XDP_UMEM_FILL_RING, &entries, sizeof(entries)) == -1 ||
+        setsockopt(queue.fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &entries, sizeof(entries)) == -1 ||
+        setsockopt(queue.fd, SOL_XDP, XDP_RX_RING, &entries, sizeof(entries)) == -1) {
+        std::cerr << StatisLogContext::getTimeString() << "Set AF_XDP ring size to " << entries
+                  << " failed, error is " << strerror(errno) << "." << std::endl;
+        return -1;
+    }
+
+    struct xdp_mmap_offsets off;
+    socklen_t optlen = sizeof(off);
+    if (getsockopt(queue.fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) == -1) {
+        std::cerr << StatisLogContext::getTimeString() << "Get XDP_MMAP_OFFSETS failed, error is "
+                  << strerror(errno) << "." << std::endl;
+        return -1;
+    }
+    if (mapXdpRing(queue.fd, off.fr, entries, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING, queue.fill.map,
+                   queue.fill.map_size, queue.fill.producer, queue.fill.consumer, queue.fill.flags,
+                   queue.fill.descs) != 0 ||
+        mapXdpRing(queue.fd, off.cr, entries, sizeof(uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING, queue.comp.map,
+                   queue.comp.map_size, queue.comp.producer, queue.comp.consumer, queue.comp.flags,
+                   queue.comp.descs) != 0 ||
+        mapXdpRing(queue.fd, off.rx, entries, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING, queue.rx.map,
+                   queue.rx.map_size, queue.rx.producer, queue.rx.consumer, queue.rx.flags,
+                   queue.rx.descs) != 0) {
+        std::cerr << StatisLogContext::getTimeString() << "Map AF_XDP rings failed, error is "
+                  << strerror(errno) << "." << std::endl;
+        return -1;
+    }
+    queue.fill.mask = entries - 1;
+    queue.comp.mask = entries - 1;
+    queue.rx.mask = entries - 1;
+
+    // hand every frame of the UMEM to the kernel before binding
+    uint64_t* addrs = static_cast<uint64_t*>(queue.fill.descs);
+    for (uint32_t i = 0; i < entries; ++i) {
+        addrs[i] = static_cast<uint64_t>(i) * _frame_size;
+    }
+    __atomic_store_n(queue.fill.producer, entries, __ATOMIC_RELEASE);
+
+    struct sockaddr_xdp addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sxdp_family = AF_XDP;
+    addr.sxdp_ifindex = static_cast<uint32_t>(_ifindex);
+    addr.sxdp_queue_id = queue_id;
+    addr.sxdp_flags = static_cast<uint16_t>((zerocopy ? XDP_ZEROCOPY : XDP_COPY) | XDP_USE_NEED_WAKEUP);
+    if (bind(queue.fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+void PcapXdpHandler::closeQueue(xdp_queue_t& queue) {
+    xdp_ring_t* rings[] = { &queue.fill, &queue.comp, &queue.rx };
+    for (size_t i = 0; i < sizeof(rings) / sizeof(rings[0]); ++i) {
+        if (rings[i]->map != NULL) {
+            munmap(rings[i]->map, rings[i]->map_size);
+            rings[i]->map = NULL;
+        }
+    }
+    if (queue.fd != INVALIDE_XDP_FD) {
+        close(queue.fd);
+        queue.fd = INVALIDE_XDP_FD;
+    }
+    if (queue.umem != NULL) {
+        munmap(queue.umem, queue.umem_size);
+        queue.umem = NULL;
+    }
+}
+
+void PcapXdpHandler::closeXdp() {
+    if (_attached) {
+        int ret = xdp_detach_prog(_ifindex, _prog_fd, _generic);
+        if (ret != 0) {
+            std::cerr << StatisLogContext::getTimeString() << "Detach XDP program failed, error is "
+                      << strerror(-ret) << ", the program on the NIC is left as it is." << std::endl;
+        }
+        _attached = false;
+    }
+    for (size_t i = 0; i < _queues.size(); ++i) {
+        closeQueue(_queues[i]);
+    }
+    _queues.clear();
+    if (_prog_fd != INVALIDE_XDP_FD) {
+        close(_prog_fd);
+        _prog_fd = INVALIDE_XDP_FD;
+    }
+    if (_map_fd != INVALIDE_XDP_FD) {
+        close(_map_fd);
+        _map_fd = INVALIDE_XDP_FD;
+    }
+    if (_has_filter) {
+        pcap_freecode(&_filter);
+        _has_filter = false;
+    }
+}
+
+int PcapXdpHandler::compileFilter(const std::string& expression) {
+    if (expression.length() == 0) {
+        return 0;
+    }
+    std::cout << StatisLogContext::getTimeString() << "Set pcap filter as \"" << expression << "\"." << std::endl;
+
+    // frames never reach a socket filter on the XDP path, the program runs in userspace
+    pcap_t* pcap_handle = pcap_open_dead(DLT_EN10MB, static_cast<int>(_snaplen));
+    if (!pcap_handle) {
+        std::cerr << StatisLogContext::getTimeString() << "Call pcap_open_dead failed." << std::endl;
+        return -1;
+    }
+    auto pcapGuard = MakeGuard([pcap_handle]() {
+        pcap_close(pcap_handle);
+    });
+    if (pcap_compile(pcap_handle, &_filter, expression.c_str(), 0, PCAP_NETMASK_UNKNOWN) != 0) {
+        std::cerr << StatisLogContext::getTimeString() << "Call pcap_compile failed, error is "
+                  << pcap_geterr(pcap_handle) << "." << std::endl;
+        return -1;
+    }
+    _has_filter = true;
+    return 0;
+}
+
+int PcapXdpHandler::openPcap(const std::string& dev, const pcap_init_t& param, const std::string& expression,
+                             bool dumpfile) {
+    closeXdp();
+    _need_update_status = param.need_update_status;
+    setBatchSize(param.batch_size);
+    _snaplen = static_cast<uint32_t>(param.snaplen > 0 ? param.snaplen : 65535);
+    _received = 0;
+    _frame_count = DEFAULT_XDP_FRAME_COUNT;
+    if (param.xdp_frame_count > 0) {
+        // ring sizes must be a power of 2
+        _frame_count = 1;
+        while (_frame_count < static_cast<uint32_t>(param.xdp_frame_count)) {
+            _frame_count <<= 1;
+        }
+    }
+    auto xdpGuard = MakeGuard([this]() {
+        closeXdp();
+    });
+
+    _ifindex = static_cast<int>(if_nametoindex(dev.c_str()));
+    if (_ifindex == 0) {
+        std::cerr << StatisLogContext::getTimeString() << "Interface " << dev << " not found." << std::endl;
+        return -1;
+    }
+    int queue_count = param.xdp_queue_count;
+    if (queue_count <= 0) {
+        queue_count = getRxQueueCount(dev);
+        if (queue_count <= 0) {
+            std::cerr << StatisLogContext::getTimeString() << "Can not find rx queues of " << dev
+                      << ", set the count with --xdp-queues." << std::endl;
+            return -1;
+        }
+    }
+    if (compileFilter(expression) != 0) {
+        return -1;
+    }
+
+    _map_fd = xdp_create_xsk_map(static_cast<uint32_t>(queue_count));
+    if (_map_fd < 0) {
+        std::cerr << StatisLogContext::getTimeString() << "Create XSKMAP failed, error is "
+                  << strerror(-_map_fd) << "." << std::endl;
+        _map_fd = INVALIDE_XDP_FD;
+        return -1;
+    }
+    _prog_fd = xdp_load_redirect_prog(_map_fd);
+    if (_prog_fd < 0) {
+        std::cerr << StatisLogContext::getTimeString() << "Load XDP program failed, error is "
+                  << strerror(-_prog_fd) << "." << std::endl;
+        _prog_fd = INVALIDE_XDP_FD;
+        return -1;
+    }
+
+    // native mode first, drivers without XDP support only take the generic (skb) mode
+    _generic = false;
+    int ret = xdp_attach_prog(_ifindex, _prog_fd, false);
+    if (ret != 0 && ret != -EBUSY) {
+        std::cout << StatisLogContext::getTimeString() << "Attach XDP program to " << dev
+                  << " in native mode failed, error is " << strerror(-ret) << ", try generic mode." << std::endl;
+        _generic = true;
+        ret = xdp_attach_prog(_ifindex, _prog_fd, true);
+    }
+    // EEXIST: a program in the other mode, the kernel runs only one of them
+    if (ret == -EBUSY || ret == -EEXIST) {
+        std::cerr << StatisLogContext::getTimeString() << dev << " already has an XDP program attached, "
+                  << "pktminerg does not replace it; detach it or use another capture backend." << std::endl;
+        return -1;
+    }
+    if (ret != 0) {
+        std::cerr << StatisLogContext::getTimeString() << "Attach XDP program to " << dev
+                  << " in generic mode failed, error is " << strerror(-ret) << "." << std::endl;
+        return -1;
+    }
+    _attached = true;
+
+    xdp_queue_t closed_queue;
+    std::memset(&closed_queue, 0, sizeof(closed_queue));
+    closed_queue.fd = INVALIDE_XDP_FD;
+    _queues.assign(static_cast<size_t>(queue_count), closed_queue);
+    for (int i = 0; i < queue_count; ++i) {
+        xdp_queue_t& queue = _queues[i];
+        uint32_t queue_id = static_cast<uint32_t>(i);
+        if (_generic || openQueue(queue, queue_id, true) != 0) {
+            closeQueue(queue);
+            if (openQueue(queue, queue_id, false) != 0) {
+                std::cerr << StatisLogContext::getTimeString() << "Bind AF_XDP socket to " << dev << " queue "
+                          << queue_id << " failed, error is " << strerror(errno) << "." << std::endl;
+                closeQueue(queue);
+                return -1;
+            }
+        }
+        ret = xdp_update_xsk_map(_map_fd, queue_id, queue.fd);
+        if (ret != 0) {
+            std::cerr << StatisLogContext::getTimeString() << "Update XSKMAP for queue " << queue_id
+                      << " failed, error is " << strerror(-ret) << "." << std::endl;
+            return -1;
+        }
+        std::cout << StatisLogContext::getTimeString() << "AF_XDP socket bound to " << dev << " queue " << queue_id
+                  << " in " << (_generic ? "generic" : "native") << " mode, "
+                  << (queue.zerocopy ? "zero-copy" : "copy") << "." << std::endl;
+    }
+
+    if (dumpfile) {
+        pcap_t* pcap_handle = pcap_open_dead(DLT_EN10MB, static_cast<int>(_snaplen));
+        if (!pcap_handle) {
+            std::cerr << StatisLogContext::getTimeString() << "Call pcap_open_dead failed." << std::endl;
+            return -1;
+        }
+        ret = openPcapDumper(pcap_handle);
+        pcap_close(pcap_handle);
+        if (ret != 0) {
+            std::cerr << StatisLogContext::getTimeString() << "Call openPcapDumper failed." << std::endl;
+            return -1;
+        }
+    }
+    xdpGuard.Dismiss();
+    return 0;
+}
+
+int PcapXdpHandler::receiveQueue(xdp_queue_t& queue, int count, int handled) {
+    const uint32_t cons = *queue.rx.consumer;
+    uint32_t avail = __atomic_load_n(queue.rx.producer, __ATOMIC_ACQUIRE) - cons;
+    if (avail == 0) {
+        return handled;
+    }
+    if (avail > static_cast<uint32_t>(_batch_size)) {
+        avail = static_cast<uint32_t>(_batch_size);
+    }
+    const struct xdp_desc* descs = static_cast<const struct xdp_desc*>(queue.rx.descs);
+    uint64_t* fill_addrs = static_cast<uint64_t*>(queue.fill.descs);
+    const uint32_t fill_prod = *queue.fill.producer;
+
+    // the rx ring carries no timestamp, stamp the whole burst when it is picked up
+    struct pcap_pkthdr header;
+    gettimeofday(&header.ts, NULL);
+    uint32_t i = 0;
+    for (; i < avail && (count <= 0 || handled < count); ++i) {
+        const struct xdp_desc& desc = descs[(cons + i) & queue.rx.mask];
+        const uint8_t* pkt_data = queue.umem + desc.addr;
+        header.len = desc.len;
+        header.caplen = desc.len > _snaplen ? _snaplen : desc.len;
+        if (!_has_filter || pcap_offline_filter(&_filter, &header, pkt_data)) {
+            _batch.push_back(header, pkt_data);
+            handled++;
+        }
+    }
+    batchHandler(_batch);
+    _batch.clear();
+
+    // the frames are free again once the exporters returned
+    for (uint32_t j = 0; j < i; ++j) {
+        const uint64_t addr = descs[(cons + j) & queue.rx.mask].addr;
+        fill_addrs[(fill_prod + j) & queue.fill.mask] = addr - addr % _frame_size;
+    }
+    __atomic_store_n(queue.rx.consumer, cons + i, __ATOMIC_RELEASE);
+    __atomic_store_n(queue.fill.producer, fill_prod + i, __ATOMIC_RELEASE);
+    _received += i;
+    if (__atomic_load_n(queue.fill.flags, __ATOMIC_ACQUIRE) & XDP_RING_NEED_WAKEUP) {
+        recvfrom(queue.fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+    }
+    return handled;
+}
+
+int PcapXdpHandler::startPcapLoop(int count) {
+    if (_queues.empty()) {
+        std::cerr << StatisLogContext::getTimeString() << "The pcap has not created." << std::endl;
+        return -1;
+    }
+    _stop = false;
+    int handled = 0;
+    std::vector<struct pollfd> pfds(_queues.size());
+    for (size_t i = 0; i < _queues.size(); ++i) {
+        pfds[i].fd = _queues[i].fd;
+        pfds[i].events = POLLIN;
+        pfds[i].revents = 0;
+    }
+    while (!_stop && (count <= 0 || handled < count)) {
+        const uint64_t before = _received;
+        for (size_t i = 0; i < _queues.size() && (count <= 0 || handled < count); ++i) {
+            handled = receiveQueue(_queues[i], count, handled);
+        }
+        if (_received == before) {
+            flushExports();
+            poll(pfds.data(), pfds.size(), XDP_POLL_TIMEOUT_MS);
+        }
+    }
+    logEndStatis();
+    return 0;
+}
+
+void PcapXdpHandler::stopPcapLoop() {
+    _stop = true;
+}
+
+int PcapXdpHandler::getCaptureStats(struct pcap_stat* stat) {
+    if (_queues.empty()) {
+        return -1;
+    }
+    // XDP_STATISTICS counters are cumulative, unlike PACKET_STATISTICS
+    uint64_t drops = 0;
+    for (size_t i = 0; i < _queues.size(); ++i) {
+        struct xdp_statistics xstats;
+        std::memset(&xstats, 0, sizeof(xstats));
+        socklen_t len = sizeof(xstats);
+        if (getsockopt(_queues[i].fd, SOL_XDP, XDP_STATISTICS, &xstats, &len) == -1) {
+            return -1;
+        }
+        drops += xstats.rx_dropped + xstats.rx_ring_full;
+    }
+    stat->ps_recv = static_cast<u_int>(_received + drops);
+    stat->ps_drop = static_cast<u_int>(drops);
+    stat->ps_ifdrop = 0;
+    return 0;
+}
+
+int PcapXdpHandler::getCaptureFd() {
+    // the frames are already spread over queues by the NIC, no fanout group on top of that
+    return INVALIDE_XDP_FD;
+}
+
+int PcapXdpHandler::getSelectableFd() {
+    // one socket per rx queue, nothing a single fd can stand for
+    return INVALIDE_XDP_FD;
+}
@@ -0,0 +1,71 @@
+#ifndef SRC_XDPHANDLER_H_
+#define SRC_XDPHANDLER_H_
+
+#include <string>
+#include <vector>
+#include "pcaphandler.h"
+
+// Capture through AF_XDP sockets, one socket and one UMEM per rx queue of the interface.
+// An XDP program redirects every frame to the socket of its queue, the frames are handed to
+// the exporters straight from the UMEM and their frames go back to the fill ring afterwards.
+// Zero-copy is used when the driver supports it, otherwise copy mode, and generic (skb) XDP
+// when the driver has no native XDP at all (veth pairs, most virtual NICs).
+class PcapXdpHandler : public PcapHandler {
+protected:
+    typedef struct XdpRing {
+        uint32_t* producer;
+        uint32_t* consumer;
+        uint32_t* flags;
+        void* descs;
+        uint32_t mask;
+        void* map;
+        size_t map_size;
+    } xdp_ring_t;
+
+    typedef struct XdpQueue {
+        int fd;
+        uint32_t queue_id;
+        bool zerocopy;
+        uint8_t* umem;
+        size_t umem_size;
+        xdp_ring_t fill;
+        xdp_ring_t comp;
+        xdp_ring_t rx;
+    } xdp_queue_t;
+
+    std::vector<xdp_queue_t> _queues;
+    int _ifindex;
+    int _map_fd;
+    int _prog_fd;
+    bool _generic;
+    bool _attached;
+    uint32_t _snaplen;
+    uint32_t _frame_size;
+    uint32_t _frame_count;
+    struct bpf_program _filter;
+    bool _has_filter;
+    volatile bool _stop;
+    uint64_t _received;
+
+protected:
+    int compileFilter(const std::string& expression);
+    int openQueue(xdp_queue_t& queue, uint32_t queue_id, bool zerocopy);
+    void closeQueue(xdp_queue_t& queue);
+    int receiveQueue(xdp_queue_t& queue, int count, int handled);
+    void closeXdp();
+
+public:
+    PcapXdpHandler();
+    ~PcapXdpHandler();
+    int openPcap(const std::string& dev, const pcap_init_t& param, const std::string& expression,
+                 bool dumpfile=false);
+    int startPcapLoop(int count);
+    void stopPcapLoop();
+    int getCaptureStats(struct pcap_stat* stat);
+    int getCaptureFd();
+    int getSelectableFd();
+
+    static int getRxQueueCount(const std::string& dev);
+};
+
+#endif // SRC_XDPHANDLER_H_
@@ -0,0 +1,215 @@
+#include "xdpprog.h"
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+static int sys_bpf(int cmd, union bpf_attr* attr) {
+    return static_cast<int>(syscall(__NR_bpf, cmd, attr, sizeof(*attr)));
+}
+
+static uint64_t ptr_to_u64(const void* ptr) {
+    return static_cast<uint64_t>(reinterpret_cast<uintptr_t>(ptr));
+}
+
+int xdp_create_xsk_map(uint32_t max_entries) {
+    union bpf_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.map_type = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size = sizeof(uint32_t);
+    attr.value_size = sizeof(int);
+    attr.max_entries = max_entries;
+    int fd = sys_bpf(BPF_MAP_CREATE, &attr);
+    return fd < 0 ? -errno : fd;
+}
+
+int xdp_load_redirect_prog(int map_fd) {
+    // r2 = ctx->rx_queue_index
+    // r1 = map_fd
+    // r3 = XDP_PASS, returned by bpf_redirect_map when the queue has no socket
+    // return bpf_redirect_map(r1, r2, r3)
+    struct bpf_insn insns[] = {
+        { BPF_LDX | BPF_W | BPF_MEM, BPF_REG_2, BPF_REG_1,
+          static_cast<int16_t>(offsetof(struct xdp_md, rx_queue_index)), 0 },
+        { BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, map_fd },
+        { 0, 0, 0, 0, 0 },
+        { BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, XDP_PASS },
+        { BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map },
+        { BPF_JMP | BPF_EXIT, 0, 0, 0, 0 },
+    };
+    static const char license[] = "GPL";
+
+    union bpf_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insn_cnt = sizeof(insns) / sizeof(insns[0]);
+    attr.insns = ptr_to_u64(insns);
+    attr.license = ptr_to_u64(license);
+    int fd = sys_bpf(BPF_PROG_LOAD, &attr);
+    return fd < 0 ? -errno : fd;
+}
+
+int xdp_update_xsk_map(int map_fd, uint32_t queue_id, int xsk_fd) {
+    union bpf_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.map_fd = static_cast<uint32_t>(map_fd);
+    attr.key = ptr_to_u64(&queue_id);
+    attr.value = ptr_to_u64(&xsk_fd);
+    attr.flags = BPF_ANY;
+    return sys_bpf(BPF_MAP_UPDATE_ELEM, &attr) < 0 ? -errno : 0;
+}
+
+// sends one rtnetlink request and reads the answer into buf, returns its length or -errno
+static int netlink_request(struct nlmsghdr* nh, char* buf, size_t buf_len) {
+    int sock = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (sock < 0) {
+        return -errno;
+    }
+    int ret = 0;
+    if (send(sock, nh, nh->nlmsg_len, 0) < 0) {
+        ret = -errno;
+    } else {
+        ssize_t len = recv(sock, buf, buf_len, 0);
+        ret = len < 0 ? -errno : static_cast<int>(len);
+    }
+    close(sock);
+    return ret;
+}
+
+static int xdp_set_link_prog(int ifindex, int prog_fd, uint32_t flags) {
+    struct {
+        struct nlmsghdr nh;
+        struct ifinfomsg ifinfo;
+        char attrbuf[64];
+    } req;
+    std::memset(&req, 0, sizeof(req));
+    req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+    req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+    req.nh.nlmsg_type = RTM_SETLINK;
+    req.nh.nlmsg_seq = 1;
+    req.ifinfo.ifi_family = AF_UNSPEC;
+    req.ifinfo.ifi_index = ifindex;
+
+    // IFLA_XDP { IFLA_XDP_FD, IFLA_XDP_FLAGS }
+    struct rtattr* xdp = reinterpret_cast<struct rtattr*>(reinterpret_cast<char*>(&req) +
+                                                          NLMSG_ALIGN(req.nh.nlmsg_len));
+    xdp->rta_type = NLA_F_NESTED | IFLA_XDP;
+    xdp->rta_len = RTA_LENGTH(0);
+    struct rtattr* attr = reinterpret_cast<struct rtattr*>(reinterpret_cast<char*>(xdp) + xdp->rta_len);
+    attr->rta_type = IFLA_XDP_FD;
+    attr->rta_len = RTA_LENGTH(sizeof(int));
+    std::memcpy(RTA_DATA(attr), &prog_fd, sizeof(int));
+    xdp->rta_len = static_cast<unsigned short>(xdp->rta_len + RTA_ALIGN(attr->rta_len));
+    attr = reinterpret_cast<struct rtattr*>(reinterpret_cast<char*>(xdp) + xdp->rta_len);
+    attr->rta_type = IFLA_XDP_FLAGS;
+    attr->rta_len = RTA_LENGTH(sizeof(uint32_t));
+    std::memcpy(RTA_DATA(attr), &flags, sizeof(uint32_t));
+    xdp->rta_len = static_cast<unsigned short>(xdp->rta_len + RTA_ALIGN(attr->rta_len));
+    req.nh.nlmsg_len = NLMSG_ALIGN(req.nh.nlmsg_len) + RTA_ALIGN(xdp->rta_len);
+
+    char buf[4096];
+    int len = netlink_request(&req.nh, buf, sizeof(buf));
+    if (len < 0) {
+        return len;
+    }
+    for (struct nlmsghdr* nh = reinterpret_cast<struct nlmsghdr*>(buf); NLMSG_OK(nh, len);
+         nh = NLMSG_NEXT(nh, len)) {
+        if (nh->nlmsg_type == NLMSG_ERROR) {
+            struct nlmsgerr* err = static_cast<struct nlmsgerr*>(NLMSG_DATA(nh));
+            return err->error;
+        }
+    }
+    return 0;
+}
+
+// id of the XDP program attached to the link in the given mode, 0 when there is none
+static int xdp_query_link_prog(int ifindex, bool generic, uint32_t& prog_id) {
+    struct {
+        struct nlmsghdr nh;
+        struct ifinfomsg ifinfo;
+    } req;
+    std::memset(&req, 0, sizeof(req));
+    req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+    req.nh.nlmsg_flags = NLM_F_REQUEST;
+    req.nh.nlmsg_type = RTM_GETLINK;
+    req.nh.nlmsg_seq = 1;
+    req.ifinfo.ifi_family = AF_UNSPEC;
+    req.ifinfo.ifi_index = ifindex;
+
+    // the link message carries all statistics of the device
+    std::vector<char> buf(32768);
+    int len = netlink_request(&req.nh, buf.data(), buf.size());
+    if (len < 0) {
+        return len;
+    }
+    prog_id = 0;
+    for (struct nlmsghdr* nh = reinterpret_cast<struct nlmsghdr*>(buf.data()); NLMSG_OK(nh, len);
+         nh = NLMSG_NEXT(nh, len)) {
+        if (nh->nlmsg_type == NLMSG_ERROR) {
+            return static_cast<struct nlmsgerr*>(NLMSG_DATA(nh))->error;
+        }
+        if (nh->nlmsg_type != RTM_NEWLINK) {
+            continue;
+        }
+        int attr_len = static_cast<int>(IFLA_PAYLOAD(nh));
+        for (struct rtattr* attr = IFLA_RTA(NLMSG_DATA(nh)); RTA_OK(attr, attr_len);
+             attr = RTA_NEXT(attr, attr_len)) {
+            if ((attr->rta_type & ~NLA_F_NESTED) != IFLA_XDP) {
+                continue;
+            }
+            // IFLA_XDP_PROG_ID when one program is attached, one id per mode when there are several
+            int xdp_len = static_cast<int>(RTA_PAYLOAD(attr));
+            for (struct rtattr* xdp = static_cast<struct rtattr*>(RTA_DATA(attr)); RTA_OK(xdp, xdp_len);
+                 xdp = RTA_NEXT(xdp, xdp_len)) {
+                uint8_t mode;
+                if (xdp->rta_type == IFLA_XDP_ATTACHED) {
+                    std::memcpy(&mode, RTA_DATA(xdp), sizeof(mode));
+                    if (mode != (generic ? XDP_ATTACHED_SKB : XDP_ATTACHED_DRV) && mode != XDP_ATTACHED_MULTI) {
+                        return 0;
+                    }
+                } else if (xdp->rta_type == IFLA_XDP_PROG_ID ||
+                           xdp->rta_type == (generic ? IFLA_XDP_SKB_PROG_ID : IFLA_XDP_DRV_PROG_ID)) {
+                    std::memcpy(&prog_id, RTA_DATA(xdp), sizeof(prog_id));
+                }
+            }
+        }
+        return 0;
+    }
+    return -ENODEV;
+}
+
+int xdp_attach_prog(int ifindex, int prog_fd, bool generic) {
+    // never replace a program someone else attached
+    return xdp_set_link_prog(ifindex, prog_fd, XDP_FLAGS_UPDATE_IF_NOEXIST |
+                                               (generic ? XDP_FLAGS_SKB_MODE : XDP_FLAGS_DRV_MODE));
+}
+
+int xdp_detach_prog(int ifindex, int prog_fd, bool generic) {
+    struct bpf_prog_info info;
+    std::memset(&info, 0, sizeof(info));
+    union bpf_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.info.bpf_fd = static_cast<uint32_t>(prog_fd);
+    attr.info.info_len = sizeof(info);
+    attr.info.info = ptr_to_u64(&info);
+    if (sys_bpf(BPF_OBJ_GET_INFO_BY_FD, &attr) < 0) {
+        return -errno;
+    }
+    uint32_t attached = 0;
+    int ret = xdp_query_link_prog(ifindex, generic, attached);
+    if (ret != 0) {
+        return ret;
+    }
+    if (attached != info.id) {
+        // somebody else replaced or removed our program meanwhile
+        return -ENOENT;
+    }
+    return xdp_set_link_prog(ifindex, -1, generic ? XDP_FLAGS_SKB_MODE : XDP_FLAGS_DRV_MODE);
+}
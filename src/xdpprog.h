@@ -0,0 +1,27 @@
+#ifndef SRC_XDPPROG_H_
+#define SRC_XDPPROG_H_
+
+#include <stdint.h>
+
+// Minimal XDP program management for the AF_XDP capture backend, done with raw bpf() and
+// netlink calls so that no libbpf is needed. Kept apart from the capture handler because
+// <linux/bpf.h> and <pcap/pcap.h> both define struct bpf_insn.
+// All functions return a file descriptor or 0 on success, -errno on failure.
+
+// XSKMAP with one slot per rx queue
+int xdp_create_xsk_map(uint32_t max_entries);
+
+// program which redirects every frame of a queue to the AF_XDP socket stored in the map for
+// that queue, frames of queues without socket go on to the kernel stack
+int xdp_load_redirect_prog(int map_fd);
+
+int xdp_update_xsk_map(int map_fd, uint32_t queue_id, int xsk_fd);
+
+// generic=false attaches in native (driver) mode, generic=true in skb mode;
+// -EBUSY when the link already has a program in that mode, which is left alone
+int xdp_attach_prog(int ifindex, int prog_fd, bool generic);
+
+// only detaches prog_fd, -ENOENT when the link has another program or none
+int xdp_detach_prog(int ifindex, int prog_fd, bool generic);
+
+#endif // SRC_XDPPROG_H_
@@ -0,0 +1,283 @@
+#include "zmqspool.h"
+#include <iostream>
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include <boost/filesystem.hpp>
+#include "statislog.h"
+
+// a segment holds at least one largest zmq batch (1 MB), larger spools get more segments rather than larger ones
+const size_t MIN_SPOOL_SEGMENT_SIZE = 4 * 1024 * 1024;
+const size_t MAX_SPOOL_SEGMENT_SIZE = 64 * 1024 * 1024;
+const size_t SPOOL_RECORD_ALIGN = 8;
+const uint16_t SPOOL_RECORD_QUEUED = 0x5351;
+const uint16_t SPOOL_RECORD_SENT = 0x5353;
+const char* const SPOOL_SUFFIX = ".spool";
+
+// in front of every batch, a segment ends at the first record of length 0 (files are created zero filled)
+typedef struct ZmqSpoolRecord {
+    uint32_t length;
+    uint16_t pkts_num;
+    uint16_t state;
+    uint64_t chunk_seq;
+} zmq_spool_record_t;
+
+static size_t recordLength(uint32_t length) {
+    const size_t record = sizeof(zmq_spool_record_t) + length;
+    return (record + SPOOL_RECORD_ALIGN - 1) / SPOOL_RECORD_ALIGN * SPOOL_RECORD_ALIGN;
+}
+
+ZmqSpool::ZmqSpool(const std::string& dir, const std::string& name, size_t max_bytes) :
+        _dir(dir),
+        _name(name),
+        _next_seq(0),
+        _bytes(0),
+        _batches(0) {
+    const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    _segment_size = std::max(std::min(max_bytes / 4, MAX_SPOOL_SEGMENT_SIZE), MIN_SPOOL_SEGMENT_SIZE);
+    _segment_size = _segment_size / page * page;
+    _max_segments = std::max(max_bytes / _segment_size, static_cast<size_t>(2));
+}
+
+ZmqSpool::~ZmqSpool() {
+    close();
+}
+
+std::string ZmqSpool::segmentPath(uint64_t seq) const {
+    char name[32];
+    snprintf(name, sizeof(name), "-%020llu", static_cast<unsigned long long>(seq));
+    return _dir + "/" + _name + name + SPOOL_SUFFIX;
+}
+
+int ZmqSpool::open() {
+    boost::system::error_code ec;
+    boost::filesystem::create_directories(_dir, ec);
+    if (ec) {
+        std::cerr << StatisLogContext::getTimeString() << "Create spool directory " << _dir << " failed, error is "
+                  << ec.message() << "." << std::endl;
+        return -1;
+    }
+    // segments of a previous run, oldest first
+    const std::string prefix = _name + "-";
+    std::vector<uint64_t> seqs;
+    boost::filesystem::directory_iterator it(_dir, ec);
+    for (; !ec && it != boost::filesystem::directory_iterator(); it.increment(ec)) {
+        const std::string name = it->path().filename().string();
+        const size_t suffix_len = std::strlen(SPOOL_SUFFIX);
+        if (name.size() <= prefix.size() + suffix_len || name.compare(0, prefix.size(), prefix) != 0
+            || name.compare(name.size() - suffix_len, suffix_len, SPOOL_SUFFIX) != 0) {
+            continue;
+        }
+        const std::string digits = name.substr(prefix.size(), name.size() - prefix.size() - suffix_len);
+        if (digits.find_first_not_of("0123456789") != std::string::npos) {
+            continue;
+        }
+        seqs.push_back(std::strtoull(digits.c_str(), NULL, 10));
+    }
+    if (ec) {
+        std::cerr << StatisLogContext::getTimeString() << "List spool directory " << _dir << " failed, error is "
+                  << ec.message() << "." << std::endl;
+        return -1;
+    }
+    std::sort(seqs.begin(), seqs.end());
+    for (size_t i = 0; i < seqs.size(); ++i) {
+        if (openSegment(seqs[i], false) != 0) {
+            continue;
+        }
+        recoverSegment(_segments.back());
+        _next_seq = seqs[i] + 1;
+    }
+    if (_batches > 0) {
+        std::cout << StatisLogContext::getTimeString() << "Spool " << _name << " resumes with " << _batches
+                  << " batches of " << _bytes << " bytes." << std::endl;
+    }
+    return 0;
+}
+
+void ZmqSpool::close() {
+    while (!_segments.empty()) {
+        zmq_spool_segment_t& segment = _segments.front();
+        closeSegment(segment, segment.batches == 0);
+        _segments.pop_front();
+    }
+    _bytes = 0;
+    _batches = 0;
+}
+
+int ZmqSpool::openSegment(uint64_t seq, bool create) {
+    const std::string path = segmentPath(seq);
+    int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC | (create ? O_CREAT | O_TRUNC : 0), 0600);
+    if (fd == -1) {
+        std::cerr << StatisLogContext::getTimeString() << "Open spool segment " << path << " failed, error is "
+                  << strerror(errno) << "." << std::endl;
+        return -1;
+    }
+    size_t size = _segment_size;
+    if (create) {
+        if (ftruncate(fd, static_cast<off_t>(size)) == -1) {
+            std::cerr << StatisLogContext::getTimeString() << "Size spool segment " << path << " failed, error is "
+                      << strerror(errno) << "." << std::endl;
+            ::close(fd);
+            unlink(path.c_str());
+            return -1;
+        }
+    } else {
+        struct stat st;
+        if (fstat(fd, &st) == -1 || static_cast<size_t>(st.st_size) < sizeof(zmq_spool_record_t)) {
+            // not a segment this spool wrote
+            ::close(fd);
+            unlink(path.c_str());
+            return -1;
+        }
+        size = static_cast<size_t>(st.st_size);
+    }
+    void* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        std::cerr << StatisLogContext::getTimeString() << "Map spool segment " << path << " of " << size
+                  << " bytes failed, error is " << strerror(errno) << "." << std::endl;
+        ::close(fd);
+        if (create) {
+            unlink(path.c_str());
+        }
+        return -1;
+    }
+    // written once and read once, both from front to back
+    madvise(map, size, MADV_SEQUENTIAL);
+    zmq_spool_segment_t segment = { seq, fd, static_cast<uint8_t*>(map), size, 0, 0, 0, 0, 0 };
+    _segments.push_back(segment);
+    return 0;
+}
+
+void ZmqSpool::recoverSegment(zmq_spool_segment_t& segment) {
+    size_t pos = 0;
+    bool sent = true;
+    while (pos + sizeof(zmq_spool_record_t) <= segment.size) {
+        zmq_spool_record_t record;
+        std::memcpy(&record, segment.map + pos, sizeof(record));
+        if (record.length == 0 || pos + recordLength(record.length) > segment.size
+            || (record.state != SPOOL_RECORD_QUEUED && record.state != SPOOL_RECORD_SENT)) {
+            break;
+        }
+        // batches are sent in order, the sent ones are a prefix
+        if (record.state == SPOOL_RECORD_QUEUED) {
+            sent = false;
+        }
+        if (sent) {
+            segment.read_pos = pos + recordLength(record.length);
+        } else {
+            segment.batches++;
+            segment.pkts_num += record.pkts_num;
+            segment.bytes += record.length;
+            _batches++;
+            _bytes += record.length;
+        }
+        pos += recordLength(record.length);
+    }
+    // nothing is appended to an old segment
+    segment.write_pos = segment.size;
+    if (!sent) {
+        segment.write_pos = pos;
+    }
+}
+
+void ZmqSpool::closeSegment(zmq_spool_segment_t& segment, bool remove) {
+    munmap(segment.map, segment.size);
+    ::close(segment.fd);
+    if (remove) {
+        unlink(segmentPath(segment.seq).c_str());
+    }
+}
+
+int ZmqSpool::push(const void* data, uint32_t length, uint16_t pkts_num, uint64_t chunk_seq,
+                   uint64_t& dropped_batches, uint64_t& dropped_pkts) {
+    dropped_batches = 0;
+    dropped_pkts = 0;
+    const size_t record_length = recordLength(length);
+    if (record_length > _segment_size) {
+        return -1;
+    }
+    if (_segments.empty() || _segments.back().write_pos + record_length > _segments.back().size) {
+        if (!_segments.empty()) {
+            // the tail is complete, start writing it back
+            msync(_segments.back().map, _segments.back().size, MS_ASYNC);
+        }
+        while (_segments.size() >= _max_segments) {
+            zmq_spool_segment_t& oldest = _segments.front();
+            dropped_batches += oldest.batches;
+            dropped_pkts += oldest.pkts_num;
+            _batches -= oldest.batches;
+            _bytes -= oldest.bytes;
+            closeSegment(oldest, true);
+            _segments.pop_front();
+        }
+        if (openSegment(_next_seq, true) != 0) {
+            return -1;
+        }
+        _next_seq++;
+    }
+    zmq_spool_segment_t& segment = _segments.back();
+    zmq_spool_record_t record = { length, pkts_num, SPOOL_RECORD_QUEUED, chunk_seq };
+    std::memcpy(segment.map + segment.write_pos + sizeof(record), data, length);
+    std::memcpy(segment.map + segment.write_pos, &record, sizeof(record));
+    segment.write_pos += record_length;
+    segment.batches++;
+    segment.pkts_num += pkts_num;
+    segment.bytes += length;
+    _batches++;
+    _bytes += length;
+    return 0;
+}
+
+bool ZmqSpool::front(const uint8_t*& data, uint32_t& length, uint16_t& pkts_num, uint64_t& chunk_seq) {
+    while (!_segments.empty()) {
+        zmq_spool_segment_t& segment = _segments.front();
+        if (segment.batches > 0) {
+            zmq_spool_record_t record;
+            std::memcpy(&record, segment.map + segment.read_pos, sizeof(record));
+            data = segment.map + segment.read_pos + sizeof(record);
+            length = record.length;
+            pkts_num = record.pkts_num;
+            chunk_seq = record.chunk_seq;
+            return true;
+        }
+        if (_segments.size() == 1) {
+            // the tail, batches may still come
+            return false;
+        }
+        closeSegment(segment, true);
+        _segments.pop_front();
+    }
+    return false;
+}
+
+void ZmqSpool::pop() {
+    const uint8_t* data;
+    uint32_t length;
+    uint16_t pkts_num;
+    uint64_t chunk_seq;
+    if (!front(data, length, pkts_num, chunk_seq)) {
+        return;
+    }
+    zmq_spool_segment_t& segment = _segments.front();
+    const uint16_t state = SPOOL_RECORD_SENT;
+    std::memcpy(segment.map + segment.read_pos + offsetof(zmq_spool_record_t, state), &state, sizeof(state));
+    segment.read_pos += recordLength(length);
+    segment.batches--;
+    segment.pkts_num -= pkts_num;
+    segment.bytes -= length;
+    _batches--;
+    _bytes -= length;
+    // a read segment goes at once, unless more batches are written to it
+    if (segment.batches == 0 && _segments.size() > 1) {
+        closeSegment(segment, true);
+        _segments.pop_front();
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef SRC_ZMQSPOOL_H_
+#define SRC_ZMQSPOOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+#include <string>
+
+// zmq batches of one remote kept on disk while the remote is away: memory mapped segment files, written and read
+// from front to back. The oldest segment is dropped when the spool would grow over max_bytes. Segments left by a
+// previous run are sent first, a batch is marked sent in its file so it is not sent twice.
+// Not thread safe, the sender thread of the exporter owns the spool.
+class ZmqSpool {
+protected:
+    typedef struct ZmqSpoolSegment {
+        uint64_t seq;
+        int fd;
+        uint8_t* map;
+        size_t size;
+        size_t write_pos;
+        size_t read_pos;
+        // unsent batches
+        uint64_t batches;
+        uint64_t pkts_num;
+        size_t bytes;
+    } zmq_spool_segment_t;
+
+protected:
+    std::string _dir;
+    std::string _name;
+    size_t _segment_size;
+    size_t _max_segments;
+    uint64_t _next_seq;
+    std::deque<zmq_spool_segment_t> _segments;
+    size_t _bytes;
+    uint64_t _batches;
+
+private:
+    std::string segmentPath(uint64_t seq) const;
+    int openSegment(uint64_t seq, bool create);
+    void recoverSegment(zmq_spool_segment_t& segment);
+    void closeSegment(zmq_spool_segment_t& segment, bool remove);
+
+public:
+    // segment files are dir/name-SEQ.spool
+    ZmqSpool(const std::string& dir, const std::string& name, size_t max_bytes);
+    ~ZmqSpool();
+    ZmqSpool(const ZmqSpool&) = delete;
+    ZmqSpool& operator=(const ZmqSpool&) = delete;
+    int open();
+    // keeps the unsent batches on disk
+    void close();
+    // dropped_* count what the oldest segment held when it made room; -1 when the batch can't be written
+    // chunk_seq is kept with the batch, the seq of its chunk header when it is sent again
+    int push(const void* data, uint32_t length, uint16_t pkts_num, uint64_t chunk_seq, uint64_t& dropped_batches,
+             uint64_t& dropped_pkts);
+    // the oldest unsent batch, false when there is none
+    bool front(const uint8_t*& data, uint32_t& length, uint16_t& pkts_num, uint64_t& chunk_seq);
+    void pop();
+    bool empty() const { return _batches == 0; }
+    uint64_t batches() const { return _batches; }
+    // of the unsent batches
+    size_t bytes() const { return _bytes; }
+    size_t segmentSize() const { return _segment_size; }
+};
+
+#endif // SRC_ZMQSPOOL_H_
@@ -1,7 +1,26 @@
+#include <cstring>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <boost/filesystem.hpp>
 #include "gtest/gtest.h"
 #include "../src/syshelp.h"
 #include "../src/pcaphandler.h"
+#include "../src/tpackethandler.h"
+#include "../src/pcapreader.h"
+#include "../src/mmaphandler.h"
+#include "../src/mergehandler.h"
 #include "../src/socketgre.h"
+#include "../src/socketgrering.h"
+#include "../src/socketvxlan.h"
+#include "../src/socketbatch.h"
+#include "../src/flowhash.h"
+#include "../src/remotebalance.h"
+#include "../src/batchcodec.h"
+#include "../src/socketzmq.h"
+#include "../src/zmqspool.h"
 #include "../src/agent_status.h"
 #include "../src/agent_control_plane.h"
 
@@ -28,11 +47,203 @@ namespace {
     TEST(PcapHandlerTest, test) {
         PcapOfflineHandler handler;
         pcap_init_t param;
+        param.batch_size = 4;
+        param.replay_mode = pacemode::none;
+        param.replay_rate = 0;
+        param.replay_loop = 1;
         handler.addExport(std::make_shared<PcapExportTest>());
         EXPECT_EQ(0, handler.openPcap("sample.pcap", param, "", false));
         EXPECT_EQ(0, handler.startPcapLoop(10));
     }
 
+    TEST(PcapMmapHandler, test) {
+        PcapMmapHandler handler;
+        pcap_init_t param;
+        param.need_update_status = 0;
+        param.batch_size = 4;
+        param.replay_mode = pacemode::none;
+        param.replay_rate = 0;
+        param.replay_loop = 1;
+        handler.addExport(std::make_shared<PcapExportTest>());
+        EXPECT_EQ(0, handler.openPcap("sample.pcap", param, "", false));
+        EXPECT_EQ(0, handler.startPcapLoop(10));
+    }
+
+    class PcapExportOrder : public PcapExportBase {
+    public:
+        int count = 0;
+        bool ordered = true;
+        struct timeval last = {0, 0};
+
+        int initExport() {
+            return 0;
+        }
+
+        int exportPacket(const struct pcap_pkthdr* header, const uint8_t* pkt_data) {
+            if (timercmp(&header->ts, &last, <)) {
+                ordered = false;
+            }
+            last = header->ts;
+            count++;
+            return 0;
+        }
+
+        int closeExport() {
+            return 0;
+        }
+    };
+
+    TEST(PcapMergeHandler, test) {
+        PcapMmapHandler single;
+        pcap_init_t param;
+        param.need_update_status = 0;
+        param.batch_size = 4;
+        param.replay_mode = pacemode::none;
+        param.replay_rate = 0;
+        param.replay_loop = 1;
+        auto single_export = std::make_shared<PcapExportOrder>();
+        single.addExport(single_export);
+        ASSERT_EQ(0, single.openPcap("sample.pcap", param, "", false));
+        EXPECT_EQ(0, single.startPcapLoop(0));
+
+        PcapMergeHandler handler;
+        auto merge_export = std::make_shared<PcapExportOrder>();
+        handler.addExport(merge_export);
+        EXPECT_EQ(0, handler.openPcap("sample.pcap,sample.pcap", param, "", false));
+        EXPECT_EQ(0, handler.startPcapLoop(0));
+        EXPECT_EQ(2 * single_export->count, merge_export->count);
+        EXPECT_TRUE(merge_export->ordered);
+    }
+
+    TEST(PcapFileReader, chunks) {
+        PcapFileReader whole;
+        ASSERT_EQ(0, whole.open("xml.pcap"));
+        struct pcap_pkthdr header;
+        const uint8_t* data;
+        std::vector<uint32_t> caplens;
+        while (whole.next(&header, &data) == 1) {
+            caplens.push_back(header.caplen);
+        }
+        // every record is read by exactly one chunk, in file order
+        const uint32_t chunk_count = 5;
+        size_t index = 0;
+        for (uint32_t i = 0; i < chunk_count; ++i) {
+            PcapFileReader reader;
+            ASSERT_EQ(0, reader.open("xml.pcap"));
+            ASSERT_EQ(0, reader.selectChunk(i, chunk_count));
+            while (reader.next(&header, &data) == 1) {
+                ASSERT_LT(index, caplens.size());
+                EXPECT_EQ(caplens[index], header.caplen);
+                index++;
+            }
+        }
+        EXPECT_EQ(caplens.size(), index);
+    }
+
+    TEST(ReplayPacer, pps) {
+        ReplayPacer pacer;
+        pacer.setMode(pacemode::pps, 1000);
+        pcap_pkthdr header;
+        std::memset(&header, 0, sizeof(header));
+        header.caplen = 64;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < 20; ++i) {
+            if (!pacer.isDue(header)) {
+                pacer.waitDue();
+            }
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start).count();
+        // the 20th packet is due 19ms after the first one
+        EXPECT_GE(elapsed, 19);
+        EXPECT_LT(elapsed, 100);
+    }
+
+    TEST(PcapFileReader, same_as_libpcap) {
+        PcapFileReader reader;
+        ASSERT_EQ(0, reader.open("sample.pcap"));
+        char errbuf[PCAP_ERRBUF_SIZE];
+        pcap_t* pcap_handle = pcap_open_offline("sample.pcap", errbuf);
+        ASSERT_TRUE(pcap_handle != NULL);
+        EXPECT_EQ(pcap_datalink(pcap_handle), reader.getLinkType());
+        EXPECT_EQ(static_cast<uint32_t>(pcap_snapshot(pcap_handle)), reader.getSnaplen());
+
+        struct pcap_pkthdr* expect_header;
+        const uint8_t* expect_data;
+        struct pcap_pkthdr header;
+        const uint8_t* data;
+        int count = 0;
+        while (pcap_next_ex(pcap_handle, &expect_header, &expect_data) == 1) {
+            ASSERT_EQ(1, reader.next(&header, &data));
+            EXPECT_EQ(expect_header->ts.tv_sec, header.ts.tv_sec);
+            EXPECT_EQ(expect_header->ts.tv_usec, header.ts.tv_usec);
+            EXPECT_EQ(expect_header->len, header.len);
+            ASSERT_EQ(expect_header->caplen, header.caplen);
+            EXPECT_EQ(0, std::memcmp(expect_data, data, header.caplen));
+            count++;
+        }
+        EXPECT_GT(count, 0);
+        EXPECT_EQ(0, reader.next(&header, &data));
+        EXPECT_EQ(reader.getFileSize(), reader.getOffset());
+        pcap_close(pcap_handle);
+    }
+
+    // counts the UDP datagrams of length bytes to port 9 (discard)
+    class PcapExportDiscard : public PcapExportBase {
+    public:
+        size_t length;
+        int count = 0;
+
+        explicit PcapExportDiscard(size_t payload) : length(payload) {
+        }
+
+        int initExport() {
+            return 0;
+        }
+
+        int exportPacket(const struct pcap_pkthdr* header, const uint8_t* pkt_data) {
+            // Ethernet, IPv4 without options, UDP
+            if (header->caplen == 14 + 20 + 8 + length && pkt_data[23] == 17 && pkt_data[36] == 0 &&
+                pkt_data[37] == 9) {
+                count++;
+            }
+            return 0;
+        }
+
+        int closeExport() {
+            return 0;
+        }
+    };
+
+    TEST(PcapTpacketHandler, test) {
+        PcapTpacketHandler handler;
+        pcap_init_t param = {};
+        param.snaplen = 2048;
+        param.promisc = 0;
+        param.buffer_size = 4 * 1024 * 1024;
+        param.need_update_status = 0;
+        param.block_size = 1024 * 1024;
+        param.block_count = 0;
+        param.retire_timeout = 10;
+        param.batch_size = 64;
+        param.replay_loop = 1;
+        auto counter = std::make_shared<PcapExportDiscard>(64);
+        handler.addExport(counter);
+        ASSERT_EQ(0, handler.openPcap("lo", param, "udp dst port 9", false));
+
+        int socketfd = socket(AF_INET, SOCK_DGRAM, 0);
+        struct sockaddr_in addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(9);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        std::vector<char> payload(64);
+        EXPECT_EQ(64, sendto(socketfd, payload.data(), payload.size(), 0, (struct sockaddr*) &addr, sizeof(addr)));
+        close(socketfd);
+        EXPECT_EQ(0, handler.startPcapLoop(1));
+        EXPECT_EQ(1, counter->count);
+    }
+
     TEST(PcapExportGre, test) {
         std::vector<std::string> remoteips;
         remoteips.push_back("127.0.1.1");
@@ -46,6 +257,628 @@ namespace {
         EXPECT_EQ(0, greExport.closeExport());
     }
 
+    TEST(PcapExportGre, export_batch) {
+        std::vector<std::string> remoteips;
+        remoteips.push_back("127.0.1.1");
+        remoteips.push_back("127.0.1.2");
+        PcapExportGre greExport(remoteips, 2, "", IP_PMTUDISC_DONT);
+        EXPECT_EQ(0, greExport.initExport());
+        pcap_pkthdr header;
+        header.caplen = 32;
+        header.len = 32;
+        std::vector<uint8_t> pkt_data(32);
+        PacketBatch batch;
+        for (int i = 0; i < 8; ++i) {
+            batch.push_back(header, pkt_data.data());
+        }
+        EXPECT_EQ(0, greExport.exportBatch(batch));
+        EXPECT_EQ(0, greExport.closeExport());
+    }
+
+    // counts the GRE packets with key 2 which reached every remote so far
+    static void countGre(int receiver, const std::vector<std::string>& remoteips, std::vector<size_t>& counts) {
+        uint8_t buffer[256];
+        ssize_t length;
+        while ((length = recv(receiver, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+            for (size_t i = 0; i < remoteips.size(); ++i) {
+                uint32_t daddr = inet_addr(remoteips[i].c_str());
+                if (length == 20 + 8 + 32 && std::memcmp(buffer + 16, &daddr, 4) == 0 &&
+                    ntohl(*reinterpret_cast<uint32_t*>(buffer + 20 + 4)) == 2) {
+                    counts[i]++;
+                }
+            }
+        }
+    }
+
+    TEST(PcapExportGre, send_batch) {
+        int receiver = socket(AF_INET, SOCK_RAW, IPPROTO_GRE);
+        ASSERT_NE(-1, receiver);
+        std::vector<std::string> remoteips;
+        remoteips.push_back("127.0.1.1");
+        remoteips.push_back("127.0.1.2");
+        PcapExportGre greExport(remoteips, 2, "", IP_PMTUDISC_DONT);
+        greExport.setSendBatch(16, 1000000);
+        EXPECT_EQ(0, greExport.initExport());
+        pcap_pkthdr header;
+        header.caplen = 32;
+        header.len = 32;
+        std::vector<uint8_t> pkt_data(32);
+        PacketBatch batch;
+        for (int i = 0; i < 40; ++i) {
+            batch.push_back(header, pkt_data.data());
+        }
+        // two full sendmmsg rounds, the last 8 packets wait for flushExport
+        std::vector<size_t> counts(remoteips.size(), 0);
+        EXPECT_EQ(0, greExport.exportBatch(batch));
+        countGre(receiver, remoteips, counts);
+        EXPECT_EQ(std::vector<size_t>({32, 32}), counts);
+        EXPECT_EQ(0, greExport.flushExport());
+        countGre(receiver, remoteips, counts);
+        EXPECT_EQ(std::vector<size_t>({40, 40}), counts);
+        EXPECT_EQ(0, greExport.closeExport());
+        close(receiver);
+    }
+
+    TEST(PcapExportGre, erspan) {
+        int receiver = socket(AF_INET, SOCK_RAW, IPPROTO_GRE);
+        ASSERT_NE(-1, receiver);
+        std::vector<std::string> remoteips;
+        remoteips.push_back("127.0.1.3");
+        PcapExportGre greExport(remoteips, 2, "", IP_PMTUDISC_DONT);
+        greExport.setEncap(greencap::erspan3);
+        EXPECT_EQ(0, greExport.initExport());
+        pcap_pkthdr header;
+        header.caplen = 32;
+        header.len = 64;
+        header.ts.tv_sec = 1586508861;
+        header.ts.tv_usec = 5;
+        std::vector<uint8_t> pkt_data(32);
+        PacketBatch batch;
+        batch.push_back(header, pkt_data.data());
+        batch.push_back(header, pkt_data.data());
+        EXPECT_EQ(0, greExport.exportBatch(batch));
+
+        uint32_t sequence = 0;
+        int received = 0;
+        uint8_t buffer[256];
+        ssize_t length;
+        while (received < 2 && (length = recv(receiver, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+            if (std::memcmp(buffer + 16, "\x7f\x00\x01\x03", 4) != 0) {
+                continue;
+            }
+            // IP, GRE with sequence number, ERSPAN III, platform sub-header, packet
+            ASSERT_EQ(20 + 8 + 12 + 8 + 32, length);
+            const uint8_t* gre = buffer + 20;
+            EXPECT_EQ(0x10, gre[0]);
+            EXPECT_EQ(0x22, gre[2]);
+            EXPECT_EQ(0xeb, gre[3]);
+            EXPECT_EQ(sequence++, ntohl(*reinterpret_cast<const uint32_t*>(gre + 4)));
+            // version 2, truncated, session 2
+            EXPECT_EQ(0x20, gre[8]);
+            EXPECT_EQ(0x04, gre[10]);
+            EXPECT_EQ(2, gre[11]);
+            EXPECT_EQ(5000u, ntohl(*reinterpret_cast<const uint32_t*>(gre + 12)));
+            // P bit, IEEE 1588 timestamp granularity, platform sub-header present
+            EXPECT_EQ(0x8005u, ntohl(*reinterpret_cast<const uint32_t*>(gre + 16)));
+            EXPECT_EQ(1586508861u, ntohl(*reinterpret_cast<const uint32_t*>(gre + 24)));
+            received++;
+        }
+        EXPECT_EQ(2, received);
+        EXPECT_EQ(0, greExport.closeExport());
+        close(receiver);
+    }
+
+    TEST(PcapExportGre, sequence) {
+        int receiver = socket(AF_INET, SOCK_RAW, IPPROTO_GRE);
+        ASSERT_NE(-1, receiver);
+        std::vector<std::string> remoteips;
+        remoteips.push_back("127.0.1.4");
+        PcapExportGre greExport(remoteips, 2, "", IP_PMTUDISC_DONT);
+        greExport.setSequence(true);
+        EXPECT_EQ(0, greExport.initExport());
+        pcap_pkthdr header;
+        header.caplen = 32;
+        header.len = 32;
+        std::vector<uint8_t> pkt_data(32);
+        PacketBatch batch;
+        for (int i = 0; i < 3; ++i) {
+            batch.push_back(header, pkt_data.data());
+        }
+        EXPECT_EQ(0, greExport.exportBatch(batch));
+
+        // every key counts on its own
+        std::vector<uint32_t> expected = {0, 1, 2, 0, 1, 2};
+        batch.tag = 1;
+        EXPECT_EQ(0, greExport.exportBatch(batch));
+        EXPECT_EQ(0, greExport.flushExport());
+        size_t received = 0;
+        uint8_t buffer[256];
+        ssize_t length;
+        while (received < expected.size() && (length = recv(receiver, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+            if (std::memcmp(buffer + 16, "\x7f\x00\x01\x04", 4) != 0) {
+                continue;
+            }
+            ASSERT_EQ(20 + 12 + 32, length);
+            const uint8_t* gre = buffer + 20;
+            EXPECT_EQ(0x30, gre[0]);
+            EXPECT_EQ(received < 3 ? 2u : 3u, ntohl(*reinterpret_cast<const uint32_t*>(gre + 4)));
+            EXPECT_EQ(expected[received], ntohl(*reinterpret_cast<const uint32_t*>(gre + 8)));
+            received++;
+        }
+        EXPECT_EQ(expected.size(), received);
+        EXPECT_EQ(0, greExport.closeExport());
+        close(receiver);
+    }
+
+    TEST(PcapExportGre, sequence_workers) {
+        int receiver = socket(AF_INET, SOCK_RAW, IPPROTO_GRE);
+        ASSERT_NE(-1, receiver);
+        std::vector<std::string> remoteips;
+        remoteips.push_back("127.0.1.8");
+        // two workers sending to one receiver, pktminerg gives worker N the key BIT+N with --gre-seq
+        std::vector<std::unique_ptr<PcapExportGre>> workers;
+        for (uint32_t i = 0; i < 2; ++i) {
+            workers.emplace_back(new PcapExportGre(remoteips, 2 + i, "", IP_PMTUDISC_DONT));
+            workers[i]->setSequence(true);
+            EXPECT_EQ(0, workers[i]->initExport());
+        }
+        pcap_pkthdr header;
+        header.caplen = 32;
+        header.len = 32;
+        std::vector<uint8_t> pkt_data(32);
+        PacketBatch batch;
+        batch.push_back(header, pkt_data.data());
+        batch.push_back(header, pkt_data.data());
+        for (int round = 0; round < 3; ++round) {
+            EXPECT_EQ(0, workers[0]->exportBatch(batch));
+            EXPECT_EQ(0, workers[1]->exportBatch(batch));
+        }
+
+        // the packets of both workers interleave, and every key still counts without gaps
+        std::map<uint32_t, uint32_t> next;
+        size_t received = 0;
+        uint8_t buffer[256];
+        ssize_t length;
+        while (received < 12 && (length = recv(receiver, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+            if (std::memcmp(buffer + 16, "\x7f\x00\x01\x08", 4) != 0) {
+                continue;
+            }
+            ASSERT_EQ(20 + 12 + 32, length);
+            const uint8_t* gre = buffer + 20;
+            uint32_t key = ntohl(*reinterpret_cast<const uint32_t*>(gre + 4));
+            EXPECT_EQ(next[key]++, ntohl(*reinterpret_cast<const uint32_t*>(gre + 8)));
+            received++;
+        }
+        EXPECT_EQ(12u, received);
+        EXPECT_EQ(2u, next.size());
+        EXPECT_EQ(6u, next[2]);
+        EXPECT_EQ(6u, next[3]);
+        for (size_t i = 0; i < workers.size(); ++i) {
+            EXPECT_EQ(0, workers[i]->closeExport());
+        }
+        close(receiver);
+    }
+
+    TEST(PcapExportGre, key_tags) {
+        int receiver = socket(AF_INET, SOCK_RAW, IPPROTO_GRE);
+        ASSERT_NE(-1, receiver);
+        std::vector<std::string> remoteips;
+        remoteips.push_back("127.0.1.7");
+        PcapExportGre greExport(remoteips, 2, "", IP_PMTUDISC_DONT);
+        greExport.setSendBatch(16, 1000000);
+        greExport.setSequence(true);
+        EXPECT_EQ(0, greExport.initExport());
+        pcap_pkthdr header;
+        header.caplen = 32;
+        header.len = 32;
+        std::vector<uint8_t> pkt_data(32);
+        PacketBatch batch;
+        batch.push_back(header, pkt_data.data());
+        batch.push_back(header, pkt_data.data());
+        // batches of two interfaces take turns, they are staged together
+        for (uint32_t tag = 0; tag < 3; ++tag) {
+            batch.tag = tag % 2;
+            EXPECT_EQ(0, greExport.exportBatch(batch));
+        }
+        uint8_t buffer[256];
+        EXPECT_EQ(-1, recv(receiver, buffer, sizeof(buffer), MSG_DONTWAIT));
+        EXPECT_EQ(0, greExport.flushExport());
+
+        std::vector<uint32_t> keys = {2, 2, 3, 3, 2, 2};
+        std::vector<uint32_t> sequences = {0, 1, 0, 1, 2, 3};
+        size_t received = 0;
+        ssize_t length;
+        while (received < keys.size() && (length = recv(receiver, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+            if (std::memcmp(buffer + 16, "\x7f\x00\x01\x07", 4) != 0) {
+                continue;
+            }
+            ASSERT_EQ(20 + 12 + 32, length);
+            const uint8_t* gre = buffer + 20;
+            EXPECT_EQ(keys[received], ntohl(*reinterpret_cast<const uint32_t*>(gre + 4)));
+            EXPECT_EQ(sequences[received], ntohl(*reinterpret_cast<const uint32_t*>(gre + 8)));
+            received++;
+        }
+        EXPECT_EQ(keys.size(), received);
+        EXPECT_EQ(0, greExport.closeExport());
+        close(receiver);
+    }
+
+    TEST(PcapExportGre, oversize) {
+        std::vector<std::string> remoteips;
+        remoteips.push_back("127.0.1.5");
+        remoteips.push_back("127.0.1.6");
+        PcapExportGre greExport(remoteips, 2, "", -1);
+        std::vector<greoversize> oversize;
+        oversize.push_back(greoversize::split);
+        oversize.push_back(greoversize::fragment);
+        greExport.setOversize(oversize);
+        EXPECT_EQ(0, greExport.initExport());
+        // the MTU of the loopback device
+        EXPECT_GE(greExport.getPathMtu(0), 1500u);
+        EXPECT_EQ(0u, greExport.getPathMtu(1));
+        pcap_pkthdr header;
+        header.caplen = 32;
+        header.len = 32;
+        std::vector<uint8_t> pkt_data(32);
+        EXPECT_EQ(0, greExport.exportPacket(&header, pkt_data.data()));
+        EXPECT_EQ(0, greExport.closeExport());
+    }
+
+    TEST(PcapExportGre, split) {
+        int receiver = socket(AF_INET, SOCK_RAW, IPPROTO_GRE);
+        ASSERT_NE(-1, receiver);
+        int rcvbuf = 4 * 1024 * 1024;
+        setsockopt(receiver, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+        std::vector<std::string> remoteips;
+        remoteips.push_back("127.0.1.9");
+        // two workers, the ids of their split frames must not collide at the receiver
+        std::vector<std::unique_ptr<PcapExportGre>> workers;
+        for (int i = 0; i < 2; ++i) {
+            workers.emplace_back(new PcapExportGre(remoteips, 2, "", -1));
+            workers[i]->setOversize(std::vector<greoversize>(1, greoversize::split));
+            EXPECT_EQ(0, workers[i]->initExport());
+        }
+        // the largest frame the exporter sends, with the IP and GRE headers it exceeds even the loopback MTU
+        const size_t mtu = workers[0]->getPathMtu(0);
+        pcap_pkthdr header;
+        header.caplen = 65535;
+        header.len = 70000;
+        ASSERT_GT(20 + 8 + header.caplen, mtu);
+        std::vector<uint8_t> pkt_data(header.caplen);
+        for (size_t i = 0; i < pkt_data.size(); ++i) {
+            pkt_data[i] = static_cast<uint8_t>(i % 251);
+        }
+        for (size_t i = 0; i < workers.size(); ++i) {
+            EXPECT_EQ(0, workers[i]->exportPacket(&header, pkt_data.data()));
+        }
+
+        // IP, GRE with key, segment header, piece
+        std::map<uint32_t, std::vector<uint8_t>> frames;
+        std::map<uint32_t, bool> complete;
+        std::vector<uint8_t> buffer(mtu);
+        ssize_t length;
+        while ((length = recv(receiver, buffer.data(), buffer.size(), MSG_DONTWAIT)) > 0) {
+            if (std::memcmp(&buffer[16], "\x7f\x00\x01\x09", 4) != 0) {
+                continue;
+            }
+            ASSERT_GT(length, 20 + 8 + 12);
+            EXPECT_LE(static_cast<size_t>(length), mtu);
+            const uint8_t* gre = &buffer[20];
+            EXPECT_EQ(GRE_PROTO_SEGMENT, ntohs(*reinterpret_cast<const uint16_t*>(gre + 2)));
+            EXPECT_EQ(2u, ntohl(*reinterpret_cast<const uint32_t*>(gre + 4)));
+            const uint8_t* segment = gre + 8;
+            const uint32_t id = ntohl(*reinterpret_cast<const uint32_t*>(segment));
+            const uint16_t offset = ntohs(*reinterpret_cast<const uint16_t*>(segment + 4));
+            const uint16_t flags = ntohs(*reinterpret_cast<const uint16_t*>(segment + 6));
+            EXPECT_EQ(header.len, ntohl(*reinterpret_cast<const uint32_t*>(segment + 8)));
+            std::vector<uint8_t>& frame = frames[id];
+            // the pieces come in order, only the last one has no GRE_SEGMENT_MORE
+            EXPECT_EQ(frame.size(), offset);
+            EXPECT_FALSE(complete[id]);
+            frame.insert(frame.end(), segment + 12, gre + (length - 20));
+            complete[id] = (flags & GRE_SEGMENT_MORE) == 0;
+        }
+        EXPECT_EQ(2u, frames.size());
+        for (auto it = frames.begin(); it != frames.end(); ++it) {
+            EXPECT_TRUE(complete[it->first]);
+            EXPECT_TRUE(it->second == pkt_data);
+        }
+        for (size_t i = 0; i < workers.size(); ++i) {
+            EXPECT_EQ(0, workers[i]->closeExport());
+        }
+        close(receiver);
+    }
+
+    TEST(PcapExportGreRing, test) {
+        // the kernel routes no frame to 127.0.0.1 that did not come from its own stack, the frames are read
+        // from lo where they arrive
+        int receiver = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+        ASSERT_NE(-1, receiver);
+        struct sockaddr_ll lo;
+        std::memset(&lo, 0, sizeof(lo));
+        lo.sll_family = AF_PACKET;
+        lo.sll_protocol = htons(ETH_P_ALL);
+        lo.sll_ifindex = static_cast<int>(if_nametoindex("lo"));
+        ASSERT_EQ(0, bind(receiver, reinterpret_cast<struct sockaddr*>(&lo), sizeof(lo)));
+        std::vector<std::string> remoteips;
+        remoteips.push_back("127.0.0.1");
+        PcapExportGreRing greExport(remoteips, 2, "lo", IP_PMTUDISC_DONT);
+        EXPECT_EQ(0, greExport.initExport());
+        pcap_pkthdr header;
+        header.caplen = 32;
+        header.len = 32;
+        std::vector<uint8_t> pkt_data(32);
+        PacketBatch batch;
+        for (int i = 0; i < 8; ++i) {
+            batch.push_back(header, pkt_data.data());
+        }
+        EXPECT_EQ(0, greExport.exportBatch(batch));
+        EXPECT_EQ(0, greExport.flushExport());
+
+        uint8_t buffer[256];
+        int received = 0;
+        for (int i = 0; i < 100 && received < 8; ++i) {
+            struct sockaddr_ll from;
+            socklen_t fromlen = sizeof(from);
+            ssize_t length = recvfrom(receiver, buffer, sizeof(buffer), MSG_DONTWAIT,
+                                      reinterpret_cast<struct sockaddr*>(&from), &fromlen);
+            if (length < 0) {
+                usleep(1000);
+                continue;
+            }
+            const uint8_t* ip = buffer + 14;
+            if (from.sll_pkttype == PACKET_OUTGOING || length != 14 + 20 + 8 + 32 || ip[9] != IPPROTO_GRE ||
+                ntohl(*reinterpret_cast<const uint32_t*>(ip + 20 + 4)) != 2) {
+                continue;
+            }
+            uint32_t sum = 0;
+            for (int j = 0; j < 20; j += 2) {
+                sum += static_cast<uint32_t>(ip[j] << 8 | ip[j + 1]);
+            }
+            while (sum >> 16) {
+                sum = (sum & 0xffff) + (sum >> 16);
+            }
+            EXPECT_EQ(0xffffu, sum);
+            EXPECT_EQ(20 + 8 + 32, ntohs(*reinterpret_cast<const uint16_t*>(ip + 2)));
+            EXPECT_EQ(0x2000, ntohs(*reinterpret_cast<const uint16_t*>(ip + 20)));
+            EXPECT_EQ(0x6558, ntohs(*reinterpret_cast<const uint16_t*>(ip + 22)));
+            received++;
+        }
+        EXPECT_EQ(8, received);
+        EXPECT_EQ(0, greExport.closeExport());
+        close(receiver);
+    }
+
+    // Ethernet, IPv4 and UDP headers of a frame from src:sport to dst:dport
+    static std::vector<uint8_t> udpFrame(uint32_t src, uint32_t dst, uint16_t sport, uint16_t dport, size_t length) {
+        std::vector<uint8_t> frame(length);
+        frame[12] = 0x08;
+        frame[14] = 0x45;
+        frame[23] = 17;
+        for (int i = 0; i < 4; ++i) {
+            frame[26 + i] = static_cast<uint8_t>(src >> (24 - 8 * i));
+            frame[30 + i] = static_cast<uint8_t>(dst >> (24 - 8 * i));
+        }
+        frame[34] = static_cast<uint8_t>(sport >> 8);
+        frame[35] = static_cast<uint8_t>(sport);
+        frame[36] = static_cast<uint8_t>(dport >> 8);
+        frame[37] = static_cast<uint8_t>(dport);
+        return frame;
+    }
+
+    TEST(FlowHash, test) {
+        auto request = udpFrame(0x0a000001, 0x0a000002, 40000, 53, 64);
+        auto reply = udpFrame(0x0a000002, 0x0a000001, 53, 40000, 64);
+        auto other = udpFrame(0x0a000001, 0x0a000002, 40001, 53, 64);
+        EXPECT_EQ(flowHash(request.data(), 64), flowHash(reply.data(), 64));
+        EXPECT_NE(flowHash(request.data(), 64), flowHash(other.data(), 64));
+        // a fragment has no ports
+        request[20] = 0x20;
+        other[20] = 0x20;
+        EXPECT_EQ(flowHash(request.data(), 64), flowHash(other.data(), 64));
+    }
+
+    TEST(RemoteBalancer, test) {
+        std::vector<std::string> remoteips;
+        remoteips.push_back("10.1.0.1");
+        remoteips.push_back("10.1.0.2");
+        remoteips.push_back("10.1.0.3");
+        RemoteBalancer balancer(remoteips);
+        auto request = udpFrame(0x0a000001, 0x0a000002, 40000, 53, 64);
+        auto reply = udpFrame(0x0a000002, 0x0a000001, 53, 40000, 64);
+        EXPECT_EQ(balancer.pick(request.data(), 64), balancer.pick(reply.data(), 64));
+
+        // without 10.1.0.2 only its flows move
+        std::vector<std::string> fewer;
+        fewer.push_back("10.1.0.1");
+        fewer.push_back("10.1.0.3");
+        RemoteBalancer smaller(fewer);
+        size_t counts[3] = {0, 0, 0};
+        for (uint32_t hash = 0; hash < 3000; ++hash) {
+            const size_t remote = balancer.pickHash(hash * 1431655u);
+            const size_t moved = smaller.pickHash(hash * 1431655u);
+            counts[remote]++;
+            if (remote != 1) {
+                EXPECT_EQ(remote == 0 ? 0u : 1u, moved);
+            }
+        }
+        for (size_t i = 0; i < 3; ++i) {
+            EXPECT_GT(counts[i], 600u);
+        }
+    }
+
+    TEST(PcapExportVxlan, test) {
+        int receiver = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        ASSERT_NE(-1, receiver);
+        struct sockaddr_in local;
+        std::memset(&local, 0, sizeof(local));
+        local.sin_family = AF_INET;
+        local.sin_port = htons(VXLAN_PORT);
+        local.sin_addr.s_addr = inet_addr("127.0.0.1");
+        ASSERT_EQ(0, bind(receiver, reinterpret_cast<struct sockaddr*>(&local), sizeof(local)));
+
+        std::vector<std::string> remoteips;
+        remoteips.push_back("127.0.0.1");
+        PcapExportVxlan vxlanExport(remoteips, 2, "", -1);
+        EXPECT_EQ(0, vxlanExport.initExport());
+        auto request = udpFrame(0x0a000001, 0x0a000002, 40000, 53, 100);
+        auto reply = udpFrame(0x0a000002, 0x0a000001, 53, 40000, 100);
+        pcap_pkthdr header;
+        header.caplen = 100;
+        header.len = 100;
+        PacketBatch batch;
+        batch.tag = 1;
+        for (int i = 0; i < 8; ++i) {
+            batch.push_back(header, i % 2 == 0 ? request.data() : reply.data());
+        }
+        EXPECT_EQ(0, vxlanExport.exportBatch(batch));
+
+        uint16_t source_port = 0;
+        for (int i = 0; i < 8; ++i) {
+            uint8_t buffer[256];
+            struct sockaddr_in from;
+            socklen_t from_len = sizeof(from);
+            ssize_t length = recvfrom(receiver, buffer, sizeof(buffer), MSG_DONTWAIT,
+                                      reinterpret_cast<struct sockaddr*>(&from), &from_len);
+            ASSERT_EQ(108, length);
+            EXPECT_EQ(0x08, buffer[0]);
+            // VNI is the key bit plus the tag
+            EXPECT_EQ(3, buffer[6]);
+            EXPECT_EQ(0, std::memcmp(buffer + 8, i % 2 == 0 ? request.data() : reply.data(), 100));
+            if (i > 0) {
+                EXPECT_EQ(source_port, from.sin_port);
+            }
+            source_port = from.sin_port;
+        }
+        EXPECT_EQ(0, vxlanExport.closeExport());
+        close(receiver);
+    }
+
+    TEST(PcapExportBatchUdp, test) {
+        int receiver = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        ASSERT_NE(-1, receiver);
+        struct sockaddr_in local;
+        std::memset(&local, 0, sizeof(local));
+        local.sin_family = AF_INET;
+        local.sin_port = htons(47999);
+        local.sin_addr.s_addr = inet_addr("127.0.0.1");
+        ASSERT_EQ(0, bind(receiver, reinterpret_cast<struct sockaddr*>(&local), sizeof(local)));
+
+        std::vector<std::string> remoteips;
+        remoteips.push_back("127.0.0.1");
+        PcapExportBatchUdp batchExport(remoteips, 47999, 2, "", -1);
+        batchExport.setMaxDelay(1000000);
+        EXPECT_EQ(0, batchExport.initExport());
+        // loopback MTU, less IP and UDP headers
+        const size_t max_payload = batchExport.getMaxPayload(0);
+        EXPECT_GT(max_payload, 1000u);
+        pcap_pkthdr header;
+        header.caplen = 64;
+        header.len = 100;
+        header.ts.tv_sec = 1586508861;
+        header.ts.tv_usec = 7;
+        std::vector<uint8_t> pkt_data(64, 0xab);
+        PacketBatch batch;
+        for (int i = 0; i < 10; ++i) {
+            batch.push_back(header, pkt_data.data());
+        }
+        // all ten fit one datagram, which waits for more
+        EXPECT_EQ(0, batchExport.exportBatch(batch));
+        uint8_t buffer[2048];
+        EXPECT_EQ(-1, recv(receiver, buffer, sizeof(buffer), MSG_DONTWAIT));
+        EXPECT_EQ(0, batchExport.flushExport());
+        ASSERT_EQ(8 + 10 * (2 + 16 + 64), recv(receiver, buffer, sizeof(buffer), MSG_DONTWAIT));
+        EXPECT_EQ(PKTMINERG_BATCH_VERSION, ntohs(*reinterpret_cast<uint16_t*>(buffer)));
+        EXPECT_EQ(10, ntohs(*reinterpret_cast<uint16_t*>(buffer + 2)));
+        EXPECT_EQ(2u, ntohl(*reinterpret_cast<uint32_t*>(buffer + 4)));
+        EXPECT_EQ(64, ntohs(*reinterpret_cast<uint16_t*>(buffer + 8)));
+        pmr_pkthdr_t record;
+        std::memcpy(&record, buffer + 10, sizeof(record));
+        EXPECT_EQ(1586508861u, ntohl(record.tv_sec));
+        EXPECT_EQ(100u, ntohl(record.len));
+        EXPECT_EQ(0xab, buffer[8 + 18]);
+        EXPECT_EQ(0, batchExport.closeExport());
+        close(receiver);
+    }
+
+    TEST(PcapExportBatchUdp, key_tags) {
+        int receiver = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        ASSERT_NE(-1, receiver);
+        struct sockaddr_in local;
+        std::memset(&local, 0, sizeof(local));
+        local.sin_family = AF_INET;
+        local.sin_port = htons(47998);
+        local.sin_addr.s_addr = inet_addr("127.0.0.1");
+        ASSERT_EQ(0, bind(receiver, reinterpret_cast<struct sockaddr*>(&local), sizeof(local)));
+
+        std::vector<std::string> remoteips;
+        remoteips.push_back("127.0.0.1");
+        PcapExportBatchUdp batchExport(remoteips, 47998, 2, "", -1);
+        batchExport.setMaxDelay(1000000);
+        EXPECT_EQ(0, batchExport.initExport());
+        pcap_pkthdr header;
+        header.caplen = 64;
+        header.len = 64;
+        header.ts.tv_sec = 1586508861;
+        header.ts.tv_usec = 7;
+        std::vector<uint8_t> pkt_data(64);
+        PacketBatch batch;
+        batch.push_back(header, pkt_data.data());
+        batch.push_back(header, pkt_data.data());
+        // batches of two interfaces take turns, each interface fills its own datagram
+        for (uint32_t tag = 0; tag < 4; ++tag) {
+            batch.tag = tag % 2;
+            EXPECT_EQ(0, batchExport.exportBatch(batch));
+        }
+        uint8_t buffer[2048];
+        EXPECT_EQ(-1, recv(receiver, buffer, sizeof(buffer), MSG_DONTWAIT));
+        EXPECT_EQ(0, batchExport.flushExport());
+        for (uint32_t keybit = 2; keybit < 4; ++keybit) {
+            ASSERT_EQ(8 + 4 * (2 + 16 + 64), recv(receiver, buffer, sizeof(buffer), MSG_DONTWAIT));
+            EXPECT_EQ(4, ntohs(*reinterpret_cast<uint16_t*>(buffer + 2)));
+            EXPECT_EQ(keybit, ntohl(*reinterpret_cast<uint32_t*>(buffer + 4)));
+        }
+        EXPECT_EQ(-1, recv(receiver, buffer, sizeof(buffer), MSG_DONTWAIT));
+        EXPECT_EQ(0, batchExport.closeExport());
+        close(receiver);
+    }
+
+    TEST(BoundedRing, test) {
+        BoundedRing<int> ring(3);
+        EXPECT_EQ(4u, ring.capacity());
+        for (int i = 0; i < 4; ++i) {
+            EXPECT_TRUE(ring.push(std::move(i)));
+        }
+        int value = 4;
+        EXPECT_FALSE(ring.push(std::move(value)));
+        EXPECT_EQ(4u, ring.size());
+        for (int i = 0; i < 4; ++i) {
+            ASSERT_TRUE(ring.pop(value));
+            EXPECT_EQ(i, value);
+        }
+        EXPECT_FALSE(ring.pop(value));
+    }
+
+    TEST(PcapExportGre, send_queue) {
+        std::vector<std::string> remoteips;
+        remoteips.push_back("127.0.1.1");
+        remoteips.push_back("127.0.1.2");
+        PcapExportGre greExport(remoteips, 2, "", IP_PMTUDISC_DONT);
+        greExport.setSendBatch(16, 0);
+        greExport.setSendQueue(64, queuefull::block);
+        EXPECT_EQ(0, greExport.initExport());
+        pcap_pkthdr header;
+        header.caplen = 32;
+        header.len = 32;
+        std::vector<uint8_t> pkt_data(32);
+        PacketBatch batch;
+        for (int i = 0; i < 100; ++i) {
+            batch.push_back(header, pkt_data.data());
+        }
+        EXPECT_EQ(0, greExport.exportBatch(batch));
+        EXPECT_EQ(0, greExport.closeExport());
+    }
+
     TEST(AgentStatusQuery, test) {
         // AgentStatus::get_instance()->update_status(1586508861, header->caplen, 
         //                      _gre_count, _gre_drop_count, _pcap_handle);
@@ -59,6 +892,364 @@ namespace {
         EXPECT_EQ(500, static_cast<uint32_t>(inst->total_cap_bytes()));
     }
 
+    TEST(AgentStatusQuery, merge_slots) {
+        AgentStatus* inst = AgentStatus::get_instance();
+        inst->reset_agent_status();
+        inst->update_capture_status(1586508862, 200, 1, 1, nullptr, 0);
+        inst->update_capture_status(1586508861, 100, 1, 2, nullptr, 1);
+        inst->update_capture_status(1586508864, 100, 2, 3, nullptr, 1);
+        EXPECT_EQ(1586508861, static_cast<uint32_t>(inst->first_packet_time()));
+        EXPECT_EQ(1586508864, static_cast<uint32_t>(inst->last_packet_time()));
+        EXPECT_EQ(400, static_cast<uint32_t>(inst->total_cap_bytes()));
+        EXPECT_EQ(4, static_cast<uint32_t>(inst->total_fwd_drop_count()));
+        inst->reset_agent_status();
+    }
+
+    TEST(AgentStatusQuery, slot_status) {
+        AgentStatus* inst = AgentStatus::get_instance();
+        inst->reset_agent_status();
+        EXPECT_EQ(0, inst->set_slot_name(0, "eth0"));
+        EXPECT_EQ(0, inst->set_slot_name(1, "eth1"));
+        inst->update_capture_status(1586508861, 200, 1, 0, nullptr, 0);
+        inst->update_capture_status(1586508862, 100, 1, 0, nullptr, 1);
+        EXPECT_EQ(2u, inst->named_slot_count());
+        EXPECT_EQ("eth1", inst->slot_name(1));
+        EXPECT_EQ(200, static_cast<uint32_t>(inst->total_cap_bytes(0)));
+        EXPECT_EQ(100, static_cast<uint32_t>(inst->total_cap_bytes(1)));
+        EXPECT_EQ(1586508862, static_cast<uint32_t>(inst->first_packet_time(1)));
+        EXPECT_EQ(0, static_cast<uint32_t>(inst->total_cap_bytes(AgentStatus::MAX_CAPTURE_SLOTS)));
+        inst->set_slot_name(0, "");
+        inst->set_slot_name(1, "");
+        inst->reset_agent_status();
+    }
+
+    TEST(ZmqBufferPool, test) {
+        ZmqBufferPool pool(64, 2);
+        char* first = pool.acquire();
+        char* second = pool.acquire();
+        EXPECT_NE(first, second);
+        // a buffer zmq released is filled again
+        ZmqBufferPool::release(first, &pool);
+        EXPECT_EQ(first, pool.acquire());
+        ZmqBufferPool::release(first, &pool);
+        ZmqBufferPool::release(second, &pool);
+        ZmqBufferPool::release(pool.acquire(), &pool);
+        ZmqBufferPool::release(new char[64], &pool);
+    }
+
+    TEST(PcapExportZMQ, flush) {
+        zmq::context_t context(1);
+        zmq::socket_t receiver(context, ZMQ_PULL);
+        receiver.bind("tcp://127.0.0.1:47998");
+        std::vector<std::string> remoteips;
+        remoteips.push_back("127.0.0.1");
+        PcapExportZMQ zmqExport(remoteips, 47998, 100, 2, "", 0);
+        zmqExport.setBatchLimits(20, 65536);
+        EXPECT_EQ(0, zmqExport.initExport());
+        pcap_pkthdr header;
+        header.caplen = 32;
+        header.len = 32;
+        header.ts.tv_sec = 1;
+        header.ts.tv_usec = 0;
+        std::vector<uint8_t> pkt_data(32);
+        EXPECT_EQ(0, zmqExport.exportPacket(&header, pkt_data.data()));
+        // no packet comes to close the batch, its age by the wall clock does
+        EXPECT_EQ(0, zmqExport.flushExport());
+        usleep(30000);
+        EXPECT_EQ(0, zmqExport.flushExport());
+        zmq::message_t msg;
+        bool received = false;
+        for (int i = 0; i < 100 && !received; ++i) {
+            received = receiver.recv(msg, zmq::recv_flags::dontwait).has_value();
+            if (!received) {
+                usleep(10000);
+            }
+        }
+        ASSERT_TRUE(received);
+        ASSERT_GE(msg.size(), sizeof(batch_pkts_hdr_t));
+        const batch_pkts_hdr_t* batch_hdr = msg.data<batch_pkts_hdr_t>();
+        EXPECT_EQ(1, ntohs(batch_hdr->pkts_num));
+        EXPECT_EQ(0, zmqExport.closeExport());
+    }
+
+    TEST(PcapExportZMQ, key_tags) {
+        zmq::context_t context(1);
+        zmq::socket_t receiver(context, ZMQ_PULL);
+        receiver.bind("tcp://127.0.0.1:47995");
+        std::vector<std::string> remoteips;
+        remoteips.push_back("127.0.0.1");
+        PcapExportZMQ zmqExport(remoteips, 47995, 100, 2, "", 0);
+        EXPECT_EQ(0, zmqExport.initExport());
+        pcap_pkthdr header;
+        header.caplen = 32;
+        header.len = 32;
+        header.ts.tv_sec = 1;
+        header.ts.tv_usec = 0;
+        std::vector<uint8_t> pkt_data(32);
+        PacketBatch batch;
+        batch.push_back(header, pkt_data.data());
+        batch.push_back(header, pkt_data.data());
+        // batches of two interfaces take turns, each interface fills its own zmq batch
+        for (uint32_t tag = 0; tag < 6; ++tag) {
+            batch.tag = tag % 2;
+            EXPECT_EQ(0, zmqExport.exportBatch(batch));
+        }
+        EXPECT_EQ(0, zmqExport.closeExport());
+        std::vector<uint32_t> keybits;
+        zmq::message_t msg;
+        for (int i = 0; i < 100 && keybits.size() < 2; ++i) {
+            if (receiver.recv(msg, zmq::recv_flags::dontwait).has_value()) {
+                ASSERT_GE(msg.size(), sizeof(batch_pkts_hdr_t));
+                const batch_pkts_hdr_t* batch_hdr = msg.data<batch_pkts_hdr_t>();
+                EXPECT_EQ(6, ntohs(batch_hdr->pkts_num));
+                keybits.push_back(ntohl(batch_hdr->keybit));
+            } else {
+                usleep(10000);
+            }
+        }
+        std::sort(keybits.begin(), keybits.end());
+        EXPECT_EQ(std::vector<uint32_t>({2, 3}), keybits);
+    }
+
+    TEST(BatchCompressor, test) {
+        EXPECT_EQ(PKTMINERG_BATCH_CODEC_LZ4, BatchCompressor::parseCodec("lz4"));
+        EXPECT_EQ(PKTMINERG_BATCH_CODEC_ZSTD, BatchCompressor::parseCodec("zstd"));
+        EXPECT_EQ(-1, BatchCompressor::parseCodec("gzip"));
+        std::vector<char> records(65536);
+        for (size_t i = 0; i < records.size(); ++i) {
+            records[i] = static_cast<char>(i % 61);
+        }
+        const uint8_t codecs[] = { PKTMINERG_BATCH_CODEC_LZ4, PKTMINERG_BATCH_CODEC_ZSTD };
+        for (uint8_t codec : codecs) {
+            // a build without the library of the codec has nothing to compress with
+            if (!BatchCompressor::available(codec)) {
+                continue;
+            }
+            BatchCompressor compressor(codec, 0);
+            std::vector<char> compressed(records.size());
+            size_t length = compressor.compress(records.data(), records.size(), compressed.data(), compressed.size());
+            ASSERT_GT(length, 0u);
+            EXPECT_LT(length, records.size() / 4);
+            std::vector<char> decompressed(records.size());
+            EXPECT_TRUE(BatchCompressor::decompress(codec, compressed.data(), length, decompressed.data(),
+                                                    decompressed.size()));
+            EXPECT_TRUE(records == decompressed);
+            // no room for the output
+            EXPECT_EQ(0u, compressor.compress(records.data(), records.size(), compressed.data(), 16));
+        }
+    }
+
+    TEST(PcapExportZMQ, compress) {
+        if (!BatchCompressor::available(PKTMINERG_BATCH_CODEC_LZ4)) {
+            return;
+        }
+        zmq::context_t context(1);
+        zmq::socket_t receiver(context, ZMQ_PULL);
+        receiver.bind("tcp://127.0.0.1:47997");
+        std::vector<std::string> remoteips;
+        remoteips.push_back("127.0.0.1");
+        PcapExportZMQ zmqExport(remoteips, 47997, 100, 2, "", 0);
+        EXPECT_EQ(0, zmqExport.setCompression(PKTMINERG_BATCH_CODEC_LZ4, 0));
+        EXPECT_EQ(0, zmqExport.initExport());
+        pcap_pkthdr header;
+        header.caplen = 256;
+        header.len = 256;
+        header.ts.tv_sec = 1;
+        header.ts.tv_usec = 0;
+        std::vector<uint8_t> pkt_data(256);
+        for (int i = 0; i < 10; ++i) {
+            EXPECT_EQ(0, zmqExport.exportPacket(&header, pkt_data.data()));
+        }
+        // closing sends the batch through the compression thread
+        EXPECT_EQ(0, zmqExport.closeExport());
+        zmq::message_t msg;
+        bool received = false;
+        for (int i = 0; i < 100 && !received; ++i) {
+            received = receiver.recv(msg, zmq::recv_flags::dontwait).has_value();
+            if (!received) {
+                usleep(10000);
+            }
+        }
+        ASSERT_TRUE(received);
+        ASSERT_GE(msg.size(), sizeof(batch_pkts_hdr_v2_t));
+        const batch_pkts_hdr_v2_t* batch_hdr = msg.data<batch_pkts_hdr_v2_t>();
+        EXPECT_EQ(PKTMINERG_BATCH_VERSION_COMPRESSED, ntohs(batch_hdr->version));
+        EXPECT_EQ(10, ntohs(batch_hdr->pkts_num));
+        EXPECT_EQ(PKTMINERG_BATCH_CODEC_LZ4, batch_hdr->codec);
+        const uint32_t raw_length = ntohl(batch_hdr->raw_length);
+        EXPECT_EQ(10 * (sizeof(uint16_t) + sizeof(pmr_pkthdr_t) + 256), raw_length);
+        std::vector<char> records(raw_length);
+        EXPECT_TRUE(BatchCompressor::decompress(PKTMINERG_BATCH_CODEC_LZ4,
+                                                msg.data<char>() + sizeof(batch_pkts_hdr_v2_t),
+                                                msg.size() - sizeof(batch_pkts_hdr_v2_t), records.data(),
+                                                records.size()));
+    }
+
+    TEST(PcapExportZMQ, retry) {
+        std::vector<std::string> remoteips;
+        remoteips.push_back("127.0.0.1");
+        PcapExportZMQ zmqExport(remoteips, 47996, 100, 2, "", 0);
+        zmqExport.setBatchLimits(1000, 4096);
+        zmqExport.setRetryBudget(1024 * 1024);
+        EXPECT_EQ(0, zmqExport.initExport());
+        pcap_pkthdr header;
+        header.caplen = 256;
+        header.len = 256;
+        header.ts.tv_sec = 1;
+        header.ts.tv_usec = 0;
+        std::vector<uint8_t> pkt_data(256);
+        // nobody listens yet, a push socket without a peer takes no message
+        for (int i = 0; i < 100; ++i) {
+            EXPECT_EQ(0, zmqExport.exportPacket(&header, pkt_data.data()));
+        }
+        zmq_retry_stats_t stats;
+        for (int i = 0; i < 100; ++i) {
+            zmqExport.getRetryStats(stats);
+            if (stats.queued >= 7) {
+                break;
+            }
+            usleep(10000);
+        }
+        EXPECT_EQ(7u, stats.queued);
+        EXPECT_EQ(0u, stats.dropped);
+        EXPECT_GT(stats.queue_bytes, 0u);
+
+        zmq::context_t context(1);
+        zmq::socket_t receiver(context, ZMQ_PULL);
+        receiver.bind("tcp://127.0.0.1:47996");
+        int pkts_num = 0;
+        zmq::message_t msg;
+        for (int i = 0; i < 200 && pkts_num < 98; ++i) {
+            if (receiver.recv(msg, zmq::recv_flags::dontwait).has_value()) {
+                pkts_num += ntohs(msg.data<batch_pkts_hdr_t>()->pkts_num);
+            } else {
+                usleep(10000);
+            }
+        }
+        EXPECT_EQ(98, pkts_num);
+        zmqExport.getRetryStats(stats);
+        EXPECT_EQ(7u, stats.retried);
+        EXPECT_EQ(0u, stats.queue_bytes);
+        EXPECT_EQ(0, zmqExport.closeExport());
+    }
+
+    TEST(ZmqSpool, test) {
+        char dir[] = "/tmp/zmqspool_XXXXXX";
+        ASSERT_TRUE(mkdtemp(dir) != NULL);
+        std::vector<char> batch(1024 * 1024);
+        uint64_t dropped_batches;
+        uint64_t dropped_pkts;
+        const uint8_t* data;
+        uint32_t length;
+        uint16_t pkts_num;
+        uint64_t chunk_seq;
+        {
+            ZmqSpool spool(dir, "remote", 8 * 1024 * 1024);
+            ASSERT_EQ(0, spool.open());
+            for (int i = 0; i < 3; ++i) {
+                batch[0] = static_cast<char>(i);
+                EXPECT_EQ(0, spool.push(batch.data(), 1000, static_cast<uint16_t>(i + 1), 100 + i, dropped_batches,
+                                        dropped_pkts));
+            }
+            EXPECT_EQ(3u, spool.batches());
+            EXPECT_EQ(3000u, spool.bytes());
+            ASSERT_TRUE(spool.front(data, length, pkts_num, chunk_seq));
+            EXPECT_EQ(0, data[0]);
+            spool.pop();
+        }
+        {
+            // the sent batch stays sent after a restart
+            ZmqSpool spool(dir, "remote", 8 * 1024 * 1024);
+            ASSERT_EQ(0, spool.open());
+            EXPECT_EQ(2u, spool.batches());
+            ASSERT_TRUE(spool.front(data, length, pkts_num, chunk_seq));
+            EXPECT_EQ(1, data[0]);
+            EXPECT_EQ(1000u, length);
+            EXPECT_EQ(2, pkts_num);
+            // a replayed batch keeps the seq of its chunk header
+            EXPECT_EQ(101u, chunk_seq);
+            spool.pop();
+            spool.pop();
+            EXPECT_TRUE(spool.empty());
+            // two segments at most, the oldest one goes with its batches
+            uint64_t dropped = 0;
+            for (int i = 0; i < 12; ++i) {
+                batch[0] = static_cast<char>(i);
+                EXPECT_EQ(0, spool.push(batch.data(), static_cast<uint32_t>(batch.size()), 1, i, dropped_batches,
+                                        dropped_pkts));
+                dropped += dropped_batches;
+            }
+            EXPECT_GT(dropped, 0u);
+            EXPECT_EQ(12u, spool.batches() + dropped);
+            ASSERT_TRUE(spool.front(data, length, pkts_num, chunk_seq));
+            EXPECT_EQ(static_cast<int>(dropped), data[0]);
+            EXPECT_EQ(dropped, chunk_seq);
+            while (!spool.empty()) {
+                spool.pop();
+            }
+        }
+        boost::filesystem::remove_all(dir);
+    }
+
+    TEST(PcapExportZMQ, spool_rate) {
+        char dir[] = "/tmp/zmqspool_XXXXXX";
+        ASSERT_TRUE(mkdtemp(dir) != NULL);
+        std::vector<std::string> remoteips;
+        remoteips.push_back("127.0.0.1");
+        pcap_pkthdr header;
+        header.caplen = 256;
+        header.len = 256;
+        header.ts.tv_sec = 1;
+        header.ts.tv_usec = 0;
+        std::vector<uint8_t> pkt_data(256);
+        zmq_retry_stats_t stats;
+        {
+            // nobody listens, the batches go to the spool
+            PcapExportZMQ zmqExport(remoteips, 47994, 100, 2, "", 0);
+            zmqExport.setBatchLimits(1000, 4096);
+            zmqExport.setSpool(dir, 8 * 1024 * 1024, 0);
+            EXPECT_EQ(0, zmqExport.initExport());
+            pkt_data[0] = 1;
+            for (int i = 0; i < 98; ++i) {
+                EXPECT_EQ(0, zmqExport.exportPacket(&header, pkt_data.data()));
+            }
+            EXPECT_EQ(0, zmqExport.closeExport());
+            zmqExport.getRetryStats(stats);
+            EXPECT_EQ(7u, stats.spooled);
+        }
+
+        zmq::context_t context(1);
+        zmq::socket_t receiver(context, ZMQ_PULL);
+        receiver.bind("tcp://127.0.0.1:47994");
+        // a spooled batch of 3.8 KB takes three seconds at 10 kbps, the new batches do not wait for it
+        PcapExportZMQ zmqExport(remoteips, 47994, 100, 2, "", 0);
+        zmqExport.setBatchLimits(1000, 4096);
+        zmqExport.setRetryBudget(1024 * 1024);
+        zmqExport.setSpool(dir, 8 * 1024 * 1024, 0.01);
+        EXPECT_EQ(0, zmqExport.initExport());
+        pkt_data[0] = 2;
+        for (int i = 0; i < 29; ++i) {
+            EXPECT_EQ(0, zmqExport.exportPacket(&header, pkt_data.data()));
+        }
+        int pkts_num = 0;
+        zmq::message_t msg;
+        for (int i = 0; i < 200 && pkts_num < 28; ++i) {
+            if (receiver.recv(msg, zmq::recv_flags::dontwait).has_value()) {
+                ASSERT_GT(msg.size(), sizeof(batch_pkts_hdr_t) + 18);
+                EXPECT_EQ(2, msg.data<uint8_t>()[sizeof(batch_pkts_hdr_t) + 18]);
+                pkts_num += ntohs(msg.data<batch_pkts_hdr_t>()->pkts_num);
+            } else {
+                usleep(10000);
+            }
+        }
+        EXPECT_EQ(28, pkts_num);
+        zmqExport.getRetryStats(stats);
+        EXPECT_EQ(0u, stats.replayed);
+        EXPECT_GT(stats.spool_bytes, 0u);
+        EXPECT_EQ(0, zmqExport.closeExport());
+        boost::filesystem::remove_all(dir);
+    }
+
     TEST(AgentControlPlane, test) {
 
         AgentControlPlane zmq_server(5556);
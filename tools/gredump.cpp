@@ -4,6 +4,7 @@
 	#include <arpa/inet.h>
 #endif
 #include <iostream>
+#include <bitset>
 #include <csignal>
 #include <ctime>
 #include <pcap/pcap.h>
@@ -11,31 +12,279 @@
 #include <boost/filesystem.hpp>
 #include "scopeguard.h"
 #include "versioninfo.h"
+#include "gredef.h"
+#include "batchdef.h"
 
 const int32_t PROT_ETH_MINLEN = 14;
 const int32_t PROT_IPV4_MINLEN = 20;
 const int32_t PROT_IPPACKET_MINLEN = PROT_ETH_MINLEN + PROT_IPV4_MINLEN;
+// how far behind the highest sequence number a late packet is still told apart from a duplicate
+const uint32_t SEQ_WINDOW = 1024;
+// split frames put together at the same time
+const size_t MAX_SEGMENT_FRAMES = 256;
 
 typedef struct IpFragCache {
     pcap_pkthdr pkthdr;
+    uint8_t protocol;
     uint8_t ipfrag_buff[65536];
 } ipfrag_cache_t;
 
+// pieces of a frame split by pktminerg --gre-oversize split
+typedef struct GreSegmentCache {
+    pcap_pkthdr pkthdr;
+    uint32_t received;
+    // 0 until the last piece came
+    uint32_t total;
+    uint8_t segment_buff[65536];
+} gre_segment_cache_t;
+
+// sequence numbers of one GRE key (ERSPAN session) of one sender
+typedef struct GreSeqStats {
+    uint32_t maxSeq;
+    uint64_t received;
+    uint64_t lost;
+    uint64_t gaps;
+    uint64_t reorders;
+    uint64_t duplicates;
+    std::bitset<SEQ_WINDOW> seen;
+} gre_seq_stats_t;
+
 typedef struct GreHandleBuff {
     pcap_dumper_t *dumper;
     uint32_t srcip;
     uint32_t dstip;
     uint32_t grekey;
+    uint16_t batchPort;
     std::map<std::tuple<uint32_t, uint32_t, uint16_t>, std::shared_ptr<ipfrag_cache_t>> ipfrags_cache;
+    // by source address and key: agents may send with the same key
+    std::map<std::pair<uint32_t, uint32_t>, gre_seq_stats_t> seq_stats;
+    std::map<std::tuple<uint32_t, uint32_t, uint32_t>, std::shared_ptr<gre_segment_cache_t>> segments_cache;
     uint64_t captureCount;
     uint64_t ipfragCount;
     uint64_t dropNotGreCount;
     uint64_t dropFilterCount;
     uint64_t dropIpFragCount;
     uint64_t dumpCount;
+    uint64_t batchCount;
+    uint64_t truncatedCount;
+    uint64_t segmentedCount;
+    uint64_t dropSegmentCount;
     std::time_t lasttime;
 } gre_handle_buff_t;
 
+// a packet missing in front of seq counts as lost until it comes late, then it counts as reordered
+void TrackSequence(gre_seq_stats_t& stats, uint32_t seq) {
+    stats.received++;
+    if (stats.received == 1) {
+        stats.maxSeq = seq;
+        stats.seen.set(seq % SEQ_WINDOW);
+        return;
+    }
+    int32_t distance = (int32_t)(seq - stats.maxSeq);
+    if (distance > 0) {
+        if (distance > 1) {
+            stats.gaps++;
+            stats.lost += (uint32_t)distance - 1;
+        }
+        if ((uint32_t)distance >= SEQ_WINDOW) {
+            stats.seen.reset();
+        } else {
+            for (uint32_t i = 1; i <= (uint32_t)distance; ++i) {
+                stats.seen.reset((stats.maxSeq + i) % SEQ_WINDOW);
+            }
+        }
+        stats.maxSeq = seq;
+        stats.seen.set(seq % SEQ_WINDOW);
+    } else if ((uint32_t)(-(int64_t)distance) < SEQ_WINDOW) {
+        if (stats.seen.test(seq % SEQ_WINDOW)) {
+            stats.duplicates++;
+        } else {
+            stats.reorders++;
+            if (stats.lost > 0) {
+                stats.lost--;
+            }
+            stats.seen.set(seq % SEQ_WINDOW);
+        }
+    } else {
+        // far behind: the sender restarted
+        stats.maxSeq = seq;
+        stats.seen.reset();
+        stats.seen.set(seq % SEQ_WINDOW);
+    }
+}
+
+// a frame pktminerg truncated, or the pieces of one it split, are dumped with the length the frame had on the wire
+void DumpGreSegment(GreHandleBuff *buff, pcap_pkthdr pkthdr, uint32_t srcIp, uint32_t keybit,
+                    const uint8_t *segment, uint32_t length) {
+    if (length < sizeof(gresegmenthdr_t)) {
+        buff->dropNotGreCount++;
+        return;
+    }
+    uint32_t id = ntohl(*((uint32_t*)segment));
+    uint32_t offset = ntohs(*((uint16_t*)(segment + 4)));
+    uint16_t flags = ntohs(*((uint16_t*)(segment + 6)));
+    uint32_t wireLength = ntohl(*((uint32_t*)(segment + 8)));
+    const uint8_t *data = segment + sizeof(gresegmenthdr_t);
+    uint32_t dataLength = length - (uint32_t)sizeof(gresegmenthdr_t);
+    if (offset == 0 && (flags & GRE_SEGMENT_MORE) == 0) {
+        if (flags & GRE_SEGMENT_TRUNCATED) {
+            buff->truncatedCount++;
+        }
+        pkthdr.caplen = dataLength;
+        pkthdr.len = wireLength > dataLength ? wireLength : dataLength;
+        pcap_dump((u_char *) buff->dumper, &pkthdr, data);
+        buff->dumpCount++;
+        return;
+    }
+    if (offset + dataLength > sizeof(((gre_segment_cache_t*)NULL)->segment_buff)) {
+        buff->dropSegmentCount++;
+        return;
+    }
+    std::tuple<uint32_t, uint32_t, uint32_t> key = std::make_tuple(srcIp, keybit, id);
+    std::shared_ptr<gre_segment_cache_t> cache = nullptr;
+    auto got = buff->segments_cache.find(key);
+    if (got != buff->segments_cache.end()) {
+        cache = got->second;
+    } else {
+        if (buff->segments_cache.size() >= MAX_SEGMENT_FRAMES) {
+            // a piece got lost, give up the frame with the lowest id
+            buff->segments_cache.erase(buff->segments_cache.begin());
+            buff->dropSegmentCount++;
+        }
+        cache = std::make_shared<gre_segment_cache_t>();
+        cache->pkthdr = pkthdr;
+        cache->received = 0;
+        cache->total = 0;
+        buff->segments_cache[key] = cache;
+    }
+    std::memcpy((void*)(cache->segment_buff + offset), data, (size_t)dataLength);
+    cache->received += dataLength;
+    if ((flags & GRE_SEGMENT_MORE) == 0) {
+        cache->total = offset + dataLength;
+    }
+    if (cache->total != 0 && cache->received >= cache->total) {
+        cache->pkthdr.caplen = cache->total;
+        cache->pkthdr.len = wireLength > cache->total ? wireLength : cache->total;
+        pcap_dump((u_char *) buff->dumper, &cache->pkthdr, cache->segment_buff);
+        buff->dumpCount++;
+        buff->segmentedCount++;
+        buff->segments_cache.erase(key);
+    }
+}
+
+// strips the GRE header, and the ERSPAN header, from a whole GRE packet and dumps what it carries
+void DumpGrePacket(GreHandleBuff *buff, pcap_pkthdr pkthdr, uint32_t srcIp, const uint8_t *gre, uint32_t length) {
+    if (length < 4) {
+        buff->dropNotGreCount++;
+        return;
+    }
+    uint16_t flags = ntohs(*((uint16_t*)gre));
+    uint16_t protocol = ntohs(*((uint16_t*)(gre + 2)));
+    uint32_t offset = 4;
+    uint32_t keybit = 0;
+    bool hasSeq = false;
+    uint32_t seq = 0;
+    if (flags & 0x8000) {
+        // checksum and reserved
+        offset += 4;
+    }
+    if ((flags & GRE_FLAG_KEY) && offset + 4 <= length) {
+        keybit = ntohl(*((uint32_t*)(gre + offset)));
+        offset += 4;
+    }
+    if ((flags & GRE_FLAG_SEQ) && offset + 4 <= length) {
+        hasSeq = true;
+        seq = ntohl(*((uint32_t*)(gre + offset)));
+        offset += 4;
+    }
+    if ((protocol == GRE_PROTO_ERSPAN2 || protocol == GRE_PROTO_ERSPAN3) && offset + 8 <= length) {
+        // the session id tells the mirror sessions apart
+        keybit = ntohl(*((uint32_t*)(gre + offset))) & 0x3ff;
+        if (protocol == GRE_PROTO_ERSPAN2) {
+            offset += sizeof(erspan2hdr_t);
+        } else if (offset + sizeof(erspan3hdr_t) <= length) {
+            bool hasPlatform = (ntohl(*((uint32_t*)(gre + offset + 8))) & 1) != 0;
+            offset += sizeof(erspan3hdr_t) + (hasPlatform ? sizeof(erspan3platform_t) : 0);
+        }
+    }
+    if (offset > length) {
+        buff->dropNotGreCount++;
+        return;
+    }
+    if (buff->grekey != 0 && buff->grekey != keybit) {
+        buff->dropFilterCount++;
+        return;
+    }
+    if (hasSeq) {
+        TrackSequence(buff->seq_stats[std::make_pair(srcIp, keybit)], seq);
+    }
+    if (protocol == GRE_PROTO_SEGMENT) {
+        DumpGreSegment(buff, pkthdr, srcIp, keybit, gre + offset, length - offset);
+        return;
+    }
+    pkthdr.len = length - offset;
+    pkthdr.caplen = length - offset;
+    pcap_dump((u_char *) buff->dumper, &pkthdr, gre + offset);
+    buff->dumpCount++;
+}
+
+// unpacks a UDP datagram of pktminerg --encap batch, every packet in it is dumped with its own header
+void DumpBatchDatagram(GreHandleBuff *buff, const uint8_t *udp, uint32_t length) {
+    if (length < 8 || ntohs(*((uint16_t*)(udp + 2))) != buff->batchPort) {
+        buff->dropNotGreCount++;
+        return;
+    }
+    uint32_t udpLength = ntohs(*((uint16_t*)(udp + 4)));
+    if (udpLength >= 8 && udpLength < length) {
+        length = udpLength;
+    }
+    const uint8_t* batch = udp + 8;
+    length -= 8;
+    if (length < sizeof(batch_pkts_hdr_t) || ntohs(*((uint16_t*)batch)) != PKTMINERG_BATCH_VERSION) {
+        buff->dropNotGreCount++;
+        return;
+    }
+    uint16_t pktsNum = ntohs(*((uint16_t*)(batch + 2)));
+    uint32_t keybit = ntohl(*((uint32_t*)(batch + 4)));
+    if (buff->grekey != 0 && buff->grekey != keybit) {
+        buff->dropFilterCount += pktsNum;
+        return;
+    }
+    buff->batchCount++;
+    uint32_t pos = sizeof(batch_pkts_hdr_t);
+    for (uint16_t i = 0; i < pktsNum; ++i) {
+        if (pos + sizeof(uint16_t) + sizeof(pmr_pkthdr_t) > length) {
+            buff->dropNotGreCount += pktsNum - i;
+            break;
+        }
+        uint16_t dataLength = ntohs(*((uint16_t*)(batch + pos)));
+        pmr_pkthdr_t smallHdr;
+        std::memcpy(&smallHdr, batch + pos + sizeof(uint16_t), sizeof(smallHdr));
+        pos += sizeof(uint16_t) + sizeof(pmr_pkthdr_t);
+        if (pos + dataLength > length) {
+            buff->dropNotGreCount += pktsNum - i;
+            break;
+        }
+        pcap_pkthdr pkthdr;
+        pkthdr.ts.tv_sec = ntohl(smallHdr.tv_sec);
+        pkthdr.ts.tv_usec = ntohl(smallHdr.tv_usec);
+        pkthdr.caplen = dataLength;
+        pkthdr.len = ntohl(smallHdr.len);
+        pcap_dump((u_char *) buff->dumper, &pkthdr, batch + pos);
+        buff->dumpCount++;
+        pos += dataLength;
+    }
+}
+
+void DumpIpPayload(GreHandleBuff *buff, const pcap_pkthdr &pkthdr, uint32_t srcIp, uint8_t protocol,
+                   const uint8_t *payload, uint32_t length) {
+    if (protocol == 47) {
+        DumpGrePacket(buff, pkthdr, srcIp, payload, length);
+    } else {
+        DumpBatchDatagram(buff, payload, length);
+    }
+}
+
 void PcapHanler(GreHandleBuff *buff, const struct pcap_pkthdr *h, const uint8_t *data) {
     uint8_t* p = (uint8_t*)data;
     int nCount = h->len;
@@ -71,7 +320,7 @@ void PcapHanler(GreHandleBuff *buff, const struct pcap_pkthdr *h, const uint8_t
     uint32_t ip_src = ntohl(*((uint32_t*)(ipdata+12)));
     uint32_t ip_dst = ntohl(*((uint32_t*)(ipdata+16)));
 
-    if (protocol != 47) {
+    if (protocol != 47 && (protocol != 17 || buff->batchPort == 0)) {
 //        std::cout << "Ip Protocol not GRE, drop it! ip prot: " << (uint16_t)protocol << std::endl;
         buff->dropNotGreCount++;
         return;
@@ -92,7 +341,6 @@ void PcapHanler(GreHandleBuff *buff, const struct pcap_pkthdr *h, const uint8_t
     p += iphdrlen;
     nCount -= iphdrlen;
 
-    uint32_t keybit;
     bool bHasCache;
     std::shared_ptr<ipfrag_cache_t> cache=nullptr;
     std::tuple<uint32_t, uint32_t, uint16_t> key = std::make_tuple(ip_src, ip_dst, ipidenti);
@@ -105,29 +353,14 @@ void PcapHanler(GreHandleBuff *buff, const struct pcap_pkthdr *h, const uint8_t
     }
     if ( moreFrags == 0 ) {
         if (fragOffset == 0) {
-            pcap_pkthdr pkthdr = *h;
-            pkthdr.len = (bpf_u_int32)nCount - 8;
-            pkthdr.caplen = (bpf_u_int32)nCount - 8;
-            keybit = ntohl(*((uint32_t*)(p+4)));
-            if (buff->grekey==0 || buff->grekey==keybit) {
-                pcap_dump((u_char *) buff->dumper, &pkthdr, p + 8);
-                buff->dumpCount++;
-            } else {
-                buff->dropFilterCount++;
-            }
+            DumpIpPayload(buff, *h, ip_src, protocol, p, (uint32_t)nCount);
         } else {
             if (bHasCache) {
                 // last pkt of ip frag
                 std::memcpy((void*)(cache->ipfrag_buff + fragOffset * 8), p, (size_t)nCount);
-                cache->pkthdr.len += nCount - 8;
-                cache->pkthdr.caplen += nCount - 8;
-                keybit = ntohl(*((uint32_t*)(cache->ipfrag_buff+4)));
-                if (buff->grekey==0 || buff->grekey==keybit) {
-                    pcap_dump((u_char*)buff->dumper, &cache->pkthdr, (const uint8_t*)(cache->ipfrag_buff + 8));
-                    buff->dumpCount++;
-                } else {
-                    buff->dropFilterCount++;
-                }
+                cache->pkthdr.len += nCount;
+                cache->pkthdr.caplen += nCount;
+                DumpIpPayload(buff, cache->pkthdr, ip_src, cache->protocol, cache->ipfrag_buff, cache->pkthdr.len);
                 buff->ipfrags_cache.erase(key);
             } else {
                 std::cerr << "Find Ip Frag! but has not frag in buffer! drop it!! dump count:" << buff->dumpCount << std::endl;
@@ -141,6 +374,7 @@ void PcapHanler(GreHandleBuff *buff, const struct pcap_pkthdr *h, const uint8_t
             buff->ipfragCount++;
             std::shared_ptr<ipfrag_cache_t> newcache = std::make_shared<ipfrag_cache_t>();
             newcache->pkthdr = *h;
+            newcache->protocol = protocol;
             newcache->pkthdr.len = (bpf_u_int32)nCount;
             newcache->pkthdr.caplen = (bpf_u_int32)nCount;
             std::memcpy((void*)(newcache->ipfrag_buff), p, (size_t)nCount);
@@ -181,6 +415,7 @@ int main(int argc, const char* argv[]) {
         ("sourceip,s", boost::program_options::value<std::string>()->value_name("SRC_IP"), "source ip filter.")
         ("remoteip,r", boost::program_options::value<std::string>()->value_name("DST_IP"), "gre remote ip filter.")
         ("keybit,k", boost::program_options::value<uint32_t>()->value_name("BIT"), "gre key bit filter.")
+        ("batch-port,b", boost::program_options::value<int>()->default_value(0)->value_name("PORT"), "also unpack the UDP datagrams to PORT sent by pktminerg --encap batch.")
         ("output,o", boost::program_options::value<std::string>()->value_name("OUT_PCAP"), "output pcap file")
         ("count,c", boost::program_options::value<int>()->default_value(0)->value_name("MAX_NUM"), "Exit after receiving count packets. Default=0, No limit if count<=0.");
 
@@ -306,12 +541,17 @@ int main(int argc, const char* argv[]) {
         grehandlebuff.grekey = 0;
     }
 
+    grehandlebuff.batchPort = (uint16_t)vm["batch-port"].as<int>();
     grehandlebuff.lasttime = std::time(NULL);
     grehandlebuff.captureCount=0;
     grehandlebuff.dropFilterCount = 0;
     grehandlebuff.dropIpFragCount = 0;
     grehandlebuff.dropNotGreCount = 0;
     grehandlebuff.dumpCount = 0;
+    grehandlebuff.batchCount = 0;
+    grehandlebuff.truncatedCount = 0;
+    grehandlebuff.segmentedCount = 0;
+    grehandlebuff.dropSegmentCount = 0;
     grehandlebuff.ipfragCount = 0;
 
     // signal
@@ -339,5 +579,22 @@ int main(int argc, const char* argv[]) {
     std::cout << "Drop Filter Packets Count:  " << grehandlebuff.dropFilterCount << std::endl;
     std::cout << "Ip Frags Packets Count:     " << grehandlebuff.ipfragCount << std::endl;
     std::cout << "Dump Packets Count:         " << grehandlebuff.dumpCount << std::endl;
+    if (grehandlebuff.batchPort != 0) {
+        std::cout << "Batch Datagrams Count:      " << grehandlebuff.batchCount << std::endl;
+    }
+    if (grehandlebuff.truncatedCount != 0 || grehandlebuff.segmentedCount != 0 ||
+        grehandlebuff.dropSegmentCount != 0) {
+        std::cout << "Truncated Packets Count:    " << grehandlebuff.truncatedCount << std::endl;
+        std::cout << "Split Packets Count:        " << grehandlebuff.segmentedCount << std::endl;
+        std::cout << "Drop Split Packets Count:   " << grehandlebuff.dropSegmentCount << std::endl;
+    }
+    for (auto it = grehandlebuff.seq_stats.begin(); it != grehandlebuff.seq_stats.end(); ++it) {
+        const gre_seq_stats_t& stats = it->second;
+        const uint32_t srcIp = it->first.first;
+        std::cout << "Source " << (srcIp >> 24) << "." << (srcIp >> 16 & 0xff) << "." << (srcIp >> 8 & 0xff) << "."
+                  << (srcIp & 0xff) << " Key " << it->first.second << " Sequenced Packets: " << stats.received << ", lost " << stats.lost
+                  << " in " << stats.gaps << " gaps, reordered " << stats.reorders << ", duplicated "
+                  << stats.duplicates << std::endl;
+    }
     return 0;
 }